@@ -5,6 +5,8 @@ DISTDIR        = '#dist'
 CXX            = 'g++'
 CC             = 'gcc'
 CXXFLAGS       = ['-O3', '-fPIC', '-Wall', '-g', '-pipe', '-march=native', '-msse2', '-ftree-vectorize', '-mfpmath=sse', '-funsafe-math-optimizations', '-fno-rounding-math', '-fno-signaling-nans', '-fno-math-errno', '-fomit-frame-pointer', '-DMTS_DEBUG', '-DSINGLE_PRECISION', '-DSPECTRUM_SAMPLES=3', '-DMTS_SSE', '-DMTS_HAS_COHERENT_RT', '-fopenmp', '-fvisibility=hidden', '-std=c++20']
+# -march=native enables the 8-wide (AVX2) and 16-wide (AVX-512) ray packets
+# on hosts that support them; add -DMTS_NO_AVX512 or -DMTS_NO_AVX to opt out
 LINKFLAGS      = []
 SHLINKFLAGS    = ['-rdynamic', '-shared', '-fPIC', '-lstdc++']
 BASEINCLUDE    = ['#include']
@@ -67,6 +67,7 @@ struct RayDifferential;
 class RemoteProcess;
 class RemoteWorker;
 class RemoteWorkerReader;
+class RemoteWorkerMerger;
 class Scheduler;
 class SerializableObject;
 struct SHRotation;
@@ -85,6 +86,7 @@ class StatsCounter;
 class Stream;
 class StreamAppender;
 class StreamBackend;
+class StreamBackendSender;
 class Thread;
 class Timer;
 struct Transform;
@@ -161,6 +163,17 @@ typedef TRay<Point2, Vector2> Ray2;
 struct RayPacket4;
 struct RayInterval4;
 struct Intersection4;
+template <typename SIMD> struct TRayPacket;
+template <typename SIMD> struct TRayInterval;
+template <typename SIMD> struct TIntersection;
+struct SIMD8;
+struct SIMD16;
+typedef TRayPacket<SIMD8>     RayPacket8;
+typedef TRayInterval<SIMD8>   RayInterval8;
+typedef TIntersection<SIMD8>  Intersection8;
+typedef TRayPacket<SIMD16>    RayPacket16;
+typedef TRayInterval<SIMD16>  RayInterval16;
+typedef TIntersection<SIMD16> Intersection16;
 class WaitFlag;
 class Wavelet2D;
 class Wavelet3D;
@@ -23,6 +23,16 @@
 #include <mitsuba/core/aabb.h>
 #include <mitsuba/core/timer.h>
 
+#if defined(MTS_OPENMP)
+# include <omp.h>
+#endif
+
+/// Point kd-trees with fewer points are always built on a single thread
+#define MTS_POINTKD_PARALLEL_POINTS 65536
+
+/// Minimum number of points in a subtree that is built as a separate task
+#define MTS_POINTKD_MIN_TASK_POINTS 4096
+
 MTS_NAMESPACE_BEGIN
 
 /**
@@ -285,7 +295,7 @@ public:
      * number of points
      */
     inline PointKDTree(size_t nodes = 0, EHeuristic heuristic = ESlidingMidpoint)
-        : m_nodes(nodes), m_heuristic(heuristic), m_depth(0) { }
+        : m_nodes(nodes), m_heuristic(heuristic), m_depth(0), m_parallelBuild(true) { }
 
     // =============================================================
     //! @{ \name \c stl::vector-like interface
@@ -321,6 +331,20 @@ public:
     /// Set the depth of the constructed KD-tree (be careful with this)
     inline void setDepth(size_t depth) { m_depth = depth; }
 
+    /**
+     * \brief Enable/disable the parallel tree construction (enabled by default)
+     *
+     * When enabled, the top levels of large trees are built on the calling
+     * thread, after which the remaining subtrees are constructed concurrently
+     * by the OpenMP worker threads. The final node permutation is also
+     * done in parallel; it happens out of place and thus temporarily needs
+     * memory for a second copy of the nodes.
+     */
+    inline void setParallelBuild(bool parallel) { m_parallelBuild = parallel; }
+
+    /// Return whether the parallel tree construction is enabled
+    inline bool getParallelBuild() const { return m_parallelBuild; }
+
     /// Construct the KD-tree hierarchy
     void build(bool recomputeAABB = false) {
         ref<Timer> timer = new Timer();
@@ -350,30 +374,49 @@ public:
         for (size_t i=0; i<m_nodes.size(); ++i)
             indirection[i] = (IndexType) i;
 
+        int threadCount = m_parallelBuild && m_nodes.size() >= MTS_POINTKD_PARALLEL_POINTS
+            ? mts_omp_get_max_threads() : 1;
+        bool parallel = threadCount > 1;
+
+        /* When building in parallel, subtrees below this size are deferred
+           and built as independent tasks. Aim for several tasks per thread
+           to balance the load. */
+        size_t taskSize = parallel ? std::max((size_t) MTS_POINTKD_MIN_TASK_POINTS,
+            m_nodes.size() / (8 * (size_t) threadCount)) : 0;
+        std::vector<BuildTask> tasks;
+        AABBType aabb(m_aabb);
+
         m_depth = 0;
         int constructionTime;
         if (NodeType::leftBalancedLayout) {
             std::vector<IndexType> permutation(m_nodes.size());
             buildLB(0, 1, indirection.begin(), indirection.begin(),
-                indirection.end(), permutation);
+                indirection.end(), permutation, aabb, m_depth,
+                parallel ? &tasks : NULL, taskSize);
+            if (parallel)
+                runTasks(tasks, indirection.begin(), &permutation);
             constructionTime = timer->getMilliseconds();
             timer->reset();
-            permute_inplace(&m_nodes[0], permutation);
+            permute(permutation, parallel);
         } else {
-            build(1, indirection.begin(), indirection.begin(), indirection.end());
+            build(1, indirection.begin(), indirection.begin(), indirection.end(),
+                aabb, m_depth, parallel ? &tasks : NULL, taskSize);
+            if (parallel)
+                runTasks(tasks, indirection.begin(), NULL);
             constructionTime = timer->getMilliseconds();
             timer->reset();
-            permute_inplace(&m_nodes[0], indirection);
+            permute(indirection, parallel);
         }
 
         int permutationTime = timer->getMilliseconds();
 
         if (recomputeAABB)
-            SLog(EDebug, "Done after %i ms (breakdown: aabb: %i ms, build: %i ms, permute: %i ms). ",
-                aabbTime + constructionTime + permutationTime, aabbTime, constructionTime, permutationTime);
+            SLog(EDebug, "Done after %i ms using %i thread(s) (breakdown: aabb: %i ms, build: %i ms, "
+                "permute: %i ms). ", aabbTime + constructionTime + permutationTime, threadCount,
+                aabbTime, constructionTime, permutationTime);
         else
-            SLog(EDebug, "Done after %i ms (breakdown: build: %i ms, permute: %i ms). ",
-                constructionTime + permutationTime, constructionTime, permutationTime);
+            SLog(EDebug, "Done after %i ms using %i thread(s) (breakdown: build: %i ms, permute: %i ms). ",
+                constructionTime + permutationTime, threadCount, constructionTime, permutationTime);
     }
 
     /**
@@ -810,6 +853,87 @@ public:
         }
     }
 protected:
+    /// Subtree whose construction was deferred by the parallel build
+    struct BuildTask {
+        /// Node index (only used by the left-balanced layout)
+        IndexType idx;
+        /// Depth of the subtree root
+        size_t depth;
+        /// Range of the subtree within the indirection table
+        size_t rangeStart, rangeEnd;
+        /// Bounds of the subtree
+        AABBType aabb;
+
+        inline BuildTask(IndexType idx, size_t depth, size_t rangeStart,
+            size_t rangeEnd, const AABBType &aabb) : idx(idx), depth(depth),
+            rangeStart(rangeStart), rangeEnd(rangeEnd), aabb(aabb) { }
+    };
+
+    /// Build the deferred subtrees concurrently
+    void runTasks(std::vector<BuildTask> &tasks,
+            typename std::vector<IndexType>::iterator base,
+            std::vector<IndexType> *permutation) {
+        size_t depth = m_depth;
+
+        /* Start with the largest subtrees */
+        std::sort(tasks.begin(), tasks.end(), TaskOrdering());
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int i=0; i<(int) tasks.size(); ++i) {
+            BuildTask &task = tasks[i];
+            size_t taskDepth = 0;
+            if (permutation)
+                buildLB(task.idx, task.depth, base, base + task.rangeStart,
+                    base + task.rangeEnd, *permutation, task.aabb, taskDepth, NULL, 0);
+            else
+                build(task.depth, base, base + task.rangeStart,
+                    base + task.rangeEnd, task.aabb, taskDepth, NULL, 0);
+            task.depth = taskDepth;
+        }
+
+        for (size_t i=0; i<tasks.size(); ++i)
+            depth = std::max(depth, tasks[i].depth);
+        m_depth = depth;
+    }
+
+    /// Orders build tasks by decreasing size
+    struct TaskOrdering {
+        inline bool operator()(const BuildTask &t1, const BuildTask &t2) const {
+            return t1.rangeEnd - t1.rangeStart > t2.rangeEnd - t2.rangeStart;
+        }
+    };
+
+    /// Apply the permutation computed by the tree construction to the nodes
+    void permute(std::vector<IndexType> &perm, bool parallel) {
+        if (!parallel) {
+            permute_inplace(&m_nodes[0], perm);
+            return;
+        }
+
+        std::vector<NodeType> nodes(m_nodes.size());
+        #pragma omp parallel for schedule(static)
+        for (ptrdiff_t i=0; i<(ptrdiff_t) perm.size(); ++i)
+            nodes[i] = m_nodes[perm[i]];
+        m_nodes.swap(nodes);
+    }
+
+    /// Count the points in a range that lie on the left of a split plane
+    size_t countLessThanOrEqual(typename std::vector<IndexType>::iterator rangeStart,
+            typename std::vector<IndexType>::iterator rangeEnd, int axis,
+            Scalar value, bool parallel) const {
+        if (!parallel)
+            return std::count_if(rangeStart, rangeEnd,
+                LessThanOrEqual(m_nodes, axis, value));
+
+        ptrdiff_t count = rangeEnd - rangeStart, result = 0;
+        #pragma omp parallel for reduction(+:result) schedule(static)
+        for (ptrdiff_t i=0; i<count; ++i) {
+            if (m_nodes[rangeStart[i]].getPosition()[axis] <= value)
+                ++result;
+        }
+        return (size_t) result;
+    }
+
     struct CoordinateOrdering {
     public:
         inline CoordinateOrdering(const std::vector<NodeType> &nodes, int axis)
@@ -872,17 +996,31 @@ protected:
         return p - 1;
     }
 
-    /// Left-balanced tree construction routine
+    /**
+     * \brief Left-balanced tree construction routine
+     *
+     * \param aabb Bounds of the current subtree (temporarily modified)
+     * \param maxDepth Updated with the maximum depth of the subtree
+     * \param tasks When non-\c NULL, subtrees with at most \c taskSize
+     *    points are not built but appended to this list
+     */
     void buildLB(IndexType idx, size_t depth,
               typename std::vector<IndexType>::iterator base,
               typename std::vector<IndexType>::iterator rangeStart,
               typename std::vector<IndexType>::iterator rangeEnd,
-              typename std::vector<IndexType> &permutation) {
-        m_depth = std::max(depth, m_depth);
-
+              typename std::vector<IndexType> &permutation,
+              AABBType &aabb, size_t &maxDepth,
+              std::vector<BuildTask> *tasks, size_t taskSize) {
         IndexType count = (IndexType) (rangeEnd-rangeStart);
         SAssert(count > 0);
 
+        if (tasks && count <= taskSize) {
+            tasks->push_back(BuildTask(idx, depth, rangeStart - base, rangeEnd - base, aabb));
+            return;
+        }
+
+        maxDepth = std::max(depth, maxDepth);
+
         if (count == 1) {
             /* Create a leaf node */
             m_nodes[*rangeStart].setLeaf(true);
@@ -892,7 +1030,7 @@ protected:
 
         typename std::vector<IndexType>::iterator split
             = rangeStart + leftSubtreeSize(count);
-        int axis = m_aabb.getLargestAxis();
+        int axis = aabb.getLargestAxis();
         std::nth_element(rangeStart, split, rangeEnd,
             CoordinateOrdering(m_nodes, axis));
 
@@ -902,30 +1040,43 @@ protected:
         permutation[idx] = *split;
 
         /* Recursively build the children */
-        Scalar temp = m_aabb.max[axis],
+        Scalar temp = aabb.max[axis],
             splitPos = splitNode.getPosition()[axis];
-        m_aabb.max[axis] = splitPos;
-        buildLB(2*idx+1, depth+1, base, rangeStart, split, permutation);
-        m_aabb.max[axis] = temp;
+        aabb.max[axis] = splitPos;
+        buildLB(2*idx+1, depth+1, base, rangeStart, split, permutation,
+            aabb, maxDepth, tasks, taskSize);
+        aabb.max[axis] = temp;
 
         if (split+1 != rangeEnd) {
-            temp = m_aabb.min[axis];
-            m_aabb.min[axis] = splitPos;
-            buildLB(2*idx+2, depth+1, base, split+1, rangeEnd, permutation);
-            m_aabb.min[axis] = temp;
+            temp = aabb.min[axis];
+            aabb.min[axis] = splitPos;
+            buildLB(2*idx+2, depth+1, base, split+1, rangeEnd, permutation,
+                aabb, maxDepth, tasks, taskSize);
+            aabb.min[axis] = temp;
         }
     }
 
-    /// Default tree construction routine
+    /**
+     * \brief Default tree construction routine
+     *
+     * The parameters have the same meaning as in \ref buildLB().
+     */
     void build(size_t depth,
               typename std::vector<IndexType>::iterator base,
               typename std::vector<IndexType>::iterator rangeStart,
-              typename std::vector<IndexType>::iterator rangeEnd) {
-        m_depth = std::max(depth, m_depth);
-
+              typename std::vector<IndexType>::iterator rangeEnd,
+              AABBType &aabb, size_t &maxDepth,
+              std::vector<BuildTask> *tasks, size_t taskSize) {
         IndexType count = (IndexType) (rangeEnd-rangeStart);
         SAssert(count > 0);
 
+        if (tasks && count <= taskSize) {
+            tasks->push_back(BuildTask(0, depth, rangeStart - base, rangeEnd - base, aabb));
+            return;
+        }
+
+        maxDepth = std::max(depth, maxDepth);
+
         if (count == 1) {
             /* Create a leaf node */
             m_nodes[*rangeStart].setLeaf(true);
@@ -938,7 +1089,7 @@ protected:
         switch (m_heuristic) {
             case EBalanced: {
                     split = rangeStart + count/2;
-                    axis = m_aabb.getLargestAxis();
+                    axis = aabb.getLargestAxis();
                     std::nth_element(rangeStart, split, rangeEnd,
                         CoordinateOrdering(m_nodes, axis));
                 };
@@ -946,7 +1097,7 @@ protected:
 
             case ELeftBalanced: {
                     split = rangeStart + leftSubtreeSize(count);
-                    axis = m_aabb.getLargestAxis();
+                    axis = aabb.getLargestAxis();
                     std::nth_element(rangeStart, split, rangeEnd,
                         CoordinateOrdering(m_nodes, axis));
                 };
@@ -954,13 +1105,13 @@ protected:
 
             case ESlidingMidpoint: {
                     /* Sliding midpoint rule: find a split that is close to the spatial median */
-                    axis = m_aabb.getLargestAxis();
+                    axis = aabb.getLargestAxis();
 
                     Scalar midpoint = (Scalar) 0.5f
-                        * (m_aabb.max[axis]+m_aabb.min[axis]);
+                        * (aabb.max[axis]+aabb.min[axis]);
 
-                    size_t nLT = std::count_if(rangeStart, rangeEnd,
-                            LessThanOrEqual(m_nodes, axis, midpoint));
+                    size_t nLT = countLessThanOrEqual(rangeStart, rangeEnd,
+                            axis, midpoint, tasks != NULL);
 
                     /* Re-adjust the split to pass through a nearby point */
                     split = rangeStart + nLT;
@@ -983,8 +1134,8 @@ protected:
                             CoordinateOrdering(m_nodes, dim));
 
                         size_t numLeft = 1, numRight = count-2;
-                        AABBType leftAABB(m_aabb), rightAABB(m_aabb);
-                        Float invVolume = 1.0f / m_aabb.getVolume();
+                        AABBType leftAABB(aabb), rightAABB(aabb);
+                        Float invVolume = 1.0f / aabb.getVolume();
                         for (typename std::vector<IndexType>::iterator it = rangeStart+1;
                                 it != rangeEnd; ++it) {
                             ++numLeft; --numRight;
@@ -1021,17 +1172,17 @@ protected:
         std::iter_swap(rangeStart, split);
 
         /* Recursively build the children */
-        Scalar temp = m_aabb.max[axis],
+        Scalar temp = aabb.max[axis],
             splitPos = splitNode.getPosition()[axis];
-        m_aabb.max[axis] = splitPos;
-        build(depth+1, base, rangeStart+1, split+1);
-        m_aabb.max[axis] = temp;
+        aabb.max[axis] = splitPos;
+        build(depth+1, base, rangeStart+1, split+1, aabb, maxDepth, tasks, taskSize);
+        aabb.max[axis] = temp;
 
         if (split+1 != rangeEnd) {
-            temp = m_aabb.min[axis];
-            m_aabb.min[axis] = splitPos;
-            build(depth+1, base, split+1, rangeEnd);
-            m_aabb.min[axis] = temp;
+            temp = aabb.min[axis];
+            aabb.min[axis] = splitPos;
+            build(depth+1, base, split+1, rangeEnd, aabb, maxDepth, tasks, taskSize);
+            aabb.min[axis] = temp;
         }
     }
 protected:
@@ -1039,6 +1190,7 @@ protected:
     AABBType m_aabb;
     EHeuristic m_heuristic;
     size_t m_depth;
+    bool m_parallelBuild;
 };
 
 MTS_NAMESPACE_END
@@ -94,6 +94,21 @@ public:
         return m_cache.size() == m_capacity;
     }
 
+    size_t size() const {
+        return m_cache.size();
+    }
+
+    // Purge the least-recently-used record. Returns
+    // false if the cache is empty.
+    bool evict() {
+        if (m_cache.empty())
+            return false;
+        if (m_cleanupFunction)
+            m_cleanupFunction(m_cache.right.begin()->info);
+        m_cache.right.erase(m_cache.right.begin());
+        return true;
+    }
+
     // Obtain value of the cached function for k
     V get(const K& k, bool &hit) {
         // Attempt to find existing record
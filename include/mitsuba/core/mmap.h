@@ -34,8 +34,19 @@ public:
     /// Create a new memory-mapped file of the specified size
     MemoryMappedFile(const fs::path &filename, size_t size);
 
-    /// Map the specified file into memory
-    MemoryMappedFile(const fs::path &filename, bool readOnly = true);
+    /**
+     * \brief Map the specified file into memory
+     *
+     * \param readOnly
+     *     Map the file read-only
+     * \param copyOnWrite
+     *     Create a private mapping: the memory region is writable
+     *     (regardless of \c readOnly), but modifications are never
+     *     written back to the file. Unmodified pages are shared with
+     *     other processes that map the same file.
+     */
+    MemoryMappedFile(const fs::path &filename, bool readOnly = true,
+        bool copyOnWrite = false);
 
     /// Return a pointer to the file contents in memory
     void *getData();
@@ -67,7 +78,8 @@ public:
      * \brief Create a temporary memory-mapped file
      *
      * \remark When closing the mapping, the file is
-     * automatically deleted.
+     * automatically deleted. On Linux and Mac OS, it is
+     * created in \c $TMPDIR (\c /tmp by default).
      */
     static ref<MemoryMappedFile> createTemporary(size_t size);
 
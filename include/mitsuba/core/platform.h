@@ -160,6 +160,15 @@
 #define SSE_STR "SSE2 disabled"
 #endif
 
+/* 8- and 16-wide ray packets are used when the compiler targets AVX2
+   or AVX-512 (e.g. -march=native), unless explicitly disabled */
+#if defined(MTS_SSE) && defined(__AVX2__) && !defined(MTS_NO_AVX)
+#define MTS_AVX
+#if defined(__AVX512F__) && !defined(MTS_NO_AVX512)
+#define MTS_AVX512
+#endif
+#endif
+
 /* The default OpenMP implementation on OSX is seriously broken,
    for instance it segfaults when launching OpenMP threads
    from context other than the main application thread */
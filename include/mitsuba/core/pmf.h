@@ -233,54 +233,88 @@ namespace math {
      * The downside of this method is that it generally does not preserve
      * the nice stratification properties of QMC number sequences.
      *
+     * \c Entry can be \ref AliasTableEntry or any other type that
+     * provides the fields \c prob and \c index.
+     *
      * \return The original (un-normalized) sum of all probabilities
      * in \c pmf.
      */
-    template <typename Scalar, typename QuantizedScalar, typename Index> float makeAliasTable(
-            AliasTableEntry<QuantizedScalar, Index> *tbl, Scalar *pmf, Index size) {
-        /* Allocate temporary storage for classification purposes */
-        Index *c = new Index[size],
-              *c_short = c - 1, *c_long  = c + size;
-
+    template <typename Scalar, typename Entry, typename Index> Scalar makeAliasTable(
+            Entry *tbl, const Scalar *pmf, Index size) {
         /* Begin by computing the normalization constant */
         Scalar sum = 0;
-        for (size_t i=0; i<size; ++i)
+        for (Index i=0; i<size; ++i)
             sum += pmf[i];
 
+        if (!(sum > 0)) {
+            /* Degenerate case: fall back to a uniform distribution */
+            for (Index i=0; i<size; ++i) {
+                tbl[i].prob  = 1;
+                tbl[i].index = i;
+            }
+            return sum;
+        }
+
+        /* Allocate temporary storage for classification purposes. Entries
+           with "too little" mass are pushed from the front, entries with
+           "too much" (or exactly enough) mass from the back */
+        Index *c = new Index[size];
+        Index nShort = 0, nLong = 0;
+
         Scalar normalization = (Scalar) 1 / sum;
+        Index largest = 0;
         for (Index i=0; i<size; ++i) {
+            if (pmf[i] > pmf[largest])
+                largest = i;
+
             /* For each entry, determine whether there is
                "too little" or "too much" probability mass */
             Scalar value = size * normalization * pmf[i];
             if (value < 1)
-                *++c_short = i;
-            else if (value > 1)
-                *--c_long  = i;
+                c[nShort++] = i;
+            else
+                c[size - ++nLong] = i;
             tbl[i].prob  = value;
             tbl[i].index = i;
         }
 
         /* Perform pairwise exchanges while there are entries
-           with too much probability mass */
-        for (Index i=0; i < size-1 && c_long - c < size; ++i) {
-            Index short_index = c[i],
-                  long_index  = *c_long;
+           with too much probability mass (Vose's method) */
+        while (nShort > 0 && nLong > 0) {
+            Index short_index = c[--nShort],
+                  long_index  = c[size - nLong];
 
             tbl[short_index].index = long_index;
-            tbl[long_index].prob  -= (Scalar) 1 - tbl[short_index].prob;
+            tbl[long_index].prob  -= (Scalar) 1 - (Scalar) tbl[short_index].prob;
 
-            if (tbl[long_index].prob <= 1)
-                ++c_long;
+            if (tbl[long_index].prob < 1) {
+                --nLong;
+                c[nShort++] = long_index;
+            }
         }
 
+        /* Whatever is left over only differs from 1 due to roundoff.
+           Entries without any probability mass must never be chosen though */
+        while (nShort > 0) {
+            Index i = c[--nShort];
+            if (pmf[i] > 0) {
+                tbl[i].prob = 1;
+            } else {
+                tbl[i].prob = 0;
+                tbl[i].index = largest;
+            }
+        }
+        while (nLong > 0)
+            tbl[c[size - nLong--]].prob = 1;
+
         delete[] c;
 
         return sum;
     }
 
     /// Generate a sample in constant time using the alias method
-    template <typename Scalar, typename QuantizedScalar, typename Index> Index sampleAlias(
-            const AliasTableEntry<QuantizedScalar, Index> *tbl, Index size, Scalar sample) {
+    template <typename Scalar, typename Entry, typename Index> Index sampleAlias(
+            const Entry *tbl, Index size, Scalar sample) {
         Index l = std::min((Index) (sample * size), (Index) (size - 1));
         Scalar prob = (Scalar) tbl[l].prob;
 
@@ -298,8 +332,8 @@ namespace math {
      * This variation shifts and scales the uniform random sample so
      * that it can be reused for another sampling operation
      */
-    template <typename Scalar, typename QuantizedScalar, typename Index> Index sampleAliasReuse(
-            const AliasTableEntry<QuantizedScalar, Index> *tbl, Index size, Scalar &sample) {
+    template <typename Scalar, typename Entry, typename Index> Index sampleAliasReuse(
+            const Entry *tbl, Index size, Scalar &sample) {
         Index l = std::min((Index) (sample * size), (Index) (size - 1));
         Scalar prob = (Scalar) tbl[l].prob;
 
@@ -315,6 +349,324 @@ namespace math {
     }
 };
 
+/**
+ * \brief Discrete probability distribution based on Walker's alias method
+ *
+ * This data structure provides the same interface as \ref DiscreteDistribution,
+ * but it generates samples in constant time instead of using a binary search
+ * over the cumulative distribution function. Each table entry also records the
+ * probability of its alias, hence sampling with a probability value touches a
+ * single cache line regardless of the number of entries.
+ *
+ * The \c sampleReuse() functions remap the sample value so that it is again
+ * uniformly distributed on [0,1]. However, the mapping from samples to
+ * indices is not monotonic, which means that stratification of the
+ * original sample is not preserved (see \ref math::makeAliasTable()).
+ *
+ * \ingroup libcore
+ */
+struct AliasDistribution {
+public:
+    /// Alias table entry, which also stores the probabilities of both outcomes
+    struct Entry {
+        /// Threshold, below which the entry itself (and not the alias) is chosen
+        Float prob;
+        /// Index of the alias entry
+        uint32_t index;
+        /// Probability of the current entry
+        Float pmf;
+        /// Probability of the alias entry
+        Float aliasPmf;
+    };
+
+    /// Allocate memory for a distribution with the given number of entries
+    explicit inline AliasDistribution(size_t nEntries = 0) {
+        reserve(nEntries);
+        clear();
+    }
+
+    /// Clear all entries
+    inline void clear() {
+        m_table.clear();
+        m_sum = m_normalization = 0.0f;
+        m_normalized = false;
+    }
+
+    /// Reserve memory for a certain number of entries
+    inline void reserve(size_t nEntries) {
+        m_table.reserve(nEntries);
+    }
+
+    /// Append an entry with the specified discrete probability
+    inline void append(Float pdfValue) {
+        Entry entry;
+        entry.prob = 1.0f;
+        entry.index = (uint32_t) m_table.size();
+        entry.pmf = entry.aliasPmf = pdfValue;
+        m_table.push_back(entry);
+        m_normalized = false;
+    }
+
+    /// Return the number of entries so far
+    inline size_t size() const {
+        return m_table.size();
+    }
+
+    /// Access an entry by its index
+    inline Float operator[](size_t entry) const {
+        return m_table[entry].pmf;
+    }
+
+    /// Have the probability densities been normalized?
+    inline bool isNormalized() const {
+        return m_normalized;
+    }
+
+    /**
+     * \brief Return the original (unnormalized) sum of all PDF entries
+     *
+     * This assumes that \ref normalize() has previously been called
+     */
+    inline Float getSum() const {
+        return m_sum;
+    }
+
+    /**
+     * \brief Return the normalization factor (i.e. the inverse of \ref getSum())
+     *
+     * This assumes that \ref normalize() has previously been called
+     */
+    inline Float getNormalization() const {
+        return m_normalization;
+    }
+
+    /**
+     * \brief Normalize the distribution and build the alias table
+     *
+     * Throws an exception when no entries were previously
+     * added to the distribution.
+     *
+     * \return Sum of the (previously unnormalized) entries
+     */
+    inline Float normalize() {
+        SAssert(!m_table.empty());
+        std::vector<Float> pmf(m_table.size());
+        for (size_t i=0; i<m_table.size(); ++i)
+            pmf[i] = m_table[i].pmf;
+
+        m_sum = math::makeAliasTable(&m_table[0], &pmf[0], (uint32_t) m_table.size());
+        if (m_sum > 0) {
+            m_normalization = 1.0f / m_sum;
+            for (size_t i=0; i<m_table.size(); ++i)
+                m_table[i].pmf = pmf[i] * m_normalization;
+            for (size_t i=0; i<m_table.size(); ++i)
+                m_table[i].aliasPmf = m_table[m_table[i].index].pmf;
+            m_normalized = true;
+        } else {
+            m_normalization = 0.0f;
+        }
+        return m_sum;
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored distribution
+     *
+     * \param[in] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \return
+     *     The discrete index associated with the sample
+     */
+    inline size_t sample(Float sampleValue) const {
+        return math::sampleAlias(&m_table[0], (uint32_t) m_table.size(), sampleValue);
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored distribution
+     *
+     * \param[in] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \param[out] pdf
+     *     Probability value of the sample
+     * \return
+     *     The discrete index associated with the sample
+     */
+    inline size_t sample(Float sampleValue, Float &pdf) const {
+        return sampleReuse(sampleValue, pdf);
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample to the stored distribution
+     *
+     * The original sample is value adjusted so that it can be "reused".
+     *
+     * \param[in, out] sampleValue
+     *     An uniformly distributed sample on [0,1]
+     * \return
+     *     The discrete index associated with the sample
+     */
+    inline size_t sampleReuse(Float &sampleValue) const {
+        Float pdf;
+        return sampleReuse(sampleValue, pdf);
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed sample.
+     *
+     * The original sample is value adjusted so that it can be "reused".
+     *
+     * \param[in,out]
+     *     An uniformly distributed sample on [0,1]
+     * \param[out] pdf
+     *     Probability value of the sample
+     * \return
+     *     The discrete index associated with the sample
+     */
+    inline size_t sampleReuse(Float &sampleValue, Float &pdf) const {
+        uint32_t size = (uint32_t) m_table.size(),
+                 l = std::min((uint32_t) (sampleValue * size), size - 1);
+        const Entry &entry = m_table[l];
+
+        sampleValue = sampleValue * size - l;
+        if (entry.prob == 1 || (entry.prob != 0 && sampleValue < entry.prob)) {
+            sampleValue = std::min(sampleValue / entry.prob, (Float) ONE_MINUS_EPS);
+            pdf = entry.pmf;
+            return l;
+        } else {
+            sampleValue = std::min((sampleValue - entry.prob)
+                / (1 - entry.prob), (Float) ONE_MINUS_EPS);
+            pdf = entry.aliasPmf;
+            return entry.index;
+        }
+    }
+
+    /**
+     * \brief Turn the underlying distribution into a
+     * human-readable string format
+     */
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "AliasDistribution[sum=" << m_sum << ", normalized="
+            << (int) m_normalized << ", pmf={";
+        for (size_t i=0; i<m_table.size(); ++i) {
+            oss << m_table[i].pmf;
+            if (i != m_table.size()-1)
+                oss << ", ";
+        }
+        oss << "}]";
+        return oss.str();
+    }
+private:
+    std::vector<Entry> m_table;
+    Float m_sum, m_normalization;
+    bool m_normalized;
+};
+
+/**
+ * \brief Two-dimensional discrete distribution based on alias tables
+ *
+ * Hierarchical counterpart of the marginal/conditional CDF tables that are
+ * commonly used to importance sample images such as environment maps: a
+ * marginal alias table chooses a row, and a per-row conditional alias table
+ * chooses the column within it. Both steps run in constant time.
+ *
+ * To keep the memory footprint close to that of a CDF (8 instead of 4 bytes
+ * per entry), the tables don't store probabilities. Callers are expected
+ * to evaluate densities from the original data.
+ *
+ * \ingroup libcore
+ */
+struct AliasDistribution2D {
+public:
+    typedef math::AliasTableEntry<float, uint32_t> Entry;
+
+    /// Create an empty distribution
+    inline AliasDistribution2D() : m_width(0), m_height(0), m_sum(0.0f) { }
+
+    /// Allocate memory for a distribution with the given resolution
+    inline void init(uint32_t width, uint32_t height) {
+        m_width = width;
+        m_height = height;
+        m_conditional.resize((size_t) width * (size_t) height);
+        m_marginal.resize(height);
+        m_rowSums.resize(height);
+        m_sum = 0.0f;
+    }
+
+    /// Return the number of columns
+    inline uint32_t getWidth() const { return m_width; }
+
+    /// Return the number of rows
+    inline uint32_t getHeight() const { return m_height; }
+
+    /**
+     * \brief Build the conditional distribution of a row
+     *
+     * \param y
+     *     Index of the row
+     * \param values
+     *     The (unnormalized) probabilities of the \c width entries of the row
+     * \param weight
+     *     Additional weight of the row as a whole
+     * \return
+     *     The sum of \c values
+     */
+    inline Float setRow(uint32_t y, const Float *values, Float weight = 1.0f) {
+        Float sum = math::makeAliasTable(&m_conditional[(size_t) y * m_width],
+            values, m_width);
+        m_rowSums[y] = sum * weight;
+        return sum;
+    }
+
+    /**
+     * \brief Build the marginal distribution after all rows have been set
+     *
+     * \return Sum of the (weighted) entries of all rows
+     */
+    inline Float normalize() {
+        SAssert(m_height > 0);
+        m_sum = math::makeAliasTable(&m_marginal[0], &m_rowSums[0], m_height);
+        return m_sum;
+    }
+
+    /// Return the sum of all (weighted) entries
+    inline Float getSum() const {
+        return m_sum;
+    }
+
+    /// Return the memory used by the tables in bytes
+    inline size_t getMemoryUsage() const {
+        return (m_conditional.size() + m_marginal.size()) * sizeof(Entry)
+            + m_rowSums.size() * sizeof(Float);
+    }
+
+    /**
+     * \brief %Transform a uniformly distributed 2D sample into a discrete
+     * position
+     *
+     * Both components of the sample are adjusted so that they can be "reused".
+     *
+     * \param[in,out] sample
+     *     An uniformly distributed sample on [0,1]^2. The \c y component is
+     *     used to choose the row, and \c x chooses the column.
+     * \return
+     *     The discrete position (column, row) associated with the sample
+     */
+    inline Point2u sampleReuse(Point2 &sample) const {
+        uint32_t row = math::sampleAliasReuse(&m_marginal[0], m_height, sample.y),
+                 col = math::sampleAliasReuse(&m_conditional[(size_t) row * m_width],
+                    m_width, sample.x);
+        sample.x = std::min(sample.x, (Float) ONE_MINUS_EPS);
+        sample.y = std::min(sample.y, (Float) ONE_MINUS_EPS);
+        return Point2u(col, row);
+    }
+private:
+    std::vector<Entry> m_conditional;
+    std::vector<Entry> m_marginal;
+    std::vector<Float> m_rowSums;
+    uint32_t m_width, m_height;
+    Float m_sum;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_CORE_PMF_H_ */
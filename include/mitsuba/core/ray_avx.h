@@ -0,0 +1,212 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_CORE_RAY_AVX_H_)
+#define __MITSUBA_CORE_RAY_AVX_H_
+
+#include <mitsuba/core/platform.h>
+
+#if !defined(MTS_AVX)
+#error "This header requires AVX2 support."
+#endif
+
+#include <immintrin.h>
+#include <mitsuba/core/sse.h>
+#include <mitsuba/core/ray.h>
+#include <mitsuba/core/aabb.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Thin wrappers around the 8-wide AVX2 intrinsics
+ *
+ * The wide ray packets are templated on such a structure, which
+ * lets them share the traversal and intersection code between
+ * AVX2 (8 rays) and AVX-512 (16 rays). Lane masks are opaque:
+ * \ref movemask() converts them into one bit per lane.
+ */
+struct SIMD8 {
+    enum { Width = 8, FullMask = 0xFF };
+    typedef __m256 Vec;
+    typedef __m256 Mask;
+
+    static FINLINE Vec set1(float f) { return _mm256_set1_ps(f); }
+    static FINLINE Vec set1i(int32_t i) { return _mm256_castsi256_ps(_mm256_set1_epi32(i)); }
+    static FINLINE Vec add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+    static FINLINE Vec sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+    static FINLINE Vec mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+    static FINLINE Vec div(Vec a, Vec b) { return _mm256_div_ps(a, b); }
+    static FINLINE Vec min(Vec a, Vec b) { return _mm256_min_ps(a, b); }
+    static FINLINE Vec max(Vec a, Vec b) { return _mm256_max_ps(a, b); }
+    static FINLINE Mask cmplt(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static FINLINE Mask cmple(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static FINLINE Mask cmpgt(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static FINLINE Mask cmpge(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static FINLINE Mask maskOr(Mask a, Mask b) { return _mm256_or_ps(a, b); }
+    static FINLINE Mask maskAnd(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+    /// Return <tt>a & ~b</tt>
+    static FINLINE Mask maskAndNot(Mask a, Mask b) { return _mm256_andnot_ps(b, a); }
+    static FINLINE int movemask(Mask m) { return _mm256_movemask_ps(m); }
+    /// Return \c a in lanes where \c m is set, and \c b otherwise
+    static FINLINE Vec select(Mask m, Vec a, Vec b) { return _mm256_blendv_ps(b, a, m); }
+    static FINLINE Mask noMask() { return _mm256_setzero_ps(); }
+};
+
+#if defined(MTS_AVX512)
+/// Thin wrappers around the 16-wide AVX-512 intrinsics \sa SIMD8
+struct SIMD16 {
+    enum { Width = 16, FullMask = 0xFFFF };
+    typedef __m512 Vec;
+    typedef __mmask16 Mask;
+
+    static FINLINE Vec set1(float f) { return _mm512_set1_ps(f); }
+    static FINLINE Vec set1i(int32_t i) { return _mm512_castsi512_ps(_mm512_set1_epi32(i)); }
+    static FINLINE Vec add(Vec a, Vec b) { return _mm512_add_ps(a, b); }
+    static FINLINE Vec sub(Vec a, Vec b) { return _mm512_sub_ps(a, b); }
+    static FINLINE Vec mul(Vec a, Vec b) { return _mm512_mul_ps(a, b); }
+    static FINLINE Vec div(Vec a, Vec b) { return _mm512_div_ps(a, b); }
+    static FINLINE Vec min(Vec a, Vec b) { return _mm512_min_ps(a, b); }
+    static FINLINE Vec max(Vec a, Vec b) { return _mm512_max_ps(a, b); }
+    static FINLINE Mask cmplt(Vec a, Vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static FINLINE Mask cmple(Vec a, Vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    static FINLINE Mask cmpgt(Vec a, Vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    static FINLINE Mask cmpge(Vec a, Vec b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+    static FINLINE Mask maskOr(Mask a, Mask b) { return (Mask) (a | b); }
+    static FINLINE Mask maskAnd(Mask a, Mask b) { return (Mask) (a & b); }
+    static FINLINE Mask maskAndNot(Mask a, Mask b) { return (Mask) (a & ~b); }
+    static FINLINE int movemask(Mask m) { return (int) m; }
+    static FINLINE Vec select(Mask m, Vec a, Vec b) { return _mm512_mask_blend_ps(m, b, a); }
+    static FINLINE Mask noMask() { return 0; }
+};
+#endif
+
+/// Wide counterpart of \ref SSEVector, which allows accessing individual lanes
+template <typename SIMD> union TSIMDVector {
+    typename SIMD::Vec ps;
+    float f[SIMD::Width];
+    int32_t i[SIMD::Width];
+    uint32_t ui[SIMD::Width];
+
+    inline TSIMDVector() { }
+    explicit inline TSIMDVector(typename SIMD::Vec ps) : ps(ps) { }
+};
+
+/**
+ * \brief SIMD ray packet with 8 (AVX2) or 16 (AVX-512) rays for
+ * coherent ray tracing
+ *
+ * \sa RayPacket4
+ */
+template <typename SIMD> struct TRayPacket {
+    TSIMDVector<SIMD> o[3], d[3];
+    TSIMDVector<SIMD> dRcp[3];
+    uint8_t signs[3];
+
+    inline TRayPacket() {
+    }
+
+    /// Load \c SIMD::Width rays. Fails if their direction signs differ.
+    inline bool load(const Ray *rays) {
+        for (int axis=0; axis<3; axis++)
+            signs[axis] = rays[0].d[axis] < 0 ? 1 : 0;
+        for (int i=0; i<SIMD::Width; i++) {
+            for (int axis=0; axis<3; axis++) {
+                o[axis].f[i] = rays[i].o[axis];
+                d[axis].f[i] = rays[i].d[axis];
+                dRcp[axis].f[i] = rays[i].dRcp[axis];
+                if ((rays[i].d[axis] < 0 ? 1 : 0) != signs[axis])
+                    return false;
+            }
+        }
+        return true;
+    }
+};
+
+/// Wide counterpart of \ref RayInterval4
+template <typename SIMD> struct TRayInterval {
+    TSIMDVector<SIMD> mint;
+    TSIMDVector<SIMD> maxt;
+
+    inline TRayInterval() {
+        mint.ps = SIMD::set1(Epsilon);
+        maxt.ps = SIMD::set1(std::numeric_limits<float>::infinity());
+    }
+
+    inline TRayInterval(const Ray *rays) {
+        for (int i=0; i<SIMD::Width; i++) {
+            mint.f[i] = rays[i].mint;
+            maxt.f[i] = rays[i].maxt;
+        }
+    }
+};
+
+/// Wide counterpart of \ref Intersection4
+template <typename SIMD> struct TIntersection {
+    TSIMDVector<SIMD> t;
+    TSIMDVector<SIMD> u;
+    TSIMDVector<SIMD> v;
+    TSIMDVector<SIMD> primIndex;
+    TSIMDVector<SIMD> shapeIndex;
+
+    inline TIntersection() {
+        t.ps          = SIMD::set1(std::numeric_limits<float>::infinity());
+        u.ps          = SIMD::set1(0.0f);
+        v.ps          = SIMD::set1(0.0f);
+        primIndex.ps  = SIMD::set1i(-1);
+        shapeIndex.ps = SIMD::set1i(-1);
+    }
+};
+
+/**
+ * \brief NaN-aware slab test of a wide ray packet against an AABB
+ *
+ * Returns false if none of the rays intersect.
+ * \sa AABB::rayIntersectPacket
+ */
+template <typename SIMD> FINLINE bool rayIntersectPacket(const AABB &aabb,
+        const TRayPacket<SIMD> &ray, TRayInterval<SIMD> &interval) {
+    typedef typename SIMD::Vec Vec;
+    const Vec pInf = SIMD::set1(std::numeric_limits<float>::infinity()),
+              nInf = SIMD::set1(-std::numeric_limits<float>::infinity());
+    Vec lmax = pInf, lmin = nInf;
+
+    for (int axis=0; axis<3; ++axis) {
+        const Vec
+            l1 = SIMD::mul(ray.dRcp[axis].ps,
+                SIMD::sub(SIMD::set1(aabb.min[axis]), ray.o[axis].ps)),
+            l2 = SIMD::mul(ray.dRcp[axis].ps,
+                SIMD::sub(SIMD::set1(aabb.max[axis]), ray.o[axis].ps)),
+            l1a = SIMD::min(l1, pInf), l2a = SIMD::min(l2, pInf),
+            l1b = SIMD::max(l1, nInf), l2b = SIMD::max(l2, nInf);
+
+        lmax = SIMD::min(SIMD::max(l1a, l2a), lmax);
+        lmin = SIMD::max(SIMD::min(l1b, l2b), lmin);
+    }
+
+    interval.mint.ps = lmin;
+    interval.maxt.ps = lmax;
+
+    return SIMD::movemask(SIMD::maskAnd(
+        SIMD::cmpge(lmax, SIMD::set1(0.0f)),
+        SIMD::cmple(lmin, lmax))) != 0;
+}
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_CORE_RAY_AVX_H_ */
@@ -452,7 +452,9 @@ public:
      * running workers.
      *
      * Any currently scheduled work units are still completed.
-     * Processing can be resumed via \ref start().
+     * Processing can be resumed via \ref start(). In work stealing
+     * mode, units that local workers had already queued are kept and
+     * redistributed when the scheduler is restarted.
      */
     void pause();
 
@@ -477,6 +479,46 @@ public:
     /// Is the scheduler currently executing work?
     bool isBusy() const;
 
+    /**
+     * \brief Enable or disable work stealing for local workers
+     *
+     * By default, every local worker acquires its work units one by one
+     * from the central queue, which requires taking the main scheduler lock
+     * for every unit. In work stealing mode, each local worker instead pulls
+     * batches of up to \c batchSize work units into a private deque and
+     * processes them from there. Once both the central queue and its own
+     * deque run dry, it steals half of the remaining units of another local
+     * worker. Remote workers always use the central queue.
+     *
+     * Can only be changed while the scheduler is not running.
+     */
+    void setWorkStealing(bool enabled, size_t batchSize = 4);
+
+    /// Is work stealing enabled for local workers?
+    inline bool getWorkStealing() const { return m_workStealing; }
+
+    /// Return the number of work units that are generated per batch in work stealing mode
+    inline size_t getWorkBatchSize() const { return m_workBatchSize; }
+
+    /**
+     * \brief Enable or disable NUMA-aware scheduling
+     *
+     * When enabled, the scheduler assigns its local workers to the NUMA
+     * nodes of the machine in a round-robin fashion upon \ref start() and
+     * pins each of them to a core of its node (overriding any previously
+     * specified core affinity). In work stealing mode, workers then prefer
+     * to steal from other workers on the same node. The time spent per
+     * work unit is recorded separately for every node and reported in the
+     * statistics summary. Acceleration data structures also consult this
+     * flag to decide whether to interleave their memory across nodes.
+     *
+     * Can only be changed while the scheduler is not running.
+     */
+    void setNUMAMode(bool enabled);
+
+    /// Is NUMA-aware scheduling enabled?
+    inline bool getNUMAMode() const { return m_numaMode; }
+
     /// Initialize the scheduler of this process -- called once in main()
     static void staticInitialization();
 
@@ -540,6 +582,7 @@ public:
     struct ResourceRecord {
         std::vector<SerializableObject *> resources;
         ref<MemoryStream> stream;
+        std::string hash;
         int refCount;
         bool multi;
 
@@ -553,6 +596,41 @@ public:
         }
     };
 
+    /**
+     * Private deque of pre-generated work units owned by a local
+     * worker (only used in work stealing mode)
+     */
+    struct WorkDeque {
+        struct Entry {
+            /* ID of the process that generated the unit */
+            int id;
+            ref<WorkUnit> unit;
+
+            inline Entry() : id(-1) { }
+            inline Entry(int id, WorkUnit *unit) : id(id), unit(unit) { }
+        };
+
+        /* Protects \c units. Never acquire the main scheduler
+           lock while holding it. */
+        ref<Mutex> mutex;
+        std::deque<Entry> units;
+        /* Recycled work units of the owner's current process
+           (only accessed by the owning worker) */
+        std::vector<ref<WorkUnit> > freeUnits;
+
+        inline WorkDeque() : mutex(new Mutex()) { }
+
+        /// Take the oldest work unit from the deque
+        inline bool pop(Entry &entry) {
+            LockGuard lock(mutex);
+            if (units.empty())
+                return false;
+            entry = units.front();
+            units.pop_front();
+            return true;
+        }
+    };
+
     /// A list of status codes returned by acquireWork()
     enum EStatus {
         /// Sucessfully acquired a work unit
@@ -570,6 +648,16 @@ public:
     /// Return a resource in the form of a binary data stream
     const MemoryStream *getResourceStream(int id);
 
+    /**
+     * \brief Return the SHA-256 digest of the binary data stream of a
+     * resource, which identifies it in the caches of remote nodes
+     *
+     * A cryptographic hash is used, since the persistent cache is shared
+     * by all clients of a server and a collision would silently hand
+     * them the wrong resource. It is only computed once per resource.
+     */
+    std::string getResourceHash(int id);
+
     /**
      * \brief Test whether this is a multi-resource,
      * i.e. different for every core.
@@ -588,6 +676,24 @@ protected:
      */
     EStatus acquireWork(Item &item, bool local, bool onlyTry, bool keepLock);
 
+    /**
+     * Work stealing variant of \ref acquireWork() -- internally used
+     * by local workers when \ref setWorkStealing() is enabled.
+     */
+    EStatus acquireLocalWork(Item &item);
+
+    /**
+     * Generate up to \c m_workBatchSize work units from the central
+     * queue into the given deque. Must be called with the main lock held.
+     */
+    EStatus generateWorkBatch(Item &item, WorkDeque *deque);
+
+    /// Steal work units from the deque of another local worker
+    bool stealWork(int workerIndex, WorkDeque::Entry &entry);
+
+    /// Does any local worker have pre-generated units in its deque?
+    bool hasQueuedWork() const;
+
     /// Release the main scheduler lock -- internally used by the remote worker
     inline void releaseLock() { m_mutex->unlock(); }
 
@@ -633,7 +739,7 @@ protected:
         const ParallelProcess::ResourceBindings &bindings = item.proc->getResourceBindings();
         for (ParallelProcess::ResourceBindings::const_iterator it = bindings.begin();
             it != bindings.end(); ++it)
-            item.wp->m_resources[(*it).first] = m_scheduler->getResource((*it).second, item.coreOffset);
+            item.wp->m_resources[(*it).first] = getResource((*it).second, item.coreOffset);
         try {
             item.wp->prepare();
             item.workUnit = item.wp->createWorkUnit();
@@ -662,8 +768,13 @@ private:
     std::map<int, ResourceRecord *> m_resources;
     /// List of all active workers
     std::vector<Worker *> m_workers;
+    /// Per-worker deques (work stealing mode, NULL for remote workers)
+    std::vector<WorkDeque *> m_workDeques;
+    size_t m_workBatchSize;
     int m_resourceCounter, m_processCounter;
     bool m_running;
+    bool m_workStealing;
+    bool m_numaMode;
 };
 
 /**
@@ -677,6 +788,8 @@ public:
     inline size_t getCoreCount() const { return m_coreCount; }
     /// Is this a remote worker?
     inline bool isRemoteWorker() const { return m_isRemote; };
+    /// Return the NUMA node assigned by the scheduler (or -1 if none)
+    inline int getNUMANode() const { return m_numaNode; }
 
     MTS_DECLARE_CLASS()
 protected:
@@ -720,6 +833,11 @@ protected:
         return m_scheduler->acquireWork(m_schedItem, local, onlyTry, keepLock);
     }
 
+    /// Acquire a work unit in work stealing mode
+    inline Scheduler::EStatus acquireLocalWork() {
+        return m_scheduler->acquireLocalWork(m_schedItem);
+    }
+
     void releaseSchedulerLock() {
         return m_scheduler->releaseLock();
     }
@@ -746,6 +864,7 @@ protected:
     Scheduler *m_scheduler;
     Scheduler::Item m_schedItem;
     size_t m_coreCount;
+    int m_numaNode;
     bool m_isRemote;
 };
 
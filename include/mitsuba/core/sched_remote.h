@@ -27,7 +27,10 @@
 #define MTS_DEFAULT_PORT 7554
 
 /** How many work units should be sent to a remote worker
-   at a time? This is a multiple of the worker's core count */
+   at a time? This is a multiple of the worker's core count.
+   On links with a noticeable latency, the remote worker adds
+   the number of units that are completed during one round
+   trip to this minimum (see \ref RemoteWorker) */
 #define MTS_BACKLOG_FACTOR 3
 
 /** Once the back log factor drops below this value (also a
@@ -35,30 +38,73 @@
    continue sending batches of work units */
 #define MTS_CONTINUE_FACTOR 2
 
+/** Upper limit of the adaptive back log (again a multiple
+   of the core count) */
+#define MTS_MAX_BACKLOG_FACTOR 32
+
+/** Revision of the wire protocol. Nodes must agree on it
+   (in addition to the version) in order to communicate */
+#define MTS_PROTOCOL_REVISION 6
+
+/** Maximum amount of (uncompressed) message data that is
+   sent in a single frame when compression is enabled */
+#define MTS_FRAME_SIZE (4*1024*1024)
+
+/** Default amount of memory in MiB, which a server uses to
+   keep the resources received from previous jobs */
+#define MTS_RESOURCE_CACHE_SIZE 512
+
 MTS_NAMESPACE_BEGIN
 
 class RemoteWorkerReader;
+class RemoteWorkerMerger;
 class StreamBackend;
+class StreamBackendSender;
 
 /**
  * \brief Acquires work from the scheduler and forwards
  * it to a processing node reachable through a \ref Stream.
  *
+ * The number of work units in transit adapts to the connection: the
+ * worker periodically measures the round-trip time to the node and
+ * the rate at which it completes work units, and keeps enough units
+ * in flight to cover one round trip in addition to the static
+ * minimum of <tt>MTS_BACKLOG_FACTOR</tt> units per core. Received
+ * work results are merged by a separate thread, so that the
+ * connection is drained while results are being processed.
+ *
  * \ingroup libcore
  * \ingroup libpython
  */
 class MTS_EXPORT_CORE RemoteWorker : public Worker {
     friend class RemoteWorkerReader;
+    friend class RemoteWorkerMerger;
 public:
     /**
      * \brief Construct a new remote worker with the given name and
      * communication stream
+     *
+     * \param compressionLevel
+     *    When set to a value between 1 and 9, all messages exchanged
+     *    with the node are compressed using \c zlib with this
+     *    level (1: fastest, 9: best compression). The default value
+     *    of zero disables compression.
      */
-    RemoteWorker(const std::string &name, Stream *stream);
+    RemoteWorker(const std::string &name, Stream *stream,
+        int compressionLevel = 0);
 
     /// Return the name of the node on the other side
     inline const std::string &getNodeName() const { return m_nodeName; }
 
+    /// Return the compression level that was negotiated with the node (0: none)
+    inline int getCompressionLevel() const { return m_compressionLevel; }
+
+    /// Return the measured round-trip time in seconds (or -1 if unknown)
+    inline Float getRoundTripTime() const { return m_roundTripTime; }
+
+    /// Return the current number of work units that may be in transit
+    inline size_t getBacklog() const { return m_backlog; }
+
     MTS_DECLARE_CLASS()
 protected:
     /// Virtual destructor
@@ -71,32 +117,55 @@ protected:
     virtual void signalProcessTermination(int id);
     virtual void start(Scheduler *scheduler, int workerIndex, int coreOffset);
     void flush();
-
-    inline void signalCompletion() {
-        LockGuard lock(m_mutex);
-        m_inFlight--;
-        m_finishCond->signal();
-    }
+    /// Append a round-trip time measurement to the message buffer
+    void sendPing();
+    /// Recompute the number of work units that may be in transit
+    void updateBacklog();
+    /// Called by the reader when a work result has arrived
+    void signalCompletion();
+    /// Called by the reader when a ping has returned
+    void signalPong(uint64_t timestamp);
 protected:
     ref<Mutex> m_mutex;
     ref<ConditionVariable> m_finishCond;
     ref<MemoryStream> m_memStream;
     ref<Stream> m_stream;
+    ref<Stream> m_inputStream;
     ref<RemoteWorkerReader> m_reader;
+    ref<RemoteWorkerMerger> m_merger;
+    ref<Timer> m_timer;
 
     /* List of processes and resources that are
        currently active at the remote node */
     std::set<int> m_resources;
     std::set<int> m_processes;
     std::set<std::string> m_plugins;
+    /* Content hashes of the resources that are cached by the remote node.
+       Unless the node keeps them in a cache directory, each one may only
+       be referenced once, since the node is free to evict it afterwards */
+    std::set<std::string> m_cachedResources;
+    bool m_persistentCache;
     std::string m_nodeName;
     size_t m_inFlight;
+    /* Adaptive back log: the measured round-trip time and work unit
+       completion rate (both -1 while unknown), and the time window
+       over which completed units are currently being counted */
+    size_t m_backlog;
+    Float m_roundTripTime, m_unitRate;
+    bool m_pingPending;
+    uint64_t m_windowStart;
+    size_t m_windowCompleted;
+    int m_compressionLevel;
+    std::vector<uint8_t> m_frameBuffer;
+    size_t m_sentBytes, m_sentFrameBytes;
 };
 
 /**
  * \brief Communication helper thread required by \ref RemoteWorker.
  *
- * Constantly waits for finished work units sent by the processing node.
+ * Constantly waits for finished work units sent by the processing node
+ * and passes them on to the \ref RemoteWorkerMerger without
+ * deserializing them.
  */
 class MTS_EXPORT_CORE RemoteWorkerReader : public Thread {
     friend class RemoteWorker;
@@ -112,10 +181,55 @@ protected:
     /// Thread body
     void run();
 private:
-    std::vector<Thread *> m_joinThreads;
     RemoteWorker *m_parent;
     ref<Stream> m_stream;
     bool m_shutdown;
+};
+
+/**
+ * \brief Communication helper thread required by \ref RemoteWorker.
+ *
+ * Deserializes the work results received by the \ref RemoteWorkerReader
+ * and hands them to the scheduler in the order of their arrival.
+ */
+class MTS_EXPORT_CORE RemoteWorkerMerger : public Thread {
+    friend class RemoteWorker;
+public:
+    RemoteWorkerMerger(RemoteWorker *parent);
+
+    /**
+     * \brief Queue a message for processing. Blocks while too
+     * many messages are waiting.
+     *
+     * \param msg   Message type
+     * \param id    Process ID
+     * \param data  Serialized work result (if any)
+     */
+    void push(short msg, int id, MemoryStream *data);
+
+    /// Process all queued messages and stop
+    void shutdown();
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~RemoteWorkerMerger();
+    /// Thread body
+    void run();
+private:
+    struct Message {
+        short msg;
+        int id;
+        ref<MemoryStream> data;
+    };
+
+    std::vector<Thread *> m_joinThreads;
+    RemoteWorker *m_parent;
+    ref<Mutex> m_mutex;
+    ref<ConditionVariable> m_cond;
+    std::deque<Message> m_queue;
+    size_t m_maxQueueSize;
+    bool m_shutdown;
     int m_currentID;
     Scheduler::Item m_schedItem;
 };
@@ -198,6 +312,7 @@ class MTS_EXPORT_CORE StreamBackend : public Thread {
     friend class RemoteProcess;
     friend class RemoteWorker;
     friend class RemoteWorkerReader;
+    friend class RemoteWorkerMerger;
 public:
     /**
      * \brief Create a new stream backend
@@ -216,6 +331,25 @@ public:
     StreamBackend(const std::string &name, Scheduler *scheduler,
         const std::string &nodeName, Stream *stream, bool detach);
 
+    /**
+     * \brief Configure the resource cache of this process
+     *
+     * Resources (e.g. scenes) received by any stream backend are kept
+     * in a cache indexed by a hash of their contents. When a later job
+     * uses the same resource, the client only transmits the hash.
+     *
+     * \param memoryLimit
+     *    Amount of memory (in bytes) used to cache resources. Resources,
+     *    which are not in use by any connection, are evicted from memory
+     *    when this limit is exceeded.
+     * \param directory
+     *    When not empty, received resources are also written to this
+     *    directory, which makes them available to later invocations
+     *    of the server.
+     */
+    static void configureResourceCache(size_t memoryLimit,
+        const fs::path &directory);
+
     MTS_DECLARE_CLASS()
 protected:
     enum EMessage {
@@ -233,6 +367,9 @@ protected:
         EResourceExpired,
         EQuit,
         EIncompatible,
+        ECachedResource,
+        EPing,
+        EPong,
         EHello = 0x1bcd
     };
 
@@ -241,6 +378,8 @@ protected:
     virtual void run();
     void sendWorkResult(int id, const WorkResult *result, bool cancelled);
     void sendCancellation(int id, int numLost);
+    /// Compress a message if requested and queue it for transmission
+    void send(MemoryStream *message);
 private:
     Scheduler *m_scheduler;
     std::string m_nodeName;
@@ -248,8 +387,42 @@ private:
     ref<MemoryStream> m_memStream;
     std::map<int, RemoteProcess *> m_processes;
     std::map<int, int> m_resources;
-    ref<Mutex> m_sendMutex;
+    /* Content hashes of the cached resources that were announced to the
+       client and have not been used yet (these can't be evicted) */
+    std::set<std::string> m_cachedResources;
+    ref<StreamBackendSender> m_sender;
     bool m_detach;
+    int m_compressionLevel;
+};
+
+/**
+ * \brief Communication helper thread required by \ref StreamBackend.
+ *
+ * Writes queued messages (mostly work results) to the stream, so that
+ * the local workers never wait for the network.
+ */
+class MTS_EXPORT_CORE StreamBackendSender : public Thread {
+public:
+    StreamBackendSender(const std::string &name, Stream *stream);
+
+    /// Queue a message for transmission
+    void push(MemoryStream *message);
+
+    /// Send all queued messages and stop
+    void shutdown();
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~StreamBackendSender();
+    /// Thread body
+    void run();
+private:
+    ref<Stream> m_stream;
+    ref<Mutex> m_mutex;
+    ref<ConditionVariable> m_cond;
+    std::vector<ref<MemoryStream> > m_queue;
+    bool m_shutdown;
 };
 
 MTS_NAMESPACE_END
@@ -39,12 +39,15 @@ MTS_NAMESPACE_BEGIN
 #define PROGRESS_MSG_SIZE 56
 
 /**
- * Specifies the number of internal counters associated with each
+ * Specifies the number of internal counters (shards) associated with each
  * \ref StatsCounter instance.
  *
  * This is needed for SMP/ccNUMA systems where different processors might
- * be contending for a cache line containing a counter. The solution used
- * here tries to ensure that every processor has  its own local counter.
+ * be contending for a cache line containing a counter. Every thread is
+ * assigned its own shard (see \ref StatsCounter::getShard()), which it can
+ * update without atomic instructions. The last shard is reserved for the
+ * threads that are started when all others are in use; they share it and
+ * update it atomically.
  */
 #define NUM_COUNTERS       128   // Must be a power of 2
 
@@ -58,7 +61,8 @@ enum EStatsType {
     EPercentage,      ///< Percentage with respect to a base counter
     EMinimumValue,    ///< Minimum observed value of some quantity
     EMaximumValue,    ///< Maximum observed value of some quantity
-    EAverage          ///< Average value with respect to a base counter
+    EAverage,         ///< Average value with respect to a base counter
+    ETimeValue        ///< Time in nanoseconds, the base counter stores the number of measurements
 };
 
 #if (defined(_WIN32) && !defined(_WIN64)) || (defined(__POWERPC__) && !defined(_LP64))
@@ -113,18 +117,11 @@ public:
 #if defined(MTS_NO_STATISTICS)
         // do nothing
         return 0;
-#elif defined(_MSC_VER) && defined(_WIN64)
-        const int offset = Thread::getID() & NUM_COUNTERS_MASK;
-        _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&m_value[offset].value), 1);
-        return m_value[offset].value;
-#elif defined(_MSC_VER) && defined(_WIN32)
-        const int offset = Thread::getID() & NUM_COUNTERS_MASK;
-        _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&m_value[offset].value), 1);
-        return m_value[offset].value;
-#elif defined(__POWERPC__) && !defined(_LP64)
-        return (uint64_t) __sync_fetch_and_add(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value, 1);
 #else
-        return __sync_fetch_and_add(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value, 1);
+        int shard = getShard();
+        if (EXPECT_TAKEN(shard >= 0))
+            return m_value[shard].value++;
+        return atomicIncrement(m_value[~shard], 1);
 #endif
     }
 
@@ -132,25 +129,25 @@ public:
     inline void operator+=(size_t amount) {
 #ifdef MTS_NO_STATISTICS
         /// do nothing
-#elif defined(_MSC_VER) && defined(_WIN64)
-        _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
-#elif defined(_MSC_VER) && defined(_WIN32)
-        _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
 #else
-        __sync_fetch_and_add(&m_value[Thread::getID() & NUM_COUNTERS_MASK].value, amount);
+        int shard = getShard();
+        if (EXPECT_TAKEN(shard >= 0))
+            m_value[shard].value += amount;
+        else
+            atomicIncrement(m_value[~shard], amount);
 #endif
     }
 
-    /// Increment the base counter by the specified amount (only for use with EPercentage/EAverage)
+    /// Increment the base counter by the specified amount (only for use with EPercentage/EAverage/ETimeValue)
     inline void incrementBase(size_t amount = 1) {
 #ifdef MTS_NO_STATISTICS
         /// do nothing
-#elif defined(_MSC_VER) && defined(_WIN64)
-        _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&m_base[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
-#elif defined(_WIN32)
-        _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&m_base[Thread::getID() & NUM_COUNTERS_MASK].value), amount);
 #else
-        __sync_fetch_and_add(&m_base[Thread::getID() & NUM_COUNTERS_MASK].value, amount);
+        int shard = getShard();
+        if (EXPECT_TAKEN(shard >= 0))
+            m_base[shard].value += amount;
+        else
+            atomicIncrement(m_base[~shard], amount);
 #endif
     }
 
@@ -159,7 +156,7 @@ public:
      * an observation of the quantity whose minimum is to be determined
      */
     inline void recordMinimum(size_t value) {
-        int id = Thread::getID() & NUM_COUNTERS_MASK;
+        int shard = getShard(), id = shard >= 0 ? shard : ~shard;
         #if MTS_32BIT_COUNTERS == 1
             volatile int32_t *ptr =
                 (volatile int32_t *) &m_value[id].value;
@@ -187,7 +184,7 @@ public:
      * an observation of the quantity whose maximum is to be determined
      */
     inline void recordMaximum(size_t value) {
-        int id = Thread::getID() & NUM_COUNTERS_MASK;
+        int shard = getShard(), id = shard >= 0 ? shard : ~shard;
         #if MTS_32BIT_COUNTERS == 1
             volatile int32_t *ptr =
                 (volatile int32_t *) &m_value[id].value;
@@ -268,7 +265,35 @@ public:
 
     /// Sorting by name (for the statistics)
     bool operator<(const StatsCounter &v) const;
+
+    /**
+     * \brief Return the counter shard of the calling thread
+     *
+     * A shard is assigned to each thread when it first updates a counter.
+     * A negative return value \c ~i refers to the reserved shard \c i,
+     * which is shared with other threads (and must be updated atomically)
+     * because all other shards are in use.
+     */
+    static int getShard();
+
+    /**
+     * \brief Return the shard of the calling thread to the pool
+     *
+     * This is done automatically when a Mitsuba \ref Thread exits.
+     */
+    static void releaseShard();
 private:
+    /// Atomically increment a (shared) shard
+    static inline uint64_t atomicIncrement(CacheLineCounter &counter, size_t amount) {
+#if defined(_MSC_VER) && defined(_WIN64)
+        return (uint64_t) _InterlockedExchangeAdd64(reinterpret_cast<__int64 volatile *>(&counter.value), amount);
+#elif defined(_MSC_VER) && defined(_WIN32)
+        return (uint64_t) _InterlockedExchangeAdd(reinterpret_cast<long volatile *>(&counter.value), amount);
+#else
+        return (uint64_t) __sync_fetch_and_add(&counter.value, amount);
+#endif
+    }
+
     std::string m_category;
     std::string m_name;
     EStatsType m_type;
@@ -330,8 +355,9 @@ private:
 /** \brief Collects various rendering statistics and presents them
  * in a human-readable form.
  *
- * \remark Only the \ref getInstance(), \ref getStats(), and
- * \ref printStats() functions are implemented in the Python bindings.
+ * \remark Only the \ref getInstance(), \ref getStats(), \ref getStatsJSON(),
+ * \ref printStats(), \ref resetAll() and timing-related functions are
+ * implemented in the Python bindings.
  *
  * \ingroup libcore
  * \ingroup libpython
@@ -353,6 +379,23 @@ public:
     /// Return a string containing gathered statistics
     std::string getStats();
 
+    /**
+     * \brief Return all counters (including those with a value of zero)
+     * and loaded plugins in JSON format, e.g. for automated profiling
+     */
+    std::string getStatsJSON();
+
+    /**
+     * \brief Enable/disable the time measurements of \ref ScopedStatsTimer
+     *
+     * This is disabled by default, since reading the clock on every
+     * invocation of the timed functions has a small but measurable cost.
+     */
+    static void setTimingEnabled(bool enabled);
+
+    /// Are time measurements enabled?
+    static inline bool isTimingEnabled() { return m_timingEnabled; }
+
     /// Reset all statistics counters
     void resetAll();
 
@@ -378,11 +421,49 @@ private:
     };
 
     static ref<Statistics> m_instance;
+    static bool m_timingEnabled;
     std::vector<const StatsCounter *> m_counters;
     std::vector<std::pair<std::string, std::string> > m_plugins;
     ref<Mutex> m_mutex;
 };
 
+/** \brief Measures the time spent in a scope and records it in a
+ * \ref StatsCounter of type \ref ETimeValue
+ *
+ * Measurements are only taken when they have been enabled using
+ * \ref Statistics::setTimingEnabled(). Usage:
+ *
+ * \code
+ * static StatsCounter timeBSDFSample("Timing", "BSDF sampling", ETimeValue);
+ * ...
+ * {
+ *     ScopedStatsTimer timer(timeBSDFSample);
+ *     bsdfWeight = bsdf->sample(bRec, bsdfPdf, rRec.nextSample2D());
+ * }
+ * \endcode
+ *
+ * \ingroup libcore
+ */
+class ScopedStatsTimer {
+public:
+#if defined(MTS_NO_STATISTICS)
+    inline ScopedStatsTimer(StatsCounter &) { }
+#else
+    inline ScopedStatsTimer(StatsCounter &counter) : m_counter(counter),
+        m_start(Statistics::isTimingEnabled() ? Timer::getTimestamp() : 0) { }
+
+    inline ~ScopedStatsTimer() {
+        if (m_start != 0) {
+            m_counter += (size_t) (Timer::getTimestamp() - m_start);
+            m_counter.incrementBase();
+        }
+    }
+private:
+    StatsCounter &m_counter;
+    uint64_t m_start;
+#endif
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_CORE_STATISTICS_H_ */
@@ -91,6 +91,12 @@ public:
     /// Return a string representation
     std::string toString() const;
 
+    /**
+     * \brief Return a timestamp of the underlying monotonic clock in
+     * nanoseconds (e.g. for cheaply measuring short code sections)
+     */
+    static uint64_t getTimestamp();
+
     MTS_DECLARE_CLASS()
 protected:
     /// Virtual destructor
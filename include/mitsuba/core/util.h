@@ -65,6 +65,9 @@ extern MTS_EXPORT_CORE std::string timeString(Float time, bool precise = false);
 /// Turn a memory size into a human-readable string
 extern MTS_EXPORT_CORE std::string memString(size_t size, bool precise = false);
 
+/// Compute the SHA-256 digest of a memory region and return it as a hexadecimal string
+extern MTS_EXPORT_CORE std::string sha256(const void *data, size_t size);
+
 /// Return a string representation of a list of objects
 template<class Iterator> std::string containerToString(const Iterator &start, const Iterator &end) {
     std::ostringstream oss;
@@ -112,6 +115,34 @@ extern std::string MTS_EXPORT_CORE lastErrorText();
 /// Determine the number of available CPU cores
 extern MTS_EXPORT_CORE int getCoreCount();
 
+/**
+ * \brief Determine the number of NUMA nodes of this machine
+ *
+ * Returns 1 on non-NUMA machines and on platforms where the
+ * topology cannot be queried.
+ */
+extern MTS_EXPORT_CORE int getNUMANodeCount();
+
+/**
+ * \brief Return the CPU cores belonging to the specified NUMA node
+ *
+ * The returned indices use the same numbering as \ref getCoreCount()
+ * and \ref Thread::setCoreAffinity(), i.e. they refer to the cores
+ * that are available to this process.
+ */
+extern MTS_EXPORT_CORE std::vector<int> getNUMANodeCores(int node);
+
+/**
+ * \brief Interleave the pages of a memory region across all NUMA nodes
+ *
+ * Pages that have already been touched are migrated. This is meant
+ * for large read-only data structures that are accessed by worker
+ * threads on all nodes. The region is extended to page boundaries.
+ *
+ * \return \c true if the memory policy could be applied
+ */
+extern MTS_EXPORT_CORE bool interleaveMemory(const void *ptr, size_t size);
+
 /// Return the host name of this machine
 extern MTS_EXPORT_CORE std::string getHostName();
 
@@ -22,6 +22,7 @@
 
 #include <mitsuba/render/common.h>
 #include <mitsuba/core/track.h>
+#include <mitsuba/core/aabb.h>
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/cobject.h>
 #include <mitsuba/render/shader.h>
@@ -431,6 +432,39 @@ protected:
     uint32_t m_type;
 };
 
+/**
+ * \brief Conservative bounds on the spatial extent and the directional
+ * emission profile of an emitter
+ *
+ * These are used by the light hierarchy (\ref LightTree) to estimate the
+ * contribution of a group of emitters towards a reference point. All emitted
+ * light leaves from within \c aabb along directions \c d satisfying
+ * <tt>angle(d, axis) <= acos(cosThetaO) + acos(cosThetaE)</tt>, where the
+ * first angle bounds the spread of the surface normals and the second one
+ * bounds the emission around each normal.
+ *
+ * \ingroup librender
+ */
+struct MTS_EXPORT_RENDER EmissionBounds {
+    /// Spatial extent of the emitter
+    AABB aabb;
+    /// Central axis of the cone of emission directions
+    Vector axis;
+    /// Cosine of the spread of the surface normals around \c axis
+    Float cosThetaO;
+    /// Cosine of the maximal emission angle relative to the normals
+    Float cosThetaE;
+    /// Approximate emitted power (luminance)
+    Float power;
+
+    /// Create bounds that include all directions and no power
+    inline EmissionBounds() : axis(0.0f, 0.0f, 1.0f), cosThetaO(-1.0f),
+        cosThetaE(0.0f), power(0.0f) { }
+
+    /// Return a string representation
+    std::string toString() const;
+};
+
 /**
  * \brief Abstract radiance emitter interface
  *
@@ -552,6 +586,19 @@ public:
      */
     virtual ref<Bitmap> getBitmap(const Vector2i &sizeHint = Vector2i(-1, -1)) const;
 
+    /**
+     * \brief Return bounds on the spatial and directional emission profile
+     *
+     * This is used by the light hierarchy that \ref Scene optionally builds
+     * to select emitters based on their estimated contribution at a
+     * reference point. Emitters that are not localized (e.g. environment
+     * maps or directional lights) should return \c false, in which case
+     * they are selected according to their sampling weight.
+     *
+     * \remark The default implementation returns \c false
+     */
+    virtual bool getEmissionBounds(EmissionBounds &bounds) const;
+
     /// Serialize this emitter to a binary data stream
     virtual void serialize(Stream *stream, InstanceManager *manager) const;
 
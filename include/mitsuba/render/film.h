@@ -51,6 +51,24 @@ public:
     /// Merge an image block into the film
     virtual void put(const ImageBlock *block) = 0;
 
+    /**
+     * \brief Can \ref put() be called from several threads at the same time?
+     *
+     * When this is the case, render processes merge finished blocks without
+     * serializing them. The default implementation returns \c false.
+     */
+    virtual bool hasConcurrentPut() const { return false; }
+
+    /**
+     * \brief Should image blocks preferably be rendered in scanline order?
+     *
+     * Films that stream finished blocks to disk hold on to every block
+     * until its neighbors have arrived. Generating the blocks row by row
+     * keeps this set small. The default implementation returns \c false,
+     * in which case the usual spiral pattern is used.
+     */
+    virtual bool hasScanlineOrder() const { return false; }
+
     /// Overwrite the film with the given bitmap and optionally multiply it by a scalar
     virtual void setBitmap(const Bitmap *bitmap, Float multiplier = 1.0f) = 0;
 
@@ -29,9 +29,11 @@ class BSDF;
 struct BSDFSamplingRecord;
 struct DirectionSamplingRecord;
 struct DirectSamplingRecord;
+struct EmissionBounds;
 class Emitter;
 class Film;
 class GatherPhotonProcess;
+class GeometryPager;
 class HemisphereSampler;
 class HWResource;
 class ImageBlock;
@@ -39,6 +41,7 @@ class Instanced;
 class Integrator;
 struct Intersection;
 class IrradianceCache;
+class LightTree;
 template <typename AABBType> class KDTreeBase;
 template <typename AABBType, typename TreeConstructionHeuristic, typename Derived> class GenericKDTree;
 template <typename Derived> class SAHKDTree3D;
@@ -0,0 +1,127 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_GEOMPAGER_H_)
+#define __MITSUBA_RENDER_GEOMPAGER_H_
+
+#include <mitsuba/render/triaccel.h>
+#include <mitsuba/core/mmap.h>
+#include <mitsuba/core/tls.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Out-of-core storage for the precomputed triangle data
+ * (\ref TriAccel) of a \ref ShapeKDTree
+ *
+ * The records are written to a temporary memory-mapped page file and are
+ * paged back in on demand. Each thread keeps the pages that it has touched
+ * in an LRU cache. The pages of all caches together stay below a
+ * user-specified limit regardless of the size of the scene: a thread that
+ * needs a new page while the limit is reached first evicts its own least
+ * recently used pages. Only the page that a thread is currently reading
+ * is exempt, hence the limit can be exceeded by at most one page per
+ * thread.
+ *
+ * Records are stored in the order in which they are appended. The kd-tree
+ * appends them in the depth-first order of its leaves, so that the
+ * geometry of a subtree ends up on a small number of pages.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER GeometryPager : public Object {
+public:
+    /// Records per page (i.e. 48 KiB pages in single precision)
+    enum {
+        EPageShift = 10,
+        EPageSize = 1 << EPageShift,
+        EPageMask = EPageSize - 1
+    };
+
+    /**
+     * \brief Create a page file with room for \c recordCount records
+     *
+     * \param cacheSize
+     *     Memory limit of the page caches in bytes. It is shared by
+     *     all threads that access the pager.
+     */
+    GeometryPager(size_t recordCount, size_t cacheSize);
+
+    /**
+     * \brief Append the record of a primitive to the page file
+     *
+     * Returns a reference to the new (zero-initialized) record,
+     * which must be filled in by the caller.
+     */
+    TriAccel &append(uint32_t primIndex);
+
+    /// Look up the record of a primitive, paging it in if necessary
+    FINLINE const TriAccel &get(uint32_t primIndex) const {
+        uint32_t location = m_location[primIndex];
+        return getPage(location >> EPageShift)[location & EPageMask];
+    }
+
+    /// Return the contents of a page, paging it in if necessary
+    const TriAccel *getPage(uint32_t page) const;
+
+    /// Return the number of pages in the page file
+    inline size_t getPageCount() const { return m_pageCount; }
+
+    /// Return the size of the page file in bytes
+    inline size_t getFileSize() const { return m_file->getSize(); }
+
+    /// Return the memory limit of the page caches in bytes
+    inline size_t getCacheSize() const { return m_cacheSize; }
+
+    /// Return the number of pages that are currently resident in the caches
+    inline size_t getResidentPageCount() const { return (size_t) m_residentPages; }
+
+    /**
+     * \brief Return the amount of memory that is permanently resident
+     * (i.e. excluding the page caches)
+     */
+    size_t getMemoryUsage() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Per-thread LRU cache of resident pages
+    struct PageCache;
+
+    /// Copy a page from the page file into memory
+    TriAccel *loadPage(uint32_t page) const;
+
+    /// Release a page that was evicted from a cache
+    void releasePage(TriAccel * const &data) const;
+
+    /// Virtual destructor
+    virtual ~GeometryPager();
+private:
+    ref<MemoryMappedFile> m_file;
+    uint32_t *m_location;
+    size_t m_recordCount, m_appended;
+    size_t m_pageCount, m_maxPages;
+    size_t m_cacheSize;
+    int32_t m_id;
+    mutable volatile int32_t m_residentPages;
+    mutable ThreadLocal<PageCache> m_cache;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_GEOMPAGER_H_ */
@@ -22,8 +22,10 @@
 
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/lock.h>
+#include <mitsuba/core/atomic.h>
 #include <boost/static_assert.hpp>
 #include <stack>
+#include <deque>
 
 #if defined(__LINUX__)
 #include <malloc.h>
@@ -43,6 +45,15 @@
 #define MTS_KD_BLOCKSIZE_KD  (512*1024/sizeof(KDNode))
 #define MTS_KD_BLOCKSIZE_IDX (512*1024/sizeof(uint32_t))
 
+/**
+ * \brief Nodes with at least this many edge events are split into chunks,
+ * which are processed cooperatively by all builder threads
+ */
+#define MTS_KD_PARALLEL_EVENTS (256*1024)
+
+/// Subtrees with fewer primitives are never handed over to another builder thread
+#define MTS_KD_MIN_TASK_PRIMS 4096
+
 /**
  * \brief To avoid numerical issues, the size of the scene
  * bounding box is increased by this amount
@@ -406,7 +417,8 @@ public:
             delete[] m_buffer;
         if (size > 0) {
             m_bufferSize = size/4 + ((size % 4) > 0 ? 1 : 0);
-            m_buffer = new uint8_t[m_bufferSize];
+            /* Round up to whole words (see \ref setAtomic()) */
+            m_buffer = new uint8_t[(m_bufferSize + 3) & ~(size_t) 3];
         } else {
             m_buffer = NULL;
         }
@@ -418,6 +430,27 @@ public:
         *ptr = (*ptr & ~(3 << shift)) | (value << shift);
     }
 
+    /**
+     * \brief Thread-safe version of \ref set(), which can be used when
+     * several threads classify the primitives of one node concurrently
+     */
+    inline void setAtomic(uint32_t index, int value) {
+        size_t byteIndex = index >> 2;
+        volatile int32_t *word = reinterpret_cast<volatile int32_t *>(
+            m_buffer + (byteIndex & ~(size_t) 3));
+        uint8_t shift = (index & 3) << 1;
+        union {
+            int32_t word;
+            uint8_t bytes[4];
+        } oldValue, newValue;
+
+        do {
+            oldValue.word = newValue.word = *word;
+            uint8_t &byte = newValue.bytes[byteIndex & 3];
+            byte = (uint8_t) ((byte & ~(3 << shift)) | (value << shift));
+        } while (!atomicCompareAndExchange(word, newValue.word, oldValue.word));
+    }
+
     inline int get(uint32_t index) const {
         uint8_t *ptr = m_buffer + (index >> 2);
         uint8_t shift = (index & 3) << 1;
@@ -697,7 +730,12 @@ MTS_NAMESPACE_BEGIN
  * cache misses. Once the input data has been narrowed down to a
  * reasonable amount, the implementation switches over to the O(N log N)
  * builder. When multiple processors are available, the build process runs
- * in parallel.
+ * in parallel: large subtrees are queued as jobs, which are picked up by a
+ * set of builder threads that recursively spawn further jobs. Nodes with
+ * very many primitives (e.g. near the top of a tree that is built entirely
+ * using the O(N log N) method) are additionally split into chunks, so that
+ * several threads cooperate on sorting, split search, classification and
+ * partitioning.
  *
  * \author Wenzel Jakob
  * \ingroup librender
@@ -729,7 +767,7 @@ public:
      * \brief Create a new kd-tree instance initialized with
      * the default parameters.
      */
-    GenericKDTree() : m_indices(NULL) {
+    GenericKDTree() : m_indices(NULL), m_packedIndices(NULL), m_packedSize(0) {
         m_nodes = NULL;
         m_traversalCost = 15;
         m_queryCost = 20;
@@ -741,8 +779,12 @@ public:
         m_maxDepth = 0;
         m_retract = true;
         m_parallelBuild = true;
+        m_warnIfEmpty = true;
+        m_builderCount = 0;
         m_minMaxBins = 128;
         m_logLevel = EDebug;
+        m_buildTime = 0;
+        m_sahCost = 0;
     }
 
     /**
@@ -751,6 +793,8 @@ public:
     virtual ~GenericKDTree() {
         if (m_indices)
             delete[] m_indices;
+        if (m_packedIndices)
+            delete[] m_packedIndices;
         if (m_nodes)
             freeAligned(m_nodes-1); // undo alignment shift
     }
@@ -764,9 +808,62 @@ public:
 
     /**
      * \brief Returns the underlying kd-tree index buffer
+     *
+     * This is \c NULL after \ref packIndices() was called, in which
+     * case the leaf contents must be accessed using a \ref LeafIterator.
      */
     inline IndexType *getIndices() const { return m_indices; }
 
+    /// Were the index lists compressed using \ref packIndices()?
+    inline bool hasPackedIndices() const { return m_packedIndices != NULL; }
+
+    /**
+     * \brief Iterates over the primitive indices referenced by a leaf
+     * node, regardless of whether the index lists are packed or not
+     *
+     * Usage:
+     * <pre>
+     * LeafIterator it(tree, node);
+     * IndexType primIdx;
+     * while (it.next(primIdx)) { ... }
+     * </pre>
+     */
+    class LeafIterator {
+    public:
+        FINLINE LeafIterator(const GenericKDTree *tree, const KDNode *node)
+            : m_indices(tree->m_indices), m_entry(node->getPrimStart()),
+              m_end(node->getPrimEnd()), m_packed(tree->m_packedIndices),
+              m_value(0) { }
+
+        /// Fetch the next primitive index. Returns \c false at the end.
+        FINLINE bool next(IndexType &primIdx) {
+            if (m_entry == m_end)
+                return false;
+            if (EXPECT_TAKEN(!m_packed)) {
+                primIdx = m_indices[m_entry++];
+                return true;
+            }
+
+            /* Packed lists are sorted, and store the differences
+               between successive indices as variable-length integers */
+            IndexType delta = 0;
+            int shift = 0;
+            uint8_t byte;
+            do {
+                byte = m_packed[m_entry++];
+                delta |= (IndexType) (byte & 0x7F) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            primIdx = m_value += delta;
+            return true;
+        }
+    private:
+        const IndexType * __restrict m_indices;
+        IndexType m_entry, m_end;
+        const uint8_t * __restrict m_packed;
+        IndexType m_value;
+    };
+
     /**
      * \brief Return the traversal cost used by the tree construction heuristic
      */
@@ -914,6 +1011,57 @@ public:
         return m_parallelBuild;
     }
 
+    /**
+     * \brief Specify whether or not building a tree that
+     * contains no geometry should produce a warning.
+     */
+    inline void setWarnIfEmpty(bool warnIfEmpty) {
+        m_warnIfEmpty = warnIfEmpty;
+    }
+
+    /**
+     * \brief Return whether or not building a tree that
+     * contains no geometry will produce a warning.
+     */
+    inline bool getWarnIfEmpty() const {
+        return m_warnIfEmpty;
+    }
+
+    /**
+     * \brief Specify the number of builder threads used for
+     * parallel tree construction (0 = one per core)
+     */
+    inline void setBuilderCount(SizeType builderCount) {
+        m_builderCount = builderCount;
+    }
+
+    /**
+     * \brief Return the number of builder threads used for
+     * parallel tree construction (0 = one per core)
+     */
+    inline SizeType getBuilderCount() const {
+        return m_builderCount;
+    }
+
+    /// Return the time (in milliseconds) spent building the tree
+    inline unsigned int getBuildTime() const {
+        return m_buildTime;
+    }
+
+    /**
+     * \brief Return the expected query cost of the tree according to
+     * the tree construction heuristic (e.g. the SAH cost)
+     */
+    inline Float getSAHCost() const {
+        return m_sahCost;
+    }
+
+    /// Return the memory used by the nodes and index lists in bytes
+    inline size_t getMemoryUsage() const {
+        return sizeof(KDNode) * m_nodeCount + (m_packedIndices ? m_packedSize
+            : sizeof(IndexType) * m_indexCount);
+    }
+
     /**
      * \brief Specify the number of primitives, at which the builder will
      * switch from (approximate) Min-Max binning to the accurate
@@ -968,16 +1116,19 @@ protected:
         if (m_minMaxBins <= 1)
             KDLog(EError, "The number of min-max bins must be > 2");
 
+        ref<Timer> buildTimer = new Timer();
         SizeType primCount = cast()->getPrimitiveCount();
         if (primCount == 0) {
-            KDLog(EWarn, "kd-tree contains no geometry!");
+            if (m_warnIfEmpty)
+                KDLog(EWarn, "kd-tree contains no geometry!");
             // +1 shift is for alignment purposes (see KDNode::getSibling)
             m_nodes = static_cast<KDNode *>(allocAligned(sizeof(KDNode) * 2))+1;
             m_nodes[0].initLeafNode(0, 0);
             return;
         }
 
-        if (primCount <= m_exactPrimThreshold)
+        /* Not worth starting the builder threads for tiny trees */
+        if (primCount < 4 * MTS_KD_MIN_TASK_PRIMS)
             m_parallelBuild = false;
 
         BuildContext ctx(primCount, m_minMaxBins);
@@ -1032,7 +1183,8 @@ protected:
                 m_parallelBuild ? "yes" : "no");
         KDLog(m_logLevel, "");
 
-        SizeType procCount = getCoreCount();
+        SizeType procCount = m_builderCount > 0 ? m_builderCount
+            : (SizeType) getCoreCount();
         if (procCount == 1)
             m_parallelBuild = false;
 
@@ -1055,7 +1207,10 @@ protected:
         KDAssert(ctx.rightAlloc.used() == 0);
 
         if (m_parallelBuild) {
+            /* Wait until all queued subtrees have been built */
             UniqueLock lock(m_interface.mutex);
+            while (m_interface.pendingJobs > 0)
+                m_interface.condJobsDone->wait();
             m_interface.done = true;
             m_interface.cond->broadcast();
             lock.unlock();
@@ -1256,6 +1411,9 @@ protected:
         KDLog(m_logLevel, "   Final cost                  : %.2f", heuristicCost);
         KDLog(m_logLevel, "");
 
+        m_sahCost = heuristicCost;
+        m_buildTime = buildTimer->getMilliseconds();
+
         #if defined(__LINUX__)
             /* Forcefully release Heap memory back to the OS */
             malloc_trim(0);
@@ -1340,6 +1498,13 @@ protected:
         }
     };
 
+    /// Used to locate the beginning of an axis in a sorted edge event list
+    struct EdgeEventAxisOrdering {
+        inline bool operator()(const EdgeEvent &a, int axis) const {
+            return (int) a.axis < axis;
+        }
+    };
+
     /**
      * \brief Data type for split candidates computed by
      * the O(n log n) greedy optimization method.
@@ -1434,6 +1599,37 @@ protected:
         }
     };
 
+    /**
+     * \brief Job description for building a subtree on one of
+     * the builder threads (see \ref spawnJob())
+     */
+    struct BuildJob {
+        unsigned int depth;
+        KDNode *node;
+        AABBType nodeAABB, tightAABB;
+        /// Index list for min-max binning (or \c NULL)
+        IndexType *indices;
+        /// Sorted edge event list for the O(n log n) method (or \c NULL)
+        EdgeEvent *events;
+        size_t eventCount;
+        SizeType primCount;
+        SizeType badRefines;
+    };
+
+    /**
+     * \brief Data-parallel loop over a number of chunks, which is
+     * processed cooperatively by the builder threads
+     * (see \ref parallelFor())
+     */
+    struct ParallelLoop {
+        SizeType chunkCount, nextChunk, remaining;
+
+        virtual ~ParallelLoop() { }
+
+        /// Process the specified chunk
+        virtual void process(SizeType chunk) = 0;
+    };
+
     /**
      * \brief Communication data structure used to pass jobs to
      * kd-tree builder threads
@@ -1441,23 +1637,21 @@ protected:
     struct BuildInterface {
         /* Communcation */
         ref<Mutex> mutex;
-        ref<ConditionVariable> cond, condJobTaken;
+        ref<ConditionVariable> cond, condJobsDone, condLoopDone;
         std::map<const KDNode *, IndexType> threadMap;
         bool done;
 
-        /* Job description for building a subtree */
-        int depth;
-        KDNode *node;
-        AABBType nodeAABB;
-        EdgeEvent *eventStart, *eventEnd;
-        SizeType primCount;
-        int badRefines;
+        /* Queued subtree jobs and data-parallel loops */
+        std::deque<BuildJob> jobs;
+        std::deque<ParallelLoop *> loops;
+        SizeType pendingJobs;
 
         inline BuildInterface() {
             mutex = new Mutex();
             cond = new ConditionVariable(mutex);
-            condJobTaken = new ConditionVariable(mutex);
-            node = NULL;
+            condJobsDone = new ConditionVariable(mutex);
+            condLoopDone = new ConditionVariable(mutex);
+            pendingJobs = 0;
             done = false;
         }
     };
@@ -1483,33 +1677,32 @@ protected:
         }
 
         void run() {
-            OrderedChunkAllocator &leftAlloc = m_context.leftAlloc;
+            UniqueLock lock(m_interface.mutex);
             while (true) {
-                UniqueLock lock(m_interface.mutex);
-                while (!m_interface.done && !m_interface.node)
+                while (!m_interface.done && m_interface.jobs.empty()
+                        && m_interface.loops.empty())
                     m_interface.cond->wait();
-                if (m_interface.done) {
-                    break;
+
+                /* Chunks of large nodes take precedence, since
+                   another thread is waiting for them */
+                if (!m_interface.loops.empty()) {
+                    m_parent->processLoopChunk(lock);
+                    continue;
                 }
-                int depth = m_interface.depth;
-                KDNode *node = m_interface.node;
-                AABBType nodeAABB = m_interface.nodeAABB;
-                size_t eventCount = m_interface.eventEnd - m_interface.eventStart;
-                SizeType primCount = m_interface.primCount;
-                int badRefines = m_interface.badRefines;
-                EdgeEvent *eventStart = leftAlloc.allocate<EdgeEvent>(eventCount),
-                          *eventEnd = eventStart + eventCount;
-                memcpy(eventStart, m_interface.eventStart,
-                        eventCount * sizeof(EdgeEvent));
-                m_interface.threadMap[node] = m_id;
-                m_interface.node = NULL;
-                m_interface.condJobTaken->signal();
+
+                if (m_interface.jobs.empty())
+                    break;
+
+                BuildJob job = m_interface.jobs.front();
+                m_interface.jobs.pop_front();
+                m_interface.threadMap[job.node] = m_id;
                 lock.unlock();
 
-                std::sort(eventStart, eventEnd, EdgeEventOrdering());
-                m_parent->buildTree(m_context, depth, node,
-                    nodeAABB, eventStart, eventEnd, primCount, true, badRefines);
-                leftAlloc.release(eventStart);
+                m_parent->runJob(m_context, job);
+
+                lock.lock();
+                if (--m_interface.pendingJobs == 0)
+                    m_interface.condJobsDone->broadcast();
             }
         }
 
@@ -1534,6 +1727,504 @@ protected:
         return static_cast<const Derived *>(this);
     }
 
+    /**
+     * \brief Try to hand the construction of a subtree over to the
+     * builder threads
+     *
+     * The index list (min-max binning) or the sorted edge event list
+     * (O(n log n) method) is copied, hence the caller can release it as
+     * usual. Subtrees built this way are never torn down again, which is
+     * signaled to the callers by a cost of -infinity.
+     *
+     * \returns \c false when the subtree should be built by the calling
+     * thread instead (because it is too small, or because there are
+     * already enough queued jobs to keep all builder threads busy)
+     */
+    bool spawnJob(unsigned int depth, KDNode *node, const AABBType &nodeAABB,
+            const AABBType &tightAABB, const IndexType *indices,
+            const EdgeEvent *eventStart, const EdgeEvent *eventEnd,
+            SizeType primCount, SizeType badRefines) {
+        if (!m_parallelBuild || primCount < MTS_KD_MIN_TASK_PRIMS)
+            return false;
+
+        {
+            LockGuard lock(m_interface.mutex);
+            if (m_interface.jobs.size() >= m_builders.size())
+                return false;
+        }
+
+        BuildJob job;
+        job.depth = depth;
+        job.node = node;
+        job.nodeAABB = nodeAABB;
+        job.tightAABB = tightAABB;
+        job.indices = NULL;
+        job.events = NULL;
+        job.eventCount = 0;
+        job.primCount = primCount;
+        job.badRefines = badRefines;
+
+        if (eventStart) {
+            job.eventCount = eventEnd - eventStart;
+            job.events = new EdgeEvent[job.eventCount];
+            memcpy(job.events, eventStart, job.eventCount * sizeof(EdgeEvent));
+        } else {
+            job.indices = new IndexType[primCount];
+            memcpy(job.indices, indices, primCount * sizeof(IndexType));
+        }
+
+        LockGuard lock(m_interface.mutex);
+        m_interface.jobs.push_back(job);
+        m_interface.pendingJobs++;
+        m_interface.cond->signal();
+        return true;
+    }
+
+    /// Build a subtree that was queued by \ref spawnJob()
+    void runJob(BuildContext &ctx, const BuildJob &job) {
+        OrderedChunkAllocator &leftAlloc = ctx.leftAlloc;
+
+        if (job.events) {
+            EdgeEvent *eventStart = leftAlloc.allocate<EdgeEvent>(job.eventCount),
+                      *eventEnd = eventStart + job.eventCount;
+            memcpy(eventStart, job.events, job.eventCount * sizeof(EdgeEvent));
+            delete[] job.events;
+            buildTree(ctx, job.depth, job.node, job.nodeAABB, eventStart,
+                eventEnd, job.primCount, true, job.badRefines);
+            leftAlloc.release(eventStart);
+        } else {
+            IndexType *indices = leftAlloc.allocate<IndexType>(job.primCount);
+            memcpy(indices, job.indices, job.primCount * sizeof(IndexType));
+            delete[] job.indices;
+            buildTreeMinMax(ctx, job.depth, job.node, job.nodeAABB,
+                job.tightAABB, indices, job.primCount, true, job.badRefines);
+            leftAlloc.release(indices);
+        }
+    }
+
+    /**
+     * \brief Claim and process a chunk of the oldest pending data-parallel
+     * loop. Must be called with the interface lock held, which is
+     * released while the chunk is being processed.
+     */
+    void processLoopChunk(UniqueLock &lock) {
+        ParallelLoop *loop = m_interface.loops.front();
+        SizeType chunk = loop->nextChunk++;
+        if (loop->nextChunk == loop->chunkCount)
+            m_interface.loops.pop_front();
+        lock.unlock();
+
+        loop->process(chunk);
+
+        lock.lock();
+        if (--loop->remaining == 0)
+            m_interface.condLoopDone->broadcast();
+    }
+
+    /**
+     * \brief Process all chunks of a data-parallel loop with the help of
+     * any idle builder threads and return once all of them are done
+     */
+    void parallelFor(ParallelLoop &loop, SizeType chunkCount) {
+        loop.chunkCount = chunkCount;
+        loop.nextChunk = 0;
+        loop.remaining = chunkCount;
+
+        if (!m_parallelBuild || chunkCount <= 1) {
+            for (SizeType i=0; i<chunkCount; ++i)
+                loop.process(i);
+            return;
+        }
+
+        UniqueLock lock(m_interface.mutex);
+        m_interface.loops.push_back(&loop);
+        m_interface.cond->broadcast();
+
+        while (loop.nextChunk < loop.chunkCount) {
+            SizeType chunk = loop.nextChunk++;
+            if (loop.nextChunk == loop.chunkCount)
+                m_interface.loops.erase(std::find(m_interface.loops.begin(),
+                    m_interface.loops.end(), &loop));
+            lock.unlock();
+
+            loop.process(chunk);
+
+            lock.lock();
+            --loop.remaining;
+        }
+
+        while (loop.remaining > 0)
+            m_interface.condLoopDone->wait();
+    }
+
+    /// Should the operations on a node with this many events run in parallel?
+    inline bool isLargeNode(size_t eventCount) const {
+        return m_parallelBuild && eventCount >= MTS_KD_PARALLEL_EVENTS;
+    }
+
+    /// Return a suitable number of chunks for a parallel loop over \c size elements
+    inline SizeType getChunkCount(size_t size) const {
+        size_t chunkCount = std::min(m_builders.size() * 4,
+            size / (MTS_KD_PARALLEL_EVENTS / 16));
+        return (SizeType) std::max(chunkCount, (size_t) 1);
+    }
+
+    /// Parallel loop used by \ref sortEvents()
+    struct SortLoop : public ParallelLoop {
+        EdgeEvent *source, *target;
+        std::vector<size_t> bounds;
+        SizeType width;
+
+        void process(SizeType chunk) {
+            if (width == 0) {
+                std::sort(source + bounds[chunk], source + bounds[chunk+1],
+                    EdgeEventOrdering());
+            } else {
+                /* Merge two neighboring sorted runs */
+                SizeType start = chunk * 2 * width,
+                         middle = start + width,
+                         end = start + 2 * width;
+                std::merge(source + bounds[start], source + bounds[middle],
+                    source + bounds[middle], source + bounds[end],
+                    target + bounds[start], EdgeEventOrdering());
+            }
+        }
+    };
+
+    /**
+     * \brief Sort an edge event list
+     *
+     * Large lists are split into runs that are sorted and then merged
+     * in parallel. The temporary buffer is taken from \c alloc.
+     */
+    void sortEvents(OrderedChunkAllocator &alloc, EdgeEvent *eventStart,
+            EdgeEvent *eventEnd) {
+        size_t eventCount = eventEnd - eventStart;
+        if (!isLargeNode(eventCount)) {
+            std::sort(eventStart, eventEnd, EdgeEventOrdering());
+            return;
+        }
+
+        SizeType runCount = 1;
+        while (runCount < m_builders.size() * 2 && runCount < 64)
+            runCount *= 2;
+
+        SortLoop loop;
+        loop.bounds.resize(runCount + 1);
+        for (SizeType i=0; i<=runCount; ++i)
+            loop.bounds[i] = (eventCount * i) / runCount;
+
+        EdgeEvent *temp = alloc.allocate<EdgeEvent>(eventCount);
+        loop.source = eventStart;
+        loop.target = temp;
+        loop.width = 0;
+        parallelFor(loop, runCount);
+
+        for (loop.width = 1; loop.width < runCount; loop.width *= 2) {
+            parallelFor(loop, runCount / (2 * loop.width));
+            std::swap(loop.source, loop.target);
+        }
+
+        if (loop.source != eventStart)
+            memcpy(eventStart, loop.source, eventCount * sizeof(EdgeEvent));
+        alloc.release(temp);
+    }
+
+    /**
+     * \brief Append the edge events of a primitive (optionally clipped to
+     * the node bounds) to a list. Returns the new end of the list, which
+     * equals \c target when the primitive does not overlap the node.
+     */
+    inline EdgeEvent *appendEvents(const AABBType &nodeAABB, IndexType index,
+            EdgeEvent *target) const {
+        AABBType aabb;
+        if (m_clip) {
+            aabb = cast()->getClippedAABB(index, nodeAABB);
+            if (!aabb.isValid() || aabb.getSurfaceArea() == 0)
+                return target;
+        } else {
+            aabb = cast()->getAABB(index);
+        }
+
+        for (int axis=0; axis<PointType::dim; ++axis) {
+            float min = math::castflt_down(aabb.min[axis]),
+                  max = math::castflt_up(aabb.max[axis]);
+
+            if (min == max) {
+                *target++ = EdgeEvent(EdgeEvent::EEdgePlanar, axis,
+                        min, index);
+            } else {
+                *target++ = EdgeEvent(EdgeEvent::EEdgeStart, axis,
+                        min, index);
+                *target++ = EdgeEvent(EdgeEvent::EEdgeEnd, axis,
+                        max, index);
+            }
+        }
+        return target;
+    }
+
+    /**
+     * \brief Append the edge events of a primitive that was clipped to one
+     * of the children of a node during partitioning
+     */
+    static inline EdgeEvent *appendClippedEvents(const AABBType &clipped,
+            IndexType index, EdgeEvent *target) {
+        for (int axis=0; axis<PointType::dim; ++axis) {
+            float min = clipped.min[axis],
+                  max = clipped.max[axis];
+
+            if (min == max) {
+                *target++ = EdgeEvent(
+                        EdgeEvent::EEdgePlanar,
+                        axis, min, index);
+            } else {
+                *target++ = EdgeEvent(
+                        EdgeEvent::EEdgeStart,
+                        axis, min, index);
+                *target++ = EdgeEvent(
+                        EdgeEvent::EEdgeEnd,
+                        axis, max, index);
+            }
+        }
+        return target;
+    }
+
+    /// Parallel loop used by \ref createEventList()
+    struct EventCreationLoop : public ParallelLoop {
+        const GenericKDTree *tree;
+        const AABBType *nodeAABB;
+        const IndexType *prims;
+        SizeType primCount, chunkSize;
+        EdgeEvent *events;
+        std::vector<size_t> eventCount;
+        std::vector<SizeType> actualPrimCount;
+
+        void process(SizeType chunk) {
+            SizeType start = chunk * chunkSize,
+                     end = std::min(start + chunkSize, primCount),
+                     count = 0;
+            EdgeEvent *regionStart = events + (size_t) start * 2 * PointType::dim,
+                      *regionEnd = regionStart;
+
+            for (SizeType i=start; i<end; ++i) {
+                EdgeEvent *newEnd = tree->appendEvents(*nodeAABB, prims[i], regionEnd);
+                if (newEnd != regionEnd)
+                    ++count;
+                regionEnd = newEnd;
+            }
+            eventCount[chunk] = regionEnd - regionStart;
+            actualPrimCount[chunk] = count;
+        }
+    };
+
+    /// Parallel loop used for the min-max binning of large nodes
+    struct BinningLoop : public ParallelLoop {
+        const Derived *derived;
+        IndexType *indices;
+        SizeType primCount, chunkSize;
+        std::vector<MinMaxBins *> bins;
+
+        void process(SizeType chunk) {
+            SizeType start = chunk * chunkSize,
+                     end = std::min(start + chunkSize, primCount);
+            bins[chunk]->bin(derived, indices + start, end - start);
+        }
+    };
+
+    /// Parallel loop that searches the split candidates of each axis separately
+    struct SplitSearchLoop : public ParallelLoop {
+        const GenericKDTree *tree;
+        const AABBType *nodeAABB;
+        EdgeEvent **eventsByAxis, *eventEnd;
+        SizeType primCount;
+        SplitCandidate candidates[PointType::dim];
+
+        void process(SizeType axis) {
+            EdgeEvent *start = eventsByAxis[axis],
+                      *end = axis + 1 < PointType::dim ? eventsByAxis[axis+1] : eventEnd;
+            if (start < end)
+                tree->sweepEvents(*nodeAABB, start, end, primCount,
+                    candidates[axis], NULL);
+        }
+    };
+
+    /**
+     * \brief Parallel loop that classifies the primitives of a large node
+     * with respect to the split plane
+     *
+     * The first pass marks all primitives as straddling, and the second
+     * one moves them to the left or right side where possible.
+     */
+    struct ClassificationLoop : public ParallelLoop {
+        ClassificationStorage *storage;
+        const EdgeEvent *eventStart, *eventEnd;
+        const SplitCandidate *split;
+        size_t chunkSize;
+        bool initialize;
+        std::vector<SizeType> primsLeft, primsRight;
+
+        void process(SizeType chunk) {
+            const EdgeEvent *start = eventStart + chunk * chunkSize,
+                            *end = std::min(start + chunkSize, eventEnd);
+            if (initialize) {
+                for (const EdgeEvent *event = start; event < end; ++event)
+                    storage->setAtomic(event->index, EBothSides);
+                return;
+            }
+
+            SizeType left = 0, right = 0;
+            for (const EdgeEvent *event = start; event < end; ++event) {
+                if (event->type == EdgeEvent::EEdgeEnd && event->pos <= split->pos) {
+                    storage->setAtomic(event->index, ELeftSide);
+                    left++;
+                } else if (event->type == EdgeEvent::EEdgeStart
+                        && event->pos >= split->pos) {
+                    storage->setAtomic(event->index, ERightSide);
+                    right++;
+                } else if (event->type == EdgeEvent::EEdgePlanar) {
+                    if (event->pos < split->pos || (event->pos == split->pos
+                            && split->planarLeft)) {
+                        storage->setAtomic(event->index, ELeftSide);
+                        left++;
+                    } else {
+                        storage->setAtomic(event->index, ERightSide);
+                        right++;
+                    }
+                }
+            }
+            primsLeft[chunk] = left;
+            primsRight[chunk] = right;
+        }
+    };
+
+    /**
+     * \brief Parallel loop that distributes the edge events of a large node
+     * over the two children. The first pass counts the events of each
+     * chunk, and the second pass writes them to the precomputed offsets.
+     * Events of straddling primitives are only copied when clipping is
+     * disabled.
+     */
+    struct ScatterLoop : public ParallelLoop {
+        const ClassificationStorage *storage;
+        const EdgeEvent *eventStart, *eventEnd;
+        size_t chunkSize;
+        bool clip, write;
+        EdgeEvent *left, *right;
+        std::vector<size_t> leftOffset, rightOffset;
+
+        void process(SizeType chunk) {
+            const EdgeEvent *start = eventStart + chunk * chunkSize,
+                            *end = std::min(start + chunkSize, eventEnd);
+
+            if (!write) {
+                size_t leftCount = 0, rightCount = 0;
+                for (const EdgeEvent *event = start; event < end; ++event) {
+                    int classification = storage->get(event->index);
+                    if (classification == ELeftSide) {
+                        leftCount++;
+                    } else if (classification == ERightSide) {
+                        rightCount++;
+                    } else if (!clip) {
+                        leftCount++;
+                        rightCount++;
+                    }
+                }
+                leftOffset[chunk] = leftCount;
+                rightOffset[chunk] = rightCount;
+            } else {
+                EdgeEvent *leftEnd = left + leftOffset[chunk],
+                          *rightEnd = right + rightOffset[chunk];
+                for (const EdgeEvent *event = start; event < end; ++event) {
+                    int classification = storage->get(event->index);
+                    if (classification == ELeftSide) {
+                        *leftEnd++ = *event;
+                    } else if (classification == ERightSide) {
+                        *rightEnd++ = *event;
+                    } else if (!clip) {
+                        *leftEnd++ = *event;
+                        *rightEnd++ = *event;
+                    }
+                }
+            }
+        }
+    };
+
+    /**
+     * \brief Parallel loop that clips the straddling primitives of a large
+     * node to both children. It visits the events of the split axis, on
+     * which every primitive has exactly one start or planar event. The
+     * first pass counts the straddling primitives of each chunk, and the
+     * second pass writes their new events to separate regions.
+     */
+    struct ClippingLoop : public ParallelLoop {
+        const Derived *derived;
+        const ClassificationStorage *storage;
+        const EdgeEvent *eventStart, *eventEnd;
+        const AABBType *leftNodeAABB, *rightNodeAABB;
+        size_t chunkSize;
+        bool write;
+        EdgeEvent *left, *right;
+        std::vector<size_t> offset, leftCount, rightCount;
+        std::vector<SizeType> prunedLeft, prunedRight;
+
+        void process(SizeType chunk) {
+            const EdgeEvent *start = eventStart + chunk * chunkSize,
+                            *end = std::min(start + chunkSize, eventEnd);
+
+            if (!write) {
+                size_t count = 0;
+                for (const EdgeEvent *event = start; event < end; ++event) {
+                    if (event->type != EdgeEvent::EEdgeEnd &&
+                        storage->get(event->index) == EBothSides)
+                        count++;
+                }
+                offset[chunk] = count;
+                return;
+            }
+
+            EdgeEvent *leftStart = left + offset[chunk] * 2 * PointType::dim,
+                      *rightStart = right + offset[chunk] * 2 * PointType::dim,
+                      *leftEnd = leftStart, *rightEnd = rightStart;
+            SizeType numPrunedLeft = 0, numPrunedRight = 0;
+
+            for (const EdgeEvent *event = start; event < end; ++event) {
+                if (event->type == EdgeEvent::EEdgeEnd ||
+                    storage->get(event->index) != EBothSides)
+                    continue;
+
+                const IndexType index = event->index;
+                AABBType clippedLeft = derived->getClippedAABB(index, *leftNodeAABB);
+                AABBType clippedRight = derived->getClippedAABB(index, *rightNodeAABB);
+
+                if (clippedLeft.isValid() && clippedLeft.getSurfaceArea() > 0)
+                    leftEnd = appendClippedEvents(clippedLeft, index, leftEnd);
+                else
+                    numPrunedLeft++;
+
+                if (clippedRight.isValid() && clippedRight.getSurfaceArea() > 0)
+                    rightEnd = appendClippedEvents(clippedRight, index, rightEnd);
+                else
+                    numPrunedRight++;
+            }
+
+            leftCount[chunk] = leftEnd - leftStart;
+            rightCount[chunk] = rightEnd - rightStart;
+            prunedLeft[chunk] = numPrunedLeft;
+            prunedRight[chunk] = numPrunedRight;
+        }
+    };
+
+    /// Turn per-chunk counts into offsets and return the total
+    static size_t exclusiveScan(std::vector<size_t> &values) {
+        size_t sum = 0;
+        for (size_t i=0; i<values.size(); ++i) {
+            size_t value = values[i];
+            values[i] = sum;
+            sum += value;
+        }
+        return sum;
+    }
+
     struct EventList {
         EdgeEvent *start, *end;
         SizeType primCount;
@@ -1555,32 +2246,34 @@ protected:
         EdgeEvent *eventStart = alloc.allocate<EdgeEvent>(initialSize);
         EdgeEvent *eventEnd = eventStart;
 
-        for (SizeType i=0; i<primCount; ++i) {
-            IndexType index = prims[i];
-            AABBType aabb;
-            if (m_clip) {
-                aabb = cast()->getClippedAABB(index, nodeAABB);
-                if (!aabb.isValid() || aabb.getSurfaceArea() == 0)
-                    continue;
-            } else {
-                aabb = cast()->getAABB(index);
+        if (isLargeNode(initialSize)) {
+            /* Every chunk writes to its own region, which are compacted afterwards */
+            EventCreationLoop loop;
+            loop.tree = this;
+            loop.nodeAABB = &nodeAABB;
+            loop.prims = prims;
+            loop.primCount = primCount;
+            loop.events = eventStart;
+            SizeType chunkCount = getChunkCount(primCount);
+            loop.chunkSize = (primCount + chunkCount - 1) / chunkCount;
+            loop.eventCount.resize(chunkCount);
+            loop.actualPrimCount.resize(chunkCount);
+            parallelFor(loop, chunkCount);
+
+            for (SizeType i=0; i<chunkCount; ++i) {
+                const EdgeEvent *region = eventStart + (size_t) i * loop.chunkSize * 2 * PointType::dim;
+                if (region != eventEnd)
+                    memmove(eventEnd, region, loop.eventCount[i] * sizeof(EdgeEvent));
+                eventEnd += loop.eventCount[i];
+                actualPrimCount += loop.actualPrimCount[i];
             }
-
-            for (int axis=0; axis<PointType::dim; ++axis) {
-                float min = math::castflt_down(aabb.min[axis]),
-                      max = math::castflt_up(aabb.max[axis]);
-
-                if (min == max) {
-                    *eventEnd++ = EdgeEvent(EdgeEvent::EEdgePlanar, axis,
-                            min, index);
-                } else {
-                    *eventEnd++ = EdgeEvent(EdgeEvent::EEdgeStart, axis,
-                            min, index);
-                    *eventEnd++ = EdgeEvent(EdgeEvent::EEdgeEnd, axis,
-                            max, index);
-                }
+        } else {
+            for (SizeType i=0; i<primCount; ++i) {
+                EdgeEvent *newEnd = appendEvents(nodeAABB, prims[i], eventEnd);
+                if (newEnd != eventEnd)
+                    ++actualPrimCount;
+                eventEnd = newEnd;
             }
-            ++actualPrimCount;
         }
 
         SizeType newSize = (SizeType) (eventEnd - eventStart);
@@ -1732,30 +2425,10 @@ protected:
         OrderedChunkAllocator &alloc = isLeftChild
                 ? ctx.leftAlloc : ctx.rightAlloc;
         EventList events = createEventList(alloc, nodeAABB, indices, primCount);
-        Float cost;
-        if (m_parallelBuild) {
-            LockGuard lock(m_interface.mutex);
-            m_interface.depth = depth;
-            m_interface.node = node;
-            m_interface.nodeAABB = nodeAABB;
-            m_interface.eventStart = events.start;
-            m_interface.eventEnd = events.end;
-            m_interface.primCount = events.primCount;
-            m_interface.badRefines = badRefines;
-            m_interface.cond->signal();
-
-            /* Wait for a worker thread to take this job */
-            while (m_interface.node)
-                m_interface.condJobTaken->wait();
-
-            // Never tear down this subtree (return a cost of -infinity)
-            cost = -std::numeric_limits<Float>::infinity();
-        } else {
-            std::sort(events.start, events.end, EdgeEventOrdering());
+        sortEvents(alloc, events.start, events.end);
 
-            cost = buildTree(ctx, depth, node, nodeAABB, events.start,
-                events.end, events.primCount, isLeftChild, badRefines);
-        }
+        Float cost = buildTree(ctx, depth, node, nodeAABB, events.start,
+            events.end, events.primCount, isLeftChild, badRefines);
         alloc.release(events.start);
         return cost;
     }
@@ -1809,7 +2482,28 @@ protected:
         /* ==================================================================== */
 
         ctx.minMaxBins.setAABB(tightAABB);
-        ctx.minMaxBins.bin(cast(), indices, primCount);
+        if (isLargeNode((size_t) primCount * 2 * PointType::dim)) {
+            BinningLoop loop;
+            loop.derived = cast();
+            loop.indices = indices;
+            loop.primCount = primCount;
+            SizeType chunkCount = getChunkCount(primCount);
+            loop.chunkSize = (primCount + chunkCount - 1) / chunkCount;
+            loop.bins.resize(chunkCount);
+            for (SizeType i=0; i<chunkCount; ++i) {
+                loop.bins[i] = new MinMaxBins(m_minMaxBins);
+                loop.bins[i]->setAABB(tightAABB);
+            }
+            parallelFor(loop, chunkCount);
+
+            ctx.minMaxBins.reset();
+            for (SizeType i=0; i<chunkCount; ++i) {
+                ctx.minMaxBins.accumulate(*loop.bins[i]);
+                delete loop.bins[i];
+            }
+        } else {
+            ctx.minMaxBins.bin(cast(), indices, primCount);
+        }
 
         /* ==================================================================== */
         /*                        Split candidate search                        */
@@ -1876,7 +2570,12 @@ protected:
         AABBType childAABB(nodeAABB);
         childAABB.max[bestSplit.axis] = bestSplit.pos;
 
-        Float leftCost = buildTreeMinMax(ctx, depth+1, children,
+        Float leftCost;
+        if (spawnJob(depth+1, children, childAABB, partition.left,
+                partition.leftIndices, NULL, NULL, bestSplit.numLeft, badRefines))
+            leftCost = -std::numeric_limits<Float>::infinity();
+        else
+            leftCost = buildTreeMinMax(ctx, depth+1, children,
                 childAABB, partition.left, partition.leftIndices,
                 bestSplit.numLeft, true, badRefines);
 
@@ -1894,8 +2593,7 @@ protected:
 
         /* Compute the final cost given the updated cost
            values received from the children */
-        Float finalCost = m_traversalCost +
-            (prob.first * leftCost + prob.second * rightCost);
+        Float finalCost = combineCosts(prob, leftCost, rightCost);
 
         /* Release the index lists not needed by the children anymore */
         if (isLeftChild)
@@ -1922,55 +2620,17 @@ protected:
         }
     }
 
-    /*
-     * \brief Build helper function (greedy O(n log n) optimization)
+    /**
+     * \brief Sweep over a sorted edge event list and find the best split
+     * candidate according to the tree construction heuristic
      *
-     * \param ctx
-     *     Thread-specific build context containing allocators etc.
-     * \param depth
-     *     Current tree depth (1 == root node)
-     * \param node
-     *     KD-tree node entry to be filled
-     * \param nodeAABB
-     *     Axis-aligned bounding box of the current node
-     * \param eventStart
-     *     Pointer to the beginning of a sorted edge event list
-     * \param eventEnd
-     *     Pointer to the end of a sorted edge event list
-     * \param primCount
-     *     Total primitive count for the current node
-     * \param isLeftChild
-     *     Is this node the left child of its parent? This is important for
-     *     memory management using the \ref OrderedChunkAllocator.
-     * \param badRefines
-     *     Number of "probable bad refines" further up the tree. This makes
-     *     it possible to split along an initially bad-looking candidate in
-     *     the hope that the cost was significantly overestimated. The
-     *     counter makes sure that only a limited number of such splits can
-     *     happen in succession.
-     * \returns
-     *     Final cost of the node
+     * The list can also be restricted to the events of a single axis.
+     * When \c eventsByAxis is not \c NULL, it receives the position where
+     * the events of each axis begin.
      */
-    Float buildTree(BuildContext &ctx, unsigned int depth, KDNode *node,
-        const AABBType &nodeAABB, EdgeEvent *eventStart, EdgeEvent *eventEnd,
-        SizeType primCount, bool isLeftChild, SizeType badRefines) {
-
-        Float leafCost = primCount * m_queryCost;
-        if (primCount <= m_stopPrims || depth >= m_maxDepth) {
-            createLeaf(ctx, node, eventStart, eventEnd, primCount);
-            return leafCost;
-        }
-
-        SplitCandidate bestSplit;
-
-        /* ==================================================================== */
-        /*                        Split candidate search                        */
-        /* ==================================================================== */
-
-        /* First, find the optimal splitting plane according to the
-           tree construction heuristic. To do this in O(n), the search is
-           implemented as a sweep over the edge events */
-
+    void sweepEvents(const AABBType &nodeAABB, EdgeEvent *eventStart,
+            EdgeEvent *eventEnd, SizeType primCount, SplitCandidate &bestSplit,
+            EdgeEvent **eventsByAxis) const {
         /* Initially, the split plane is placed left of the scene
            and thus all geometry is on its right side */
         SizeType numLeft[PointType::dim],
@@ -1981,9 +2641,9 @@ protected:
             numRight[i] = primCount;
         }
 
-        EdgeEvent *eventsByAxis[PointType::dim];
         int eventsByAxisCtr = 1;
-        eventsByAxis[0] = eventStart;
+        if (eventsByAxis)
+            eventsByAxis[0] = eventStart;
         TreeConstructionHeuristic tch(nodeAABB);
 
         /* Iterate over all events on the current axis */
@@ -2018,7 +2678,7 @@ protected:
             }
 
             /* Keep track of the beginning of dimensions */
-            if (event < eventEnd && event->axis != axis) {
+            if (eventsByAxis && event < eventEnd && event->axis != axis) {
                 KDAssert(eventsByAxisCtr < PointType::dim);
                 eventsByAxis[eventsByAxisCtr++] = event;
             }
@@ -2096,8 +2756,222 @@ protected:
 
 #if defined(MTS_KD_DEBUG)
         /* Sanity checks. Everything should now be left of the split plane */
-        for (int i=0; i<PointType::dim; ++i)
+        for (int i=eventStart->axis; i<=(eventEnd-1)->axis; ++i)
             KDAssert(numRight[i] == 0 && numLeft[i] == primCount);
+#endif
+    }
+
+    /**
+     * \brief Compute the final cost of an inner node from the costs
+     * of its children. A subtree that was built by another thread has
+     * a cost of -infinity, which is passed on to the ancestors so that
+     * none of them is ever torn down again.
+     */
+    inline Float combineCosts(const std::pair<Float, Float> &prob,
+            Float leftCost, Float rightCost) const {
+        const Float minusInf = -std::numeric_limits<Float>::infinity();
+        if (leftCost == minusInf || rightCost == minusInf)
+            return minusInf;
+        return m_traversalCost + (prob.first * leftCost + prob.second * rightCost);
+    }
+
+    /**
+     * \brief Partitioning step of \ref buildTree() for large nodes
+     *
+     * The events of primitives that only overlap one of the children are
+     * first scattered to temporary lists in parallel. When clipping is
+     * enabled, the straddling primitives are then clipped in parallel, and
+     * the resulting events are sorted and merged with the temporary lists.
+     */
+    void partitionParallel(BuildContext &ctx, EdgeEvent *eventStart,
+            EdgeEvent *eventEnd, EdgeEvent *splitAxisStart,
+            EdgeEvent *splitAxisEnd, const AABBType &leftNodeAABB,
+            const AABBType &rightNodeAABB, const SplitCandidate &bestSplit,
+            SizeType primsLeft, SizeType primsRight, SizeType primsBoth,
+            EdgeEvent *leftEventsStart, EdgeEvent *&leftEventsEnd,
+            EdgeEvent *rightEventsStart, EdgeEvent *&rightEventsEnd,
+            SizeType &prunedLeft, SizeType &prunedRight) {
+        OrderedChunkAllocator &leftAlloc = ctx.leftAlloc,
+            &rightAlloc = ctx.rightAlloc;
+        const size_t eventsPerPrim = 2 * PointType::dim;
+
+        /* The target lists may alias the input, hence the events are
+           first scattered to temporary storage */
+        EdgeEvent
+            *leftTemp = leftAlloc.allocate<EdgeEvent>(eventsPerPrim *
+                (m_clip ? primsLeft : bestSplit.numLeft)),
+            *rightTemp = rightAlloc.allocate<EdgeEvent>(eventsPerPrim *
+                (m_clip ? primsRight : bestSplit.numRight));
+
+        ScatterLoop scatter;
+        SizeType chunkCount = getChunkCount(eventEnd - eventStart);
+        scatter.storage = &ctx.classStorage;
+        scatter.eventStart = eventStart;
+        scatter.eventEnd = eventEnd;
+        scatter.chunkSize = ((eventEnd - eventStart) + chunkCount - 1) / chunkCount;
+        scatter.clip = m_clip;
+        scatter.left = leftTemp;
+        scatter.right = rightTemp;
+        scatter.leftOffset.resize(chunkCount);
+        scatter.rightOffset.resize(chunkCount);
+        scatter.write = false;
+        parallelFor(scatter, chunkCount);
+        size_t leftTempCount = exclusiveScan(scatter.leftOffset),
+               rightTempCount = exclusiveScan(scatter.rightOffset);
+        scatter.write = true;
+        parallelFor(scatter, chunkCount);
+
+        if (!m_clip) {
+            KDAssert(leftTempCount <= bestSplit.numLeft * eventsPerPrim);
+            KDAssert(rightTempCount <= bestSplit.numRight * eventsPerPrim);
+            memcpy(leftEventsStart, leftTemp, leftTempCount * sizeof(EdgeEvent));
+            memcpy(rightEventsStart, rightTemp, rightTempCount * sizeof(EdgeEvent));
+            leftEventsEnd = leftEventsStart + leftTempCount;
+            rightEventsEnd = rightEventsStart + rightTempCount;
+            rightAlloc.release(rightTemp);
+            leftAlloc.release(leftTemp);
+            return;
+        }
+
+        KDAssert(leftTempCount <= primsLeft * eventsPerPrim);
+        KDAssert(rightTempCount <= primsRight * eventsPerPrim);
+
+        ClippingLoop clipping;
+        chunkCount = getChunkCount(splitAxisEnd - splitAxisStart);
+        clipping.derived = cast();
+        clipping.storage = &ctx.classStorage;
+        clipping.eventStart = splitAxisStart;
+        clipping.eventEnd = splitAxisEnd;
+        clipping.leftNodeAABB = &leftNodeAABB;
+        clipping.rightNodeAABB = &rightNodeAABB;
+        clipping.chunkSize = ((splitAxisEnd - splitAxisStart) + chunkCount - 1) / chunkCount;
+        clipping.offset.resize(chunkCount);
+        clipping.leftCount.resize(chunkCount);
+        clipping.rightCount.resize(chunkCount);
+        clipping.prunedLeft.resize(chunkCount);
+        clipping.prunedRight.resize(chunkCount);
+        clipping.write = false;
+        parallelFor(clipping, chunkCount);
+        size_t straddling = exclusiveScan(clipping.offset);
+        KDAssert(straddling == primsBoth);
+
+        EdgeEvent
+            *newEventsLeftStart = leftAlloc.allocate<EdgeEvent>(straddling * eventsPerPrim),
+            *newEventsRightStart = rightAlloc.allocate<EdgeEvent>(straddling * eventsPerPrim),
+            *newEventsLeftEnd = newEventsLeftStart,
+            *newEventsRightEnd = newEventsRightStart;
+        clipping.left = newEventsLeftStart;
+        clipping.right = newEventsRightStart;
+        clipping.write = true;
+        parallelFor(clipping, chunkCount);
+
+        /* Compact the regions written by the individual chunks */
+        for (SizeType i=0; i<chunkCount; ++i) {
+            memmove(newEventsLeftEnd, newEventsLeftStart + clipping.offset[i] * eventsPerPrim,
+                clipping.leftCount[i] * sizeof(EdgeEvent));
+            memmove(newEventsRightEnd, newEventsRightStart + clipping.offset[i] * eventsPerPrim,
+                clipping.rightCount[i] * sizeof(EdgeEvent));
+            newEventsLeftEnd += clipping.leftCount[i];
+            newEventsRightEnd += clipping.rightCount[i];
+            prunedLeft += clipping.prunedLeft[i];
+            prunedRight += clipping.prunedRight[i];
+        }
+        ctx.pruned += prunedLeft + prunedRight;
+
+        /* Sort the events from overlapping prims */
+        sortEvents(leftAlloc, newEventsLeftStart, newEventsLeftEnd);
+        sortEvents(rightAlloc, newEventsRightStart, newEventsRightEnd);
+
+        /* Merge the left and right lists */
+        leftEventsEnd = std::merge(leftTemp, leftTemp + leftTempCount,
+            newEventsLeftStart, newEventsLeftEnd, leftEventsStart,
+            EdgeEventOrdering());
+        rightEventsEnd = std::merge(rightTemp, rightTemp + rightTempCount,
+            newEventsRightStart, newEventsRightEnd, rightEventsStart,
+            EdgeEventOrdering());
+
+        /* Release temporary memory */
+        leftAlloc.release(newEventsLeftStart);
+        leftAlloc.release(leftTemp);
+        rightAlloc.release(newEventsRightStart);
+        rightAlloc.release(rightTemp);
+    }
+
+    /*
+     * \brief Build helper function (greedy O(n log n) optimization)
+     *
+     * \param ctx
+     *     Thread-specific build context containing allocators etc.
+     * \param depth
+     *     Current tree depth (1 == root node)
+     * \param node
+     *     KD-tree node entry to be filled
+     * \param nodeAABB
+     *     Axis-aligned bounding box of the current node
+     * \param eventStart
+     *     Pointer to the beginning of a sorted edge event list
+     * \param eventEnd
+     *     Pointer to the end of a sorted edge event list
+     * \param primCount
+     *     Total primitive count for the current node
+     * \param isLeftChild
+     *     Is this node the left child of its parent? This is important for
+     *     memory management using the \ref OrderedChunkAllocator.
+     * \param badRefines
+     *     Number of "probable bad refines" further up the tree. This makes
+     *     it possible to split along an initially bad-looking candidate in
+     *     the hope that the cost was significantly overestimated. The
+     *     counter makes sure that only a limited number of such splits can
+     *     happen in succession.
+     * \returns
+     *     Final cost of the node
+     */
+    Float buildTree(BuildContext &ctx, unsigned int depth, KDNode *node,
+        const AABBType &nodeAABB, EdgeEvent *eventStart, EdgeEvent *eventEnd,
+        SizeType primCount, bool isLeftChild, SizeType badRefines) {
+
+        Float leafCost = primCount * m_queryCost;
+        if (primCount <= m_stopPrims || depth >= m_maxDepth) {
+            createLeaf(ctx, node, eventStart, eventEnd, primCount);
+            return leafCost;
+        }
+
+        SplitCandidate bestSplit;
+        EdgeEvent *eventsByAxis[PointType::dim];
+        TreeConstructionHeuristic tch(nodeAABB);
+        bool parallel = isLargeNode(eventEnd - eventStart);
+
+        /* ==================================================================== */
+        /*                        Split candidate search                        */
+        /* ==================================================================== */
+
+        /* First, find the optimal splitting plane according to the
+           tree construction heuristic. To do this in O(n), the search is
+           implemented as a sweep over the edge events */
+        if (parallel) {
+            /* Large node: sweep over the different axes in parallel */
+            for (int axis=0; axis<PointType::dim; ++axis)
+                eventsByAxis[axis] = std::lower_bound(eventStart, eventEnd,
+                    axis, EdgeEventAxisOrdering());
+
+            SplitSearchLoop loop;
+            loop.tree = this;
+            loop.nodeAABB = &nodeAABB;
+            loop.eventsByAxis = eventsByAxis;
+            loop.eventEnd = eventEnd;
+            loop.primCount = primCount;
+            parallelFor(loop, PointType::dim);
+
+            for (int axis=0; axis<PointType::dim; ++axis) {
+                if (loop.candidates[axis].cost < bestSplit.cost)
+                    bestSplit = loop.candidates[axis];
+            }
+        } else {
+            sweepEvents(nodeAABB, eventStart, eventEnd, primCount,
+                bestSplit, eventsByAxis);
+        }
+
+#if defined(MTS_KD_DEBUG)
         for (int i=1; i<PointType::dim; ++i)
             KDAssert(eventsByAxis[i]->axis == i && (eventsByAxis[i]-1)->axis == i-1);
 #endif
@@ -2118,48 +2992,76 @@ protected:
         /* ==================================================================== */
 
         ClassificationStorage &storage = ctx.classStorage;
-
-        /* Initially mark all prims as being located on both sides */
-        for (EdgeEvent *event = eventsByAxis[bestSplit.axis];
-             event < eventEnd && event->axis == bestSplit.axis; ++event)
-            storage.set(event->index, EBothSides);
-
         SizeType primsLeft = 0, primsRight = 0, primsBoth = primCount;
-        /* Sweep over all edge events and classify the primitives wrt. the split */
-        for (EdgeEvent *event = eventsByAxis[bestSplit.axis];
-             event < eventEnd && event->axis == bestSplit.axis; ++event) {
-            if (event->type == EdgeEvent::EEdgeEnd && event->pos <= bestSplit.pos) {
-                /* The primitive's interval ends before or on the split plane
-                   -> classify to the left side */
-                KDAssert(storage.get(event->index) == EBothSides);
-                storage.set(event->index, ELeftSide);
-                primsBoth--;
-                primsLeft++;
-            } else if (event->type == EdgeEvent::EEdgeStart
-                    && event->pos >= bestSplit.pos) {
-                /* The primitive's interval starts after or on the split plane
-                   -> classify to the right side */
-                KDAssert(storage.get(event->index) == EBothSides);
-                storage.set(event->index, ERightSide);
-                primsBoth--;
-                primsRight++;
-            } else if (event->type == EdgeEvent::EEdgePlanar) {
-                /* If the planar primitive is not on the split plane, the
-                   classification is easy. Otherwise, place it on the side with
-                   the lower cost */
-                KDAssert(storage.get(event->index) == EBothSides);
-                if (event->pos < bestSplit.pos || (event->pos == bestSplit.pos
-                        && bestSplit.planarLeft)) {
+        EdgeEvent *splitAxisStart = eventsByAxis[bestSplit.axis],
+                  *splitAxisEnd = eventEnd;
+        if (bestSplit.axis + 1 < PointType::dim && parallel)
+            splitAxisEnd = eventsByAxis[bestSplit.axis + 1];
+
+        if (parallel) {
+            ClassificationLoop loop;
+            SizeType chunkCount = getChunkCount(splitAxisEnd - splitAxisStart);
+            loop.storage = &storage;
+            loop.eventStart = splitAxisStart;
+            loop.eventEnd = splitAxisEnd;
+            loop.split = &bestSplit;
+            loop.chunkSize = ((splitAxisEnd - splitAxisStart) + chunkCount - 1) / chunkCount;
+            loop.primsLeft.resize(chunkCount);
+            loop.primsRight.resize(chunkCount);
+
+            /* The second pass may only start once all prims are marked */
+            loop.initialize = true;
+            parallelFor(loop, chunkCount);
+            loop.initialize = false;
+            parallelFor(loop, chunkCount);
+
+            for (SizeType i=0; i<chunkCount; ++i) {
+                primsLeft += loop.primsLeft[i];
+                primsRight += loop.primsRight[i];
+            }
+            primsBoth -= primsLeft + primsRight;
+        } else {
+            /* Initially mark all prims as being located on both sides */
+            for (EdgeEvent *event = eventsByAxis[bestSplit.axis];
+                 event < eventEnd && event->axis == bestSplit.axis; ++event)
+                storage.set(event->index, EBothSides);
+
+            /* Sweep over all edge events and classify the primitives wrt. the split */
+            for (EdgeEvent *event = eventsByAxis[bestSplit.axis];
+                 event < eventEnd && event->axis == bestSplit.axis; ++event) {
+                if (event->type == EdgeEvent::EEdgeEnd && event->pos <= bestSplit.pos) {
+                    /* The primitive's interval ends before or on the split plane
+                       -> classify to the left side */
+                    KDAssert(storage.get(event->index) == EBothSides);
                     storage.set(event->index, ELeftSide);
                     primsBoth--;
                     primsLeft++;
-                } else if (event->pos > bestSplit.pos
-                       || (event->pos == bestSplit.pos && !bestSplit.planarLeft)) {
+                } else if (event->type == EdgeEvent::EEdgeStart
+                        && event->pos >= bestSplit.pos) {
+                    /* The primitive's interval starts after or on the split plane
+                       -> classify to the right side */
+                    KDAssert(storage.get(event->index) == EBothSides);
                     storage.set(event->index, ERightSide);
                     primsBoth--;
                     primsRight++;
-                } else {
-                    KDAssertEx(false, "Internal error!");
+                } else if (event->type == EdgeEvent::EEdgePlanar) {
+                    /* If the planar primitive is not on the split plane, the
+                       classification is easy. Otherwise, place it on the side with
+                       the lower cost */
+                    KDAssert(storage.get(event->index) == EBothSides);
+                    if (event->pos < bestSplit.pos || (event->pos == bestSplit.pos
+                            && bestSplit.planarLeft)) {
+                        storage.set(event->index, ELeftSide);
+                        primsBoth--;
+                        primsLeft++;
+                    } else if (event->pos > bestSplit.pos
+                           || (event->pos == bestSplit.pos && !bestSplit.planarLeft)) {
+                        storage.set(event->index, ERightSide);
+                        primsBoth--;
+                        primsRight++;
+                    } else {
+                        KDAssertEx(false, "Internal error!");
+                    }
                 }
             }
         }
@@ -2193,7 +3095,13 @@ protected:
         /*                            Partitioning                              */
         /* ==================================================================== */
 
-        if (m_clip) {
+        if (parallel) {
+            partitionParallel(ctx, eventStart, eventEnd, splitAxisStart,
+                splitAxisEnd, leftNodeAABB, rightNodeAABB, bestSplit,
+                primsLeft, primsRight, primsBoth, leftEventsStart,
+                leftEventsEnd, rightEventsStart, rightEventsEnd,
+                prunedLeft, prunedRight);
+        } else if (m_clip) {
             EdgeEvent
               *leftEventsTempStart = leftAlloc.allocate<EdgeEvent>(primsLeft * 2 * PointType::dim),
               *rightEventsTempStart = rightAlloc.allocate<EdgeEvent>(primsRight * 2 * PointType::dim),
@@ -2225,49 +3133,17 @@ protected:
                     KDAssert(leftNodeAABB.contains(clippedLeft));
                     KDAssert(rightNodeAABB.contains(clippedRight));
 
-                    if (clippedLeft.isValid() && clippedLeft.getSurfaceArea() > 0) {
-                        for (int axis=0; axis<PointType::dim; ++axis) {
-                            float min = clippedLeft.min[axis],
-                                  max = clippedLeft.max[axis];
-
-                            if (min == max) {
-                                *newEventsLeftEnd++ = EdgeEvent(
-                                        EdgeEvent::EEdgePlanar,
-                                        axis, min, index);
-                            } else {
-                                *newEventsLeftEnd++ = EdgeEvent(
-                                        EdgeEvent::EEdgeStart,
-                                        axis, min, index);
-                                *newEventsLeftEnd++ = EdgeEvent(
-                                        EdgeEvent::EEdgeEnd,
-                                        axis, max, index);
-                            }
-                        }
-                    } else {
+                    if (clippedLeft.isValid() && clippedLeft.getSurfaceArea() > 0)
+                        newEventsLeftEnd = appendClippedEvents(clippedLeft,
+                            index, newEventsLeftEnd);
+                    else
                         prunedLeft++;
-                    }
 
-                    if (clippedRight.isValid() && clippedRight.getSurfaceArea() > 0) {
-                        for (int axis=0; axis<PointType::dim; ++axis) {
-                            float min = clippedRight.min[axis],
-                                  max = clippedRight.max[axis];
-
-                            if (min == max) {
-                                *newEventsRightEnd++ = EdgeEvent(
-                                        EdgeEvent::EEdgePlanar,
-                                        axis, min, index);
-                            } else {
-                                *newEventsRightEnd++ = EdgeEvent(
-                                        EdgeEvent::EEdgeStart,
-                                        axis, min, index);
-                                *newEventsRightEnd++ = EdgeEvent(
-                                        EdgeEvent::EEdgeEnd,
-                                        axis, max, index);
-                            }
-                        }
-                    } else {
+                    if (clippedRight.isValid() && clippedRight.getSurfaceArea() > 0)
+                        newEventsRightEnd = appendClippedEvents(clippedRight,
+                            index, newEventsRightEnd);
+                    else
                         prunedRight++;
-                    }
 
                     /* Mark this primitive as processed so that clipping
                         is only done once */
@@ -2352,7 +3228,13 @@ protected:
         }
         ctx.innerNodeCount++;
 
-        Float leftCost = buildTree(ctx, depth+1, children,
+        Float leftCost;
+        if (spawnJob(depth+1, children, leftNodeAABB, leftNodeAABB, NULL,
+                leftEventsStart, leftEventsEnd, bestSplit.numLeft - prunedLeft,
+                badRefines))
+            leftCost = -std::numeric_limits<Float>::infinity();
+        else
+            leftCost = buildTree(ctx, depth+1, children,
                 leftNodeAABB, leftEventsStart, leftEventsEnd,
                 bestSplit.numLeft - prunedLeft, true, badRefines);
 
@@ -2366,8 +3248,7 @@ protected:
 
         /* Compute the final cost given the updated cost
            values received from the children */
-        Float finalCost = m_traversalCost +
-            (prob.first * leftCost + prob.second * rightCost);
+        Float finalCost = combineCosts(prob, leftCost, rightCost);
 
         /* Release the index lists not needed by the children anymore */
         if (isLeftChild)
@@ -2433,6 +3314,26 @@ protected:
             return (IndexType) std::min((float) (m_binCount-1), std::max(0.0f, (pos - m_min[axis]) * m_invBinSize[axis]));
         }
 
+        /// Clear all bins
+        void reset() {
+            m_primCount = 0;
+            memset(m_minBins, 0, sizeof(SizeType) * PointType::dim * m_binCount);
+            memset(m_maxBins, 0, sizeof(SizeType) * PointType::dim * m_binCount);
+        }
+
+        /**
+         * \brief Add the bin counts of another instance, which must
+         * have been set up with the same bounds
+         */
+        void accumulate(const MinMaxBins &other) {
+            KDAssert(other.m_binCount == m_binCount);
+            m_primCount += other.m_primCount;
+            for (int i=0; i<m_binCount * PointType::dim; ++i) {
+                m_minBins[i] += other.m_minBins[i];
+                m_maxBins[i] += other.m_maxBins[i];
+            }
+        }
+
         /**
          * \brief Run min-max binning
          *
@@ -2443,9 +3344,8 @@ protected:
          */
         void bin(const Derived *derived, IndexType *indices,
                 SizeType primCount) {
+            reset();
             m_primCount = primCount;
-            memset(m_minBins, 0, sizeof(SizeType) * PointType::dim * m_binCount);
-            memset(m_maxBins, 0, sizeof(SizeType) * PointType::dim * m_binCount);
 
             for (SizeType i=0; i<m_primCount; ++i) {
                 const AABBType aabb = derived->getAABB(indices[i]);
@@ -2591,11 +3491,70 @@ protected:
     };
 
 protected:
+    /**
+     * \brief Compress the index lists of all leaf nodes
+     *
+     * The indices of each leaf are sorted, and the differences between
+     * successive entries are stored as variable-length integers (7 bits
+     * per byte). This typically needs less than half the memory of the
+     * plain lists. Afterwards, the leaf nodes reference byte offsets
+     * into the packed buffer, and \ref getIndices() returns \c NULL.
+     */
+    void packIndices() {
+        if (!m_indices || m_packedIndices)
+            return;
+
+        std::vector<uint8_t> packed;
+        packed.reserve(m_indexCount * 2);
+        std::vector<IndexType> leaf;
+
+        for (SizeType i=0; i<m_nodeCount; ++i) {
+            KDNode &node = m_nodes[i];
+            if (!node.isLeaf())
+                continue;
+
+            leaf.assign(m_indices + node.getPrimStart(),
+                m_indices + node.getPrimEnd());
+            std::sort(leaf.begin(), leaf.end());
+
+            size_t start = packed.size();
+            IndexType prev = 0;
+            for (size_t j=0; j<leaf.size(); ++j) {
+                IndexType delta = leaf[j] - prev;
+                prev = leaf[j];
+                while (delta >= 0x80) {
+                    packed.push_back((uint8_t) (delta | 0x80));
+                    delta >>= 7;
+                }
+                packed.push_back((uint8_t) delta);
+            }
+
+            if (packed.size() > (size_t) KDNode::ELeafOffsetMask)
+                KDLog(EError, "Cannot represent the packed index lists -- "
+                    "too many primitives?");
+            node.initLeafNode((unsigned int) start,
+                (unsigned int) (packed.size() - start));
+        }
+
+        m_packedSize = packed.size();
+        m_packedIndices = new uint8_t[std::max(m_packedSize, (size_t) 1)];
+        if (m_packedSize > 0)
+            memcpy(m_packedIndices, &packed[0], m_packedSize);
+        delete[] m_indices;
+        m_indices = NULL;
+
+        KDLog(m_logLevel, "Packed the index lists: %s -> %s",
+            memString(sizeof(IndexType) * m_indexCount).c_str(),
+            memString(m_packedSize).c_str());
+    }
+
     IndexType *m_indices;
+    uint8_t *m_packedIndices;
+    size_t m_packedSize;
     Float m_traversalCost;
     Float m_queryCost;
     Float m_emptySpaceBonus;
-    bool m_clip, m_retract, m_parallelBuild;
+    bool m_clip, m_retract, m_parallelBuild, m_warnIfEmpty;
     SizeType m_maxDepth;
     SizeType m_stopPrims;
     SizeType m_maxBadRefines;
@@ -2603,6 +3562,9 @@ protected:
     SizeType m_minMaxBins;
     SizeType m_nodeCount;
     SizeType m_indexCount;
+    SizeType m_builderCount;
+    unsigned int m_buildTime;
+    Float m_sahCost;
     std::vector<TreeBuilder *> m_builders;
     std::vector<KDNode *> m_indirections;
     ref<Mutex> m_indirectionLock;
@@ -24,6 +24,9 @@
 #include <mitsuba/core/sched.h>
 #include <mitsuba/core/rfilter.h>
 
+/// Number of bitmap rows that share a lock in \ref ImageBlock::putConcurrent()
+#define MTS_IMAGEBLOCK_BAND_HEIGHT 16
+
 MTS_NAMESPACE_BEGIN
 
 /**
@@ -106,6 +109,21 @@ public:
                 - Vector2i(block->getBorderSize() - m_borderSize)));
     }
 
+    /**
+     * \brief Accumulate another image block into this one, while other
+     * threads may concurrently do the same
+     *
+     * The bitmap is split into bands of \ref MTS_IMAGEBLOCK_BAND_HEIGHT
+     * rows, each of which is protected by a separate spin lock. Blocks
+     * covering different parts of the image are therefore merged in
+     * parallel, and simultaneous merges of full-image blocks (e.g. from
+     * particle tracing) proceed in a pipelined fashion.
+     *
+     * This must not be combined with concurrent calls to the other
+     * (unsynchronized) modification functions.
+     */
+    void putConcurrent(const ImageBlock *block);
+
     /**
      * \brief Store a single sample inside the image block
      *
@@ -241,6 +259,7 @@ protected:
     int m_borderSize;
     const ReconstructionFilter *m_filter;
     Float *m_weightsX, *m_weightsY;
+    volatile int32_t *m_bandLocks;
     bool m_warn;
 };
 
@@ -28,7 +28,9 @@ MTS_NAMESPACE_BEGIN
  * Abstract parallel process, which performs a certain task (to be defined by
  * the subclass) on the pixels of an image where work on adjacent pixels
  * is independent. For preview purposes, a spiraling pattern of square
- * pixel blocks is generated.
+ * pixel blocks is generated by default. Alternatively, the blocks can be
+ * produced in scanline order, which minimizes the number of blocks whose
+ * neighbors are still outstanding (this is what streaming films want).
  *
  * \ingroup librender
  */
@@ -43,6 +45,18 @@ public:
     //! @}
     // ======================================================================
 
+    /// Order in which the pixel blocks are generated
+    enum EBlockOrder {
+        /// Spiral outwards from the center of the image (good for previews)
+        ESpiralOrder = 0,
+
+        /// Row by row, starting at the top left corner
+        EScanlineOrder
+    };
+
+    /// Return the order in which pixel blocks are generated
+    inline EBlockOrder getBlockOrder() const { return m_blockOrder; }
+
     MTS_DECLARE_CLASS()
 protected:
     /**
@@ -54,8 +68,11 @@ protected:
      *    Size of the image region to be processed
      * \param blockSize
      *    Size of the generated square pixel blocks
+     * \param blockOrder
+     *    Order in which the blocks should be generated
      */
-    void init(const Point2i &offset, const Vector2i &size, uint32_t blockSize);
+    void init(const Point2i &offset, const Vector2i &size, uint32_t blockSize,
+        EBlockOrder blockOrder = ESpiralOrder);
 
     /// Protected constructor
     inline BlockedImageProcess() { }
@@ -76,6 +93,7 @@ protected:
     int m_stepsLeft, m_numBlocksTotal;
     int m_numBlocksGenerated;
     int m_blockSize;
+    EBlockOrder m_blockOrder;
 };
 
 MTS_NAMESPACE_END
@@ -261,6 +261,15 @@ public:
      */
     inline bool rayIntersect(const RayDifferential &ray);
 
+    /**
+     * \brief Finish a query whose intersection record \c its
+     * was computed externally (e.g. by a batched query)
+     *
+     * Performs steps 2-5 of \ref rayIntersect(), which will then
+     * use the provided intersection record.
+     */
+    inline void setIntersection(const RayDifferential &ray);
+
     /// Retrieve a 2D sample
     inline Point2 nextSample2D();
 
@@ -394,6 +403,30 @@ public:
         Sampler *sampler, ImageBlock *block, const bool &stop,
         const std::vector< TPoint2<uint8_t> > &points) const;
 
+    /**
+     * \brief Sample the incident radiance along a batch of rays
+     *
+     * This function is used by the wavefront execution mode
+     * (<tt>wavefront=true</tt>), which processes the pixels of a block in
+     * lockstep. The default implementation intersects all rays at once,
+     * groups the queries by the BSDF of the intersected surface, and then
+     * calls \ref Li() for each one of them. Integrators can override it
+     * to also run the later stages of their random walks in bulk.
+     *
+     * \param count
+     *    Number of queries
+     * \param rays
+     *    Array of \c count rays
+     * \param rRecs
+     *    Array of \c count radiance query records. Each record
+     *    must refer to its own sampler.
+     * \param result
+     *    Array of \c count entries, which will receive the
+     *    radiance estimates
+     */
+    virtual void LiWavefront(size_t count, const RayDifferential *rays,
+        RadianceQueryRecord *rRecs, Spectrum *result) const;
+
     /**
      * <tt>NetworkedObject</tt> implementation:
      * When a parallel rendering process starts, the integrator is
@@ -430,9 +463,41 @@ protected:
 
     /// Virtual destructor
     virtual ~SamplingIntegrator() { }
+
+    /// Wavefront version of \ref renderBlock()
+    void renderBlockWavefront(const Scene *scene, const Sensor *sensor,
+        Sampler *sampler, ImageBlock *block, const bool &stop,
+        const std::vector< TPoint2<uint8_t> > &points) const;
+
+    /**
+     * \brief Intersect the rays of the queries referenced by
+     * \c indices as a batch and store the results in the query records
+     *
+     * Queries that still have the \ref RadianceQueryRecord::EIntersection
+     * flag set are finished using \ref RadianceQueryRecord::setIntersection().
+     * Otherwise, only the intersection record is replaced (e.g. when
+     * continuing a path), and alpha/distance are left untouched.
+     */
+    static void rayIntersectBatch(const RayDifferential *rays,
+        RadianceQueryRecord *rRecs, const std::vector<uint32_t> &indices);
+
+    /**
+     * \brief Reorder the query indices so that queries with the same BSDF
+     * at their intersection are processed consecutively
+     */
+    static void sortByMaterial(const RadianceQueryRecord *rRecs,
+        std::vector<uint32_t> &indices);
 protected:
+    /// Per-thread samplers of \ref renderBlockWavefront(), cloned from \c parent
+    struct WavefrontSamplers {
+        ref<Sampler> parent;
+        ref_vector<Sampler> samplers;
+    };
+
     /// Used to temporarily cache a parallel process while it is in operation
     ref<ParallelProcess> m_process;
+    mutable PrimitiveThreadLocal<WavefrontSamplers> m_wavefrontSamplers;
+    bool m_wavefront;
 };
 
 /*
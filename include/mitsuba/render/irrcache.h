@@ -76,6 +76,9 @@ public:
     /// Generate a set of projected solid angle-distributed directions
     void generateDirections(const Intersection &its);
 
+    /// Reseed the random number generator used by \ref generateDirections()
+    inline void seed(uint64_t value) { m_random->seed(value); }
+
     /// Compute mean distance, gradients etc.
     void process(const Intersection &its);
 
@@ -215,6 +218,33 @@ public:
     /// Manually insert an irradiance record
     void insert(Record *rec);
 
+    /**
+     * \brief Enable/disable buffered insertion
+     *
+     * When enabled, records created by \ref put() are first stored in a
+     * buffer that is private to the calling thread, where only lookups
+     * made by the same thread can see them. A subsequent call to
+     * \ref commit() (e.g. once an image block is finished) publishes
+     * them to all threads. Lookups never lock, and neighbor clamping only
+     * modifies shared records while committing.
+     */
+    inline void setBuffered(bool active) { m_buffered = active; }
+
+    /// Is buffered insertion enabled?
+    inline bool isBuffered() const { return m_buffered; }
+
+    /// Publish the records that were buffered by the calling thread
+    void commit();
+
+    /**
+     * \brief Remove the records buffered by the calling thread without
+     * publishing them
+     *
+     * The records are appended to \c records, and their ownership
+     * passes to the caller.
+     */
+    void detach(std::vector<Record *> &records);
+
     /**
      * Serialize an irradiance cache to a binary data stream
      */
@@ -324,6 +354,45 @@ public:
 protected:
     /// Release all memory
     virtual ~IrradianceCache();
+
+    /// Records buffered by one thread, along with an octree over their valid regions
+    struct PendingRecords {
+        std::vector<Record *> records;
+        DynamicOctree<Record *> *octree;
+
+        inline PendingRecords() : octree(NULL) { }
+
+        /// Release the records that were never committed or detached
+        inline ~PendingRecords() {
+            for (size_t i=0; i<records.size(); ++i)
+                delete records[i];
+            clear();
+        }
+
+        inline void clear() {
+            records.clear();
+            if (octree) {
+                delete octree;
+                octree = NULL;
+            }
+        }
+    };
+
+    /// Execute <tt>functor.operator()</tt> on buffered records that potentially overlap \c sphere
+    template <typename Functor> void searchPending(const BSphere &sphere,
+            Functor &functor) const {
+        const PendingRecords &pending = m_pending.get();
+        if (pending.octree)
+            pending.octree->searchSphere(sphere, functor);
+    }
+
+    /// Execute <tt>functor.operator()</tt> on buffered records whose valid region contains \c p
+    template <typename Functor> void lookupPending(const Point &p,
+            Functor &functor) const {
+        const PendingRecords &pending = m_pending.get();
+        if (pending.octree)
+            pending.octree->lookup(p, functor);
+    }
 protected:
     /* ===================================================================== */
     /*                        Protected attributes                           */
@@ -335,6 +404,8 @@ protected:
     Float m_sceneSize;
     Float m_minDist, m_maxDist;
     bool m_clampScreen, m_clampNeighbor, m_useGradients;
+    bool m_buffered;
+    PrimitiveThreadLocal<PendingRecords> m_pending;
     ref<Mutex> m_mutex;
 };
 
@@ -0,0 +1,164 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_LIGHTTREE_H_)
+#define __MITSUBA_RENDER_LIGHTTREE_H_
+
+#include <mitsuba/render/emitter.h>
+#include <mitsuba/core/pmf.h>
+#include <boost/unordered_map.hpp>
+
+/// Number of buckets per axis used by the split search of the light tree
+#define MTS_LIGHTTREE_BUCKETS 12
+
+/// Depth, below which the light tree builder switches to median splits
+#define MTS_LIGHTTREE_MAXDEPTH 64
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Bounding volume hierarchy over the emitters of a scene, which
+ * selects emitters according to their estimated contribution at a
+ * reference point ("many-light" sampling)
+ *
+ * Every node stores the combined \ref EmissionBounds of the emitters below
+ * it: a bounding box, a cone bounding the emission directions, and the
+ * total power. To pick an emitter, the tree is traversed from the root, and
+ * at every inner node a child is chosen proportionally to a conservative
+ * estimate of its contribution at the reference point (taking into account
+ * the distance, the orientation of the emitters, and the normal at the
+ * reference point). The same estimates are used to evaluate the discrete
+ * probability of an emitter by walking from its leaf to the root.
+ *
+ * Emitters that don't provide emission bounds (such as environment maps)
+ * are kept outside of the tree. They are chosen according to their
+ * sampling weights, where the tree as a whole receives the sum of the
+ * weights of the emitters it contains.
+ *
+ * The tree is constructed top-down using the orientation-aware surface
+ * area heuristic by Conty Estevez and Kulla ("Importance Sampling of Many
+ * Lights with Adaptive Tree Splitting", HPG 2018).
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER LightTree : public Object {
+public:
+    typedef uint32_t IndexType;
+
+    /// Build a light tree over the given emitters
+    LightTree(const ref_vector<Emitter> &emitters);
+
+    /**
+     * \brief Choose an emitter for direct illumination sampling at a
+     * reference point
+     *
+     * \param p
+     *    The reference point
+     * \param n
+     *    The surface normal at the reference point. Emitters below the
+     *    surface are never chosen. Pass a zero normal for points within
+     *    participating media or on transmissive surfaces.
+     * \param sample
+     *    A uniformly distributed sample on <tt>[0, 1]</tt>, which will
+     *    be modified so that it can be reused
+     * \param pdf
+     *    Will be set to the discrete probability of the chosen emitter
+     * \return
+     *    The chosen emitter, or \c NULL when no emitter is expected to
+     *    contribute at the reference point
+     */
+    const Emitter *sample(const Point &p, const Normal &n,
+        Float &sample, Float &pdf) const;
+
+    /**
+     * \brief Return the discrete probability of choosing the given
+     * emitter with \ref sample()
+     */
+    Float pdf(const Point &p, const Normal &n, const Emitter *emitter) const;
+
+    /// Return the number of emitters within the hierarchy
+    inline size_t getBoundedEmitterCount() const { return m_emitters.size(); }
+
+    /// Return the number of emitters outside of the hierarchy
+    inline size_t getUnboundedEmitterCount() const { return m_unbounded.size(); }
+
+    /// Return the number of nodes
+    inline size_t getNodeCount() const { return m_nodes.size(); }
+
+    /// Return the memory used by the hierarchy in bytes
+    size_t getMemoryUsage() const;
+
+    /// Return a string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /**
+     * \brief Light tree node
+     *
+     * The two children of an inner node are stored next to each other;
+     * \c index refers to the first one. For leaves, \c index refers to
+     * the emitter.
+     */
+    struct LightNode {
+        EmissionBounds bounds;
+        IndexType index;
+        IndexType parent;
+        bool leaf;
+    };
+
+    /// Emitter reference used during construction
+    struct EmitterRef {
+        EmissionBounds bounds;
+        IndexType index;
+    };
+
+    struct BucketPredicate;
+    struct CentroidOrdering;
+
+    /// Estimate the contribution of a node at the reference point
+    static Float importance(const EmissionBounds &bounds,
+        const Point &p, const Normal &n);
+
+    /// Merge two sets of emission bounds
+    static EmissionBounds merge(const EmissionBounds &a, const EmissionBounds &b);
+
+    /// Orientation-aware SAH cost of a set of emission bounds
+    static Float cost(const EmissionBounds &bounds);
+
+    /// Recursively build the subtree for a range of emitters
+    void build(std::vector<EmitterRef> &refs, size_t start, size_t end,
+        IndexType nodeIndex, int depth);
+
+    /// Virtual destructor
+    virtual ~LightTree();
+private:
+    std::vector<LightNode> m_nodes;
+    std::vector<const Emitter *> m_emitters;
+    std::vector<IndexType> m_leaves;
+    boost::unordered_map<const Emitter *, IndexType> m_emitterIndices;
+    std::vector<const Emitter *> m_unbounded;
+    DiscreteDistribution m_unboundedPDF;
+    Float m_unboundedProb;
+    unsigned int m_buildTime;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_LIGHTTREE_H_ */
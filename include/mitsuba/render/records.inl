@@ -118,29 +118,33 @@ inline bool RadianceQueryRecord::rayIntersect(const RayDifferential &ray) {
     /* Only search for an intersection if this was explicitly requested */
     if (type & EIntersection) {
         scene->rayIntersect(ray, its);
-        if (type & EOpacity) {
-            int unused = INT_MAX;
-
-            if (its.isValid()) {
-                if (EXPECT_TAKEN(!its.isMediumTransition()))
-                    alpha = 1.0f;
-                else
-                    alpha = 1-scene->evalTransmittance(its.p, true,
-                        ray(scene->getBSphere().radius*2), false,
-                        ray.time, its.getTargetMedium(ray.d), unused).average();
-            } else if (medium) {
-                alpha = 1-scene->evalTransmittance(ray.o, false,
+        setIntersection(ray);
+    }
+    return its.isValid();
+}
+
+inline void RadianceQueryRecord::setIntersection(const RayDifferential &ray) {
+    if (type & EOpacity) {
+        int unused = INT_MAX;
+
+        if (its.isValid()) {
+            if (EXPECT_TAKEN(!its.isMediumTransition()))
+                alpha = 1.0f;
+            else
+                alpha = 1-scene->evalTransmittance(its.p, true,
                     ray(scene->getBSphere().radius*2), false,
-                    ray.time, medium, unused).average();
-            } else {
-                alpha = 0.0f;
-            }
+                    ray.time, its.getTargetMedium(ray.d), unused).average();
+        } else if (medium) {
+            alpha = 1-scene->evalTransmittance(ray.o, false,
+                ray(scene->getBSphere().radius*2), false,
+                ray.time, medium, unused).average();
+        } else {
+            alpha = 0.0f;
         }
-        if (type & EDistance)
-            dist = its.t;
-        type ^= EIntersection; // unset the intersection bit
     }
-    return its.isValid();
+    if (type & EDistance)
+        dist = its.t;
+    type &= ~EIntersection; // unset the intersection bit
 }
 
 inline Point2 RadianceQueryRecord::nextSample2D() {
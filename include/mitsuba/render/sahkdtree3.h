@@ -110,6 +110,7 @@ public:
     typedef typename KDTreeBase<AABB>::SizeType                 SizeType;
     typedef typename KDTreeBase<AABB>::IndexType                IndexType;
     typedef typename KDTreeBase<AABB>::KDNode                   KDNode;
+    typedef typename Parent::LeafIterator                       LeafIterator;
 
     using Parent::m_nodes;
     using Parent::m_aabb;
@@ -268,9 +269,9 @@ protected:
             }
 
             /* Reached a leaf node */
-            for (IndexType entry=currNode->getPrimStart(),
-                    last = currNode->getPrimEnd(); entry != last; entry++) {
-                const IndexType primIdx = m_indices[entry];
+            LeafIterator it(this, currNode);
+            IndexType primIdx;
+            while (it.next(primIdx)) {
 
                 #if defined(MTS_KD_MAILBOX_ENABLED)
                 if (mailbox.contains(primIdx))
@@ -402,9 +403,9 @@ protected:
             }
 
             /* Reached a leaf node */
-            for (unsigned int entry=currNode->getPrimStart(),
-                    last = currNode->getPrimEnd(); entry != last; entry++) {
-                const IndexType primIdx = m_indices[entry];
+            LeafIterator it(this, currNode);
+            IndexType primIdx;
+            while (it.next(primIdx)) {
 
                 ++numIntersections;
                 bool result = cast()->intersect(ray, primIdx, mint, maxt, t, temp);
@@ -468,9 +469,9 @@ protected:
                     maxt = tPlane;
                 }
             } else {
-                for (unsigned int entry=node->getPrimStart(),
-                        last = node->getPrimEnd(); entry != last; entry++) {
-                    const IndexType primIdx = m_indices[entry];
+                LeafIterator it(this, node);
+                IndexType primIdx;
+                while (it.next(primIdx)) {
 
                     bool result;
                     if (!shadowRay)
@@ -110,6 +110,16 @@ public:
     /// Manually set the current sample index
     virtual void setSampleIndex(size_t sampleIndex);
 
+    /**
+     * \brief Reseed the random number generator used by this sampler
+     *
+     * This makes the generated samples reproducible regardless of what
+     * the sampler was used for before. Samplers whose samples only depend
+     * on the pixel position and sample index (e.g. \c halton) ignore this
+     * call, which is also what the default implementation does.
+     */
+    virtual void seed(uint64_t value);
+
     /// Retrieve the next component value from the current sample
     virtual Float next1D() = 0;
 
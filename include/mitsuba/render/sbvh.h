@@ -0,0 +1,322 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_SBVH_H_)
+#define __MITSUBA_RENDER_SBVH_H_
+
+#include <mitsuba/render/skdtree.h>
+
+/// Depth, below which the BVH builder switches from SAH to median splits
+#define MTS_BVH_MAXDEPTH 48
+
+/**
+ * \brief Size of the traversal stack. Every visited node pushes at most three
+ * additional entries; median splits below \ref MTS_BVH_MAXDEPTH add at most
+ * 32 more levels.
+ */
+#define MTS_BVH_STACKSIZE (3 * (MTS_BVH_MAXDEPTH + 32) + 1)
+
+/// Maximum number of primitives in a leaf (limited by the child encoding)
+#define MTS_BVH_MAX_LEAF_SIZE 15
+
+/// Maximum number of bins used by the SAH split search
+#define MTS_BVH_MAX_BINS 64
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Four-wide SAH bounding volume hierarchy for fast ray-shape
+ * intersections.
+ *
+ * This is an alternative to \ref ShapeKDTree with the same ray tracing
+ * interface, which can be selected per scene (<tt>accel="bvh"</tt>).
+ * The hierarchy is built top-down using binned SAH splits on the primitive
+ * centroids, which is much faster and needs considerably less memory than
+ * the construction of a 'perfect split' kd-tree. This makes it the better
+ * choice for scenes that change frequently, while the kd-tree usually
+ * traces rays a little faster.
+ *
+ * Each node stores the bounding boxes of up to four children in a
+ * structure-of-arrays layout, so that they can be tested against a ray using
+ * a few SSE instructions (when compiled with \c MTS_SSE). Leaves are not
+ * stored as separate nodes: a child reference directly encodes a range of
+ * the primitive array, which is sorted in leaf order. Hence there is no
+ * index indirection like in the kd-tree. Triangle intersections use the same
+ * "TriAccel" representation as \ref ShapeKDTree, or the Moeller-Trumbore
+ * test when compiled with \c MTS_KD_CONSERVE_MEMORY.
+ *
+ * When the vertex positions of the contained meshes change while their
+ * topology stays the same (e.g. in an animation), the hierarchy can be
+ * updated using \ref refit(), which recomputes all bounds bottom-up
+ * instead of rebuilding the tree.
+ *
+ * \sa ShapeKDTree
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER ShapeBVH : public Object {
+public:
+    typedef uint32_t SizeType;
+    typedef uint32_t IndexType;
+
+    // =============================================================
+    //! @{ \name Initialization and construction
+    // =============================================================
+
+    /// Create an empty BVH
+    ShapeBVH();
+
+    /// Add a shape to the BVH
+    void addShape(const Shape *shape);
+
+    /// Return the list of stored shapes
+    inline const std::vector<const Shape *> &getShapes() const { return m_shapes; }
+
+    /**
+     * \brief Return the total number of low-level primitives (triangles
+     * and other low-level primitives)
+     */
+    inline SizeType getPrimitiveCount() const {
+        return m_shapeMap[m_shapeMap.size()-1];
+    }
+
+    /// Return a (slightly enlarged) axis-aligned bounding box containing all primitives
+    inline const AABB &getAABB() const { return m_aabb; }
+
+    /// Return a tight axis-aligned bounding box containing all primitives
+    inline const AABB &getTightAABB() const { return m_tightAABB; }
+
+    /// Build the BVH (needs to be called before tracing any rays)
+    void build();
+
+    /// Has the BVH been built yet?
+    inline bool isBuilt() const { return m_nodes != NULL; }
+
+    /**
+     * \brief Update the BVH after the vertex positions of the contained
+     * meshes (or the bounds of other shapes) have changed
+     *
+     * The tree topology is kept, and the bounds of all nodes are recomputed
+     * bottom-up, one tree level at a time and in parallel. This is much
+     * faster than \ref build(), though the quality of the tree degrades when
+     * the geometry moves far from the configuration it was built for. The
+     * triangle count and connectivity of all meshes must remain unchanged.
+     */
+    void refit();
+
+    /// Return the time (in milliseconds) spent by the last call to \ref refit()
+    inline unsigned int getRefitTime() const { return m_refitTime; }
+
+    /**
+     * \brief Set the number of bins used by the SAH split search
+     * (default: 16, at most \ref MTS_BVH_MAX_BINS)
+     */
+    inline void setBinCount(SizeType binCount) { m_binCount = binCount; }
+
+    /// Return the number of bins used by the SAH split search
+    inline SizeType getBinCount() const { return m_binCount; }
+
+    /**
+     * \brief Set the maximum number of primitives in a leaf
+     * (default: 4, at most \ref MTS_BVH_MAX_LEAF_SIZE)
+     */
+    inline void setMaxLeafSize(SizeType maxLeafSize) { m_maxLeafSize = maxLeafSize; }
+
+    /// Return the maximum number of primitives in a leaf
+    inline SizeType getMaxLeafSize() const { return m_maxLeafSize; }
+
+    /// Set the relative cost of a node traversal in the SAH (default: 1)
+    inline void setTraversalCost(Float traversalCost) { m_traversalCost = traversalCost; }
+
+    /// Return the relative cost of a node traversal in the SAH
+    inline Float getTraversalCost() const { return m_traversalCost; }
+
+    /// Set the relative cost of a primitive intersection in the SAH (default: 1)
+    inline void setQueryCost(Float queryCost) { m_queryCost = queryCost; }
+
+    /// Return the relative cost of a primitive intersection in the SAH
+    inline Float getQueryCost() const { return m_queryCost; }
+
+    /// Return the number of (four-wide) nodes
+    inline SizeType getNodeCount() const { return m_nodeCount; }
+
+    /// Return the time (in milliseconds) spent building the BVH
+    inline unsigned int getBuildTime() const { return m_buildTime; }
+
+    /// Return the SAH cost of the BVH
+    inline Float getSAHCost() const { return m_sahCost; }
+
+    /// Return the memory used by the nodes and primitive data in bytes
+    size_t getMemoryUsage() const;
+
+    //! @}
+    // =============================================================
+
+    // =============================================================
+    //! @{ \name Ray tracing routines
+    // =============================================================
+
+    /// Intersect a ray and return detailed intersection information
+    bool rayIntersect(const Ray &ray, Intersection &its) const;
+
+    /**
+     * \brief Intersect a ray and return the traveled distance, intersected
+     * shape, geometric normal and UV coordinates
+     * (see \ref ShapeKDTree::rayIntersect())
+     */
+    bool rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
+        Normal &n, Point2 &uv) const;
+
+    /// Test a ray for occlusion
+    bool rayIntersect(const Ray &ray) const;
+
+    /// Plain shadow ray query
+    bool rayIntersect(const Ray &ray, Float mint, Float maxt) const;
+
+    /// Plain intersection query
+    bool rayIntersect(const Ray &ray, Float mint, Float maxt,
+        Float &t, void *temp) const;
+
+    /**
+     * \brief After a successful plain intersection query, fill a detailed
+     * intersection record using the temporary information
+     */
+    inline void fillIntersectionRecord(const Ray &ray, const void *temp,
+            Intersection &its) const {
+        const ShapeKDTree::IntersectionCache *cache =
+            reinterpret_cast<const ShapeKDTree::IntersectionCache *>(temp);
+        ShapeKDTree::fillIntersectionRecord<false>(m_shapes[cache->shapeIndex],
+            m_triangleFlag[cache->shapeIndex], ray, temp, its);
+    }
+
+    //! @}
+    // =============================================================
+
+    /// Return a string representation
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /**
+     * \brief Four-wide BVH node
+     *
+     * Child references are non-negative for inner nodes (index into the
+     * node array). Leaves are stored as <tt>~(offset << 4 | count)</tt>,
+     * where \c offset refers to the primitive array. Unused child slots
+     * have an empty bounding box.
+     */
+    struct BVHNode {
+        /// Child bounds, indexed by [min/max][axis][child]
+        float bounds[2][3][4];
+        /// Child references
+        int32_t child[4];
+    };
+
+    /// Primitive reference used during construction
+    struct PrimRef {
+        AABB aabb;
+        IndexType index;
+    };
+
+    /// Range of primitive references that is processed by the builder
+    struct BuildRange {
+        size_t start, end;
+        AABB aabb, centroidAABB;
+
+        inline size_t size() const { return end - start; }
+    };
+
+    /**
+     * \brief Return the shape index corresponding to a global primitive
+     * index. For triangle meshes, \a idx is updated to the triangle index
+     */
+    inline IndexType findShape(IndexType &idx) const {
+        std::vector<IndexType>::const_iterator it = std::lower_bound(
+                m_shapeMap.begin(), m_shapeMap.end(), idx + 1) - 1;
+        idx -= *it;
+        return (IndexType) (it - m_shapeMap.begin());
+    }
+
+    /// Recompute the bounds of a range of primitive references
+    static void computeBounds(const std::vector<PrimRef> &refs, BuildRange &range);
+
+    struct BinPredicate;
+    struct CentroidOrdering;
+
+    /**
+     * \brief Partition a range into two parts using the binned SAH
+     *
+     * \return \c false if a leaf is preferable to any split
+     */
+    bool split(std::vector<PrimRef> &refs, const BuildRange &range,
+        int depth, BuildRange &left, BuildRange &right) const;
+
+    /// Recursively build a node, whose first children are given
+    int32_t buildNode(std::vector<PrimRef> &refs,
+        std::vector<BVHNode> &nodes, BuildRange *children,
+        int childCount, int depth);
+
+    /// Create a leaf child reference for a range
+    int32_t createLeaf(std::vector<PrimRef> &refs, const BuildRange &range);
+
+    /// Sort the nodes by their depth for \ref refit()
+    void computeRefitLevels();
+
+    /// Recompute the child bounds of a node, whose children are up to date
+    void refitNode(int32_t nodeIndex);
+
+    /// Set the tight bounds and slightly enlarge them for ray tracing
+    void setAABB(const AABB &aabb);
+
+    /// Intersect a single primitive (closest hit)
+    bool intersect(const Ray &ray, IndexType idx, Float mint,
+        Float maxt, Float &t, void *temp) const;
+
+    /// Intersect a single primitive (shadow ray)
+    bool intersect(const Ray &ray, IndexType idx, Float mint, Float maxt) const;
+
+    /// Traverse the hierarchy
+    template <bool shadowRay> bool traverse(const Ray &ray, Float mint,
+        Float maxt, Float &t, void *temp) const;
+
+    /// Virtual destructor
+    virtual ~ShapeBVH();
+private:
+    std::vector<const Shape *> m_shapes;
+    std::vector<bool> m_triangleFlag;
+    std::vector<IndexType> m_shapeMap;
+    std::vector<IndexType> m_primOrder;
+    BVHNode *m_nodes;
+    SizeType m_nodeCount;
+    std::vector<int32_t> m_refitOrder;
+    std::vector<SizeType> m_refitLevels;
+#if defined(MTS_KD_CONSERVE_MEMORY)
+    IndexType *m_primIndices;
+#else
+    TriAccel *m_triAccel;
+#endif
+    AABB m_aabb, m_tightAABB;
+    SizeType m_binCount, m_maxLeafSize;
+    Float m_traversalCost, m_queryCost;
+    Float m_sahCost;
+    unsigned int m_buildTime, m_refitTime;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_SBVH_H_ */
@@ -25,6 +25,8 @@
 #include <mitsuba/core/aabb.h>
 #include <mitsuba/render/trimesh.h>
 #include <mitsuba/render/skdtree.h>
+#include <mitsuba/render/sbvh.h>
+#include <mitsuba/render/lighttree.h>
 #include <mitsuba/render/sensor.h>
 #include <mitsuba/render/integrator.h>
 #include <mitsuba/render/bsdf.h>
@@ -80,6 +82,38 @@ public:
      */
     void invalidate();
 
+    /**
+     * \brief Update the scene after the geometry of its shapes has been
+     * modified in-place (e.g. the vertex positions of an animated mesh)
+     *
+     * Each shape is notified using \ref Shape::updateGeometry(). When the
+     * scene uses a BVH, its bounds are then refit bottom-up, which is
+     * significantly faster than a rebuild. The kd-tree cannot be refit
+     * and is rebuilt from scratch instead. Afterwards, the scene bounds
+     * and bounding sphere, the emitters that depend on them and the
+     * light tree (if any) are updated.
+     *
+     * The number of shapes and their topology (e.g. the triangle count
+     * of meshes) must not change. Emitter sampling weights are not
+     * recomputed.
+     */
+    void updateGeometry();
+
+    /**
+     * \brief Rebuild the top-level acceleration data structure over the
+     * geometry instances after instances were moved, added or removed
+     *
+     * By default, shapes created by the \c instance plugin are not stored
+     * in the scene's kd-tree or BVH, but in a separate BVH over their
+     * bounding boxes, which builds very quickly. This function only
+     * rebuilds that hierarchy; the rest of the scene is left untouched.
+     * New instances must have been added using \ref addChild().
+     *
+     * When the two-level scheme is disabled (<tt>twoLevelInstancing=false</tt>),
+     * this is equivalent to \ref updateGeometry().
+     */
+    void updateInstances();
+
     /**
      * \brief Initialize the scene for bidirectional rendering algorithms.
      *
@@ -185,7 +219,11 @@ public:
      * \return \c true if an intersection was found
      */
     inline bool rayIntersect(const Ray &ray, Intersection &its) const {
-        return m_kdtree->rayIntersect(ray, its);
+        bool result = m_bvh.get() ? m_bvh->rayIntersect(ray, its)
+            : m_kdtree->rayIntersect(ray, its);
+        if (EXPECT_NOT_TAKEN(m_instanceBVH.get() != NULL))
+            result = rayIntersectInstances(ray, result, its);
+        return result;
     }
 
     /**
@@ -219,7 +257,11 @@ public:
      */
     inline bool rayIntersect(const Ray &ray, Float &t,
             ConstShapePtr &shape, Normal &n, Point2 &uv) const {
-        return m_kdtree->rayIntersect(ray, t, shape, n, uv);
+        bool result = m_bvh.get() ? m_bvh->rayIntersect(ray, t, shape, n, uv)
+            : m_kdtree->rayIntersect(ray, t, shape, n, uv);
+        if (EXPECT_NOT_TAKEN(m_instanceBVH.get() != NULL))
+            result = rayIntersectInstances(ray, result, t, shape, n, uv);
+        return result;
     }
 
     /**
@@ -239,9 +281,42 @@ public:
      * \return \c true if an intersection was found
      */
     inline bool rayIntersect(const Ray &ray) const {
-        return m_kdtree->rayIntersect(ray);
+        if (m_bvh.get() ? m_bvh->rayIntersect(ray) : m_kdtree->rayIntersect(ray))
+            return true;
+        return m_instanceBVH.get() && m_instanceBVH->rayIntersect(ray);
     }
 
+    /**
+     * \brief Intersect a batch of rays against all primitives stored in
+     * the scene and return detailed intersection information
+     *
+     * Equivalent to calling \ref rayIntersect() for every ray, but the
+     * kd-tree traces coherent groups of four consecutive rays as SIMD
+     * packets (see \ref ShapeKDTree::rayIntersectBatch()).
+     *
+     * \param rays
+     *    Array of \c count rays
+     *
+     * \param count
+     *    Number of rays
+     *
+     * \param its
+     *    Array of \c count intersection records, which will be filled
+     *    by the query. Rays that miss are marked by invalid records.
+     */
+    void rayIntersectBatch(const Ray *rays, size_t count,
+        Intersection *its) const;
+
+    /**
+     * \brief Test a batch of rays for occlusion
+     *
+     * Equivalent to calling the shadow ray version of
+     * \ref rayIntersect() for every ray, but see
+     * \ref rayIntersectBatch().
+     */
+    void rayIntersectBatch(const Ray *rays, size_t count,
+        bool *occluded) const;
+
     /**
      * \brief Return the transmittance between \c p1 and \c p2 at the
      * specified time.
@@ -844,6 +919,11 @@ public:
     /**
      * \brief Return the discrete probability of choosing a
      * certain emitter in <tt>sampleEmitter*</tt>
+     *
+     * When the scene uses a light tree (<tt>emitterSampling="tree"</tt>),
+     * the direct illumination sampling routines instead choose emitters
+     * depending on the reference point, and this function only applies to
+     * \ref sampleEmitterPosition() and \ref sampleEmitterRay().
      */
     inline Float pdfEmitterDiscrete(const Emitter *emitter) const {
         return emitter->getSamplingWeight() * m_emitterPDF.getNormalization();
@@ -1071,6 +1151,40 @@ public:
     /// Return the scene's kd-tree accelerator
     inline const ShapeKDTree *getKDTree() const { return m_kdtree.get(); }
 
+    /**
+     * \brief Return the scene's BVH accelerator, or \c NULL when the
+     * kd-tree is used (<tt>accel="kdtree"</tt>, the default)
+     */
+    inline ShapeBVH *getBVH() { return m_bvh; }
+    /// Return the scene's BVH accelerator (or \c NULL)
+    inline const ShapeBVH *getBVH() const { return m_bvh.get(); }
+
+    /**
+     * \brief Return the top-level BVH over the geometry instances, or
+     * \c NULL when the scene contains no instances or the two-level scheme
+     * is disabled (see \ref updateInstances())
+     */
+    inline const ShapeBVH *getInstanceBVH() const { return m_instanceBVH.get(); }
+
+    /**
+     * \brief Return a bounding box containing the scene geometry
+     *
+     * In contrast to \ref getAABB(), this excludes sensors and emitters.
+     */
+    inline AABB getGeometryAABB() const {
+        AABB aabb(m_bvh.get() ? m_bvh->getAABB() : m_kdtree->getAABB());
+        if (m_instanceBVH.get())
+            aabb.expandBy(m_instanceBVH->getAABB());
+        return aabb;
+    }
+
+    /**
+     * \brief Return the light tree used for direct illumination sampling,
+     * or \c NULL when emitters are chosen according to their sampling
+     * weights (<tt>emitterSampling="weight"</tt>, the default)
+     */
+    inline const LightTree *getLightTree() const { return m_lightTree.get(); }
+
     /// Return the a list of all subsurface integrators
     inline ref_vector<Subsurface> &getSubsurfaceIntegrators() { return m_ssIntegrators; }
     /// Return the a list of all subsurface integrators
@@ -1142,9 +1256,33 @@ protected:
     /// \cond
     /// Add a shape to the scene
     void addShape(Shape *shape);
+
+    /// Create an empty top-level BVH for the geometry instances
+    ShapeBVH *createInstanceBVH() const;
+
+    /// Intersect a ray with the geometry instances (closer than \c its)
+    bool rayIntersectInstances(const Ray &ray, bool found, Intersection &its) const;
+
+    /// Intersect a ray with the geometry instances (compact record version)
+    bool rayIntersectInstances(const Ray &ray, bool found, Float &t,
+        ConstShapePtr &shape, Normal &n, Point2 &uv) const;
     /// \endcond
+
+    /**
+     * \brief Randomly pick an emitter for direct illumination sampling
+     * at the reference point of \c dRec (reuses \c sample)
+     */
+    inline const Emitter *sampleEmitterDirectDiscrete(
+            const DirectSamplingRecord &dRec, Float &sample, Float &pdf) const {
+        if (m_lightTree.get())
+            return m_lightTree->sample(dRec.ref, dRec.refN, sample, pdf);
+        return m_emitters[m_emitterPDF.sampleReuse(sample, pdf)].get();
+    }
 private:
     ref<ShapeKDTree> m_kdtree;
+    ref<ShapeBVH> m_bvh;
+    ref<ShapeBVH> m_instanceBVH;
+    ref<LightTree> m_lightTree;
     ref<Sensor> m_sensor;
     ref<Integrator> m_integrator;
     ref<Sampler> m_sampler;
@@ -1165,6 +1303,8 @@ private:
     uint32_t m_blockSize;
     bool m_degenerateSensor;
     bool m_degenerateEmitters;
+    bool m_useLightTree;
+    bool m_twoLevelInstancing;
 };
 
 MTS_NAMESPACE_END
@@ -82,11 +82,9 @@ extern MTS_EXPORT_RENDER void pushSceneCleanupHandler(void (*cleanup)());
  */
 class MTS_EXPORT_RENDER SceneHandler : public xercesc::HandlerBase {
 public:
-    typedef std::map<std::string, ConfigurableObject *> NamedObjectMap;
     typedef std::map<std::string, std::string, SimpleStringOrdering> ParameterMap;
 
-    SceneHandler(const ParameterMap &params, NamedObjectMap *objects = NULL,
-            bool isIncludedFile = false);
+    SceneHandler(const ParameterMap &params);
     virtual ~SceneHandler();
 
     /// Convenience method -- load a scene from a given filename
@@ -103,6 +101,26 @@ public:
     /// Free the memory taken up by staticInitialization()
     static void staticShutdown();
 
+    /**
+     * \brief Enable or disable parallel object instantiation
+     * (default: disabled)
+     *
+     * When enabled, the handler first assembles the complete object graph
+     * of a scene file. Afterwards, all plugin objects are constructed in
+     * parallel on the local worker threads of the scheduler. This step
+     * covers most of the loading time, since it is where meshes, bitmaps
+     * and volumes are read from disk. Finally, children are attached and
+     * \ref ConfigurableObject::configure() is called in the same order as
+     * in the serial case.
+     *
+     * Requires a running scheduler; otherwise, the objects are constructed
+     * one after the other.
+     */
+    static void setParallelLoading(bool parallel);
+
+    /// Is parallel object instantiation enabled?
+    static bool getParallelLoading();
+
     // -----------------------------------------------------------------------
     //  Implementation of the SAX DocumentHandler interface
     // -----------------------------------------------------------------------
@@ -134,6 +152,13 @@ protected:
     void clear();
 
 private:
+    friend class InstantiationProcess;
+    struct ObjectNode;
+    typedef std::map<std::string, ObjectNode *> NamedObjectMap;
+
+    /// Create a handler for an included file
+    SceneHandler(const ParameterMap &params, SceneHandler *parent);
+
     /**
      * Enumeration of all possible tags that can be encountered in a
      * Mitsuba scene file
@@ -159,9 +184,39 @@ private:
         ETag tag;
         Properties properties;
         std::map<std::string, std::string> attributes;
-        std::vector<std::pair<std::string, ConfigurableObject *> > children;
+        std::vector<std::pair<std::string, ObjectNode *> > children;
+    };
+
+    /// Operations on the object graph, which are replayed in document order
+    enum EActionType {
+        EAddChild, EConfigure, EExpand, ECheckProperties
     };
 
+    struct Action {
+        inline Action(EActionType type, ObjectNode *node,
+            ObjectNode *other = NULL, const std::string &name = "")
+            : type(type), node(node), other(other), name(name) { }
+
+        EActionType type;
+        ObjectNode *node, *other;
+        std::string name;
+    };
+
+    /// Create a new node of the object graph
+    ObjectNode *createNode(const Class *theClass, const Properties &props,
+        bool create = true);
+
+    /// Perform an action (immediately or after the document has been parsed)
+    void record(const Action &action);
+
+    /// Apply an action to the instantiated objects
+    void execute(const Action &action);
+
+    /// Construct all objects and replay the recorded actions
+    void instantiate();
+
+    /// Return a description of the current position in the document
+    std::string getLocation() const;
 
     typedef std::pair<ETag, const Class *> TagEntry;
     typedef boost::unordered_map<std::string, TagEntry> TagMap;
@@ -169,14 +224,22 @@ private:
     const xercesc::Locator *m_locator;
     xercesc::XMLTranscoder* m_transcoder;
     ref<Scene> m_scene;
+    ObjectNode *m_sceneNode;
     ParameterMap m_params;
-    NamedObjectMap *m_namedObjects;
     PluginManager *m_pluginManager;
     std::stack<ParseContext> m_context;
     TagMap m_tags;
     Transform m_transform;
     ref<AnimatedTransform> m_animatedTransform;
     bool m_isIncludedFile;
+
+    /* The following are only used by the handler of the main file */
+    SceneHandler *m_root;
+    NamedObjectMap m_namedObjects;
+    std::vector<ObjectNode *> m_nodes;
+    std::vector<Action> m_actions;
+    bool m_deferred;
+    static bool m_parallelLoading;
 };
 
 MTS_NAMESPACE_END
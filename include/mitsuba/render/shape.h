@@ -187,6 +187,9 @@ public:
     /// Is this a compound shape consisting of several sub-objects?
     virtual bool isCompound() const;
 
+    /// Is this an instance of a shape group (see the \c instance plugin)?
+    virtual bool isInstance() const;
+
     /**
      * \brief Return a sub-element of a compound shape.
      *
@@ -209,6 +212,18 @@ public:
     /// Return a bounding box containing the shape
     virtual AABB getAABB() const = 0;
 
+    /**
+     * \brief Update cached quantities after the geometry of the shape
+     * has been modified in-place
+     *
+     * This is used by \ref Scene::updateGeometry() to support animated
+     * geometry whose topology stays fixed. Implementations should e.g.
+     * recompute bounding boxes and sampling tables.
+     *
+     * The default implementation does nothing.
+     */
+    virtual void updateGeometry();
+
     /**
      * \brief Returns the minimal axis-aligned bounding box
      * of this shape when clipped to another bounding box.
@@ -23,12 +23,7 @@
 #include <mitsuba/render/shape.h>
 #include <mitsuba/render/sahkdtree3.h>
 #include <mitsuba/render/triaccel.h>
-
-#if defined(MTS_KD_CONSERVE_MEMORY)
-#if defined(MTS_HAS_COHERENT_RT)
-#error MTS_KD_CONSERVE_MEMORY & MTS_HAS_COHERENT_RT are incompatible
-#endif
-#endif
+#include <mitsuba/render/geompager.h>
 
 #if defined(SINGLE_PRECISION)
 /// 64 byte temporary storage for intersection computations
@@ -58,9 +53,21 @@ typedef const Shape * ConstShapePtr;
  * and Interactive Global Illumination". This adds an overhead of 48 bytes per
  * triangle.
  *
- * When compiled with \c MTS_KD_CONSERVE_MEMORY, the Moeller-Trumbore intersection
- * test is used instead, which doesn't need any extra storage. However, it also
- * tends to be quite a bit slower.
+ * For very large scenes, the tree can instead be switched into a memory-lean
+ * \a compact mode (see \ref setCompact()). It uses the Moeller-Trumbore
+ * intersection test on the indexed mesh data instead, which doesn't need any
+ * extra storage, and additionally packs the index lists of the leaf nodes
+ * (see \ref GenericKDTree::packIndices()). However, it also tends to be
+ * quite a bit slower, and rays are never traced as SIMD packets. When
+ * compiled with \c MTS_KD_CONSERVE_MEMORY, this is the default.
+ *
+ * Scenes that don't fit into memory can use the \a out-of-core mode
+ * (see \ref setOutOfCore()), which also packs the index lists. The
+ * TriAccel records are then moved into a page file and read back through
+ * a bounded cache (see \ref GeometryPager). Only the tree nodes, the
+ * packed index lists and a 4-byte page location per primitive stay in
+ * memory. The triangle meshes themselves should be loaded from
+ * uncompressed serialized files, whose contents are memory-mapped.
  *
  * \sa GenericKDTree
  * \ingroup librender
@@ -72,6 +79,7 @@ class MTS_EXPORT_RENDER ShapeKDTree : public SAHKDTree3D<ShapeKDTree> {
     friend class Instance;
     friend class AnimatedInstance;
     friend class SingleScatter;
+    friend class ShapeBVH;
 
 public:
     // =============================================================
@@ -97,9 +105,43 @@ public:
     /// Return an axis-aligned bounding box containing all primitives
     inline const AABB &getAABB() const { return m_aabb; }
 
+    /**
+     * \brief Use the memory-lean compact layout? (see the class description)
+     * Must be set before calling \ref build().
+     */
+    inline void setCompact(bool compact) { Assert(!isBuilt()); m_compact = compact; }
+
+    /// Does the tree use the memory-lean compact layout?
+    inline bool getCompact() const { return m_compact; }
+
+    /**
+     * \brief Page the precomputed triangle data in and out of a file on
+     * disk? (see the class description) Must be set before calling
+     * \ref build().
+     */
+    inline void setOutOfCore(bool outOfCore) { Assert(!isBuilt()); m_outOfCore = outOfCore; }
+
+    /// Does the tree page its triangle data in and out of a file on disk?
+    inline bool getOutOfCore() const { return m_outOfCore; }
+
+    /// Set the memory limit of the out-of-core page caches (in bytes)
+    inline void setPageCacheSize(size_t size) { Assert(!isBuilt()); m_pageCacheSize = size; }
+
+    /// Return the memory limit of the out-of-core page caches (in bytes)
+    inline size_t getPageCacheSize() const { return m_pageCacheSize; }
+
+    /// Return the page file of an out-of-core tree (or \c NULL)
+    inline const GeometryPager *getPager() const { return m_pager.get(); }
+
     /// Build the kd-tree (needs to be called before tracing any rays)
     void build();
 
+    /**
+     * \brief Return the memory used by the nodes, index lists and
+     * precomputed triangle data in bytes
+     */
+    size_t getMemoryUsage() const;
+
     //! @}
     // =============================================================
 
@@ -175,10 +217,51 @@ public:
      */
     bool rayIntersect(const Ray &ray) const;
 
+    /**
+     * \brief Intersect a stream of rays against all primitives stored in
+     * the kd-tree and return detailed intersection information
+     *
+     * When coherent ray tracing is available, the rays are first
+     * regrouped by their direction octant and the position of their
+     * origin, after which the groups are traced as SIMD packets of the
+     * requested width. Leftover rays are traced using narrower packets
+     * or one at a time. The rays may thus be in arbitrary order, though
+     * coherent streams (e.g. camera rays of neighboring pixels) are
+     * traced most efficiently. Rays that miss are marked by an invalid
+     * intersection record.
+     *
+     * \param packetWidth
+     *    Widest packet that should be used (1, 4, 8 or 16). The
+     *    default (0) selects \ref getMaxPacketWidth().
+     */
+    void rayIntersectBatch(const Ray *rays, size_t count,
+        Intersection *its, int packetWidth = 0) const;
+
+    /**
+     * \brief Test a stream of rays for occlusion with respect to all
+     * primitives stored in the kd-tree
+     *
+     * \sa rayIntersectBatch
+     */
+    void rayIntersectBatch(const Ray *rays, size_t count,
+        bool *occluded, int packetWidth = 0) const;
+
+    /**
+     * \brief Return the widest ray packet supported by this build
+     *
+     * This is 16 with AVX-512, 8 with AVX2, 4 with SSE, and 1 when
+     * coherent ray tracing is disabled.
+     */
+    static int getMaxPacketWidth();
+
 #if defined(MTS_HAS_COHERENT_RT)
     /**
      * \brief Intersect four rays with the stored triangle meshes while making
      * use of ray coherence to do this very efficiently. Requires SSE.
+     *
+     * In compact and out-of-core mode (see \ref setCompact() and
+     * \ref setOutOfCore()), the packet functions fall back to tracing
+     * the rays one at a time.
      */
     void rayIntersectPacket(const RayPacket4 &packet,
         const RayInterval4 &interval, Intersection4 &its, void *temp) const;
@@ -189,6 +272,30 @@ public:
      */
     void rayIntersectPacketIncoherent(const RayPacket4 &packet,
         const RayInterval4 &interval, Intersection4 &its, void *temp) const;
+
+#if defined(MTS_AVX)
+    /**
+     * \brief Intersect eight rays with the stored triangle meshes
+     * while making use of ray coherence. Requires AVX2.
+     *
+     * Like the 4-wide version, this traces the rays one at a time in
+     * compact and out-of-core mode.
+     */
+    void rayIntersectPacket(const RayPacket8 &packet,
+        const RayInterval8 &interval, Intersection8 &its, void *temp) const;
+#endif
+
+#if defined(MTS_AVX512)
+    /**
+     * \brief Intersect sixteen rays with the stored triangle meshes
+     * while making use of ray coherence. Requires AVX-512.
+     *
+     * Like the 4-wide version, this traces the rays one at a time in
+     * compact and out-of-core mode.
+     */
+    void rayIntersectPacket(const RayPacket16 &packet,
+        const RayInterval16 &interval, Intersection16 &its, void *temp) const;
+#endif
 #endif
     //! @}
     // =============================================================
@@ -250,7 +357,32 @@ protected:
         IntersectionCache *cache =
             static_cast<IntersectionCache *>(temp);
 
-#if defined(MTS_KD_CONSERVE_MEMORY)
+        if (EXPECT_TAKEN(m_triAccel != NULL || m_pager != NULL)) {
+            const TriAccel &ta = m_triAccel ? m_triAccel[idx] : m_pager->get(idx);
+            if (EXPECT_TAKEN(ta.k != KNoTriangleFlag)) {
+                Float tempU, tempV, tempT;
+                if (ta.rayIntersect(ray, mint, maxt, tempU, tempV, tempT)) {
+                    t = tempT;
+                    cache->shapeIndex = ta.shapeIndex;
+                    cache->primIndex = ta.primIndex;
+                    cache->u = tempU;
+                    cache->v = tempV;
+                    return true;
+                }
+            } else {
+                uint32_t shapeIndex = ta.shapeIndex;
+                const Shape *shape = m_shapes[shapeIndex];
+                if (shape->rayIntersect(ray, mint, maxt, t,
+                        reinterpret_cast<uint8_t*>(temp) + 2*sizeof(IndexType))) {
+                    cache->shapeIndex = shapeIndex;
+                    cache->primIndex = KNoTriangleFlag;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /* Compact mode: intersect the indexed mesh data */
         IndexType shapeIdx = findShape(idx);
         if (EXPECT_TAKEN(m_triangleFlag[shapeIdx])) {
             const TriMesh *mesh =
@@ -277,29 +409,6 @@ protected:
                 return true;
             }
         }
-#else
-        const TriAccel &ta = m_triAccel[idx];
-        if (EXPECT_TAKEN(m_triAccel[idx].k != KNoTriangleFlag)) {
-            Float tempU, tempV, tempT;
-            if (ta.rayIntersect(ray, mint, maxt, tempU, tempV, tempT)) {
-                t = tempT;
-                cache->shapeIndex = ta.shapeIndex;
-                cache->primIndex = ta.primIndex;
-                cache->u = tempU;
-                cache->v = tempV;
-                return true;
-            }
-        } else {
-            uint32_t shapeIndex = ta.shapeIndex;
-            const Shape *shape = m_shapes[shapeIndex];
-            if (shape->rayIntersect(ray, mint, maxt, t,
-                    reinterpret_cast<uint8_t*>(temp) + 2*sizeof(IndexType))) {
-                cache->shapeIndex = shapeIndex;
-                cache->primIndex = KNoTriangleFlag;
-                return true;
-            }
-        }
-#endif
         return false;
     }
 
@@ -309,7 +418,19 @@ protected:
      */
     FINLINE bool intersect(const Ray &ray, IndexType idx,
             Float mint, Float maxt) const {
-#if defined(MTS_KD_CONSERVE_MEMORY)
+        if (EXPECT_TAKEN(m_triAccel != NULL || m_pager != NULL)) {
+            const TriAccel &ta = m_triAccel ? m_triAccel[idx] : m_pager->get(idx);
+            uint32_t shapeIndex = ta.shapeIndex;
+            const Shape *shape = m_shapes[shapeIndex];
+            if (EXPECT_TAKEN(ta.k != KNoTriangleFlag)) {
+                Float tempU, tempV, tempT;
+                return ta.rayIntersect(ray, mint, maxt, tempU, tempV, tempT);
+            } else {
+                return shape->rayIntersect(ray, mint, maxt);
+            }
+        }
+
+        /* Compact mode: intersect the indexed mesh data */
         IndexType shapeIdx = findShape(idx);
         if (EXPECT_TAKEN(m_triangleFlag[shapeIdx])) {
             const TriMesh *mesh =
@@ -323,17 +444,6 @@ protected:
             const Shape *shape = m_shapes[shapeIdx];
             return shape->rayIntersect(ray, mint, maxt);
         }
-#else
-        const TriAccel &ta = m_triAccel[idx];
-        uint32_t shapeIndex = ta.shapeIndex;
-        const Shape *shape = m_shapes[shapeIndex];
-        if (EXPECT_TAKEN(m_triAccel[idx].k != KNoTriangleFlag)) {
-            Float tempU, tempV, tempT;
-            return ta.rayIntersect(ray, mint, maxt, tempU, tempV, tempT);
-        } else {
-            return shape->rayIntersect(ray, mint, maxt);
-        }
-#endif
     }
 
     /**
@@ -343,8 +453,19 @@ protected:
     template<bool BarycentricPos> FINLINE void fillIntersectionRecord(const Ray &ray,
             const void *temp, Intersection &its) const {
         const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
-        const Shape *shape = m_shapes[cache->shapeIndex];
-        if (m_triangleFlag[cache->shapeIndex]) {
+        fillIntersectionRecord<BarycentricPos>(m_shapes[cache->shapeIndex],
+            m_triangleFlag[cache->shapeIndex], ray, temp, its);
+    }
+
+    /**
+     * \brief Fill a detailed intersection record for a hit on \c shape
+     * (also used by \ref ShapeBVH, which shares the temporary storage layout)
+     */
+    template<bool BarycentricPos> static FINLINE void fillIntersectionRecord(
+            const Shape *shape, bool isTriangle, const Ray &ray,
+            const void *temp, Intersection &its) {
+        const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
+        if (isTriangle) {
             const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
             const Triangle &tri = trimesh->getTriangles()[cache->primIndex];
             const Point *vertexPositions = trimesh->getVertexPositions();
@@ -427,6 +548,14 @@ protected:
         its.wi = its.toLocal(-ray.d);
     }
 
+    /**
+     * \brief Compute the geometric normal and UV coordinates of a hit
+     * on \c hitShape for the compact \ref rayIntersect() query
+     */
+    static void fillCompactIntersectionRecord(const Shape *hitShape,
+        bool isTriangle, const Ray &ray, Float t, const void *temp,
+        ConstShapePtr &shape, Normal &n, Point2 &uv);
+
     /// Plain shadow ray query (used by the 'instance' plugin)
     inline bool rayIntersect(const Ray &ray, Float _mint, Float _maxt) const {
         Float mint, maxt, tempT = std::numeric_limits<Float>::infinity();
@@ -457,15 +586,45 @@ protected:
         return false;
     }
 
+    /**
+     * \brief Shared implementation of the two \ref rayIntersectBatch()
+     * variants (exactly one of \c its and \c occluded is non-NULL)
+     */
+    void rayIntersectStream(const Ray *rays, size_t count,
+        Intersection *its, bool *occluded, int packetWidth) const;
+
+#if defined(MTS_HAS_COHERENT_RT) && defined(MTS_AVX)
+    /// Packet traversal shared by the 8- and 16-wide \ref rayIntersectPacket()
+    template <typename SIMD> void rayIntersectPacketWide(
+        const TRayPacket<SIMD> &packet, const TRayInterval<SIMD> &interval,
+        TIntersection<SIMD> &its, void *temp) const;
+#endif
+
+    /**
+     * \brief Write the precomputed triangle data to a page file in the
+     * depth-first order of the leaves (used in out-of-core mode)
+     */
+    void buildPages();
+
+    /// Append the precomputed data of a primitive to the page file
+    void appendPagedRecord(IndexType idx);
+
     /// Virtual destructor
     virtual ~ShapeKDTree();
 private:
     std::vector<const Shape *> m_shapes;
     std::vector<bool> m_triangleFlag;
     std::vector<IndexType> m_shapeMap;
-#if !defined(MTS_KD_CONSERVE_MEMORY)
+    /* Precomputed triangle data (NULL in compact and out-of-core mode) */
     TriAccel *m_triAccel;
-#endif
+    bool m_compact;
+    /* Out-of-core storage of the precomputed triangle data */
+    ref<GeometryPager> m_pager;
+    bool m_outOfCore;
+    size_t m_pageCacheSize;
+    /* Packet traversal doesn't pass the ray time to generic
+       shapes, hence batches only use it for pure triangle scenes */
+    bool m_trianglesOnly;
 };
 
 MTS_NAMESPACE_END
@@ -0,0 +1,98 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_TRIACCEL_AVX_H_)
+#define __MITSUBA_RENDER_TRIACCEL_AVX_H_
+
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/core/ray_avx.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Intersect a wide ray packet with a TriAccel triangle
+ *
+ * Identical to the SSE version in \c triaccel_sse.h, except that it
+ * is templated on the SIMD width.
+ */
+template <typename SIMD> FINLINE typename SIMD::Mask rayIntersectPacket(
+        const TriAccel &tri, const TRayPacket<SIMD> &packet,
+        typename SIMD::Vec mint, typename SIMD::Vec maxt,
+        typename SIMD::Mask inactive, TIntersection<SIMD> &its) {
+    typedef typename SIMD::Vec Vec;
+    typedef typename SIMD::Mask Mask;
+    static const int waldModulo[4] = { 1, 2, 0, 1 };
+    const int ku = waldModulo[tri.k], kv = waldModulo[tri.k+1];
+
+    /* Get the u and v components */
+    const Vec
+        o_u = packet.o[ku].ps, o_v = packet.o[kv].ps, o_k = packet.o[tri.k].ps,
+        d_u = packet.d[ku].ps, d_v = packet.d[kv].ps, d_k = packet.d[tri.k].ps;
+
+    const Vec
+        n_u = SIMD::set1(tri.n_u),
+        n_v = SIMD::set1(tri.n_v),
+        n_d = SIMD::set1(tri.n_d);
+
+    /* Calculate the plane intersection */
+    const Vec
+        num   = SIMD::sub(SIMD::sub(SIMD::sub(n_d, SIMD::mul(o_u, n_u)),
+                    SIMD::mul(o_v, n_v)), o_k),
+        denom = SIMD::add(SIMD::add(SIMD::mul(d_u, n_u),
+                    SIMD::mul(d_v, n_v)), d_k),
+        t     = SIMD::div(num, denom);
+
+    Mask hasIts = SIMD::maskAndNot(SIMD::maskAnd(
+        SIMD::cmpgt(maxt, t), SIMD::cmpgt(t, mint)), inactive);
+
+    if (SIMD::movemask(hasIts) == 0)
+        return hasIts;
+
+    const Vec
+        hu = SIMD::add(o_u, SIMD::sub(SIMD::mul(t, d_u), SIMD::set1(tri.a_u))),
+        hv = SIMD::add(o_v, SIMD::sub(SIMD::mul(t, d_v), SIMD::set1(tri.a_v)));
+
+    const Vec
+        u = SIMD::add(SIMD::mul(hv, SIMD::set1(tri.b_nu)),
+                SIMD::mul(hu, SIMD::set1(tri.b_nv))),
+        v = SIMD::add(SIMD::mul(hu, SIMD::set1(tri.c_nu)),
+                SIMD::mul(hv, SIMD::set1(tri.c_nv)));
+
+    const Vec zero = SIMD::set1(0.0f);
+    hasIts = SIMD::maskAnd(hasIts, SIMD::maskAnd(
+        SIMD::maskAnd(SIMD::cmpge(u, zero), SIMD::cmpge(v, zero)),
+        SIMD::cmpge(SIMD::set1(1.0f), SIMD::add(u, v))));
+
+    if (SIMD::movemask(hasIts) == 0)
+        return hasIts;
+
+    its.t.ps  = SIMD::select(hasIts, t, its.t.ps);
+    its.u.ps  = SIMD::select(hasIts, u, its.u.ps);
+    its.v.ps  = SIMD::select(hasIts, v, its.v.ps);
+    its.primIndex.ps = SIMD::select(hasIts,
+        SIMD::set1i((int32_t) tri.primIndex), its.primIndex.ps);
+    its.shapeIndex.ps = SIMD::select(hasIts,
+        SIMD::set1i((int32_t) tri.shapeIndex), its.shapeIndex.ps);
+
+    return hasIts;
+}
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_TRIACCEL_AVX_H_ */
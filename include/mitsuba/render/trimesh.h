@@ -22,8 +22,19 @@
 
 #include <mitsuba/core/triangle.h>
 #include <mitsuba/core/pmf.h>
+#include <mitsuba/core/mmap.h>
 #include <mitsuba/render/shape.h>
 
+/* Identifiers of the serialized mesh format */
+#define MTS_FILEFORMAT_HEADER     0x041C
+#define MTS_FILEFORMAT_VERSION_V3 0x0003
+#define MTS_FILEFORMAT_VERSION_V4 0x0004
+/// Uncompressed variant of version 4, which can be memory-mapped
+#define MTS_FILEFORMAT_VERSION_V5 0x0005
+
+/// Alignment of the arrays in an uncompressed serialized mesh (in bytes)
+#define MTS_FILEFORMAT_ALIGNMENT  64
+
 MTS_NAMESPACE_BEGIN
 
 /**
@@ -251,6 +262,21 @@ public:
      */
     void serialize(Stream *stream) const;
 
+    /**
+     * \brief Serialize to a file stream without compression
+     *
+     * Writes the same data as \ref serialize(Stream *), but uses format
+     * version 5: nothing is compressed, and all arrays are aligned to
+     * \ref MTS_FILEFORMAT_ALIGNMENT bytes relative to the beginning of the
+     * stream. Such files are larger, but they can be memory-mapped by the
+     * \c serialized plugin, which then references the vertex and index
+     * data directly (see \ref loadMapped()).
+     */
+    void serializeUncompressed(Stream *stream) const;
+
+    /// Does this mesh reference data in a memory-mapped file?
+    inline bool isMapped() const { return m_mmap.get() != NULL; }
+
     /**
      * \brief Build a discrete probability distribution
      * for sampling.
@@ -259,6 +285,13 @@ public:
      */
     virtual void configure();
 
+    /**
+     * \brief Recompute the bounding box, vertex normals and tangents,
+     * and discard the area sampling table after the vertex positions
+     * have been modified
+     */
+    virtual void updateGeometry();
+
     /**
      * \brief Return the derivative of the normal vector with
      * respect to the UV parameterization
@@ -324,6 +357,55 @@ protected:
     /// Load a Mitsuba compressed triangle mesh substream
     void loadCompressed(Stream *stream, int idx = 0);
 
+    /**
+     * \brief Load an uncompressed mesh (format version 5) from a
+     * memory-mapped file
+     *
+     * When the precision and byte order of the file match the host,
+     * the mesh arrays point directly into the mapping, which should be
+     * created with the \c copyOnWrite flag so that the mesh can still be
+     * transformed in place. Otherwise, the data is copied and converted.
+     *
+     * \param offset
+     *     Position of the mesh within the file
+     */
+    void loadMapped(MemoryMappedFile *mmap, size_t offset);
+
+    /**
+     * \brief Read an uncompressed mesh (the stream must be positioned
+     * right after the header). When \c mmap is specified, the stream
+     * must refer to its contents
+     */
+    void loadUncompressed(Stream *stream, MemoryMappedFile *mmap);
+
+    /// Does the given array point into the memory-mapped file?
+    inline bool isMapped(const void *ptr) const {
+        if (!m_mmap.get() || !ptr)
+            return false;
+        const uint8_t *data = static_cast<const uint8_t *>(m_mmap->getData());
+        return ptr >= data && ptr < data + m_mmap->getSize();
+    }
+
+    /// Release an array, unless it is part of the memory-mapped file
+    template <typename T> inline void releaseArray(T *&ptr) {
+        if (ptr && !isMapped(ptr))
+            delete[] ptr;
+        ptr = NULL;
+    }
+
+    /**
+     * \brief Replace an array that is part of the memory-mapped file
+     * by a private copy before modifying it. The mapping may be shared
+     * with other meshes that were loaded from the same location.
+     */
+    template <typename T> inline void detachArray(T *&ptr, size_t count) {
+        if (!isMapped(ptr))
+            return;
+        T *copy = new T[count];
+        memcpy(copy, ptr, sizeof(T) * count);
+        ptr = copy;
+    }
+
     /**
      * \brief Reads the header information of a compressed file, returning
      * the version ID.
@@ -364,6 +446,7 @@ protected:
     size_t m_vertexCount;
     bool m_flipNormals;
     bool m_faceNormals;
+    ref<MemoryMappedFile> m_mmap;
 
     /* Surface and distribution -- generated on demand */
     DiscreteDistribution m_areaDistr;
@@ -45,6 +45,16 @@ public:
     /// Look up a floating point value by position
     virtual Float lookupFloat(const Point &p) const;
 
+    /**
+     * \brief Look up floating point values for a batch of positions
+     *
+     * The default implementation calls \ref lookupFloat() once per point.
+     * Data sources with a non-trivial per-lookup setup cost (e.g. sparse
+     * grid accessors) can override it to amortize that cost over the batch,
+     * which is useful for integrators that march along a ray segment.
+     */
+    virtual void lookupFloat(const Point *p, Float *result, size_t count) const;
+
     /// Are spectrum-valued lookups permitted?
     virtual bool supportsSpectrumLookups() const;
 
@@ -17,6 +17,7 @@
 */
 
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/render/trimesh.h>
 #include <set>
 
 using namespace mitsuba;
@@ -29,6 +30,7 @@ public:
         m_xres = m_yres = -1;
         m_filmType = "hdrfilm";
         m_packGeometry = true;
+        m_uncompressedGeometry = false;
         m_importMaterials = true;
         m_importAnimations = false;
     }
@@ -44,10 +46,19 @@ public:
     inline void setMapSmallerSide(bool mapSmallerSide) { m_mapSmallerSide = mapSmallerSide; }
     inline void setResolution(int xres, int yres) { m_xres = xres; m_yres = yres; }
     inline void setPackGeometry(bool packGeometry) { m_packGeometry = packGeometry; }
+    inline void setUncompressedGeometry(bool uncompressed) { m_uncompressedGeometry = uncompressed; }
     inline void setImportMaterials(bool importMaterials) { m_importMaterials = importMaterials; }
     inline void setImportAnimations(bool importAnimations) { m_importAnimations = importAnimations; }
     inline void setFilmType(const std::string &filmType) { m_filmType = filmType; }
     inline const fs::path &getFilename() const { return m_filename; }
+
+    /// Write a mesh using the configured (compressed or mappable) format
+    inline void writeMesh(const TriMesh *mesh, Stream *stream) const {
+        if (m_uncompressedGeometry)
+            mesh->serializeUncompressed(stream);
+        else
+            mesh->serialize(stream);
+    }
 private:
     void convertCollada(const fs::path &inputFile, std::ostream &os,
         const fs::path &textureDirectory,
@@ -64,5 +75,5 @@ public:
     ref<FileStream> m_geometryFile;
     fs::path m_geometryFileName;
     std::vector<size_t> m_geometryDict;
-    bool m_packGeometry;
+    bool m_packGeometry, m_uncompressedGeometry;
 };
@@ -62,6 +62,7 @@ void help() {
         <<  "   -m          Map the larger image side to the full field of view" << endl << endl
         <<  "   -z          Import animations" << endl << endl
         <<  "   -y          Don't pack all geometry data into a single file" << endl << endl
+        <<  "   -u          Store geometry uncompressed, so that it can be memory-mapped" << endl << endl
         <<  "   -n          Don't import any materials (an adjustments file will be necessary)" << endl << endl
         <<  "   -l <type>   Override the type of film (e.g. 'hdrfilm', 'ldrfilm', ..)" << endl << endl
         <<  "   -r <w>x<h>  Override the image resolution to e.g. 1920x1080" << endl << endl
@@ -77,11 +78,11 @@ int importMain(int argc, char **argv) {
     FileResolver *fileResolver = Thread::getThread()->getFileResolver();
     ELogLevel logLevel = EInfo;
     bool packGeometry = true, importMaterials = true,
-         importAnimations = false;
+         importAnimations = false, uncompressedGeometry = false;
 
     optind = 1;
 
-    while ((optchar = getopt(argc, argv, "snzvyhmr:a:l:")) != -1) {
+    while ((optchar = getopt(argc, argv, "snzvyuhmr:a:l:")) != -1) {
         switch (optchar) {
             case 'a': {
                     std::vector<std::string> paths = tokenize(optarg, ";");
@@ -110,6 +111,9 @@ int importMain(int argc, char **argv) {
             case 'y':
                 packGeometry = false;
                 break;
+            case 'u':
+                uncompressedGeometry = true;
+                break;
             case 'r': {
                     std::vector<std::string> tokens = tokenize(optarg, "x");
                     if (tokens.size() != 2)
@@ -144,6 +148,7 @@ int importMain(int argc, char **argv) {
     converter.setImportAnimations(importAnimations);
     converter.setMapSmallerSide(mapSmallerSide);
     converter.setPackGeometry(packGeometry);
+    converter.setUncompressedGeometry(uncompressedGeometry);
     converter.setFilmType(filmType);
 
     const Logger *logger = Thread::getThread()->getLogger();
@@ -17,7 +17,7 @@
 */
 
 #include <mitsuba/render/emitter.h>
-#include <mitsuba/render/shape.h>
+#include <mitsuba/render/trimesh.h>
 #include <mitsuba/render/medium.h>
 #include <mitsuba/hw/gpuprogram.h>
 #include <mitsuba/core/warp.h>
@@ -205,6 +205,65 @@ public:
         return m_shape->getAABB();
     }
 
+    bool getEmissionBounds(EmissionBounds &bounds) const {
+        if (!m_shape)
+            return false;
+
+        bounds.aabb = m_shape->getAABB();
+        bounds.power = m_power.getLuminance();
+        bounds.cosThetaE = 0.0f; /* One-sided emission around the normals */
+
+        /* Bound the normals of a triangulated version of the shape. When
+           the mesh has vertex normals, these are interpolated and used to
+           decide on which side light is emitted, otherwise the faces are */
+        ref<TriMesh> mesh = m_shape->createTriMesh();
+        if (!mesh || mesh->getTriangleCount() == 0)
+            return true;
+
+        const Triangle *triangles = mesh->getTriangles();
+        const Point *positions = mesh->getVertexPositions();
+        const Normal *normals = mesh->getVertexNormals();
+        size_t count = normals ? mesh->getVertexCount()
+            : mesh->getTriangleCount();
+
+        Vector axis(0.0f);
+        for (size_t i=0; i<count; ++i) {
+            if (normals) {
+                axis += Vector(normals[i]);
+            } else {
+                const Triangle &tri = triangles[i];
+                axis += cross(positions[tri.idx[1]] - positions[tri.idx[0]],
+                              positions[tri.idx[2]] - positions[tri.idx[0]]);
+            }
+        }
+        if (axis.isZero())
+            return true;
+        axis = normalize(axis);
+
+        Float cosThetaO = 1.0f;
+        for (size_t i=0; cosThetaO >= 0 && i<count; ++i) {
+            Vector n;
+            if (normals) {
+                n = Vector(normals[i]);
+            } else {
+                const Triangle &tri = triangles[i];
+                n = cross(positions[tri.idx[1]] - positions[tri.idx[0]],
+                          positions[tri.idx[2]] - positions[tri.idx[0]]);
+            }
+            Float length = n.length();
+            if (length != 0)
+                cosThetaO = std::min(cosThetaO, dot(axis, n) / length);
+        }
+
+        /* Interpolated normals may leave cones that are wider than a
+           hemisphere, so these are not worth representing */
+        if (cosThetaO >= 0) {
+            bounds.axis = axis;
+            bounds.cosThetaO = cosThetaO;
+        }
+        return true;
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "AreaLight[" << endl
@@ -61,6 +61,14 @@ MTS_NAMESPACE_BEGIN
  *        \emph{filename}\code{.mip} to be created.
  *        \default{automatic---use caching for images larger than 1M pixels.}
  *     }
+ *     \parameter{aliasSampling}{\Boolean}{
+ *        Select pixels for importance sampling using alias tables, which
+ *        take constant time instead of the binary searches of the default
+ *        approach based on the inversion of a cumulative distribution function.
+ *        The alias method doesn't preserve the stratification of the sampler,
+ *        and it needs twice the amount of memory.
+ *        \default{automatic---use alias tables for images larger than 1M pixels.}
+ *     }
  *     \parameter{samplingWeight}{\Float}{
  *         Specifies the relative amount of samples
  *         allocated to this emitter. \default{1}
@@ -186,6 +194,12 @@ public:
 
         /* Scale factor */
         m_scale = props.getFloat("scale", 1.0f);
+
+        /* Use constant-time sampling for large images, where the binary
+           searches over the CDF tables become expensive */
+        const Vector2i &size = m_mipmap->getSize();
+        m_aliasSampling = props.getBoolean("aliasSampling",
+            (size_t) size.x * (size_t) size.y > 1024*1024);
     }
 
     EnvironmentMap(Stream *stream, InstanceManager *manager) : Emitter(stream, manager),
@@ -194,6 +208,7 @@ public:
         Log(EDebug, "Unserializing texture \"%s\"", m_filename.filename().string().c_str());
         m_gamma = stream->readFloat();
         m_scale = stream->readFloat();
+        m_aliasSampling = stream->readBool();
         m_sceneBSphere = BSphere(stream);
         m_geoBSphere = BSphere(stream);
 
@@ -236,6 +251,7 @@ public:
         stream->writeString(m_filename.string());
         stream->writeFloat(m_gamma);
         stream->writeFloat(m_scale);
+        stream->writeBool(m_aliasSampling);
         m_sceneBSphere.serialize(stream);
         m_geoBSphere.serialize(stream);
 
@@ -261,54 +277,74 @@ public:
         Emitter::configure();
 
         if (!m_rowWeights) {
-            /// Build CDF tables to sample the environment map
+            /// Build CDF or alias tables to sample the environment map
             const MIPMap::Array2DType &array = m_mipmap->getArray();
             m_size = array.getSize();
 
             size_t nEntries = (size_t) (m_size.x + 1) * (size_t) m_size.y,
                 totalStorage = sizeof(float) * (m_size.x + 1 + nEntries);
+            if (m_aliasSampling)
+                totalStorage = sizeof(AliasDistribution2D::Entry)
+                    * (size_t) m_size.x * (size_t) (m_size.y + 1);
 
-            Log(EInfo, "Precomputing data structures for environment map sampling (%s)",
-                memString(totalStorage).c_str());
+            Log(EInfo, "Precomputing data structures for environment map sampling (%s%s)",
+                memString(totalStorage).c_str(), m_aliasSampling ? ", alias tables" : "");
 
             ref<Timer> timer = new Timer();
-            m_cdfCols = new float[nEntries];
-            m_cdfRows = new float[m_size.y + 1];
             m_rowWeights = new Float[m_size.y];
-
-            size_t colPos = 0, rowPos = 0;
             Float rowSum = 0.0f;
 
-            /* Build a marginal & conditional cumulative distribution
-               function over luminances weighted by sin(theta) */
-            m_cdfRows[rowPos++] = 0;
-            for (int y=0; y<m_size.y; ++y) {
-                Float colSum = 0;
-
-                m_cdfCols[colPos++] = 0;
-                for (int x=0; x<m_size.x; ++x) {
-                    Spectrum value(array(x, y));
-
-                    colSum += value.getLuminance();
-                    m_cdfCols[colPos++] = (float) colSum;
+            if (m_aliasSampling) {
+                /* Build a marginal & conditional alias table
+                   over luminances weighted by sin(theta) */
+                std::vector<Float> luminances(m_size.x);
+                m_aliasTable.init(m_size.x, m_size.y);
+                for (int y=0; y<m_size.y; ++y) {
+                    for (int x=0; x<m_size.x; ++x)
+                        luminances[x] = Spectrum(array(x, y)).getLuminance();
+
+                    Float weight = std::sin((y + 0.5f) * M_PI / m_size.y);
+                    m_rowWeights[y] = weight;
+                    m_aliasTable.setRow(y, &luminances[0], weight);
+                }
+                rowSum = m_aliasTable.normalize();
+            } else {
+                m_cdfCols = new float[nEntries];
+                m_cdfRows = new float[m_size.y + 1];
+
+                size_t colPos = 0, rowPos = 0;
+
+                /* Build a marginal & conditional cumulative distribution
+                   function over luminances weighted by sin(theta) */
+                m_cdfRows[rowPos++] = 0;
+                for (int y=0; y<m_size.y; ++y) {
+                    Float colSum = 0;
+
+                    m_cdfCols[colPos++] = 0;
+                    for (int x=0; x<m_size.x; ++x) {
+                        Spectrum value(array(x, y));
+
+                        colSum += value.getLuminance();
+                        m_cdfCols[colPos++] = (float) colSum;
+                    }
+
+                    float normalization = 1.0f / (float) colSum;
+                    for (int x=1; x<m_size.x; ++x)
+                        m_cdfCols[colPos-x-1] *= normalization;
+                    m_cdfCols[colPos-1] = 1.0f;
+
+                    Float weight = std::sin((y + 0.5f) * M_PI / m_size.y);
+                    m_rowWeights[y] = weight;
+                    rowSum += colSum * weight;
+                    m_cdfRows[rowPos++] = (float) rowSum;
                 }
 
-                float normalization = 1.0f / (float) colSum;
-                for (int x=1; x<m_size.x; ++x)
-                    m_cdfCols[colPos-x-1] *= normalization;
-                m_cdfCols[colPos-1] = 1.0f;
-
-                Float weight = std::sin((y + 0.5f) * M_PI / m_size.y);
-                m_rowWeights[y] = weight;
-                rowSum += colSum * weight;
-                m_cdfRows[rowPos++] = (float) rowSum;
+                float normalization = 1.0f / (float) rowSum;
+                for (int y=1; y<m_size.y; ++y)
+                    m_cdfRows[rowPos-y-1] *= normalization;
+                m_cdfRows[rowPos-1] = 1.0f;
             }
 
-            float normalization = 1.0f / (float) rowSum;
-            for (int y=1; y<m_size.y; ++y)
-                m_cdfRows[rowPos-y-1] *= normalization;
-            m_cdfRows[rowPos-1] = 1.0f;
-
             if (rowSum == 0)
                 Log(EError, "The environment map is completely black -- this is not allowed.");
             else if (!std::isfinite(rowSum))
@@ -332,7 +368,7 @@ public:
         /* Create a bounding sphere that surrounds the scene */
         BSphere sceneBSphere(scene->getAABB().getBSphere());
         sceneBSphere.radius = std::max(Epsilon, sceneBSphere.radius * 1.5f);
-        BSphere geoBSphere(scene->getKDTree()->getAABB().getBSphere());
+        BSphere geoBSphere(scene->getGeometryAABB().getBSphere());
 
         if (sceneBSphere != m_sceneBSphere || geoBSphere != m_geoBSphere) {
             m_sceneBSphere = sceneBSphere;
@@ -566,8 +602,15 @@ public:
     /// Helper function that samples a direction from the environment map
     void internalSampleDirection(Point2 sample, Vector &d, Spectrum &value, Float &pdf) const {
         /* Sample a discrete pixel position */
-        uint32_t row = sampleReuse(m_cdfRows, m_size.y, sample.y),
-                 col = sampleReuse(m_cdfCols + row * (m_size.x+1), m_size.x, sample.x);
+        uint32_t row, col;
+        if (m_aliasSampling) {
+            Point2u pixel = m_aliasTable.sampleReuse(sample);
+            row = pixel.y;
+            col = pixel.x;
+        } else {
+            row = sampleReuse(m_cdfRows, m_size.y, sample.y);
+            col = sampleReuse(m_cdfCols + row * (m_size.x+1), m_size.x, sample.x);
+        }
 
         /* Using the remaining bits of precision to shift the sample by an offset
            drawn from a tent function. This effectively creates a sampling strategy
@@ -664,6 +707,8 @@ private:
     MIPMap *m_mipmap;
     float *m_cdfRows, *m_cdfCols;
     Float *m_rowWeights;
+    AliasDistribution2D m_aliasTable;
+    bool m_aliasSampling;
     fs::path m_filename;
     Float m_gamma, m_scale;
     Float m_normalization;
@@ -154,6 +154,13 @@ public:
         return m_worldTransform->getTranslationBounds();
     }
 
+    bool getEmissionBounds(EmissionBounds &bounds) const {
+        /* Isotropic emission: leave the default cone (all directions) */
+        bounds.aabb = getAABB();
+        bounds.power = m_intensity.getLuminance() * 4 * M_PI;
+        return true;
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "PointEmitter[" << endl
@@ -215,6 +215,18 @@ public:
         return m_worldTransform->getTranslationBounds();
     }
 
+    bool getEmissionBounds(EmissionBounds &bounds) const {
+        bounds.aabb = getAABB();
+        bounds.power = m_intensity.getLuminance() * 2 * M_PI * (1 - m_cosCutoffAngle);
+        if (m_worldTransform->isStatic()) {
+            /* Rotating spot lights keep the default cone (all directions) */
+            bounds.axis = normalize(m_worldTransform->eval(0)(Vector(0, 0, 1)));
+            bounds.cosThetaO = 1.0f;
+            bounds.cosThetaE = m_cosCutoffAngle;
+        }
+        return true;
+    }
+
     std::string toString() const {
         std::ostringstream oss;
         oss << "SpotEmitter[" << std::endl
@@ -389,9 +389,11 @@ public:
     }
 
     void put(const ImageBlock *block) {
-        m_storage->put(block);
+        m_storage->putConcurrent(block);
     }
 
+    bool hasConcurrentPut() const { return true; }
+
     void setBitmap(const Bitmap *bitmap, Float multiplier) {
         bitmap->convert(m_storage->getBitmap(), multiplier);
     }
@@ -60,6 +60,11 @@ MTS_NAMESPACE_BEGIN
  *         \code{float16}, \code{float32}, or \code{uint32}
  *         \default{\code{float16}}
  *     }
+ *     \parameter{memoryLimit}{\Integer}{Upper bound (in MiB) on the amount
+ *         of memory used to hold finished image tiles that cannot be written
+ *         yet. Tiles beyond this budget are temporarily spilled to disk.
+ *         A value of zero disables the limit \default{0}
+ *     }
  *
  *     \parameter{\Unnamed}{\RFilter}{Reconstruction filter that should
  *     be used by the film. \default{\code{gaussian}, a windowed Gaussian filter}}
@@ -73,6 +78,15 @@ MTS_NAMESPACE_BEGIN
  * large output images that would otherwise not fit into memory (e.g.
  * 100K$\times$100K).
  *
+ * A finished tile can only be written once all of its neighbors are done,
+ * since their reconstruction filter footprints overlap it. To keep the
+ * number of such pending tiles small, this film requests that blocks are
+ * rendered in scanline order rather than in the usual spiral pattern.
+ * Blocks that arrive out of order (e.g. from slow network nodes) can still
+ * pile up; the \code{memoryLimit} parameter places a hard limit on their
+ * memory usage, in which case the least complete pending tiles are moved
+ * to a temporary file until their neighbors arrive.
+ *
  * When the image can fit into memory, usage of this plugin is discouraged:
  * due to the extra overhead of tracking image tiles, the rendering process
  * will be slower, and the output files also generally do not compress as
@@ -189,6 +203,11 @@ public:
         if (m_highQualityEdges)
             Log(EError, "The 'highQualityEdges' parameter is incompatible with the "
                 "tiled EXR film. Please disable it.");
+
+        int memoryLimit = props.getInteger("memoryLimit", 0);
+        if (memoryLimit < 0)
+            Log(EError, "The 'memoryLimit' parameter must be nonnegative!");
+        m_memoryLimit = (size_t) memoryLimit * 1024 * 1024;
     }
 
     TiledHDRFilm(Stream *stream, InstanceManager *manager)
@@ -200,6 +219,7 @@ public:
         for (size_t i=0; i<m_channelNames.size(); ++i)
             m_channelNames[i] = stream->readString();
         m_componentFormat = (Bitmap::EComponentFormat) stream->readUInt();
+        m_memoryLimit = stream->readSize();
     }
 
     virtual ~TiledHDRFilm() {
@@ -208,14 +228,18 @@ public:
 
     void serialize(Stream *stream, InstanceManager *manager) const {
         Film::serialize(stream, manager);
+        stream->writeUInt((uint32_t) m_pixelFormats.size());
         for (size_t i=0; i<m_pixelFormats.size(); ++i)
             stream->writeUInt(m_pixelFormats[i]);
         stream->writeUInt((uint32_t) m_channelNames.size());
         for (size_t i=0; i<m_channelNames.size(); ++i)
             stream->writeString(m_channelNames[i]);
         stream->writeUInt(m_componentFormat);
+        stream->writeSize(m_memoryLimit);
     }
 
+    bool hasScanlineOrder() const { return true; }
+
     void setDestinationFile(const fs::path &destFile, uint32_t blockSize) {
         if (m_output)
             develop(NULL, 0);
@@ -231,6 +255,10 @@ public:
         header.setTileDescription(Imf::TileDescription(blockSize, blockSize, Imf::ONE_LEVEL));
         header.insert("generated-by", Imf::StringAttribute("Mitsuba version " MTS_VERSION));
 
+        /* With the default (increasing Y) line order, OpenEXR would buffer
+           all tiles that are written out of order in memory */
+        header.lineOrder() = Imf::RANDOM_Y;
+
         if (m_pixelFormats.size() == 1) {
             /* Write a chromaticity tag when this is possible */
             Bitmap::EPixelFormat pixelFormat = m_pixelFormats[0];
@@ -294,7 +322,37 @@ public:
         }
 
         m_output->setFrameBuffer(*m_frameBuffer);
-        m_peakUsage = 0;
+        m_peakUsage = m_liveTiles = m_spillCount = 0;
+        m_tileState.clear();
+        m_tileState.resize((size_t) m_blocksH * (size_t) m_blocksV, ETileMissing);
+        m_neighborsDone.clear();
+        m_neighborsDone.resize(m_tileState.size(), 0);
+        m_spillFile = NULL;
+        m_spillSlots.clear();
+        m_freeSlots.clear();
+        m_slotCount = 0;
+        m_prototype = NULL;
+    }
+
+    /// Initialize the memory accounting from the first received block
+    void initializeLimit(const ImageBlock *block) {
+        m_prototype = block->clone();
+
+        /* Both copies of a tile are accounted for by the memory limit */
+        if (m_memoryLimit > 0) {
+            size_t tileSize = 2 * (block->getBitmap()->getBufferSize() + sizeof(ImageBlock));
+            m_maxLiveTiles = (int) std::min(m_memoryLimit / tileSize, (size_t) INT_MAX);
+
+            /* Writing a tile requires it and its 8 neighbors to be resident */
+            if (m_maxLiveTiles < 10) {
+                Log(EWarn, "The memory limit is too small to hold the 10 tiles "
+                    "that are needed at a time -- raising it to %s.",
+                    memString(10 * tileSize).c_str());
+                m_maxLiveTiles = 10;
+            }
+        } else {
+            m_maxLiveTiles = INT_MAX;
+        }
     }
 
     void put(const ImageBlock *block) {
@@ -310,32 +368,34 @@ public:
 
         int x = block->getOffset().x / (int) m_blockSize;
         int y = block->getOffset().y / (int) m_blockSize;
+        uint32_t idx = (uint32_t) x + (uint32_t) y * m_blocksH;
 
-        /* Create two copies: a clean one, and one that is used for accumulation */
-        ref<ImageBlock> copy1, copy2;
-        if (m_freeBlocks.size() > 0) {
-            copy1 = m_freeBlocks.back();
-            block->copyTo(copy1);
-            m_freeBlocks.pop_back();
-        } else {
-            copy1 = block->clone();
-            copy1->incRef();
-            ++m_peakUsage;
+        if (m_tileState[idx] != ETileMissing) {
+            Log(EWarn, "Ignoring a block that was already received (%i, %i)!", x, y);
+            return;
         }
 
-        if (m_freeBlocks.size() > 0) {
-            copy2 = m_freeBlocks.back();
-            block->copyTo(copy2);
-            m_freeBlocks.pop_back();
-        } else {
-            copy2 = block->clone();
-            copy2->incRef();
-            ++m_peakUsage;
-        }
+        if (!m_prototype)
+            initializeLimit(block);
 
-        uint32_t idx = (uint32_t) x + (uint32_t) y * m_blocksH;
+        /* Make room for the new tile, but keep the 3x3 neighborhood resident */
+        reserve(x, y);
+
+        /* Create two copies: a clean one, and one that is used for accumulation */
+        ImageBlock *copy1 = allocateBlock(block), *copy2 = allocateBlock(block);
         m_origBlocks[idx]   = copy1;
         m_mergedBlocks[idx] = copy2;
+        m_tileState[idx] = ETileResident;
+        m_peakUsage = std::max(m_peakUsage, ++m_liveTiles);
+
+        for (int yo = -1; yo <= 1; ++yo) {
+            for (int xo = -1; xo <= 1; ++xo) {
+                int xp = x + xo, yp = y + yo;
+                if ((xo != 0 || yo != 0) && xp >= 0 && yp >= 0 &&
+                    xp < m_blocksH && yp < m_blocksV)
+                    ++m_neighborsDone[(uint32_t) xp + (uint32_t) yp * m_blocksH];
+            }
+        }
 
         for (int yo = -1; yo <= 1; ++yo)
             for (int xo = -1; xo <= 1; ++xo)
@@ -354,36 +414,138 @@ public:
             "rendering technique or use a non-tiled film. (e.g. 'hdrfilm')");
     }
 
+    /// Return the number of neighbors of a tile that lie within the image
+    inline int neighborCount(int x, int y) const {
+        int nx = 1 + (x > 0 ? 1 : 0) + (x + 1 < m_blocksH ? 1 : 0);
+        int ny = 1 + (y > 0 ? 1 : 0) + (y + 1 < m_blocksV ? 1 : 0);
+        return nx * ny - 1;
+    }
+
+    /// Fetch a fresh image block holding a copy of \c block
+    ImageBlock *allocateBlock(const ImageBlock *block) {
+        ImageBlock *result;
+        if (m_freeBlocks.size() > 0) {
+            result = m_freeBlocks.back();
+            block->copyTo(result);
+            m_freeBlocks.pop_back();
+        } else {
+            ref<ImageBlock> copy = block->clone();
+            copy->incRef();
+            result = copy;
+        }
+        return result;
+    }
+
+    /**
+     * \brief Ensure that there is space for one more resident tile.
+     *
+     * When the memory limit is reached, the pending tile with the fewest
+     * finished neighbors (i.e. the one that is least likely to be needed
+     * soon) is spilled to disk. Tiles in the 3x3 neighborhood of
+     * <tt>(x, y)</tt> are never chosen.
+     */
+    void reserve(int x, int y) {
+        while (m_liveTiles >= m_maxLiveTiles) {
+            uint32_t victim = 0;
+            int victimDone = INT_MAX;
+
+            for (std::map<uint32_t, ImageBlock *>::iterator it = m_origBlocks.begin();
+                it != m_origBlocks.end(); ++it) {
+                uint32_t idx = it->first;
+                int xp = (int) (idx % m_blocksH), yp = (int) (idx / m_blocksH);
+                if (std::abs(xp - x) <= 1 && std::abs(yp - y) <= 1)
+                    continue;
+                if (m_neighborsDone[idx] < victimDone) {
+                    victim = idx;
+                    victimDone = m_neighborsDone[idx];
+                }
+            }
+
+            if (victimDone == INT_MAX)
+                Log(EError, "Internal error: unable to find a tile that can be spilled!");
+
+            spill(victim);
+        }
+    }
+
+    /// Move a resident tile to the temporary file
+    void spill(uint32_t idx) {
+        if (!m_spillFile) {
+            m_spillFile = FileStream::createTemporary();
+            Log(EInfo, "Memory limit reached, spilling pending tiles to \"%s\"",
+                m_spillFile->getPath().string().c_str());
+        }
+
+        ImageBlock *origBlock = m_origBlocks[idx], *mergedBlock = m_mergedBlocks[idx];
+        size_t slotSize = 2 * (4 * sizeof(int) + origBlock->getBitmap()->getBufferSize());
+
+        uint32_t slot;
+        if (m_freeSlots.size() > 0) {
+            slot = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        } else {
+            slot = m_slotCount++;
+        }
+
+        m_spillFile->seek((size_t) slot * slotSize);
+        origBlock->save(m_spillFile);
+        mergedBlock->save(m_spillFile);
+        m_spillSlots[idx] = slot;
+
+        m_freeBlocks.push_back(origBlock);
+        m_freeBlocks.push_back(mergedBlock);
+        m_origBlocks.erase(idx);
+        m_mergedBlocks.erase(idx);
+        m_tileState[idx] = ETileSpilled;
+        --m_liveTiles;
+        ++m_spillCount;
+    }
+
+    /// Bring a tile back into memory if it was spilled before
+    void restore(uint32_t idx, int x, int y) {
+        if (m_tileState[idx] != ETileSpilled)
+            return;
+
+        reserve(x, y);
+
+        ImageBlock *blocks[2];
+        for (int i=0; i<2; ++i)
+            blocks[i] = allocateBlock(m_prototype);
+
+        std::map<uint32_t, uint32_t>::iterator it = m_spillSlots.find(idx);
+        size_t slotSize = 2 * (4 * sizeof(int) + blocks[0]->getBitmap()->getBufferSize());
+        m_spillFile->seek((size_t) it->second * slotSize);
+        blocks[0]->load(m_spillFile);
+        blocks[1]->load(m_spillFile);
+        m_freeSlots.push_back(it->second);
+        m_spillSlots.erase(it);
+
+        m_origBlocks[idx]   = blocks[0];
+        m_mergedBlocks[idx] = blocks[1];
+        m_tileState[idx] = ETileResident;
+        m_peakUsage = std::max(m_peakUsage, ++m_liveTiles);
+    }
+
     void potentiallyWrite(int x, int y) {
         if (x < 0 || y < 0 || x >= m_blocksH || y >= m_blocksV)
             return;
 
         uint32_t idx = (uint32_t) x + (uint32_t) y * m_blocksH;
-        std::map<uint32_t, ImageBlock *>::iterator it = m_origBlocks.find(idx);
-        if (it == m_origBlocks.end())
-            return;
-
-        ImageBlock *origBlock = it->second;
-        if (origBlock == NULL)
-            return;
+        if ((m_tileState[idx] != ETileResident && m_tileState[idx] != ETileSpilled)
+            || m_neighborsDone[idx] != neighborCount(x, y))
+            return; /* Not all neighboring blocks are there yet */
 
-        /* This could be accelerated using some counters */
+        /* Make sure that the tile and its pending neighbors are resident */
         for (int yo = -1; yo <= 1; ++yo) {
             for (int xo = -1; xo <= 1; ++xo) {
                 int xp = x + xo, yp = y + yo;
-                if (xp < 0 || yp < 0 || xp >= m_blocksH || yp >= m_blocksV
-                   || (xp == x && yp == y))
-                    continue;
-
-                uint32_t idx2 = (uint32_t) xp + (uint32_t) yp * m_blocksH;
-                if (m_origBlocks.find(idx2) == m_origBlocks.end())
-                    return; /* Not all neighboring blocks are there yet */
+                if (xp >= 0 && yp >= 0 && xp < m_blocksH && yp < m_blocksV)
+                    restore((uint32_t) xp + (uint32_t) yp * m_blocksH, x, y);
             }
         }
 
+        ImageBlock *origBlock   = m_origBlocks[idx];
         ImageBlock *mergedBlock = m_mergedBlocks[idx];
-        if (mergedBlock == NULL)
-            return;
 
         /* All neighboring blocks are there -- join overlapping regions */
         for (int yo = -1; yo <= 1; ++yo) {
@@ -393,13 +555,11 @@ public:
                    || (xp == x && yp == y))
                     continue;
                 uint32_t idx2 = (uint32_t) xp + (uint32_t) yp * m_blocksH;
-                ImageBlock *origBlock2   = m_origBlocks[idx2];
-                ImageBlock *mergedBlock2 = m_mergedBlocks[idx2];
-                if (!origBlock2 || !mergedBlock2)
-                    continue;
+                if (m_tileState[idx2] != ETileResident)
+                    continue; /* Already written */
 
-                mergedBlock->put(origBlock2);
-                mergedBlock2->put(origBlock);
+                mergedBlock->put(m_origBlocks[idx2]);
+                m_mergedBlocks[idx2]->put(origBlock);
             }
         }
 
@@ -447,8 +607,10 @@ public:
         /* Release the block */
         m_freeBlocks.push_back(origBlock);
         m_freeBlocks.push_back(mergedBlock);
-        m_origBlocks[idx] = NULL;
-        m_mergedBlocks[idx] = NULL;
+        m_origBlocks.erase(idx);
+        m_mergedBlocks.erase(idx);
+        m_tileState[idx] = ETileWritten;
+        --m_liveTiles;
     }
 
     bool develop(const Point2i &sourceOffset, const Vector2i &size,
@@ -459,13 +621,14 @@ public:
 
     void develop(const Scene *scene, Float renderTime) {
         if (m_output) {
-            Log(EInfo, "Closing EXR file (%u tiles in total, peak memory usage: %u tiles)..",
-                m_blocksH * m_blocksV, m_peakUsage);
+            Log(EInfo, "Closing EXR file (%u tiles in total, peak memory usage: %u tiles, "
+                "%u tiles spilled to disk)..", m_blocksH * m_blocksV, m_peakUsage, m_spillCount);
             delete m_output;
             delete m_frameBuffer;
             m_output = NULL;
             m_frameBuffer = NULL;
             m_tile = NULL;
+            m_prototype = NULL;
 
             for (std::vector<ImageBlock *>::iterator it = m_freeBlocks.begin();
                 it != m_freeBlocks.end(); ++it)
@@ -473,18 +636,21 @@ public:
             m_freeBlocks.clear();
 
             for (std::map<uint32_t, ImageBlock *>::iterator it = m_origBlocks.begin();
-                it != m_origBlocks.end(); ++it) {
-                if ((*it).second)
-                    (*it).second->decRef();
-            }
+                it != m_origBlocks.end(); ++it)
+                (*it).second->decRef();
             m_origBlocks.clear();
 
             for (std::map<uint32_t, ImageBlock *>::iterator it = m_mergedBlocks.begin();
-                it != m_mergedBlocks.end(); ++it) {
-                if ((*it).second)
-                    (*it).second->decRef();
-            }
+                it != m_mergedBlocks.end(); ++it)
+                (*it).second->decRef();
             m_mergedBlocks.clear();
+
+            /* Closing the temporary file also deletes it */
+            m_spillFile = NULL;
+            m_spillSlots.clear();
+            m_freeSlots.clear();
+            m_tileState.clear();
+            m_neighborsDone.clear();
         }
     }
 
@@ -521,6 +687,7 @@ public:
             oss << "\"" << m_channelNames[i] << "\"" << ", ";
         oss << endl
             << "  componentFormat = " << m_componentFormat << "," << endl
+            << "  memoryLimit = " << memString(m_memoryLimit) << "," << endl
             << "  cropOffset = " << m_cropOffset.toString() << "," << endl
             << "  cropSize = " << m_cropSize.toString() << "," << endl
             << "  filter = " << indent(m_filter->toString()) << endl
@@ -530,6 +697,13 @@ public:
 
     MTS_DECLARE_CLASS()
 protected:
+    enum ETileState {
+        ETileMissing = 0,
+        ETileResident,
+        ETileSpilled,
+        ETileWritten
+    };
+
     std::vector<Bitmap::EPixelFormat> m_pixelFormats;
     std::vector<std::string> m_channelNames;
     Bitmap::EComponentFormat m_componentFormat;
@@ -541,6 +715,15 @@ protected:
     size_t m_pixelStride, m_rowStride;
     int m_blocksH, m_blocksV, m_peakUsage;
     int m_blockSize;
+    /* Streaming state */
+    std::vector<uint8_t> m_tileState, m_neighborsDone;
+    size_t m_memoryLimit;
+    int m_liveTiles, m_maxLiveTiles, m_spillCount;
+    ref<FileStream> m_spillFile;
+    ref<ImageBlock> m_prototype;
+    std::map<uint32_t, uint32_t> m_spillSlots;
+    std::vector<uint32_t> m_freeSlots;
+    uint32_t m_slotCount;
 };
 
 MTS_IMPLEMENT_CLASS_S(TiledHDRFilm, false, Film)
@@ -359,11 +359,16 @@ void BDPTProcess::processResult(const WorkResult *wr, bool cancelled) {
         return;
     const BDPTWorkResult *result = static_cast<const BDPTWorkResult *>(wr);
     ImageBlock *block = const_cast<ImageBlock *>(result->getImageBlock());
+
+    /* Accumulating the full-size light image dominates the cost of this
+       function. It is merged band-wise without holding the result lock */
+    if (m_config.lightImage)
+        m_result->put(result);
+
     LockGuard lock(m_resultMutex);
     m_progress->update(++m_resultCount);
     if (m_config.lightImage) {
         const ImageBlock *lightImage = m_result->getLightImage();
-        m_result->put(result);
         if (m_parent->isInteractive()) {
             /* Modify the finished image block so that it includes the light image contributions,
                which creates a more intuitive preview of the rendering process. This is
@@ -68,11 +68,11 @@ BDPTWorkResult::~BDPTWorkResult() { }
 void BDPTWorkResult::put(const BDPTWorkResult *workResult) {
 #if BDPT_DEBUG == 1
     for (size_t i=0; i<m_debugBlocks.size(); ++i)
-        m_debugBlocks[i]->put(workResult->m_debugBlocks[i].get());
+        m_debugBlocks[i]->putConcurrent(workResult->m_debugBlocks[i].get());
 #endif
-    m_block->put(workResult->m_block.get());
+    m_block->putConcurrent(workResult->m_block.get());
     if (m_lightImage)
-        m_lightImage->put(workResult->m_lightImage.get());
+        m_lightImage->putConcurrent(workResult->m_lightImage.get());
 }
 
 void BDPTWorkResult::clear() {
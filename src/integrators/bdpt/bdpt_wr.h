@@ -48,7 +48,7 @@ public:
     /// Serialize a work result to a binary data stream
     virtual void save(Stream *stream) const;
 
-    /// Aaccumulate another work result into this one
+    /// Accumulate another work result into this one (thread-safe)
     void put(const BDPTWorkResult *workResult);
 
 #if BDPT_DEBUG == 1
@@ -17,6 +17,7 @@
 */
 
 #include <mitsuba/render/scene.h>
+#include <boost/scoped_array.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -46,6 +47,10 @@ MTS_NAMESPACE_BEGIN
  *        See page~\pageref{sec:hideemitters} for details.
  *        \default{no, i.e. \code{false}}
  *     }
+ *     \parameter{wavefront}{\Boolean}{Trace the rays of many pixels as
+ *        batches? See page~\pageref{sec:wavefront} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
  * }
  * \vspace{-1mm}
  * \renderings{
@@ -308,6 +313,212 @@ public:
         return Li;
     }
 
+    /// A BSDF sample of the wavefront implementation whose ray is in flight
+    struct BSDFSample {
+        uint32_t index;
+        Spectrum value;
+        Float pdf;
+        Float fracLum, fracBSDF, weight;
+        unsigned int sampledType;
+    };
+
+    /**
+     * Wavefront version of \ref Li(): the camera rays are intersected at
+     * once, the hits are shaded grouped by material, and the emitter
+     * samples and BSDF samples of all queries are traced in batches.
+     */
+    void LiWavefront(size_t count, const RayDifferential *rays,
+            RadianceQueryRecord *rRecs, Spectrum *result) const {
+        const Scene *scene = rRecs[0].scene;
+        std::vector<uint32_t> indices;
+        std::vector<Ray> shadowRays, bsdfRays;
+        std::vector<Spectrum> shadowValues;
+        std::vector<uint32_t> shadowIndices;
+        std::vector<BSDFSample> bsdfSamples;
+
+        /* Perform the first ray intersections (or ignore them if
+           they have already been provided) */
+        for (size_t i=0; i<count; ++i) {
+            if (rRecs[i].type & RadianceQueryRecord::EIntersection)
+                indices.push_back((uint32_t) i);
+        }
+        rayIntersectBatch(rays, rRecs, indices);
+
+        indices.resize(count);
+        for (size_t i=0; i<count; ++i)
+            indices[i] = (uint32_t) i;
+        sortByMaterial(rRecs, indices);
+
+        for (size_t i=0; i<count; ++i) {
+            uint32_t idx = indices[i];
+            result[idx] = sampleDirect(idx, rays[idx], rRecs[idx], shadowRays,
+                shadowValues, shadowIndices, bsdfRays, bsdfSamples);
+        }
+
+        /* Resolve the visibility of all emitter samples at once */
+        if (!shadowRays.empty()) {
+            boost::scoped_array<bool> occluded(new bool[shadowRays.size()]);
+            scene->rayIntersectBatch(&shadowRays[0], shadowRays.size(), occluded.get());
+            for (size_t i=0; i<shadowRays.size(); ++i) {
+                if (!occluded[i])
+                    result[shadowIndices[i]] += shadowValues[i];
+            }
+        }
+
+        if (bsdfRays.empty())
+            return;
+
+        /* Trace the rays of all BSDF samples at once */
+        std::vector<Intersection> bsdfIts(bsdfRays.size());
+        scene->rayIntersectBatch(&bsdfRays[0], bsdfRays.size(), &bsdfIts[0]);
+
+        for (size_t i=0; i<bsdfRays.size(); ++i) {
+            const BSDFSample &sample = bsdfSamples[i];
+            const Ray &bsdfRay = bsdfRays[i];
+            DirectSamplingRecord dRec(rRecs[sample.index].its);
+
+            Spectrum value;
+            if (bsdfIts[i].isValid()) {
+                /* Intersected something - check if it was an emitter */
+                if (!bsdfIts[i].isEmitter())
+                    continue;
+
+                value = bsdfIts[i].Le(-bsdfRay.d);
+                dRec.setQuery(bsdfRay, bsdfIts[i]);
+            } else {
+                /* Intersected nothing -- perhaps there is an environment map? */
+                const Emitter *env = scene->getEnvironmentEmitter();
+
+                if (!env || (m_hideEmitters && sample.sampledType == BSDF::ENull))
+                    continue;
+
+                value = env->evalEnvironment(RayDifferential(bsdfRay));
+                if (!env->fillDirectSamplingRecord(dRec, bsdfRay))
+                    continue;
+            }
+
+            const Float lumPdf = (!(sample.sampledType & BSDF::EDelta)) ?
+                scene->pdfEmitterDirect(dRec) : 0;
+
+            /* Weight using the power heuristic */
+            const Float weight = miWeight(sample.pdf * sample.fracBSDF,
+                lumPdf * sample.fracLum) * sample.weight;
+
+            result[sample.index] += value * sample.value * weight;
+        }
+    }
+
+    /**
+     * Shade the first intersection of a query for \ref LiWavefront().
+     * Returns the emitted radiance, while the emitter samples and BSDF
+     * samples are appended to the given queues.
+     */
+    Spectrum sampleDirect(uint32_t index, const RayDifferential &ray,
+            RadianceQueryRecord &rRec, std::vector<Ray> &shadowRays,
+            std::vector<Spectrum> &shadowValues, std::vector<uint32_t> &shadowIndices,
+            std::vector<Ray> &bsdfRays, std::vector<BSDFSample> &bsdfSamples) const {
+        const Scene *scene = rRec.scene;
+        const Intersection &its = rRec.its;
+        Spectrum Li(0.0f);
+        Point2 sample;
+
+        if (!its.isValid()) {
+            if (rRec.type & RadianceQueryRecord::EEmittedRadiance && !m_hideEmitters)
+                return scene->evalEnvironment(ray);
+            else
+                return Spectrum(0.0f);
+        }
+
+        if (its.isEmitter() && (rRec.type & RadianceQueryRecord::EEmittedRadiance) && !m_hideEmitters)
+            Li += its.Le(-ray.d);
+
+        if (its.hasSubsurface() && (rRec.type & RadianceQueryRecord::ESubsurfaceRadiance))
+            Li += its.LoSub(scene, rRec.sampler, -ray.d, rRec.depth);
+
+        const BSDF *bsdf = rRec.its.getBSDF(ray);
+
+        if (!(rRec.type & RadianceQueryRecord::EDirectSurfaceRadiance)
+            || (m_strictNormals && dot(ray.d, its.geoFrame.n)
+                * Frame::cosTheta(its.wi) >= 0))
+            return Li;
+
+        bool adaptiveQuery = (rRec.extra & RadianceQueryRecord::EAdaptiveQuery);
+
+        Point2 *sampleArray;
+        size_t numDirectSamples = m_emitterSamples,
+               numBSDFSamples = m_bsdfSamples;
+        Float fracLum = m_fracLum, fracBSDF = m_fracBSDF,
+              weightLum = m_weightLum, weightBSDF = m_weightBSDF;
+
+        if (rRec.depth > 1 || adaptiveQuery) {
+            numBSDFSamples = numDirectSamples = 1;
+            fracLum = fracBSDF = .5f;
+            weightLum = weightBSDF = 1.0f;
+        }
+
+        if (numDirectSamples > 1) {
+            sampleArray = rRec.sampler->next2DArray(numDirectSamples);
+        } else {
+            sample = rRec.nextSample2D(); sampleArray = &sample;
+        }
+
+        DirectSamplingRecord dRec(its);
+        if (bsdf->getType() & BSDF::ESmooth) {
+            for (size_t i=0; i<numDirectSamples; ++i) {
+                /* Visibility is resolved later on */
+                Spectrum value = scene->sampleEmitterDirect(dRec, sampleArray[i], false);
+                if (value.isZero())
+                    continue;
+
+                const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
+                BSDFSamplingRecord bRec(its, its.toLocal(dRec.d));
+                const Spectrum bsdfVal = bsdf->eval(bRec);
+
+                if (!bsdfVal.isZero() && (!m_strictNormals
+                        || dot(its.geoFrame.n, dRec.d) * Frame::cosTheta(bRec.wo) > 0)) {
+                    Float bsdfPdf = emitter->isOnSurface() ? bsdf->pdf(bRec) : 0;
+                    const Float weight = miWeight(dRec.pdf * fracLum,
+                            bsdfPdf * fracBSDF) * weightLum;
+
+                    shadowRays.push_back(Ray(dRec.ref, dRec.d, Epsilon,
+                        dRec.dist*(1-ShadowEpsilon), dRec.time));
+                    shadowValues.push_back(value * bsdfVal * weight);
+                    shadowIndices.push_back(index);
+                }
+            }
+        }
+
+        if (numBSDFSamples > 1) {
+            sampleArray = rRec.sampler->next2DArray(numBSDFSamples);
+        } else {
+            sample = rRec.nextSample2D(); sampleArray = &sample;
+        }
+
+        for (size_t i=0; i<numBSDFSamples; ++i) {
+            BSDFSample bsdfSample;
+            BSDFSamplingRecord bRec(its, rRec.sampler, ERadiance);
+            bsdfSample.value = bsdf->sample(bRec, bsdfSample.pdf, sampleArray[i]);
+            if (bsdfSample.value.isZero())
+                continue;
+
+            /* Prevent light leaks due to the use of shading normals */
+            const Vector wo = its.toWorld(bRec.wo);
+            Float woDotGeoN = dot(its.geoFrame.n, wo);
+            if (m_strictNormals && woDotGeoN * Frame::cosTheta(bRec.wo) <= 0)
+                continue;
+
+            bsdfSample.index = index;
+            bsdfSample.fracLum = fracLum;
+            bsdfSample.fracBSDF = fracBSDF;
+            bsdfSample.weight = weightBSDF;
+            bsdfSample.sampledType = bRec.sampledType;
+            bsdfRays.push_back(Ray(its.p, wo, ray.time));
+            bsdfSamples.push_back(bsdfSample);
+        }
+
+        return Li;
+    }
+
     inline Float miWeight(Float pdfA, Float pdfB) const {
         pdfA *= pdfA; pdfB *= pdfB;
         return pdfA / (pdfA + pdfB);
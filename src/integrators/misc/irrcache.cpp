@@ -39,6 +39,10 @@ MTS_NAMESPACE_BEGIN
  *     \parameter{indirectOnly}{\Boolean}{Only show the indirect illumination? This can be useful to check
  *      the interpolation quality. \default{\code{false}}}
  *     \parameter{debug}{\Boolean}{Visualize the sample placement? \default{\code{false}}}
+ *     \parameter{deterministic}{\Boolean}{Make the result independent of the
+ *      number of threads and of the scheduling order? When enabled, every image block
+ *      only interpolates amongst the overture samples and its own new samples, at the cost of
+ *      some redundant cache misses. \default{\code{false}}}
  * }
  * \renderings{
  *  \unframedbigrendering{Illustration of the effect of the different optimizatations
@@ -78,6 +82,10 @@ MTS_NAMESPACE_BEGIN
  * improve the achieved interpolation quality, namely irradiance gradients
  * \cite{Ward1992Irradiance}, neighbor clamping \cite{Krivanek2006Making}, a screen-space
  * clamping metric and an improved error function \cite{Tabellion2004Approximate}.
+ *
+ * Samples that are created while rendering an image block are initially only
+ * visible to the thread rendering it and are shared with the other threads
+ * once the block is finished. Cache lookups therefore never need to lock.
  */
 
 class IrradianceCacheIntegrator : public SamplingIntegrator {
@@ -115,11 +123,16 @@ public:
         /* If set to true, direct illumination will be suppressed -
            useful for checking the interpolation quality */
         m_indirectOnly = props.getBoolean("indirectOnly", false);
+        /* If set to true, samples created while rendering a block are
+           only used within that block. This makes the output deterministic
+           regardless of the thread count and scheduling order. */
+        m_deterministic = props.getBoolean("deterministic", false);
 
         if (m_debug)
             m_overture = false;
 
         Assert(m_qualityAdjustment > 0 && m_qualityAdjustment <= 1);
+        m_deferredMutex = new Mutex();
     }
 
     IrradianceCacheIntegrator(Stream *stream, InstanceManager *manager)
@@ -136,6 +149,10 @@ public:
         m_gradients = stream->readBool();
         m_debug = stream->readBool();
         m_indirectOnly = stream->readBool();
+        m_deterministic = stream->readBool();
+        if (m_irrCache)
+            m_irrCache->setBuffered(true);
+        m_deferredMutex = new Mutex();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -152,6 +169,7 @@ public:
         stream->writeBool(m_gradients);
         stream->writeBool(m_debug);
         stream->writeBool(m_indirectOnly);
+        stream->writeBool(m_deterministic);
     }
 
     void configureSampler(const Scene *scene, Sampler *sampler) {
@@ -198,6 +216,7 @@ public:
         m_irrCache->clampScreen(m_clampScreen);
         m_irrCache->useGradients(m_gradients);
         m_irrCache->setQuality(m_quality);
+        m_irrCache->setBuffered(true);
 
         std::string irrCacheStatus;
         if (m_overture)
@@ -210,6 +229,8 @@ public:
             irrCacheStatus += "clampNeighbor, ";
         if (m_clampScreen)
             irrCacheStatus += "clampScreen, ";
+        if (m_deterministic)
+            irrCacheStatus += "deterministic, ";
 
         Log(EDebug, "Irradiance cache status : %s", irrCacheStatus.c_str());
         Log(EDebug, "  - Gather resolution   : %ix%i = %i samples", m_resolution, 2*m_resolution, 2*m_resolution*m_resolution);
@@ -218,7 +239,7 @@ public:
         if (m_overture) {
             int subIntegratorResID = sched->registerResource(m_subIntegrator);
             ref<OvertureProcess> proc = new OvertureProcess(job, m_resolution, m_gradients,
-                m_clampNeighbor, m_clampScreen, m_quality);
+                m_clampNeighbor, m_clampScreen, m_quality, m_deterministic);
             m_proc = proc;
             proc->bindResource("scene", sceneResID);
             proc->bindResource("sensor", sensorResID);
@@ -244,6 +265,52 @@ public:
         return true;
     }
 
+    void postprocess(const Scene *scene, RenderQueue *queue, const RenderJob *job,
+            int sceneResID, int sensorResID, int samplerResID) {
+        SamplingIntegrator::postprocess(scene, queue, job, sceneResID, sensorResID, samplerResID);
+
+        /* Add the samples that were kept private to their blocks */
+        LockGuard lock(m_deferredMutex);
+        for (DeferredMap::iterator it = m_deferred.begin(); it != m_deferred.end(); ++it) {
+            for (size_t i=0; i<it->second.size(); ++i)
+                m_irrCache->insert(it->second[i]);
+        }
+        m_deferred.clear();
+    }
+
+    void renderBlock(const Scene *scene, const Sensor *sensor,
+            Sampler *sampler, ImageBlock *block, const bool &stop,
+            const std::vector< TPoint2<uint8_t> > &points) const {
+        if (m_deterministic) {
+            /* Reseed the pixel and cache miss samplers based on the block
+               position so that no random state carries over between blocks */
+            HemisphereSampler *hs;
+            Sampler *missSampler;
+            getMissSamplers(hs, missSampler);
+            uint64_t seed = ((uint64_t) (uint32_t) block->getOffset().x << 32)
+                | (uint32_t) block->getOffset().y;
+            sampler->seed(seed);
+            hs->seed(~seed);
+            missSampler->seed(seed ^ 0x9E3779B97F4A7C15ULL);
+        }
+
+        SamplingIntegrator::renderBlock(scene, sensor, sampler, block, stop, points);
+
+        if (m_deterministic) {
+            std::vector<IrradianceCache::Record *> records;
+            m_irrCache->detach(records);
+            if (!records.empty()) {
+                LockGuard lock(m_deferredMutex);
+                std::vector<IrradianceCache::Record *> &target = m_deferred[
+                    std::make_pair(block->getOffset().y, block->getOffset().x)];
+                target.insert(target.end(), records.begin(), records.end());
+            }
+        } else {
+            /* Share the samples of this block with the other threads */
+            m_irrCache->commit();
+        }
+    }
+
     void cancel() {
         if (m_proc) {
             Scheduler::getInstance()->cancel(m_proc);
@@ -284,20 +351,31 @@ public:
         return m_subIntegrator->Li(ray, rRec);
     }
 
-    void handleMiss(RayDifferential ray, const RadianceQueryRecord &rRec,
-            Spectrum &E) const {
-        /* Handle an irradiance cache miss */
-        HemisphereSampler *hs = m_hemisphereSampler.get();
-        Sampler *sampler = m_sampleGenerator.get();
-        RadianceQueryRecord rRec2;
+    /// Return the per-thread hemisphere sampler and sample generator used for cache misses
+    void getMissSamplers(HemisphereSampler *&hs, Sampler *&sampler) const {
+        hs = m_hemisphereSampler.get();
+        sampler = m_sampleGenerator.get();
         if (hs == NULL) {
-            Properties props("independent");
-            sampler = static_cast<Sampler *> (PluginManager::getInstance()->
-                createObject(MTS_CLASS(Sampler), props));
+            if (m_deterministic) {
+                sampler = new SeededSampler();
+            } else {
+                Properties props("independent");
+                sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+                    createObject(MTS_CLASS(Sampler), props));
+            }
             hs = new HemisphereSampler(m_resolution, 2 * m_resolution);
             m_hemisphereSampler.set(hs);
             m_sampleGenerator.set(sampler);
         }
+    }
+
+    void handleMiss(RayDifferential ray, const RadianceQueryRecord &rRec,
+            Spectrum &E) const {
+        /* Handle an irradiance cache miss */
+        HemisphereSampler *hs;
+        Sampler *sampler;
+        RadianceQueryRecord rRec2;
+        getMissSamplers(hs, sampler);
 
         /* Generate stratified cosine-weighted samples and compute
            rotational + translational gradients */
@@ -348,8 +426,11 @@ public:
             RadianceQueryRecord rRec(scene, sampler);
             rRec.newQuery(RadianceQueryRecord::ERadianceNoEmission, medium);
             rRec.its = its;
-            if (!m_irrCache->get(rRec.its, EIndir))
+            if (!m_irrCache->get(rRec.its, EIndir)) {
                 handleMiss(RayDifferential(), rRec, EIndir);
+                /* Not called from renderBlock() -- publish right away */
+                m_irrCache->commit();
+            }
         }
 
         return (EDir / (Float) nSamples) + EIndir;
@@ -372,7 +453,16 @@ public:
     }
 
     MTS_DECLARE_CLASS()
+protected:
+    virtual ~IrradianceCacheIntegrator() {
+        for (DeferredMap::iterator it = m_deferred.begin(); it != m_deferred.end(); ++it) {
+            for (size_t i=0; i<it->second.size(); ++i)
+                delete it->second[i];
+        }
+    }
 private:
+    typedef std::map<std::pair<int, int>, std::vector<IrradianceCache::Record *> > DeferredMap;
+
     mutable ThreadLocal<HemisphereSampler> m_hemisphereSampler;
     mutable ThreadLocal<Sampler> m_sampleGenerator;
     mutable ref<IrradianceCache> m_irrCache;
@@ -381,7 +471,10 @@ private:
     Float m_quality, m_qualityAdjustment, m_diffScaleFactor;
     bool m_clampScreen, m_clampNeighbor;
     bool m_overture, m_gradients, m_debug, m_indirectOnly;
+    bool m_deterministic;
     int m_resolution;
+    mutable DeferredMap m_deferred;
+    mutable ref<Mutex> m_deferredMutex;
 };
 
 MTS_IMPLEMENT_CLASS_S(IrradianceCacheIntegrator, false, SamplingIntegrator)
@@ -26,9 +26,9 @@ MTS_NAMESPACE_BEGIN
 class OvertureWorker : public WorkProcessor {
 public:
     OvertureWorker(int resolution, bool gradients, bool clampNeighbor,
-        bool clampScreen, Float quality) : m_resolution(resolution), m_gradients(gradients),
-        m_clampNeighbor(clampNeighbor), m_clampScreen(clampScreen),
-        m_quality(quality) {
+        bool clampScreen, Float quality, bool deterministic) : m_resolution(resolution),
+        m_gradients(gradients), m_clampNeighbor(clampNeighbor), m_clampScreen(clampScreen),
+        m_quality(quality), m_deterministic(deterministic) {
     }
 
     OvertureWorker(Stream *stream, InstanceManager *manager) {
@@ -37,6 +37,7 @@ public:
         m_clampNeighbor = stream->readBool();
         m_clampScreen = stream->readBool();
         m_quality = stream->readFloat();
+        m_deterministic = stream->readBool();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
@@ -45,6 +46,7 @@ public:
         stream->writeBool(m_clampNeighbor);
         stream->writeBool(m_clampScreen);
         stream->writeFloat(m_quality);
+        stream->writeBool(m_deterministic);
     }
 
     ref<WorkUnit> createWorkUnit() const {
@@ -59,18 +61,26 @@ public:
         m_scene = static_cast<Scene *>(getResource("scene"));
         m_sensor = static_cast<Sensor *>(getResource("sensor"));
         m_subIntegrator = static_cast<SamplingIntegrator *>(getResource("subIntegrator"));
-        Properties props("independent");
-        props.setInteger("sampleCount", m_resolution * 3 * m_resolution);
-        m_sampler = static_cast<Sampler *> (PluginManager::getInstance()->
-            createObject(MTS_CLASS(Sampler), props));
+        if (m_deterministic) {
+            m_sampler = new SeededSampler();
+        } else {
+            Properties props("independent");
+            props.setInteger("sampleCount", m_resolution * 3 * m_resolution);
+            m_sampler = static_cast<Sampler *> (PluginManager::getInstance()->
+                createObject(MTS_CLASS(Sampler), props));
+        }
         m_subIntegrator->wakeup(NULL, m_resources);
 
+        createCache();
+        m_hs = new HemisphereSampler(m_resolution, 3*m_resolution);
+    }
+
+    void createCache() {
         m_irrCache = new IrradianceCache(m_scene->getAABB());
         m_irrCache->clampNeighbor(m_clampNeighbor);
         m_irrCache->clampScreen(m_clampScreen);
         m_irrCache->useGradients(m_gradients);
         m_irrCache->setQuality(m_quality);
-        m_hs = new HemisphereSampler(m_resolution, 3*m_resolution);
     }
 
     void process(const WorkUnit *workUnit, WorkResult *workResult,
@@ -87,6 +97,15 @@ public:
                 ex = sx + rect->getSize().x,
                 ey = sy + rect->getSize().y;
         result->clear();
+        result->setOffset(rect->getOffset());
+
+        if (m_deterministic) {
+            /* Only use samples from this block, and reseed based on its position */
+            uint64_t seed = ((uint64_t) (uint32_t) sx << 32) | (uint32_t) sy;
+            createCache();
+            m_hs->seed(seed);
+            static_cast<SeededSampler *>(m_sampler.get())->seed(~seed);
+        }
 
         for (int y = sy; y < ey; y++) {
             for (int x = sx; x < ex; x++) {
@@ -134,7 +153,7 @@ public:
 
     ref<WorkProcessor> clone() const {
         return new OvertureWorker(m_resolution, m_gradients, m_clampNeighbor,
-            m_clampScreen, m_quality);
+            m_clampScreen, m_quality, m_deterministic);
     }
 
     MTS_DECLARE_CLASS()
@@ -150,10 +169,12 @@ private:
     int m_resolution;
     bool m_gradients, m_clampNeighbor, m_clampScreen;
     Float m_quality;
+    bool m_deterministic;
 };
 
 void IrradianceRecordVector::load(Stream *stream) {
     clear();
+    m_offset = Point2i(stream);
     size_t count = stream->readUInt();
     m_samples.resize(count);
     for (size_t i=0; i<count; ++i)
@@ -165,6 +186,7 @@ IrradianceRecordVector::~IrradianceRecordVector() {
 }
 
 void IrradianceRecordVector::save(Stream *stream) const {
+    m_offset.serialize(stream);
     stream->writeUInt((unsigned int) m_samples.size());
     for (size_t i=0; i<m_samples.size(); ++i)
         m_samples[i]->serialize(stream);
@@ -178,9 +200,10 @@ std::string IrradianceRecordVector::toString() const {
 }
 
 OvertureProcess::OvertureProcess(const RenderJob *job, int resolution, bool gradients,
-    bool clampNeighbor, bool clampScreen, Float quality) : m_job(job), m_resolution(resolution),
-    m_gradients(gradients), m_clampNeighbor(clampNeighbor),
-    m_clampScreen(clampScreen), m_quality(quality), m_progress(NULL) {
+    bool clampNeighbor, bool clampScreen, Float quality, bool deterministic)
+    : m_job(job), m_resolution(resolution), m_gradients(gradients),
+    m_clampNeighbor(clampNeighbor), m_clampScreen(clampScreen),
+    m_deterministic(deterministic), m_quality(quality), m_progress(NULL) {
     m_resultCount = 0;
     m_resultMutex = new Mutex();
     m_samples = new IrradianceRecordVector();
@@ -193,17 +216,32 @@ OvertureProcess::~OvertureProcess() {
 
 ref<WorkProcessor> OvertureProcess::createWorkProcessor() const {
     return new OvertureWorker(m_resolution, m_gradients, m_clampNeighbor,
-        m_clampScreen, m_quality);
+        m_clampScreen, m_quality, m_deterministic);
 }
 
 void OvertureProcess::processResult(const WorkResult *wr, bool cancelled) {
     const IrradianceRecordVector *result = static_cast<const IrradianceRecordVector *>(wr);
-    LockGuard lock(m_resultMutex);
+    ref<IrradianceRecordVector> samples = new IrradianceRecordVector();
     for (size_t i=0; i<result->size(); ++i)
-        m_samples->put((*result)[i]);
+        samples->put((*result)[i]);
+
+    LockGuard lock(m_resultMutex);
+    m_blockSamples[std::make_pair(result->getOffset().y, result->getOffset().x)] = samples;
     m_progress->update(++m_resultCount);
 }
 
+const IrradianceRecordVector *OvertureProcess::getSamples() {
+    LockGuard lock(m_resultMutex);
+    for (std::map<std::pair<int, int>, ref<IrradianceRecordVector> >::iterator it
+            = m_blockSamples.begin(); it != m_blockSamples.end(); ++it) {
+        const IrradianceRecordVector *samples = it->second.get();
+        for (size_t i=0; i<samples->size(); ++i)
+            m_samples->put((*samples)[i]);
+    }
+    m_blockSamples.clear();
+    return m_samples.get();
+}
+
 void OvertureProcess::bindResource(const std::string &name, int id) {
     if (name == "scene") {
         m_scene = static_cast<Scene *>(Scheduler::getInstance()->getResource(id));
@@ -218,6 +256,7 @@ void OvertureProcess::bindResource(const std::string &name, int id) {
     BlockedImageProcess::bindResource(name, id);
 }
 
+MTS_IMPLEMENT_CLASS(SeededSampler, false, Sampler);
 MTS_IMPLEMENT_CLASS(IrradianceRecordVector, false, WorkResult);
 MTS_IMPLEMENT_CLASS_S(OvertureWorker, false, WorkProcessor);
 MTS_IMPLEMENT_CLASS(OvertureProcess, false, BlockedImageProcess);
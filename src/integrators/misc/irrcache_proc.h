@@ -22,9 +22,40 @@
 #include <mitsuba/render/imageproc.h>
 #include <mitsuba/render/rectwu.h>
 #include <mitsuba/render/irrcache.h>
+#include <mitsuba/render/sampler.h>
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * Independent sample generator that can be reseeded. This is used to
+ * make cache misses reproducible, i.e. independent of the image blocks
+ * that a thread happened to process before.
+ */
+class SeededSampler : public Sampler {
+public:
+    SeededSampler() : Sampler(Properties("independent")) {
+        m_random = new Random();
+    }
+
+    inline void seed(uint64_t value) { m_random->seed(value); }
+
+    Float next1D() { return m_random->nextFloat(); }
+
+    Point2 next2D() {
+        Float value1 = m_random->nextFloat();
+        Float value2 = m_random->nextFloat();
+        return Point2(value1, value2);
+    }
+
+    std::string toString() const { return "SeededSampler[]"; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~SeededSampler() { }
+private:
+    ref<Random> m_random;
+};
+
 /**
  * This stores a number of irradiance samples, which can be sent
  * over the wire as needed. Used to implement parallel overture
@@ -53,6 +84,12 @@ public:
         return m_samples[index];
     }
 
+    /// Set the offset of the image block that produced these samples
+    inline void setOffset(const Point2i &offset) { m_offset = offset; }
+
+    /// Return the offset of the image block that produced these samples
+    inline const Point2i &getOffset() const { return m_offset; }
+
     /* WorkUnit interface */
     void load(Stream *stream);
     void save(Stream *stream) const;
@@ -64,6 +101,7 @@ protected:
     virtual ~IrradianceRecordVector();
 private:
     std::vector<IrradianceCache::Record *> m_samples;
+    Point2i m_offset;
 };
 
 /**
@@ -72,11 +110,13 @@ private:
 class OvertureProcess : public BlockedImageProcess {
 public:
     OvertureProcess(const RenderJob *job, int resolution, bool gradients,
-        bool clampNeighbor, bool clampScreen, Float quality);
+        bool clampNeighbor, bool clampScreen, Float quality, bool deterministic);
 
-    inline const IrradianceRecordVector *getSamples() const {
-        return m_samples.get();
-    }
+    /**
+     * Return the generated samples. They are sorted by the image block
+     * that produced them, hence the order does not depend on scheduling.
+     */
+    const IrradianceRecordVector *getSamples();
 
     ref<WorkProcessor> createWorkProcessor() const;
     void processResult(const WorkResult *wr, bool cancelled);
@@ -92,8 +132,9 @@ private:
     int m_resultCount;
     ref<Mutex> m_resultMutex;
     ref<IrradianceRecordVector> m_samples;
+    std::map<std::pair<int, int>, ref<IrradianceRecordVector> > m_blockSamples;
     int m_resolution;
-    bool m_gradients, m_clampNeighbor, m_clampScreen;
+    bool m_gradients, m_clampNeighbor, m_clampScreen, m_deterministic;
     Float m_quality;
     ProgressReporter *m_progress;
 };
@@ -18,10 +18,12 @@
 
 #include <mitsuba/render/scene.h>
 #include <mitsuba/core/statistics.h>
+#include <boost/scoped_array.hpp>
 
 MTS_NAMESPACE_BEGIN
 
 static StatsCounter avgPathLength("Path tracer", "Average path length", EAverage);
+static StatsCounter timeBSDFSample("Timing", "BSDF sampling", ETimeValue);
 
 /*! \plugin{path}{Path tracer}
  * \order{2}
@@ -44,6 +46,10 @@ static StatsCounter avgPathLength("Path tracer", "Average path length", EAverage
  *        See page~\pageref{sec:hideemitters} for details.
  *        \default{no, i.e. \code{false}}
  *     }
+ *     \parameter{wavefront}{\Boolean}{Trace the rays of many pixels as
+ *        batches? See page~\pageref{sec:wavefront} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
  * }
  *
  * This integrator implements a basic path tracer and is a \emph{good default choice}
@@ -206,7 +212,11 @@ public:
             /* Sample BSDF * cos(theta) */
             Float bsdfPdf;
             BSDFSamplingRecord bRec(its, rRec.sampler, ERadiance);
-            Spectrum bsdfWeight = bsdf->sample(bRec, bsdfPdf, rRec.nextSample2D());
+            Spectrum bsdfWeight;
+            {
+                ScopedStatsTimer timer(timeBSDFSample);
+                bsdfWeight = bsdf->sample(bRec, bsdfPdf, rRec.nextSample2D());
+            }
             if (bsdfWeight.isZero())
                 break;
 
@@ -293,6 +303,255 @@ public:
         return Li;
     }
 
+    /// State of a path that is traced by the wavefront implementation
+    struct PathState {
+        Spectrum Li;
+        Spectrum throughput;
+        Float eta;
+        bool scattered;
+
+        /* Direct sampling record of the last vertex and
+           details of the BSDF sample taken there */
+        DirectSamplingRecord dRec;
+        Spectrum bsdfWeight;
+        Float bsdfPdf;
+        Float bsdfEta;
+        bool bsdfDelta;
+    };
+
+    /**
+     * Wavefront version of \ref Li(): all paths advance one vertex at a
+     * time. The vertices are shaded grouped by material, and the shadow
+     * rays and continuation rays of all paths are traced in batches.
+     */
+    void LiWavefront(size_t count, const RayDifferential *r,
+            RadianceQueryRecord *rRecs, Spectrum *result) const {
+        std::vector<RayDifferential> rays(r, r + count);
+        std::vector<PathState> paths(count);
+        std::vector<uint32_t> active, next;
+        std::vector<Ray> shadowRays;
+        std::vector<Spectrum> shadowValues;
+        std::vector<uint32_t> shadowPaths;
+        boost::scoped_array<bool> occluded(new bool[count]);
+
+        for (size_t i=0; i<count; ++i) {
+            PathState &path = paths[i];
+            path.Li = Spectrum(0.0f);
+            path.throughput = Spectrum(1.0f);
+            path.eta = 1.0f;
+            path.scattered = false;
+            if (rRecs[i].type & RadianceQueryRecord::EIntersection)
+                active.push_back((uint32_t) i);
+        }
+
+        /* Perform the first ray intersections (or ignore them if
+           they have already been provided) */
+        rayIntersectBatch(&rays[0], rRecs, active);
+
+        active.clear();
+        for (size_t i=0; i<count; ++i) {
+            rays[i].mint = Epsilon;
+            if (rRecs[i].depth <= m_maxDepth || m_maxDepth < 0)
+                active.push_back((uint32_t) i);
+            else
+                finishPath(paths[i], rRecs[i], result[i]);
+        }
+
+        while (!active.empty()) {
+            /* Shade all vertices grouped by material */
+            sortByMaterial(rRecs, active);
+            shadowRays.clear();
+            shadowValues.clear();
+            shadowPaths.clear();
+            next.clear();
+
+            for (size_t i=0; i<active.size(); ++i) {
+                uint32_t idx = active[i];
+                Ray shadowRay;
+                Spectrum shadowValue(0.0f);
+                if (sampleVertex(rays[idx], paths[idx], rRecs[idx], shadowRay, shadowValue))
+                    next.push_back(idx);
+                else
+                    finishPath(paths[idx], rRecs[idx], result[idx]);
+
+                if (!shadowValue.isZero()) {
+                    shadowRays.push_back(shadowRay);
+                    shadowValues.push_back(shadowValue);
+                    shadowPaths.push_back(idx);
+                }
+            }
+
+            /* Resolve the visibility of all emitter samples at once */
+            if (!shadowRays.empty()) {
+                rRecs[0].scene->rayIntersectBatch(&shadowRays[0],
+                    shadowRays.size(), occluded.get());
+                for (size_t i=0; i<shadowRays.size(); ++i) {
+                    if (!occluded[i])
+                        paths[shadowPaths[i]].Li += shadowValues[i];
+                }
+            }
+
+            /* Trace the rays of all sampled BSDF directions at once */
+            rayIntersectBatch(&rays[0], rRecs, next);
+
+            active.clear();
+            for (size_t i=0; i<next.size(); ++i) {
+                uint32_t idx = next[i];
+                if (continuePath(rays[idx], paths[idx], rRecs[idx]))
+                    active.push_back(idx);
+                else
+                    finishPath(paths[idx], rRecs[idx], result[idx]);
+            }
+        }
+    }
+
+    /**
+     * Shade the current vertex of a path and sample a direction to
+     * continue it (the first half of a loop iteration in \ref Li()).
+     * Unoccluded emitter samples are not accounted for directly -- their
+     * contribution and shadow ray are returned instead.
+     */
+    bool sampleVertex(RayDifferential &ray, PathState &path,
+            RadianceQueryRecord &rRec, Ray &shadowRay, Spectrum &shadowValue) const {
+        const Scene *scene = rRec.scene;
+        Intersection &its = rRec.its;
+
+        if (!its.isValid()) {
+            /* If no intersection could be found, potentially return
+               radiance from a environment luminaire if it exists */
+            if ((rRec.type & RadianceQueryRecord::EEmittedRadiance)
+                && (!m_hideEmitters || path.scattered))
+                path.Li += path.throughput * scene->evalEnvironment(ray);
+            return false;
+        }
+
+        const BSDF *bsdf = its.getBSDF(ray);
+
+        /* Possibly include emitted radiance if requested */
+        if (its.isEmitter() && (rRec.type & RadianceQueryRecord::EEmittedRadiance)
+            && (!m_hideEmitters || path.scattered))
+            path.Li += path.throughput * its.Le(-ray.d);
+
+        /* Include radiance from a subsurface scattering model if requested */
+        if (its.hasSubsurface() && (rRec.type & RadianceQueryRecord::ESubsurfaceRadiance))
+            path.Li += path.throughput * its.LoSub(scene, rRec.sampler, -ray.d, rRec.depth);
+
+        if ((rRec.depth >= m_maxDepth && m_maxDepth > 0)
+            || (m_strictNormals && dot(ray.d, its.geoFrame.n)
+                * Frame::cosTheta(its.wi) >= 0))
+            return false;
+
+        /* Estimate the direct illumination if this is requested */
+        DirectSamplingRecord &dRec = path.dRec;
+        dRec = DirectSamplingRecord(its);
+
+        if (rRec.type & RadianceQueryRecord::EDirectSurfaceRadiance &&
+            (bsdf->getType() & BSDF::ESmooth)) {
+            Spectrum value = scene->sampleEmitterDirect(dRec, rRec.nextSample2D(), false);
+            if (!value.isZero()) {
+                const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
+                BSDFSamplingRecord bRec(its, its.toLocal(dRec.d), ERadiance);
+                const Spectrum bsdfVal = bsdf->eval(bRec);
+
+                if (!bsdfVal.isZero() && (!m_strictNormals
+                        || dot(its.geoFrame.n, dRec.d) * Frame::cosTheta(bRec.wo) > 0)) {
+                    Float bsdfPdf = (emitter->isOnSurface() && dRec.measure == ESolidAngle)
+                        ? bsdf->pdf(bRec) : 0;
+                    Float weight = miWeight(dRec.pdf, bsdfPdf);
+                    shadowValue = path.throughput * value * bsdfVal * weight;
+                    shadowRay = Ray(dRec.ref, dRec.d, Epsilon,
+                        dRec.dist*(1-ShadowEpsilon), dRec.time);
+                }
+            }
+        }
+
+        /* Sample BSDF * cos(theta) */
+        BSDFSamplingRecord bRec(its, rRec.sampler, ERadiance);
+        {
+            ScopedStatsTimer timer(timeBSDFSample);
+            path.bsdfWeight = bsdf->sample(bRec, path.bsdfPdf, rRec.nextSample2D());
+        }
+        if (path.bsdfWeight.isZero())
+            return false;
+
+        path.scattered |= bRec.sampledType != BSDF::ENull;
+
+        /* Prevent light leaks due to the use of shading normals */
+        const Vector wo = its.toWorld(bRec.wo);
+        Float woDotGeoN = dot(its.geoFrame.n, wo);
+        if (m_strictNormals && woDotGeoN * Frame::cosTheta(bRec.wo) <= 0)
+            return false;
+
+        path.bsdfEta = bRec.eta;
+        path.bsdfDelta = (bRec.sampledType & BSDF::EDelta) != 0;
+        ray = Ray(its.p, wo, ray.time);
+        return true;
+    }
+
+    /**
+     * Account for an emitter that was hit by the sampled direction
+     * and apply russian roulette (the second half of a loop iteration
+     * in \ref Li()). Expects the new intersection in \c rRec.its.
+     */
+    bool continuePath(const RayDifferential &ray, PathState &path,
+            RadianceQueryRecord &rRec) const {
+        const Scene *scene = rRec.scene;
+        const Intersection &its = rRec.its;
+        bool hitEmitter = false;
+        Spectrum value;
+
+        if (its.isValid()) {
+            /* Intersected something - check if it was a luminaire */
+            if (its.isEmitter()) {
+                value = its.Le(-ray.d);
+                path.dRec.setQuery(ray, its);
+                hitEmitter = true;
+            }
+        } else {
+            /* Intersected nothing -- perhaps there is an environment map? */
+            const Emitter *env = scene->getEnvironmentEmitter();
+
+            if (!env || (m_hideEmitters && !path.scattered))
+                return false;
+
+            value = env->evalEnvironment(ray);
+            if (!env->fillDirectSamplingRecord(path.dRec, ray))
+                return false;
+            hitEmitter = true;
+        }
+
+        path.throughput *= path.bsdfWeight;
+        path.eta *= path.bsdfEta;
+
+        if (hitEmitter &&
+            (rRec.type & RadianceQueryRecord::EDirectSurfaceRadiance)) {
+            const Float lumPdf = !path.bsdfDelta ?
+                scene->pdfEmitterDirect(path.dRec) : 0;
+            path.Li += path.throughput * value * miWeight(path.bsdfPdf, lumPdf);
+        }
+
+        if (!its.isValid() || !(rRec.type & RadianceQueryRecord::EIndirectSurfaceRadiance))
+            return false;
+        rRec.type = RadianceQueryRecord::ERadianceNoEmission;
+
+        if (rRec.depth++ >= m_rrDepth) {
+            Float q = std::min(path.throughput.max() * path.eta * path.eta, (Float) 0.95f);
+            if (rRec.nextSample1D() >= q)
+                return false;
+            path.throughput /= q;
+        }
+
+        return rRec.depth <= m_maxDepth || m_maxDepth < 0;
+    }
+
+    /// Store the result of a terminated path
+    inline void finishPath(const PathState &path,
+            const RadianceQueryRecord &rRec, Spectrum &result) const {
+        avgPathLength.incrementBase();
+        avgPathLength += rRec.depth;
+        result = path.Li;
+    }
+
     inline Float miWeight(Float pdfA, Float pdfB) const {
         pdfA *= pdfA;
         pdfB *= pdfB;
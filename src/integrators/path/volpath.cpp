@@ -45,6 +45,10 @@ static StatsCounter avgPathLength("Volumetric path tracer", "Average path length
  *        See page~\pageref{sec:hideemitters} for details.
  *        \default{no, i.e. \code{false}}
  *     }
+ *     \parameter{wavefront}{\Boolean}{Trace the rays of many pixels as
+ *        batches? See page~\pageref{sec:wavefront} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
  * }
  *
  * This plugin provides a volumetric path tracer that can be used to
@@ -20,6 +20,7 @@
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/render/gatherproc.h>
 #include <mitsuba/render/renderqueue.h>
+#include "sppm_proc.h"
 
 #if defined(MTS_OPENMP)
 # include <omp.h>
@@ -50,6 +51,11 @@ MTS_NAMESPACE_BEGIN
  *     }
  *     \parameter{maxPasses}{\Integer}{Maximum number of passes to render (where \code{-1}
  *        corresponds to rendering until stopped manually). \default{\code{-1}}}
+ *     \parameter{splatPhotons}{\Boolean}{
+ *        Splat the photons directly into the gather points while they
+ *        are being traced instead of storing them in a photon map?
+ *        \default{\code{false}}
+ *     }
  * }
  * This plugin implements stochastic progressive photon mapping by Hachisuka et al.
  * \cite{Hachisuka2009Stochastic}. This algorithm is an extension of progressive photon
@@ -61,6 +67,14 @@ MTS_NAMESPACE_BEGIN
  * number of samples per pixel are not necessary. As with \pluginref{ppm}, once started,
  * the rendering process continues indefinitely until it is manually stopped.
  *
+ * By default, every pass stores its photons in a photon map, which is then
+ * built and queried at each gather point. When \code{splatPhotons} is set to
+ * \code{true}, the implementation instead organizes the gather points into a
+ * spatial hash grid once per pass. Each traced photon is then added to the
+ * statistics of the gather points close to it using atomic operations. This
+ * avoids building the photon map, and memory usage only depends on the number
+ * of gather points, which permits a much larger \code{photonCount}.
+ *
  * \remarks{
  *    \item Due to the data dependencies of this algorithm, the parallelization is
  *    limited to the local machine (i.e. cluster-wide renderings are not implemented)
@@ -71,19 +85,7 @@ MTS_NAMESPACE_BEGIN
  */
 class SPPMIntegrator : public Integrator {
 public:
-    /// Represents one individual PPM gather point including relevant statistics
-    struct GatherPoint {
-        Intersection its;
-        Float radius;
-        Spectrum weight;
-        Spectrum flux;
-        Spectrum emission;
-        Float N;
-        int depth;
-        Point2i pos;
-
-        inline GatherPoint() : weight(0.0f), flux(0.0f), emission(0.0f), N(0.0f) { }
-    };
+    typedef SPPMGatherPoint GatherPoint;
 
     SPPMIntegrator(const Properties &props) : Integrator(props) {
         /* Initial photon query radius (0 = infer based on scene size and sensor resolution) */
@@ -105,6 +107,8 @@ public:
         m_autoCancelGathering = props.getBoolean("autoCancelGathering", true);
         /* Maximum number of passes to render. -1 renders until the process is stopped. */
         m_maxPasses = props.getInteger("maxPasses", -1);
+        /* Splat photons into a hash grid of gather points instead of building a photon map? */
+        m_splatPhotons = props.getBoolean("splatPhotons", false);
         m_mutex = new Mutex();
         if (m_maxDepth <= 1 && m_maxDepth != -1)
             Log(EError, "Maximum depth must be set to \"2\" or higher!");
@@ -197,9 +201,14 @@ public:
         Thread::initializeOpenMP(nCores);
 #endif
 
+        if (m_splatPhotons)
+            m_grid = new SPPMGatherGrid(m_maxDepth);
+
         int it = 0;
         while (m_running && (m_maxPasses == -1 || it < m_maxPasses)) {
             distributedRTPass(scene, samplers);
+            if (m_splatPhotons)
+                m_grid->build(m_gatherBlocks);
             photonMapPass(++it, queue, job, film, sceneResID,
                     sensorResID, samplerResID);
         }
@@ -211,6 +220,8 @@ public:
         for (size_t i=0; i<samplers.size(); ++i)
             samplers[i]->decRef();
 
+        m_grid = NULL;
+
         sched->unregisterResource(samplerResID);
         return true;
     }
@@ -315,27 +326,53 @@ public:
                 it, m_totalPhotons);
         ref<Scheduler> sched = Scheduler::getInstance();
 
-        /* Generate the global photon map */
-        ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
-            GatherPhotonProcess::EAllSurfacePhotons, m_photonCount,
-            m_granularity, m_maxDepth == -1 ? -1 : m_maxDepth-1, m_rrDepth, true,
-            m_autoCancelGathering, job);
-
-        proc->bindResource("scene", sceneResID);
-        proc->bindResource("sensor", sensorResID);
-        proc->bindResource("sampler", samplerResID);
-
-        sched->schedule(proc);
-        sched->wait(proc);
-
-        ref<PhotonMap> photonMap = proc->getPhotonMap();
-        photonMap->build();
-        Log(EDebug, "Photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: "
-            SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
+        ref<PhotonMap> photonMap;
+        size_t shotParticles, photonCount;
+
+        if (m_splatPhotons) {
+            /* Trace photons and splat them directly into the gather points */
+            ref<SPPMSplatProcess> proc = new SPPMSplatProcess(m_grid,
+                m_photonCount, m_granularity, m_maxDepth == -1 ? -1 : m_maxDepth-1,
+                m_rrDepth, m_autoCancelGathering, job);
+
+            proc->bindResource("scene", sceneResID);
+            proc->bindResource("sensor", sensorResID);
+            proc->bindResource("sampler", samplerResID);
+
+            sched->schedule(proc);
+            sched->wait(proc);
+
+            shotParticles = proc->getShotParticles();
+            photonCount = proc->getPhotonCount();
+            Log(EDebug, "Splatted " SIZE_T_FMT " photons (shot " SIZE_T_FMT " particles, "
+                SIZE_T_FMT " gather point references in the grid)", photonCount,
+                shotParticles, m_grid->getEntryCount());
+        } else {
+            /* Generate the global photon map */
+            ref<GatherPhotonProcess> proc = new GatherPhotonProcess(
+                GatherPhotonProcess::EAllSurfacePhotons, m_photonCount,
+                m_granularity, m_maxDepth == -1 ? -1 : m_maxDepth-1, m_rrDepth, true,
+                m_autoCancelGathering, job);
+
+            proc->bindResource("scene", sceneResID);
+            proc->bindResource("sensor", sensorResID);
+            proc->bindResource("sampler", samplerResID);
+
+            sched->schedule(proc);
+            sched->wait(proc);
+
+            photonMap = proc->getPhotonMap();
+            photonMap->build();
+            Log(EDebug, "Photon map full. Shot " SIZE_T_FMT " particles, excess photons due to parallelism: "
+                SIZE_T_FMT, proc->getShotParticles(), proc->getExcessPhotons());
+
+            shotParticles = proc->getShotParticles();
+            photonCount = photonMap->size();
+        }
 
         Log(EInfo, "Gathering ..");
-        m_totalEmitted += proc->getShotParticles();
-        m_totalPhotons += photonMap->size();
+        m_totalEmitted += shotParticles;
+        m_totalPhotons += photonCount;
         film->clear();
         #if defined(MTS_OPENMP)
             #pragma omp parallel for schedule(dynamic)
@@ -350,8 +387,15 @@ public:
                 Spectrum flux, contrib;
 
                 if (gp.depth != -1) {
-                    M = (Float) photonMap->estimateRadianceRaw(
-                        gp.its, gp.radius, flux, m_maxDepth == -1 ? INT_MAX : m_maxDepth-gp.depth);
+                    if (photonMap) {
+                        M = (Float) photonMap->estimateRadianceRaw(
+                            gp.its, gp.radius, flux, m_maxDepth == -1 ? INT_MAX : m_maxDepth-gp.depth);
+                    } else {
+                        M = (Float) gp.M;
+                        flux = gp.phi;
+                        gp.M = 0;
+                        gp.phi = Spectrum(0.0f);
+                    }
                 } else {
                     M = 0;
                     flux = Spectrum(0.0f);
@@ -368,7 +412,7 @@ public:
 
                     gp.flux = (gp.flux +
                             gp.weight * flux +
-                            gp.emission * (Float) proc->getShotParticles() * M_PI * gp.radius*gp.radius) * ratio;
+                            gp.emission * (Float) shotParticles * M_PI * gp.radius*gp.radius) * ratio;
                     gp.N = N + m_alpha * M;
                     contrib = gp.flux / ((Float) m_totalEmitted * gp.radius*gp.radius * M_PI);
                 }
@@ -389,7 +433,8 @@ public:
             << "  alpha = " << m_alpha << "," << endl
             << "  photonCount = " << m_photonCount << "," << endl
             << "  granularity = " << m_granularity << "," << endl
-            << "  maxPasses = " << m_maxPasses << endl
+            << "  maxPasses = " << m_maxPasses << "," << endl
+            << "  splatPhotons = " << m_splatPhotons << endl
             << "]";
         return oss.str();
     }
@@ -400,6 +445,7 @@ private:
     std::vector<Point2i> m_offset;
     ref<Mutex> m_mutex;
     ref<Bitmap> m_bitmap;
+    ref<SPPMGatherGrid> m_grid;
     Float m_initialRadius, m_alpha;
     int m_photonCount, m_granularity;
     int m_maxDepth, m_rrDepth;
@@ -407,6 +453,7 @@ private:
     bool m_running;
     bool m_autoCancelGathering;
     int m_maxPasses;
+    bool m_splatPhotons;
 };
 
 MTS_IMPLEMENT_CLASS_S(SPPMIntegrator, false, Integrator)
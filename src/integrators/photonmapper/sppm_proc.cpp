@@ -0,0 +1,289 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/atomic.h>
+#include <mitsuba/render/range.h>
+#include "sppm_proc.h"
+
+#if defined(MTS_OPENMP)
+# include <omp.h>
+#endif
+
+/// Maximum grid resolution along each axis (cell positions must fit into an int)
+#define MTS_SPPM_MAX_GRID_RES (1 << 20)
+
+MTS_NAMESPACE_BEGIN
+
+/* ==================================================================== */
+/*                          Gather point grid                           */
+/* ==================================================================== */
+
+SPPMGatherGrid::SPPMGatherGrid(int maxDepth) : m_maxDepth(maxDepth),
+    m_invCellSize(0.0f), m_res(0) { }
+
+void SPPMGatherGrid::build(GatherBlocks &gatherBlocks) {
+    size_t gatherPointCount = 0;
+    Float maxRadius = 0;
+
+    m_aabb.reset();
+    for (size_t i=0; i<gatherBlocks.size(); ++i) {
+        const std::vector<SPPMGatherPoint> &gatherPoints = gatherBlocks[i];
+        for (size_t j=0; j<gatherPoints.size(); ++j) {
+            const SPPMGatherPoint &gp = gatherPoints[j];
+            if (gp.depth == -1)
+                continue;
+            m_aabb.expandBy(gp.its.p);
+            maxRadius = std::max(maxRadius, gp.radius);
+            ++gatherPointCount;
+        }
+    }
+
+    m_entries.clear();
+    if (gatherPointCount == 0 || maxRadius == 0) {
+        m_cellStart.clear();
+        return;
+    }
+
+    /* The cells are as large as the radius of the largest search
+       sphere, hence a gather point overlaps at most 27 of them */
+    m_aabb.min -= Vector(maxRadius);
+    m_aabb.max += Vector(maxRadius);
+    Vector extents = m_aabb.getExtents();
+    Float cellSize = std::max(maxRadius,
+        extents[m_aabb.getLargestAxis()] / MTS_SPPM_MAX_GRID_RES);
+    m_invCellSize = 1 / cellSize;
+    for (int i=0; i<3; ++i)
+        m_res[i] = std::max(1, (int) std::ceil(extents[i] * m_invCellSize));
+
+    /* Count the references per hash table bucket */
+    size_t tableSize = gatherPointCount;
+    std::vector<int32_t> counts(tableSize, 0);
+    m_cellStart.resize(tableSize + 1);
+
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i=0; i<(int) gatherBlocks.size(); ++i) {
+        const std::vector<SPPMGatherPoint> &gatherPoints = gatherBlocks[i];
+        for (size_t j=0; j<gatherPoints.size(); ++j) {
+            const SPPMGatherPoint &gp = gatherPoints[j];
+            if (gp.depth == -1)
+                continue;
+            Point3i start = getCell(gp.its.p - Vector(gp.radius)),
+                    end   = getCell(gp.its.p + Vector(gp.radius));
+            for (int z=start.z; z<=end.z; ++z)
+                for (int y=start.y; y<=end.y; ++y)
+                    for (int x=start.x; x<=end.x; ++x)
+                        atomicAdd(&counts[hash(Point3i(x, y, z))], 1);
+        }
+    }
+
+    size_t entryCount = 0;
+    for (size_t i=0; i<tableSize; ++i) {
+        m_cellStart[i] = (uint32_t) entryCount;
+        entryCount += counts[i];
+        counts[i] = 0;
+    }
+    m_cellStart[tableSize] = (uint32_t) entryCount;
+    m_entries.resize(entryCount);
+
+    /* Scatter the gather point references into their buckets */
+    #if defined(MTS_OPENMP)
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int i=0; i<(int) gatherBlocks.size(); ++i) {
+        std::vector<SPPMGatherPoint> &gatherPoints = gatherBlocks[i];
+        for (size_t j=0; j<gatherPoints.size(); ++j) {
+            SPPMGatherPoint &gp = gatherPoints[j];
+            if (gp.depth == -1)
+                continue;
+            Point3i start = getCell(gp.its.p - Vector(gp.radius)),
+                    end   = getCell(gp.its.p + Vector(gp.radius));
+            for (int z=start.z; z<=end.z; ++z) {
+                for (int y=start.y; y<=end.y; ++y) {
+                    for (int x=start.x; x<=end.x; ++x) {
+                        Point3i cell(x, y, z);
+                        uint32_t bucket = hash(cell);
+                        int32_t offset = atomicAdd(&counts[bucket], 1) - 1;
+                        Entry &entry = m_entries[m_cellStart[bucket] + offset];
+                        entry.p = gp.its.p;
+                        entry.radiusSquared = gp.radius * gp.radius;
+                        entry.cell = cell;
+                        entry.gatherPoint = &gp;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void SPPMGatherGrid::splat(const Intersection &its, const Spectrum &power,
+        int depth) const {
+    if (m_entries.empty() || !m_aabb.contains(its.p))
+        return;
+
+    const Normal &photonNormal = its.geoFrame.n;
+    Vector wi = its.toWorld(its.wi);
+    Float wiDotGeoN = absDot(photonNormal, wi);
+
+    Point3i cell = getCell(its.p);
+    uint32_t bucket = hash(cell);
+    for (uint32_t i=m_cellStart[bucket]; i<m_cellStart[bucket+1]; ++i) {
+        const Entry &entry = m_entries[i];
+        /* Skip entries of other cells that share this bucket */
+        if (entry.cell != cell ||
+            (entry.p - its.p).lengthSquared() > entry.radiusSquared)
+            continue;
+
+        SPPMGatherPoint &gp = *entry.gatherPoint;
+
+        /* Photons are counted even if they don't contribute (this
+           matches PhotonMap::estimateRadianceRaw()) */
+        atomicAdd(&gp.M, 1);
+
+        if ((m_maxDepth != -1 && depth > m_maxDepth - gp.depth)
+            || dot(photonNormal, gp.its.shFrame.n) < 1e-1f
+            || wiDotGeoN < 1e-2f)
+            continue;
+
+        BSDFSamplingRecord bRec(gp.its, gp.its.toLocal(wi), gp.its.wi, EImportance);
+
+        Spectrum value = power * gp.its.getBSDF()->eval(bRec);
+        if (value.isZero())
+            continue;
+
+        /* Account for non-symmetry due to shading normals */
+        value *= std::abs(Frame::cosTheta(bRec.wi) /
+            (wiDotGeoN * Frame::cosTheta(bRec.wo)));
+
+        for (int k=0; k<SPECTRUM_SAMPLES; ++k)
+            atomicAdd(&gp.phi[k], value[k]);
+    }
+}
+
+/* ==================================================================== */
+/*                           Work result impl.                          */
+/* ==================================================================== */
+
+void SPPMSplatResult::load(Stream *stream) {
+    m_particleCount = stream->readSize();
+    m_photonCount = stream->readSize();
+}
+
+void SPPMSplatResult::save(Stream *stream) const {
+    stream->writeSize(m_particleCount);
+    stream->writeSize(m_photonCount);
+}
+
+std::string SPPMSplatResult::toString() const {
+    std::ostringstream oss;
+    oss << "SPPMSplatResult[particleCount=" << m_particleCount
+        << ", photonCount=" << m_photonCount << "]";
+    return oss.str();
+}
+
+/* ==================================================================== */
+/*                         Work processor impl.                         */
+/* ==================================================================== */
+
+void SPPMSplatWorker::serialize(Stream *stream, InstanceManager *manager) const {
+    Log(EError, "Network rendering is not supported!");
+}
+
+ref<WorkProcessor> SPPMSplatWorker::clone() const {
+    return new SPPMSplatWorker(m_grid.get(), m_maxDepth, m_rrDepth);
+}
+
+ref<WorkResult> SPPMSplatWorker::createWorkResult() const {
+    return new SPPMSplatResult();
+}
+
+void SPPMSplatWorker::process(const WorkUnit *workUnit, WorkResult *workResult,
+    const bool &stop) {
+    m_workResult = static_cast<SPPMSplatResult *>(workResult);
+    m_workResult->clear();
+    ParticleTracer::process(workUnit, workResult, stop);
+    m_workResult = NULL;
+}
+
+void SPPMSplatWorker::handleNewParticle() {
+    m_workResult->nextParticle();
+}
+
+void SPPMSplatWorker::handleSurfaceInteraction(int depth_, int nullInteractions,
+        bool delta, const Intersection &its, const Medium *medium,
+        const Spectrum &weight) {
+    int bsdfType = its.getBSDF()->getType(), depth = depth_ - nullInteractions;
+    if (!(bsdfType & BSDF::EDiffuseReflection) && !(bsdfType & BSDF::EGlossyReflection))
+        return;
+
+    m_workResult->nextPhoton();
+    m_grid->splat(its, weight, depth);
+}
+
+/* ==================================================================== */
+/*                           Parallel process                           */
+/* ==================================================================== */
+
+SPPMSplatProcess::SPPMSplatProcess(const SPPMGatherGrid *grid, size_t photonCount,
+    size_t granularity, int maxDepth, int rrDepth, bool autoCancel,
+    const void *progressReporterPayload)
+    : ParticleProcess(ParticleProcess::EGather, photonCount, granularity,
+      "Splatting photons", progressReporterPayload), m_grid(grid),
+      m_maxDepth(maxDepth), m_rrDepth(rrDepth), m_autoCancel(autoCancel),
+      m_numShot(0) { }
+
+bool SPPMSplatProcess::isLocal() const {
+    return true;
+}
+
+ref<WorkProcessor> SPPMSplatProcess::createWorkProcessor() const {
+    return new SPPMSplatWorker(m_grid.get(), m_maxDepth, m_rrDepth);
+}
+
+void SPPMSplatProcess::processResult(const WorkResult *wr, bool cancelled) {
+    const SPPMSplatResult *result = static_cast<const SPPMSplatResult *>(wr);
+
+    /* The photons have already been splatted, hence the particles
+       must be accounted for even if the work unit was cancelled */
+    {
+        LockGuard lock(m_resultMutex);
+        m_numShot += result->getParticleCount();
+    }
+
+    if (!cancelled)
+        increaseResultCount(result->getPhotonCount());
+}
+
+ParallelProcess::EStatus SPPMSplatProcess::generateWork(WorkUnit *unit, int worker) {
+    /* Use the same approach as PBRT for auto canceling */
+    LockGuard lock(m_resultMutex);
+    if (m_autoCancel && m_numShot > 100000 && m_receivedResultCount < m_workCount
+            && (m_receivedResultCount == 0 || m_receivedResultCount < m_numShot/1024)) {
+        Log(EInfo, "Not enough photons could be collected, giving up");
+        return EFailure;
+    }
+
+    return ParticleProcess::generateWork(unit, worker);
+}
+
+MTS_IMPLEMENT_CLASS(SPPMGatherGrid, false, Object)
+MTS_IMPLEMENT_CLASS(SPPMSplatResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS(SPPMSplatWorker, false, ParticleTracer)
+MTS_IMPLEMENT_CLASS(SPPMSplatProcess, false, ParticleProcess)
+MTS_NAMESPACE_END
@@ -0,0 +1,244 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__SPPM_PROC_H)
+#define __SPPM_PROC_H
+
+#include <mitsuba/render/particleproc.h>
+
+MTS_NAMESPACE_BEGIN
+
+/// Represents one individual PPM gather point including relevant statistics
+struct SPPMGatherPoint {
+    Intersection its;
+    Float radius;
+    Spectrum weight;
+    Spectrum flux;
+    Spectrum emission;
+    Float N;
+    int depth;
+    Point2i pos;
+
+    /* Photon statistics of the current pass (only used when splatting) */
+    Spectrum phi;
+    int32_t M;
+
+    inline SPPMGatherPoint() : weight(0.0f), flux(0.0f), emission(0.0f),
+        N(0.0f), phi(0.0f), M(0) { }
+};
+
+/* ==================================================================== */
+/*                          Gather point grid                           */
+/* ==================================================================== */
+
+/**
+ * \brief Spatial hash grid over the gather points of one SPPM pass
+ *
+ * Every gather point is registered in all grid cells overlapped by the
+ * bounding box of its search sphere. A photon must then only visit the
+ * gather points stored in its own cell. The grid is static while photons
+ * are being traced, and the photon statistics are accumulated into the
+ * gather points using atomic operations, hence no locking is needed.
+ */
+class SPPMGatherGrid : public Object {
+public:
+    typedef std::vector<std::vector<SPPMGatherPoint> > GatherBlocks;
+
+    /**
+     * \brief Create an empty grid
+     *
+     * \param maxDepth
+     *     Longest visualized path depth (<tt>-1</tt>=infinite). Photons
+     *     that would exceed it at a gather point are counted, but
+     *     don't contribute any flux.
+     */
+    SPPMGatherGrid(int maxDepth);
+
+    /// Rebuild the grid for the current positions and radii of the gather points
+    void build(GatherBlocks &gatherBlocks);
+
+    /**
+     * \brief Accumulate a photon into all gather points whose
+     * search sphere contains it
+     *
+     * \param its
+     *     Surface interaction of the photon
+     * \param power
+     *     Power of the photon
+     * \param depth
+     *     Path depth of the photon
+     */
+    void splat(const Intersection &its, const Spectrum &power, int depth) const;
+
+    /// Return the number of gather point references stored in the grid
+    inline size_t getEntryCount() const { return m_entries.size(); }
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SPPMGatherGrid() { }
+
+    /// Map a cell position to its bucket in the hash table
+    inline uint32_t hash(const Point3i &p) const {
+        return (uint32_t) (((uint32_t) p.x * 73856093u) ^
+            ((uint32_t) p.y * 19349663u) ^ ((uint32_t) p.z * 83492791u))
+            % (uint32_t) (m_cellStart.size() - 1);
+    }
+
+    /// Return the cell containing the given point
+    inline Point3i getCell(const Point &p) const {
+        Vector rel = (p - m_aabb.min) * m_invCellSize;
+        return Point3i(
+            std::max(0, std::min((int) rel.x, m_res.x - 1)),
+            std::max(0, std::min((int) rel.y, m_res.y - 1)),
+            std::max(0, std::min((int) rel.z, m_res.z - 1)));
+    }
+private:
+    /**
+     * \brief Grid entry, which caches the search sphere of a gather point
+     *
+     * Several of the cells overlapped by a gather point may hash to the
+     * same bucket. The cell is stored so that a photon only visits the
+     * entry of its own cell, and thus each gather point at most once.
+     */
+    struct Entry {
+        Point p;
+        Float radiusSquared;
+        Point3i cell;
+        SPPMGatherPoint *gatherPoint;
+    };
+
+    int m_maxDepth;
+    AABB m_aabb;
+    Float m_invCellSize;
+    Point3i m_res;
+    std::vector<uint32_t> m_cellStart;
+    std::vector<Entry> m_entries;
+};
+
+/* ==================================================================== */
+/*                             Work result                              */
+/* ==================================================================== */
+
+/// Statistics about the photons splatted by one work unit
+class SPPMSplatResult : public WorkResult {
+public:
+    inline SPPMSplatResult() : m_particleCount(0), m_photonCount(0) { }
+
+    inline void clear() { m_particleCount = m_photonCount = 0; }
+    inline void nextParticle() { ++m_particleCount; }
+    inline void nextPhoton() { ++m_photonCount; }
+
+    inline size_t getParticleCount() const { return m_particleCount; }
+    inline size_t getPhotonCount() const { return m_photonCount; }
+
+    void load(Stream *stream);
+    void save(Stream *stream) const;
+    std::string toString() const;
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SPPMSplatResult() { }
+private:
+    size_t m_particleCount;
+    size_t m_photonCount;
+};
+
+/* ==================================================================== */
+/*                             Work processor                           */
+/* ==================================================================== */
+
+/**
+ * \brief Photon tracing worker, which splats the photons directly
+ * into the gather points instead of storing them.
+ */
+class SPPMSplatWorker : public ParticleTracer {
+public:
+    inline SPPMSplatWorker(const SPPMGatherGrid *grid, int maxDepth,
+        int rrDepth) : ParticleTracer(maxDepth, rrDepth, false),
+        m_grid(grid) { }
+
+    void serialize(Stream *stream, InstanceManager *manager) const;
+    ref<WorkProcessor> clone() const;
+    ref<WorkResult> createWorkResult() const;
+    void process(const WorkUnit *workUnit, WorkResult *workResult,
+        const bool &stop);
+
+    void handleNewParticle();
+
+    void handleSurfaceInteraction(int depth, int nullInteractions, bool delta,
+        const Intersection &its, const Medium *medium,
+        const Spectrum &weight);
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SPPMSplatWorker() { }
+private:
+    ref<const SPPMGatherGrid> m_grid;
+    ref<SPPMSplatResult> m_workResult;
+};
+
+/* ==================================================================== */
+/*                           Parallel process                           */
+/* ==================================================================== */
+
+/**
+ * \brief Traces particles until the requested number of photons has
+ * been splatted into the gather point grid.
+ *
+ * Since the workers write into the gather points of the local machine,
+ * this process can't be distributed over the network. Photons of work
+ * units that are still in flight once enough photons have been
+ * collected are not discarded, since they have already been splatted
+ * -- the emitted particles are accounted for in \ref getShotParticles().
+ */
+class SPPMSplatProcess : public ParticleProcess {
+public:
+    SPPMSplatProcess(const SPPMGatherGrid *grid, size_t photonCount,
+        size_t granularity, int maxDepth, int rrDepth, bool autoCancel,
+        const void *progressReporterPayload);
+
+    /// Return the number of particles that were shot
+    inline size_t getShotParticles() const { return m_numShot; }
+
+    /// Return the number of photons that were splatted
+    inline size_t getPhotonCount() const { return m_receivedResultCount; }
+
+    /* ParallelProcess impl. */
+    bool isLocal() const;
+    ref<WorkProcessor> createWorkProcessor() const;
+    void processResult(const WorkResult *wr, bool cancelled);
+    EStatus generateWork(WorkUnit *unit, int worker);
+
+    MTS_DECLARE_CLASS()
+protected:
+    /// Virtual destructor
+    virtual ~SPPMSplatProcess() { }
+private:
+    ref<const SPPMGatherGrid> m_grid;
+    int m_maxDepth;
+    int m_rrDepth;
+    bool m_autoCancel;
+    size_t m_numShot;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __SPPM_PROC_H */
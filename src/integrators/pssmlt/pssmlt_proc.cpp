@@ -310,9 +310,10 @@ void PSSMLTProcess::develop() {
 }
 
 void PSSMLTProcess::processResult(const WorkResult *wr, bool cancelled) {
-    LockGuard lock(m_resultMutex);
     const ImageBlock *result = static_cast<const ImageBlock *>(wr);
-    m_accum->put(result);
+    m_accum->putConcurrent(result);
+
+    LockGuard lock(m_resultMutex);
     m_progress->update(++m_resultCounter);
     m_refreshTimeout = std::min(2000U, m_refreshTimeout * 2);
 
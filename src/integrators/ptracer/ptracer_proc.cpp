@@ -211,9 +211,12 @@ void CaptureParticleProcess::processResult(const WorkResult *wr, bool cancelled)
     if (cancelled)
         return;
 
+    /* Merge without holding the result lock. The result count is only
+       increased afterwards, so that the final develop() sees all data */
+    m_accum->putConcurrent(result);
+
     LockGuard lock(m_resultMutex);
     increaseResultCount(range->getSize());
-    m_accum->put(result);
     if (m_job->isInteractive() || m_receivedResultCount == m_workCount)
         develop();
 }
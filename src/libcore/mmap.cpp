@@ -18,10 +18,12 @@ struct MemoryMappedFile::MemoryMappedFilePrivate {
     size_t size;
     void *data;
     bool readOnly;
+    bool copyOnWrite;
     bool temp;
 
     MemoryMappedFilePrivate(const fs::path &f = "", size_t s = 0)
-        : filename(f), size(s), data(NULL), readOnly(false), temp(false) {}
+        : filename(f), size(s), data(NULL), readOnly(false),
+          copyOnWrite(false), temp(false) {}
 
     void create() {
         #if defined(__LINUX__) || defined(__OSX__)
@@ -63,7 +65,11 @@ struct MemoryMappedFile::MemoryMappedFilePrivate {
         temp = true;
 
         #if defined(__LINUX__) || defined(__OSX__)
-            char *path = strdup("/tmp/mitsuba_XXXXXX");
+            /* Respect $TMPDIR, since /tmp may be a RAM-backed file system */
+            const char *tmpDir = getenv("TMPDIR");
+            std::string pattern = std::string(tmpDir && *tmpDir ? tmpDir : "/tmp")
+                + "/mitsuba_XXXXXX";
+            char *path = strdup(pattern.c_str());
             int fd = mkstemp(path);
             if (fd == -1)
                 SLog(EError, "Unable to create temporary file (1): %s", strerror(errno));
@@ -122,26 +128,31 @@ struct MemoryMappedFile::MemoryMappedFilePrivate {
         size = (size_t) fs::file_size(filename);
 
         #if defined(__LINUX__) || defined(__OSX__)
-            int fd = open(filename.string().c_str(), readOnly ? O_RDONLY : O_RDWR);
+            int fd = open(filename.string().c_str(), (readOnly || copyOnWrite) ? O_RDONLY : O_RDWR);
             if (fd == -1)
                 Log(EError, "Could not open \"%s\"!", filename.string().c_str());
-            data = mmap(NULL, size, PROT_READ | (readOnly ? 0 : PROT_WRITE), MAP_SHARED, fd, 0);
+            if (copyOnWrite)
+                data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            else
+                data = mmap(NULL, size, PROT_READ | (readOnly ? 0 : PROT_WRITE), MAP_SHARED, fd, 0);
             if (data == NULL)
                 Log(EError, "Could not map \"%s\" to memory!", filename.string().c_str());
             if (close(fd) != 0)
                 Log(EError, "close(): unable to close file!");
         #elif defined(__WINDOWS__)
-            file = CreateFile(filename.string().c_str(), GENERIC_READ | (readOnly ? 0 : GENERIC_WRITE),
+            file = CreateFile(filename.string().c_str(), GENERIC_READ | ((readOnly || copyOnWrite) ? 0 : GENERIC_WRITE),
                 FILE_SHARE_WRITE|FILE_SHARE_READ, NULL, OPEN_EXISTING,
                 FILE_ATTRIBUTE_NORMAL, NULL);
             if (file == INVALID_HANDLE_VALUE)
                 Log(EError, "Could not open \"%s\": %s", filename.string().c_str(),
                     lastErrorText().c_str());
-            fileMapping = CreateFileMapping(file, NULL, readOnly ? PAGE_READONLY : PAGE_READWRITE, 0, 0, NULL);
+            fileMapping = CreateFileMapping(file, NULL, copyOnWrite ? PAGE_WRITECOPY :
+                (readOnly ? PAGE_READONLY : PAGE_READWRITE), 0, 0, NULL);
             if (fileMapping == NULL)
                 Log(EError, "CreateFileMapping: Could not map \"%s\" to memory: %s",
                     filename.string().c_str(), lastErrorText().c_str());
-            data = (void *) MapViewOfFile(fileMapping, readOnly ? FILE_MAP_READ : FILE_MAP_WRITE, 0, 0, 0);
+            data = (void *) MapViewOfFile(fileMapping, copyOnWrite ? FILE_MAP_COPY :
+                (readOnly ? FILE_MAP_READ : FILE_MAP_WRITE), 0, 0, 0);
             if (data == NULL)
                 Log(EError, "MapViewOfFile: Could not map \"%s\" to memory: %s",
                     filename.string().c_str(), lastErrorText().c_str());
@@ -197,9 +208,10 @@ MemoryMappedFile::MemoryMappedFile(const fs::path &filename, size_t size)
 }
 
 
-MemoryMappedFile::MemoryMappedFile(const fs::path &filename, bool readOnly)
-    : d(new MemoryMappedFilePrivate(filename)) {
-    d->readOnly = readOnly;
+MemoryMappedFile::MemoryMappedFile(const fs::path &filename, bool readOnly,
+        bool copyOnWrite) : d(new MemoryMappedFilePrivate(filename)) {
+    d->readOnly = readOnly && !copyOnWrite;
+    d->copyOnWrite = copyOnWrite;
     d->map();
     Log(ETrace, "Mapped \"%s\" into memory (%s)..",
         filename.filename().string().c_str(), memString(d->size).c_str());
@@ -217,7 +229,7 @@ MemoryMappedFile::~MemoryMappedFile() {
 }
 
 void MemoryMappedFile::resize(size_t size) {
-    if (!d->data)
+    if (!d->data || d->copyOnWrite)
         Log(EError, "Internal error in MemoryMappedFile::resize()!");
     bool temp = d->temp;
     d->temp = false;
@@ -19,6 +19,8 @@
 #include <mitsuba/core/sched.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/mstream.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
 
 #include <boost/thread/thread.hpp>
 
@@ -49,6 +51,12 @@ bool ParallelProcess::isLocal() const {
 /*                              Scheduler                               */
 /* ==================================================================== */
 
+static StatsCounter statsStolenUnits("Scheduler", "Work units obtained by stealing");
+
+/* Per-node work unit timings in NUMA mode. These are created on demand
+   and never released, since the statistics registry keeps pointers to them */
+static std::vector<StatsCounter *> statsNUMAUnitTime;
+
 ref<Scheduler> Scheduler::m_scheduler;
 
 Scheduler::Scheduler() {
@@ -57,11 +65,16 @@ Scheduler::Scheduler() {
     m_resourceCounter = 0;
     m_processCounter = 0;
     m_running = false;
+    m_workStealing = false;
+    m_numaMode = false;
+    m_workBatchSize = 4;
 }
 
 Scheduler::~Scheduler() {
     for (size_t i=0; i<m_workers.size(); ++i)
         m_workers[i]->decRef();
+    for (size_t i=0; i<m_workDeques.size(); ++i)
+        delete m_workDeques[i];
 }
 
 void Scheduler::registerWorker(Worker *worker) {
@@ -105,6 +118,21 @@ size_t Scheduler::getLocalWorkerCount() const {
     return count;
 }
 
+void Scheduler::setWorkStealing(bool enabled, size_t batchSize) {
+    if (m_running)
+        Log(EError, "setWorkStealing(): the scheduler must not be running!");
+    if (batchSize == 0)
+        Log(EError, "setWorkStealing(): the batch size must be positive!");
+    m_workStealing = enabled;
+    m_workBatchSize = batchSize;
+}
+
+void Scheduler::setNUMAMode(bool enabled) {
+    if (m_running)
+        Log(EError, "setNUMAMode(): the scheduler must not be running!");
+    m_numaMode = enabled;
+}
+
 bool Scheduler::isBusy() const {
     bool result;
     LockGuard lock(m_mutex); // make valgrind/helgrind happy
@@ -229,6 +257,15 @@ const MemoryStream *Scheduler::getResourceStream(int id) {
     return rec->stream;
 }
 
+std::string Scheduler::getResourceHash(int id) {
+    LockGuard lock(m_mutex);
+    const MemoryStream *stream = getResourceStream(id);
+    ResourceRecord *rec = m_resources[id];
+    if (rec->hash.empty())
+        rec->hash = sha256(stream->getData(), stream->getPos());
+    return rec->hash;
+}
+
 int Scheduler::getResourceID(const SerializableObject *obj) const {
     LockGuard lock(m_mutex);
     std::map<int, ResourceRecord *>::const_iterator it = m_resources.begin();
@@ -378,6 +415,23 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
     for (size_t i=0; i<m_workers.size(); ++i)
         m_workers[i]->signalProcessCancellation(rec->id);
 
+    /* Discard pre-generated work units of this process (work stealing mode) */
+    for (size_t i=0; i<m_workDeques.size(); ++i) {
+        WorkDeque *deque = m_workDeques[i];
+        if (!deque)
+            continue;
+        LockGuard guard(deque->mutex);
+        std::deque<WorkDeque::Entry>::iterator it = deque->units.begin();
+        while (it != deque->units.end()) {
+            if (it->id == rec->id) {
+                it = deque->units.erase(it);
+                --rec->inflight;
+            } else {
+                ++it;
+            }
+        }
+    }
+
     /* Ensure that this process won't be scheduled again */
     m_localQueue.erase(std::remove(m_localQueue.begin(), m_localQueue.end(), rec->id),
         m_localQueue.end());
@@ -495,6 +549,175 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
     return EOK;
 }
 
+Scheduler::EStatus Scheduler::acquireLocalWork(Item &item) {
+    WorkDeque *own = m_workDeques.at(item.workerIndex);
+    WorkDeque::Entry entry;
+
+    while (true) {
+        /* Stop when the scheduler is paused. Queued units stay in
+           the deques and are carried over by start() */
+        if (!m_running)
+            return EStop;
+
+        /* Try the private deque first, then the other local workers */
+        if (own->pop(entry) || stealWork(item.workerIndex, entry))
+            break;
+
+        /* Both are empty -- fetch a new batch from the central queue */
+        UniqueLock lock(m_mutex);
+        EStatus status = generateWorkBatch(item, own);
+        if (status == EStop)
+            return EStop;
+        else if (status == EOK)
+            continue;
+
+        /* Nothing to generate. Sleep unless other workers still have
+           queued units (deques are only filled while the main lock is
+           held and followed by a broadcast, hence no wakeup can be
+           missed here) */
+        if (m_running && m_localQueue.size() == 0 && !hasQueuedWork())
+            m_workAvailable->wait();
+    }
+
+    /* Recycle the previously processed work unit */
+    if (item.workUnit)
+        own->freeUnits.push_back(item.workUnit);
+
+    if (item.id != entry.id) {
+        /* The unit belongs to a different process (e.g. it was stolen) */
+        own->freeUnits.clear();
+        setProcessByID(item, entry.id);
+    }
+
+    item.workUnit = entry.unit;
+    item.stop = false;
+    return EOK;
+}
+
+Scheduler::EStatus Scheduler::generateWorkBatch(Item &item, WorkDeque *deque) {
+    size_t count = 0;
+
+    while (count < m_workBatchSize && m_running && m_localQueue.size() > 0) {
+        int id = m_localQueue.front();
+        ref<WorkUnit> unit;
+        ParallelProcess::EStatus wStatus;
+
+        try {
+            if (item.id != id) {
+                deque->freeUnits.clear();
+                setProcessByID(item, id);
+            }
+
+            if (deque->freeUnits.empty()) {
+                unit = item.wp->createWorkUnit();
+            } else {
+                unit = deque->freeUnits.back();
+                deque->freeUnits.pop_back();
+            }
+
+            wStatus = item.proc->generateWork(unit, item.workerIndex);
+        } catch (const std::exception &ex) {
+            Log(EWarn, "Caught an exception - canceling process %i: %s",
+                item.id, ex.what());
+            cancel(item.proc);
+            continue;
+        }
+
+        if (wStatus == ParallelProcess::ESuccess) {
+            item.rec->inflight++;
+            LockGuard guard(deque->mutex);
+            deque->units.push_back(WorkDeque::Entry(id, unit));
+            ++count;
+            continue;
+        }
+
+        deque->freeUnits.push_back(unit);
+        if (wStatus == ParallelProcess::EFailure) {
+#if defined(DEBUG_SCHED)
+            if (item.rec->morework)
+                Log(item.rec->logLevel, "Process %i has finished generating work", item.rec->id);
+#endif
+            item.rec->morework = false;
+            item.rec->active = false;
+            m_localQueue.pop_front();
+            if (item.rec->inflight == 0)
+                signalProcessTermination(item.proc, item.rec);
+        } else if (wStatus == ParallelProcess::EPause) {
+#if defined(DEBUG_SCHED)
+            Log(item.rec->logLevel, "Pausing process %i", item.rec->id);
+#endif
+            item.rec->active = false;
+            m_localQueue.pop_front();
+        }
+    }
+
+    /* Wake up idle workers so that they can steal the surplus */
+    if (count > 1)
+        m_workAvailable->broadcast();
+
+    if (count > 0)
+        return EOK;
+    return m_running ? ENone : EStop;
+}
+
+bool Scheduler::stealWork(int workerIndex, WorkDeque::Entry &entry) {
+    const size_t n = m_workDeques.size();
+    const int node = m_workers[workerIndex]->getNUMANode();
+    std::vector<WorkDeque::Entry> loot;
+
+    /* In NUMA mode, first try to steal from workers on the same node */
+    for (int pass = (node >= 0) ? 0 : 1; pass < 2 && loot.empty(); ++pass) {
+        for (size_t i=1; i<n && loot.empty(); ++i) {
+            size_t victimIndex = (workerIndex + i) % n;
+            WorkDeque *victim = m_workDeques[victimIndex];
+            if (!victim || (pass == 0 && m_workers[victimIndex]->getNUMANode() != node))
+                continue;
+
+            /* Take the most recently generated half of the victim's units */
+            LockGuard guard(victim->mutex);
+            size_t count = (victim->units.size() + 1) / 2;
+            for (size_t j=0; j<count; ++j) {
+                loot.push_back(victim->units.back());
+                victim->units.pop_back();
+            }
+        }
+    }
+
+    if (loot.empty())
+        return false;
+
+    statsStolenUnits += loot.size();
+
+    /* Process the oldest unit now and queue the rest in their original order
+       (done without holding the victim's lock to keep a strict lock order).
+       The surplus is published under the main lock, and idle workers are
+       woken up so that they can steal from it in turn */
+    entry = loot.back();
+    if (loot.size() > 1) {
+        WorkDeque *own = m_workDeques[workerIndex];
+        LockGuard lock(m_mutex);
+        {
+            LockGuard guard(own->mutex);
+            for (size_t j=loot.size()-1; j-- > 0; )
+                own->units.push_back(loot[j]);
+        }
+        m_workAvailable->broadcast();
+    }
+    return true;
+}
+
+bool Scheduler::hasQueuedWork() const {
+    for (size_t i=0; i<m_workDeques.size(); ++i) {
+        WorkDeque *deque = m_workDeques[i];
+        if (!deque)
+            continue;
+        LockGuard guard(deque->mutex);
+        if (!deque->units.empty())
+            return true;
+    }
+    return false;
+}
+
 void Scheduler::signalProcessTermination(ParallelProcess *proc, ProcessRecord *rec) {
 #if defined(DEBUG_SCHED)
     Log(rec->logLevel, "Process %i is complete.", rec->id);
@@ -525,10 +748,71 @@ void Scheduler::start() {
 #if defined(DEBUG_SCHED)
     Log(EDebug, "Starting ..");
 #endif
+    if (hasQueuedWork() && (!m_workStealing || !hasLocalWorkers()))
+        Log(EError, "Cannot start the scheduler - the queued work units "
+            "of the paused scheduler require work stealing and local workers!");
     m_running = true;
     if (m_workers.size() == 0)
         Log(EError, "Cannot start the scheduler - there are no registered workers!");
 
+    /* Set up the private deques of the local workers. Units that were
+       still queued when the scheduler was paused are carried over */
+    std::vector<WorkDeque::Entry> queued;
+    for (size_t i=0; i<m_workDeques.size(); ++i) {
+        WorkDeque *deque = m_workDeques[i];
+        if (!deque)
+            continue;
+        queued.insert(queued.end(), deque->units.begin(), deque->units.end());
+        delete deque;
+    }
+    m_workDeques.clear();
+    std::vector<WorkDeque *> localDeques;
+    if (m_workStealing) {
+        m_workDeques.resize(m_workers.size(), NULL);
+        for (size_t i=0; i<m_workers.size(); ++i) {
+            if (!m_workers[i]->isRemoteWorker()) {
+                m_workDeques[i] = new WorkDeque();
+                localDeques.push_back(m_workDeques[i]);
+            }
+        }
+    }
+    for (size_t i=0; i<queued.size(); ++i)
+        localDeques[i % localDeques.size()]->units.push_back(queued[i]);
+
+    /* Distribute the local workers over the NUMA nodes */
+    for (size_t i=0; i<m_workers.size(); ++i)
+        m_workers[i]->m_numaNode = -1;
+    if (m_numaMode) {
+        std::vector<std::vector<int> > nodeCores;
+        std::vector<int> nodes;
+        int nodeCount = getNUMANodeCount();
+        for (int i=0; i<nodeCount; ++i) {
+            nodeCores.push_back(getNUMANodeCores(i));
+            if (!nodeCores.back().empty())
+                nodes.push_back(i);
+        }
+
+        size_t localIndex = 0;
+        for (size_t i=0; i<m_workers.size() && !nodes.empty(); ++i) {
+            Worker *worker = m_workers[i];
+            if (worker->isRemoteWorker())
+                continue;
+            int node = nodes[localIndex % nodes.size()];
+            const std::vector<int> &cores = nodeCores[node];
+            worker->m_numaNode = node;
+            worker->setCoreAffinity(cores[(localIndex / nodes.size()) % cores.size()]);
+            ++localIndex;
+        }
+
+        while (statsNUMAUnitTime.size() < (size_t) nodeCount)
+            statsNUMAUnitTime.push_back(new StatsCounter("Scheduler",
+                formatString("Avg. work unit time on NUMA node %i (us)",
+                (int) statsNUMAUnitTime.size()), EAverage));
+
+        Log(EInfo, "NUMA mode: distributed " SIZE_T_FMT " local workers over %i node%s",
+            localIndex, (int) nodes.size(), nodes.size() == 1 ? "" : "s");
+    }
+
     int coreIndex = 0;
     for (size_t i=0; i<m_workers.size(); ++i) {
         m_workers[i]->start(this, (int) i, coreIndex);
@@ -571,6 +855,9 @@ void Scheduler::stop() {
     m_idToProcess.clear();
     m_localQueue.clear();
     m_remoteQueue.clear();
+    for (size_t i=0; i<m_workDeques.size(); ++i)
+        delete m_workDeques[i];
+    m_workDeques.clear();
     for (std::map<int, ResourceRecord *>::iterator
         it = m_resources.begin(); it != m_resources.end(); ++it) {
         ResourceRecord *rec = (*it).second;
@@ -614,7 +901,8 @@ void Scheduler::staticShutdown() {
 /*                         Worker implementations                       */
 /* ==================================================================== */
 
-Worker::Worker(const std::string &name) : Thread(name), m_coreCount(0), m_isRemote(false) {
+Worker::Worker(const std::string &name) : Thread(name), m_coreCount(0),
+    m_numaNode(-1), m_isRemote(false) {
 }
 
 void Worker::clear() {
@@ -647,9 +935,19 @@ LocalWorker::~LocalWorker() {
 }
 
 void LocalWorker::run() {
-    while (acquireWork(true) != Scheduler::EStop) {
+    const bool workStealing = m_scheduler->getWorkStealing();
+    StatsCounter *numaStats = m_numaNode >= 0 ? statsNUMAUnitTime[m_numaNode] : NULL;
+    ref<Timer> timer = numaStats ? new Timer() : NULL;
+
+    while ((workStealing ? acquireLocalWork() : acquireWork(true)) != Scheduler::EStop) {
         try {
+            if (numaStats)
+                timer->reset();
             m_schedItem.wp->process(m_schedItem.workUnit, m_schedItem.workResult, m_schedItem.stop);
+            if (numaStats) {
+                *numaStats += (size_t) timer->getMicroseconds();
+                numaStats->incrementBase();
+            }
         } catch (const std::exception &ex) {
             m_schedItem.stop = true;
             releaseWork(m_schedItem);
@@ -19,11 +19,377 @@
 #include <mitsuba/core/sched_remote.h>
 #include <mitsuba/core/sstream.h>
 #include <mitsuba/core/mstream.h>
+#include <mitsuba/core/fstream.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/timer.h>
 #include <mitsuba/core/version.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/shared_ptr.hpp>
+#include <zlib.h>
+
+/* Messages smaller than this are never compressed */
+#define MTS_FRAME_MIN_COMPRESS 256
 
 MTS_NAMESPACE_BEGIN
 
+/* ==================================================================== */
+/*                        Wire protocol helpers                         */
+/* ==================================================================== */
+
+/**
+ * \brief Identification data exchanged when a connection is established
+ *
+ * The protocol revision is appended to the version string instead of
+ * being sent separately: the server reads the string up to its null
+ * terminator, so it receives exactly as many bytes from older clients
+ * as they send and can refuse them right away.
+ */
+static std::string getHelloData() {
+    std::string data = formatString("%s-r%i", MTS_VERSION, MTS_PROTOCOL_REVISION);
+    data += '\0';
+    data += (char) SPECTRUM_SAMPLES;
+#ifdef DOUBLE_PRECISION
+    data += (char) 1;
+#else
+    data += (char) 0;
+#endif
+    return data;
+}
+
+/// Read the identification data sent by a client (see \ref getHelloData())
+static std::string readHelloData(Stream *stream) {
+    std::string data;
+    char c;
+    while ((c = stream->readChar()) != '\0') {
+        data += c;
+        if (data.length() > 256)
+            return data; /* Not a version string */
+    }
+    data += '\0';
+    data += stream->readChar();
+    data += stream->readChar();
+    return data;
+}
+
+/**
+ * \brief Write a message buffer to a stream as a sequence of compressed frames
+ *
+ * Every frame starts with the size of the uncompressed and the stored data.
+ * When compression doesn't save any space, the data is stored as-is (both
+ * sizes are then equal). Returns the number of bytes written to the stream.
+ */
+static size_t writeFrames(Stream *stream, const uint8_t *data, size_t size,
+        int level, std::vector<uint8_t> &buffer) {
+    size_t written = 0;
+
+    while (size > 0) {
+        size_t rawSize = std::min(size, (size_t) MTS_FRAME_SIZE);
+        uLongf storedSize = (uLongf) rawSize;
+
+        if (rawSize >= MTS_FRAME_MIN_COMPRESS) {
+            storedSize = compressBound((uLong) rawSize);
+            buffer.resize(storedSize);
+            int retval = compress2(&buffer[0], &storedSize, data,
+                (uLong) rawSize, level);
+            if (retval != Z_OK)
+                SLog(EError, "compress2(): failed with error code %i!", retval);
+        }
+
+        stream->writeUInt((uint32_t) rawSize);
+        if (storedSize < rawSize) {
+            stream->writeUInt((uint32_t) storedSize);
+            stream->write(&buffer[0], storedSize);
+        } else {
+            storedSize = (uLongf) rawSize;
+            stream->writeUInt((uint32_t) rawSize);
+            stream->write(data, rawSize);
+        }
+
+        written += 2*sizeof(uint32_t) + storedSize;
+        data += rawSize;
+        size -= rawSize;
+    }
+
+    return written;
+}
+
+/**
+ * \brief Read-only stream, which decodes the frames written by
+ * \ref writeFrames() from a nested stream
+ */
+class FrameInputStream : public Stream {
+public:
+    FrameInputStream(Stream *stream) : m_stream(stream), m_pos(0) {
+        setByteOrder(stream->getByteOrder());
+    }
+
+    void read(void *ptr, size_t size) {
+        uint8_t *target = (uint8_t *) ptr;
+        while (size > 0) {
+            if (m_pos == m_frame.size())
+                nextFrame();
+            size_t amount = std::min(size, m_frame.size() - m_pos);
+            memcpy(target, &m_frame[m_pos], amount);
+            m_pos += amount;
+            target += amount;
+            size -= amount;
+        }
+    }
+
+    void write(const void *ptr, size_t size) {
+        Log(EError, "write(): unsupported in a frame input stream!");
+    }
+
+    void seek(size_t pos) {
+        Log(EError, "seek(): unsupported in a frame input stream!");
+    }
+
+    size_t getPos() const {
+        Log(EError, "getPos(): unsupported in a frame input stream!");
+        return 0;
+    }
+
+    size_t getSize() const {
+        Log(EError, "getSize(): unsupported in a frame input stream!");
+        return 0;
+    }
+
+    void truncate(size_t size) {
+        Log(EError, "truncate(): unsupported in a frame input stream!");
+    }
+
+    void flush() { }
+    bool canWrite() const { return false; }
+    bool canRead() const { return true; }
+
+    std::string toString() const {
+        std::ostringstream oss;
+        oss << "FrameInputStream[" << endl
+            << "  stream = " << indent(m_stream->toString()) << endl
+            << "]";
+        return oss.str();
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~FrameInputStream() { }
+
+    void nextFrame() {
+        uint32_t rawSize = m_stream->readUInt(),
+                 storedSize = m_stream->readUInt();
+
+        /* Don't trust the peer with the size of the allocations below */
+        if (rawSize > MTS_FRAME_SIZE || storedSize > rawSize)
+            Log(EError, "Received an invalid frame (size=%u, stored size=%u)!",
+                rawSize, storedSize);
+
+        m_frame.resize(rawSize);
+        m_pos = 0;
+        if (rawSize == 0)
+            return;
+
+        if (storedSize == rawSize) {
+            m_stream->read(&m_frame[0], rawSize);
+        } else {
+            m_buffer.resize(storedSize);
+            m_stream->read(&m_buffer[0], storedSize);
+            uLongf size = (uLongf) rawSize;
+            int retval = uncompress(&m_frame[0], &size, &m_buffer[0], (uLong) storedSize);
+            if (retval != Z_OK || size != rawSize)
+                Log(EError, "uncompress(): failed with error code %i!", retval);
+        }
+    }
+private:
+    ref<Stream> m_stream;
+    std::vector<uint8_t> m_frame, m_buffer;
+    size_t m_pos;
+};
+
+/* ==================================================================== */
+/*                            Resource cache                            */
+/* ==================================================================== */
+
+namespace {
+    typedef boost::shared_ptr<std::vector<uint8_t> > ResourceData;
+
+    /* A serialized resource, which was received by a stream backend. The
+       'users' field counts the connections that were told about it during
+       the handshake and haven't used it yet -- it can't be evicted before */
+    struct CacheEntry {
+        ResourceData data;
+        int users;
+        uint64_t lastUse;
+    };
+
+    boost::mutex __cache_mutex;
+    std::map<std::string, CacheEntry> __cache_entries;
+    fs::path __cache_directory;
+    size_t __cache_limit = (size_t) MTS_RESOURCE_CACHE_SIZE * 1024 * 1024;
+    size_t __cache_usage = 0;
+    uint64_t __cache_timestamp = 0;
+
+    /// Evict unused entries until the memory limit is met (lock must be held)
+    void cacheEvict() {
+        while (__cache_usage > __cache_limit) {
+            std::map<std::string, CacheEntry>::iterator victim = __cache_entries.end();
+            for (std::map<std::string, CacheEntry>::iterator it = __cache_entries.begin();
+                    it != __cache_entries.end(); ++it) {
+                if (it->second.users == 0 && (victim == __cache_entries.end()
+                        || it->second.lastUse < victim->second.lastUse))
+                    victim = it;
+            }
+            if (victim == __cache_entries.end())
+                break;
+            __cache_usage -= victim->second.data->size();
+            __cache_entries.erase(victim);
+        }
+    }
+
+    /// Add an entry unless it already exists and return its data (lock must be held)
+    ResourceData cacheInsert(const std::string &hash, const ResourceData &data) {
+        std::map<std::string, CacheEntry>::iterator it = __cache_entries.find(hash);
+        if (it == __cache_entries.end()) {
+            CacheEntry entry;
+            entry.data = data;
+            entry.users = 0;
+            it = __cache_entries.insert(std::make_pair(hash, entry)).first;
+            __cache_usage += data->size();
+        }
+        it->second.lastUse = ++__cache_timestamp;
+        ResourceData result = it->second.data;
+        cacheEvict();
+        return result;
+    }
+
+    /// Drop the caller's claim on an entry (lock must be held)
+    void cacheUnpin(const std::string &hash, std::set<std::string> &used) {
+        if (used.erase(hash) == 0)
+            return;
+        std::map<std::string, CacheEntry>::iterator it = __cache_entries.find(hash);
+        if (it != __cache_entries.end())
+            it->second.users--;
+    }
+
+    inline fs::path cachePath(const std::string &hash) {
+        return __cache_directory / (hash + ".mtsres");
+    }
+
+    /**
+     * Return the hashes of all cached resources. The ones, which are held
+     * in memory, are marked as used by the caller (and added to \c used),
+     * so that they stay available until the caller has acquired them.
+     */
+    std::vector<std::string> cacheList(std::set<std::string> &used) {
+        boost::lock_guard<boost::mutex> guard(__cache_mutex);
+        std::vector<std::string> result;
+
+        for (std::map<std::string, CacheEntry>::iterator it = __cache_entries.begin();
+                it != __cache_entries.end(); ++it) {
+            it->second.users++;
+            used.insert(it->first);
+            result.push_back(it->first);
+        }
+
+        if (!__cache_directory.empty() && fs::is_directory(__cache_directory)) {
+            for (fs::directory_iterator it(__cache_directory), end; it != end; ++it) {
+                const fs::path &path = it->path();
+                std::string hash = path.stem().string();
+                if (path.extension() == ".mtsres" && __cache_entries.find(hash) == __cache_entries.end())
+                    result.push_back(hash);
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Look up a cached resource and drop the caller's claim on it. Resources,
+     * which are not in memory anymore, are loaded from the cache directory.
+     * The caller only holds on to the returned data while deserializing it,
+     * after which the entry may be evicted again.
+     */
+    ResourceData cacheAcquire(const std::string &hash, std::set<std::string> &used) {
+        fs::path path;
+        {
+            boost::lock_guard<boost::mutex> guard(__cache_mutex);
+            std::map<std::string, CacheEntry>::iterator it = __cache_entries.find(hash);
+            if (it != __cache_entries.end()) {
+                ResourceData data = it->second.data;
+                it->second.lastUse = ++__cache_timestamp;
+                cacheUnpin(hash, used);
+                cacheEvict();
+                return data;
+            }
+            if (!__cache_directory.empty())
+                path = cachePath(hash);
+        }
+
+        if (path.empty() || !fs::exists(path))
+            SLog(EError, "The cached resource %s is not available anymore!", hash.c_str());
+
+        ref<FileStream> fstream = new FileStream(path, FileStream::EReadOnly);
+        ResourceData data(new std::vector<uint8_t>(fstream->getSize()));
+        if (!data->empty())
+            fstream->read(&(*data)[0], data->size());
+        fstream->close();
+
+        if (sha256(data->empty() ? NULL : &(*data)[0], data->size()) != hash)
+            SLog(EError, "The cached resource \"%s\" is corrupted!", path.string().c_str());
+
+        /* Another connection might have loaded the resource in the meantime */
+        boost::lock_guard<boost::mutex> guard(__cache_mutex);
+        return cacheInsert(hash, data);
+    }
+
+    /// Add a received resource to the cache (and to the cache directory, if any)
+    void cachePut(const std::string &hash, const ResourceData &data) {
+        fs::path path;
+        {
+            boost::lock_guard<boost::mutex> guard(__cache_mutex);
+            cacheInsert(hash, data);
+            if (!__cache_directory.empty())
+                path = cachePath(hash);
+        }
+
+        if (path.empty() || fs::exists(path))
+            return;
+
+        /* Write to a temporary file first, so that other
+           processes never see an incomplete resource */
+        fs::path tempPath = path;
+        tempPath.replace_extension(formatString(".%s.tmp",
+            Thread::getThread()->getName().c_str()));
+        try {
+            ref<FileStream> fstream = new FileStream(tempPath, FileStream::ETruncWrite);
+            if (!data->empty())
+                fstream->write(&(*data)[0], data->size());
+            fstream->close();
+            fs::rename(tempPath, path);
+        } catch (const std::exception &e) {
+            SLog(EWarn, "Could not write the resource %s to the cache directory: %s",
+                hash.c_str(), e.what());
+        }
+    }
+
+    /// Release all cache entries still claimed by a connection
+    void cacheRelease(std::set<std::string> &used) {
+        boost::lock_guard<boost::mutex> guard(__cache_mutex);
+        while (!used.empty())
+            cacheUnpin(*used.begin(), used);
+        cacheEvict();
+    }
+
+    /// Are received resources also kept in a cache directory?
+    bool cacheIsPersistent() {
+        boost::lock_guard<boost::mutex> guard(__cache_mutex);
+        return !__cache_directory.empty();
+    }
+}
+
+/* ==================================================================== */
+/*                            Remote worker                             */
+/* ==================================================================== */
+
 class CancelThread : public Thread {
 public:
     CancelThread(ParallelProcess *proc) : Thread("cthr"), m_proc(proc) { }
@@ -38,18 +404,16 @@ private:
     ref<ParallelProcess> m_proc;
 };
 
-RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(name), m_stream(stream) {
-    const size_t dataLength = strlen(MTS_VERSION)+3;
-    char *data = (char *) alloca(dataLength);
-    strncpy(data, MTS_VERSION, strlen(MTS_VERSION)+1);
-    data[dataLength-2] = SPECTRUM_SAMPLES;
-#ifdef DOUBLE_PRECISION
-    data[dataLength-1] = 1;
-#else
-    data[dataLength-1] = 0;
-#endif
+RemoteWorker::RemoteWorker(const std::string &name, Stream *stream, int compressionLevel)
+    : Worker(name), m_stream(stream), m_backlog(0), m_compressionLevel(0),
+      m_sentBytes(0), m_sentFrameBytes(0) {
+    if (compressionLevel < 0 || compressionLevel > 9)
+        Log(EError, "The compression level must be between 0 and 9!");
+
+    std::string data = getHelloData();
     m_stream->writeShort(StreamBackend::EHello);
-    m_stream->write(data, dataLength);
+    m_stream->write(data.c_str(), data.length());
+    m_stream->writeShort((short) compressionLevel);
     m_stream->flush();
 
     int msg = m_stream->readShort();
@@ -59,16 +423,34 @@ RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(nam
         Log(EError, "Received an invalid response!");
     m_coreCount = m_stream->readShort();
     m_nodeName = m_stream->readString();
+    m_compressionLevel = m_stream->readShort();
+    m_persistentCache = m_stream->readBool();
+    uint32_t cacheSize = m_stream->readUInt();
+    for (uint32_t i=0; i<cacheSize; ++i)
+        m_cachedResources.insert(m_stream->readString());
+    if (m_compressionLevel > 0)
+        m_inputStream = new FrameInputStream(m_stream);
+    else
+        m_inputStream = m_stream;
     m_mutex = new Mutex();
     m_finishCond = new ConditionVariable(m_mutex);
     m_memStream = new MemoryStream();
     m_memStream->setByteOrder(Stream::ENetworkByteOrder);
+    m_timer = new Timer();
+    m_inFlight = 0;
+    m_roundTripTime = m_unitRate = -1;
+    m_pingPending = false;
+    m_windowStart = 0;
+    m_windowCompleted = 0;
+    updateBacklog();
+    m_merger = new RemoteWorkerMerger(this);
+    m_merger->start();
     m_reader = new RemoteWorkerReader(this);
     m_reader->start();
-    m_inFlight = 0;
     m_isRemote = true;
-    Log(EDebug, "Connection to \"%s\" established (%i cores).",
-        m_nodeName.c_str(), m_coreCount);
+    Log(EDebug, "Connection to \"%s\" established (%i cores, compression level %i, "
+        "%i cached resources).", m_nodeName.c_str(), m_coreCount, m_compressionLevel,
+        (int) m_cachedResources.size());
 }
 
 RemoteWorker::~RemoteWorker() {
@@ -76,35 +458,116 @@ RemoteWorker::~RemoteWorker() {
     if (!m_reader || !m_mutex || !m_memStream)
         return;
 
-    LockGuard lock(m_mutex);
-    m_reader->shutdown();
-    m_memStream->writeShort(StreamBackend::EQuit);
-    try {
-        flush();
-    } catch (std::runtime_error &e) {
-        Log(EWarn, "Could not flush buffer: %s", e.what());
+    {
+        LockGuard lock(m_mutex);
+        m_reader->shutdown();
+        m_memStream->writeShort(StreamBackend::EQuit);
+        try {
+            flush();
+        } catch (std::runtime_error &e) {
+            Log(EWarn, "Could not flush buffer: %s", e.what());
+        }
     }
+    /* Don't hold the lock here: the reader may still
+       be processing a response (e.g. to a ping) */
     m_reader->join();
+    m_merger->shutdown();
+    m_merger->join();
+    if (m_compressionLevel > 0)
+        Log(EDebug, "Sent %i KB to \"%s\" (%i KB uncompressed)", (int) (m_sentFrameBytes / 1024),
+            m_nodeName.c_str(), (int) (m_sentBytes / 1024));
 }
 
 void RemoteWorker::start(Scheduler *scheduler, int workerIndex, int coreOffset) {
     Worker::start(scheduler, workerIndex, coreOffset);
-    m_reader->m_schedItem.coreOffset = coreOffset;
+    m_merger->m_schedItem.coreOffset = coreOffset;
 }
 
 void RemoteWorker::flush() {
-    m_memStream->seek(0);
-    m_memStream->copyTo(m_stream);
+    if (m_compressionLevel > 0) {
+        size_t size = m_memStream->getPos();
+        m_sentFrameBytes += writeFrames(m_stream, m_memStream->getData(),
+            size, m_compressionLevel, m_frameBuffer);
+        m_sentBytes += size;
+    } else {
+        m_memStream->seek(0);
+        m_memStream->copyTo(m_stream);
+    }
     m_memStream->reset();
     m_stream->flush();
 }
 
+void RemoteWorker::sendPing() {
+    if (m_pingPending)
+        return;
+    m_memStream->writeShort(StreamBackend::EPing);
+    m_memStream->writeULong(m_timer->getMicroseconds());
+    m_pingPending = true;
+}
+
+void RemoteWorker::updateBacklog() {
+    size_t coreCount = std::max(m_coreCount, (size_t) 1),
+           backlog = MTS_BACKLOG_FACTOR * coreCount;
+
+    /* Little's law: cover the work units that the node completes
+       while a message travels there and back again. The measured rate
+       is itself limited by the back log when the node is starved, hence
+       twice that amount is requested -- otherwise the estimate could
+       settle below the actual throughput of the node */
+    if (m_roundTripTime > 0 && m_unitRate > 0)
+        backlog += (size_t) std::ceil(2 * m_unitRate * m_roundTripTime);
+    backlog = std::min(backlog, (size_t) MTS_MAX_BACKLOG_FACTOR * coreCount);
+
+    if (backlog != m_backlog) {
+        Log(ETrace, "Adjusting the back log to " SIZE_T_FMT " work units "
+            "(round trip: %.1f ms, %.1f units/s)", backlog,
+            m_roundTripTime * 1000, m_unitRate);
+        m_backlog = backlog;
+        m_finishCond->signal();
+    }
+}
+
+void RemoteWorker::signalCompletion() {
+    LockGuard lock(m_mutex);
+    m_inFlight--;
+
+    /* Only count completions while the node has work */
+    if (m_inFlight == 0) {
+        m_windowCompleted = 0;
+    } else if (++m_windowCompleted >= std::max(m_coreCount, (size_t) 1)) {
+        uint64_t time = m_timer->getMicroseconds();
+        Float elapsed = (time - m_windowStart) * (Float) 1e-6;
+        if (elapsed > (Float) 0.1f) {
+            Float rate = m_windowCompleted / elapsed;
+            m_unitRate = m_unitRate < 0 ? rate : (m_unitRate + rate) * 0.5f;
+            m_windowStart = time;
+            m_windowCompleted = 0;
+            updateBacklog();
+        }
+    }
+
+    m_finishCond->signal();
+}
+
+void RemoteWorker::signalPong(uint64_t timestamp) {
+    LockGuard lock(m_mutex);
+    Float rtt = (m_timer->getMicroseconds() - timestamp) * (Float) 1e-6;
+    m_roundTripTime = m_roundTripTime < 0 ? rtt
+        : m_roundTripTime * 0.75f + rtt * 0.25f;
+    m_pingPending = false;
+    updateBacklog();
+}
+
 void RemoteWorker::run() {
     Scheduler::EStatus status;
 
     while ((status = acquireWork(false, true, true)) != Scheduler::EStop) {
         if (status == Scheduler::ENone) {
-            flush();
+            {
+                LockGuard lock(m_mutex);
+                sendPing();
+                flush();
+            }
             if ((status = acquireWork(false, false, true)) == Scheduler::EStop)
                 break;
         }
@@ -164,12 +627,29 @@ void RemoteWorker::run() {
             for (size_t i=0; i<resources.size(); ++i) {
                 int resID = resources[i].first;
                 const MemoryStream *resStream = resources[i].second;
+                std::string hash = m_scheduler->getResourceHash(resID);
+                if (m_cachedResources.find(hash) != m_cachedResources.end()) {
+                    /* The remote node still has this resource from a previous job */
+                    Log(EDebug, "Resource %i is cached by \"%s\" (%s)", resID,
+                        m_nodeName.c_str(), hash.c_str());
+                    m_memStream->writeShort(StreamBackend::ECachedResource);
+                    m_memStream->writeInt(resID);
+                    m_memStream->writeString(hash);
+                    /* Without a cache directory, the node may evict the
+                       resource from memory once it has been deserialized */
+                    if (!m_persistentCache)
+                        m_cachedResources.erase(hash);
+                    continue;
+                }
                 Log(EDebug, "Sending resource %i to \"%s\" (%i KB)", resID, m_nodeName.c_str(),
                     resStream->getPos() / 1024);
                 m_memStream->writeShort(StreamBackend::ENewResource);
                 m_memStream->writeInt(resID);
+                m_memStream->writeString(hash);
                 m_memStream->writeSize(resStream->getPos());
                 m_memStream->write(resStream->getData(), resStream->getPos());
+                if (m_persistentCache)
+                    m_cachedResources.insert(hash);
             }
 
             for (size_t i=0; i<multiResources.size(); i += m_coreCount) {
@@ -202,12 +682,21 @@ void RemoteWorker::run() {
         m_memStream->writeInt(id);
         m_schedItem.workUnit->save(m_memStream);
 
-        if (++m_inFlight == MTS_BACKLOG_FACTOR * m_coreCount) {
+        if (++m_inFlight == 1) {
+            /* The node was idle -- start a new measurement window */
+            m_windowStart = m_timer->getMicroseconds();
+            m_windowCompleted = 0;
+        }
+
+        if (m_inFlight >= m_backlog) {
+            sendPing();
             flush();
             /* There are now too many packets in transit. Wait
                until this clears up a bit before attempting to
                send more work */
-            while (m_inFlight > MTS_CONTINUE_FACTOR * m_coreCount)
+            size_t batchSize = (MTS_BACKLOG_FACTOR - MTS_CONTINUE_FACTOR)
+                * std::max(m_coreCount, (size_t) 1);
+            while (m_inFlight + batchSize > m_backlog)
                 m_finishCond->wait();
         }
     }
@@ -250,17 +739,17 @@ void RemoteWorker::signalProcessTermination(int id) {
 
 void RemoteWorker::clear() {
     Worker::clear();
-    m_reader->m_schedItem.wp = NULL;
-    m_reader->m_schedItem.workUnit = NULL;
-    m_reader->m_schedItem.workResult = NULL;
-    m_reader->m_schedItem.id = -1;
+    m_merger->m_schedItem.wp = NULL;
+    m_merger->m_schedItem.workUnit = NULL;
+    m_merger->m_schedItem.workResult = NULL;
+    m_merger->m_schedItem.id = -1;
 }
 
 
 RemoteWorkerReader::RemoteWorkerReader(RemoteWorker *worker)
  : Thread(formatString("%s_r", worker->getName().c_str())),
-    m_parent(worker), m_shutdown(false), m_currentID(-1) {
-    m_stream = m_parent->m_stream;
+    m_parent(worker), m_shutdown(false) {
+    m_stream = m_parent->m_inputStream;
     setCritical(true);
 }
 
@@ -272,37 +761,31 @@ void RemoteWorkerReader::run() {
             msg = m_stream->readShort();
             id = m_stream->readInt();
 
-            if (id != m_currentID) {
-                m_parent->setProcessByID(m_schedItem, id);
-                m_currentID = id;
-            }
-
             switch (msg) {
-                case StreamBackend::EWorkResult:
-                    m_schedItem.workResult->load(m_stream);
-                    m_schedItem.stop = false;
-                    m_parent->releaseWork(m_schedItem);
-                    m_parent->signalCompletion();
+                case StreamBackend::EWorkResult: {
+                        /* Only receive the result here, the merger thread
+                           deserializes it and passes it to the scheduler */
+                        size_t size = m_stream->readSize();
+                        ref<MemoryStream> data = new MemoryStream(size);
+                        data->setByteOrder(Stream::ENetworkByteOrder);
+                        m_stream->copyTo(data, size);
+                        data->seek(0);
+                        m_parent->signalCompletion();
+                        m_parent->m_merger->push(msg, id, data);
+                    }
                     break;
                 case StreamBackend::ECancelledWorkResult:
-                    m_schedItem.stop = true;
-                    m_parent->releaseWork(m_schedItem);
                     m_parent->signalCompletion();
+                    m_parent->m_merger->push(msg, id, NULL);
                     break;
-                case StreamBackend::EProcessCancelled: {
-                        Log(EWarn, "Process %i encountered a problem on node \"%s\"."
-                            " - Cancelling the process..", id, m_parent->getNodeName().c_str());
-                        /* We can't block here waiting for the process to terminate, since
-                        we need to listen for canceled in-flight work units. Handle
-                        the cancellation notification in a separate thread */
-                        CancelThread *thr = new CancelThread(m_schedItem.proc);
-                        thr->incRef();
-                        thr->start();
-                        m_joinThreads.push_back(thr);
-                    }
+                case StreamBackend::EProcessCancelled:
+                    m_parent->m_merger->push(msg, id, NULL);
+                    break;
+                case StreamBackend::EPong:
+                    m_parent->signalPong(m_stream->readULong());
                     break;
                 default:
-                    Log(EError, "Received an unknown message (type %i)", id);
+                    Log(EError, "Received an unknown message (type %i)", msg);
             };
         } catch (std::runtime_error &e) {
             if (!m_shutdown)
@@ -310,6 +793,80 @@ void RemoteWorkerReader::run() {
             break;
         }
     }
+}
+
+RemoteWorkerMerger::RemoteWorkerMerger(RemoteWorker *worker)
+ : Thread(formatString("%s_m", worker->getName().c_str())),
+    m_parent(worker), m_shutdown(false), m_currentID(-1) {
+    m_mutex = new Mutex();
+    m_cond = new ConditionVariable(m_mutex);
+    m_maxQueueSize = MTS_BACKLOG_FACTOR * std::max(worker->m_coreCount, (size_t) 1);
+    setCritical(true);
+}
+
+RemoteWorkerMerger::~RemoteWorkerMerger() { }
+
+void RemoteWorkerMerger::push(short msg, int id, MemoryStream *data) {
+    LockGuard lock(m_mutex);
+    while (m_queue.size() >= m_maxQueueSize)
+        m_cond->wait();
+    Message message;
+    message.msg = msg;
+    message.id = id;
+    message.data = data;
+    m_queue.push_back(message);
+    m_cond->broadcast();
+}
+
+void RemoteWorkerMerger::shutdown() {
+    LockGuard lock(m_mutex);
+    m_shutdown = true;
+    m_cond->broadcast();
+}
+
+void RemoteWorkerMerger::run() {
+    while (true) {
+        Message message;
+        {
+            LockGuard lock(m_mutex);
+            while (m_queue.empty() && !m_shutdown)
+                m_cond->wait();
+            if (m_queue.empty())
+                break;
+            message = m_queue.front();
+            m_queue.pop_front();
+            m_cond->broadcast();
+        }
+
+        if (message.id != m_currentID) {
+            m_parent->setProcessByID(m_schedItem, message.id);
+            m_currentID = message.id;
+        }
+
+        switch (message.msg) {
+            case StreamBackend::EWorkResult:
+                m_schedItem.workResult->load(message.data);
+                m_schedItem.stop = false;
+                m_parent->releaseWork(m_schedItem);
+                break;
+            case StreamBackend::ECancelledWorkResult:
+                m_schedItem.stop = true;
+                m_parent->releaseWork(m_schedItem);
+                break;
+            case StreamBackend::EProcessCancelled: {
+                    Log(EWarn, "Process %i encountered a problem on node \"%s\"."
+                        " - Cancelling the process..", message.id, m_parent->getNodeName().c_str());
+                    /* We can't block here waiting for the process to terminate, since
+                    we need to listen for canceled in-flight work units. Handle
+                    the cancellation notification in a separate thread */
+                    CancelThread *thr = new CancelThread(m_schedItem.proc);
+                    thr->incRef();
+                    thr->start();
+                    m_joinThreads.push_back(thr);
+                }
+                break;
+        }
+    }
     for (size_t i=0; i<m_joinThreads.size(); ++i) {
         m_joinThreads[i]->join();
         m_joinThreads[i]->decRef();
@@ -323,9 +880,22 @@ void RemoteWorkerReader::run() {
 StreamBackend::StreamBackend(const std::string &thrName, Scheduler *scheduler,
         const std::string &nodeName, Stream *stream, bool detach) : Thread(thrName),
         m_scheduler(scheduler), m_nodeName(nodeName), m_stream(stream), m_detach(detach) {
-    m_sendMutex = new Mutex();
     m_memStream = new MemoryStream();
     m_memStream->setByteOrder(Stream::ENetworkByteOrder);
+    m_compressionLevel = 0;
+}
+
+void StreamBackend::configureResourceCache(size_t memoryLimit,
+        const fs::path &directory) {
+    if (!directory.empty() && !fs::is_directory(directory)
+            && !fs::create_directories(directory))
+        SLog(EError, "Could not create the resource cache directory \"%s\"!",
+            directory.string().c_str());
+
+    boost::lock_guard<boost::mutex> guard(__cache_mutex);
+    __cache_limit = memoryLimit;
+    __cache_directory = directory;
+    cacheEvict();
 }
 
 StreamBackend::~StreamBackend() { }
@@ -345,19 +915,7 @@ void StreamBackend::run() {
         return;
     }
 
-    const size_t dataLength = strlen(MTS_VERSION)+3;
-    char *data    = (char *) alloca(dataLength),
-         *refData = (char *) alloca(dataLength);
-    strncpy(refData, MTS_VERSION, strlen(MTS_VERSION)+1);
-    refData[dataLength-2] = SPECTRUM_SAMPLES;
-#ifdef DOUBLE_PRECISION
-    refData[dataLength-1] = 1;
-#else
-    refData[dataLength-1] = 0;
-#endif
-    m_stream->read(data, dataLength);
-
-    if (memcmp(data, refData, dataLength) != 0) {
+    if (readHelloData(m_stream) != getHelloData()) {
         m_stream->writeShort(EIncompatible);
         m_stream->flush();
         Log(EWarn, "The client either the wrong version, or it is compiled "
@@ -366,47 +924,79 @@ void StreamBackend::run() {
     }
 
     Log(EDebug, "Program versions match.");
+    m_compressionLevel = std::max(0, std::min(9, (int) m_stream->readShort()));
+    std::vector<std::string> cached = cacheList(m_cachedResources);
+
     m_memStream->writeShort(EHello);
     m_memStream->writeShort((short) m_scheduler->getCoreCount());
     m_memStream->writeString(m_nodeName);
+    m_memStream->writeShort((short) m_compressionLevel);
+    m_memStream->writeBool(cacheIsPersistent());
+    m_memStream->writeUInt((uint32_t) cached.size());
+    for (size_t i=0; i<cached.size(); ++i)
+        m_memStream->writeString(cached[i]);
     m_memStream->seek(0);
     m_memStream->copyTo(m_stream);
     m_stream->flush();
     bool running = true;
 
+    if (m_compressionLevel > 0)
+        Log(EInfo, "Using compressed messages (level %i)", m_compressionLevel);
+
+    m_sender = new StreamBackendSender(formatString("%s_s", getName().c_str()), m_stream);
+    m_sender->start();
+
+    /* All messages after the handshake are read from this stream */
+    ref<Stream> input = m_stream;
+    if (m_compressionLevel > 0)
+        input = new FrameInputStream(m_stream);
+
     try {
         while (running) {
-            msg = m_stream->readShort();
+            msg = input->readShort();
             switch (msg) {
                 case ENewProcess: {
-                        int id = m_stream->readInt();
-                        ELogLevel logLevel = (ELogLevel) m_stream->readInt();
+                        int id = input->readInt();
+                        ELogLevel logLevel = (ELogLevel) input->readInt();
                         ref<InstanceManager> manager = new InstanceManager();
-                        ref<WorkProcessor> wp = static_cast<WorkProcessor *>(manager->getInstance(m_stream));
+                        ref<WorkProcessor> wp = static_cast<WorkProcessor *>(manager->getInstance(input));
                         RemoteProcess *rp = new RemoteProcess(id, logLevel, this, wp);
                         rp->incRef();
                         m_processes[id] = rp;
                     }
                     break;
-                case ENewResource: {
-                        int id = m_stream->readInt();
-                        size_t size = m_stream->readSize();
+                case ENewResource:
+                case ECachedResource: {
+                        int id = input->readInt();
+                        std::string hash = input->readString();
+                        ResourceData data;
+                        if (msg == ENewResource) {
+                            data.reset(new std::vector<uint8_t>(input->readSize()));
+                            if (!data->empty())
+                                input->read(&(*data)[0], data->size());
+                            if (sha256(data->empty() ? NULL : &(*data)[0], data->size()) != hash)
+                                Log(EError, "Resource %i was corrupted during the transmission!", id);
+                            cachePut(hash, data);
+                        } else {
+                            data = cacheAcquire(hash, m_cachedResources);
+                            Log(EDebug, "Using the cached resource %s (%i KB)",
+                                hash.c_str(), (int) (data->size() / 1024));
+                        }
                         ref<InstanceManager> manager = new InstanceManager();
-                        ref<MemoryStream> mstream = new MemoryStream(size);
+                        ref<MemoryStream> mstream = new MemoryStream(
+                            data->empty() ? NULL : &(*data)[0], data->size());
                         mstream->setByteOrder(Stream::ENetworkByteOrder);
-                        m_stream->copyTo(mstream, size);
-                        mstream->seek(0);
                         ref<SerializableObject> res = static_cast<SerializableObject *>(manager->getInstance(mstream));
                         m_resources[id] = m_scheduler->registerResource(res);
                     }
                     break;
                 case ENewMultiResource: {
-                        int id = m_stream->readInt();
-                        size_t size = m_stream->readSize();
+                        int id = input->readInt();
+                        size_t size = input->readSize();
                         ref<InstanceManager> manager = new InstanceManager();
                         ref<MemoryStream> mstream = new MemoryStream(size);
                         mstream->setByteOrder(Stream::ENetworkByteOrder);
-                        m_stream->copyTo(mstream, size);
+                        input->copyTo(mstream, size);
                         mstream->seek(0);
                         size_t coreCount = m_scheduler->getCoreCount();
                         std::vector<SerializableObject *> objects(coreCount);
@@ -416,29 +1006,29 @@ void StreamBackend::run() {
                     }
                     break;
                 case EEnsurePluginLoaded: {
-                        std::string name = m_stream->readString();
+                        std::string name = input->readString();
                         PluginManager::getInstance()->ensurePluginLoaded(name);
                     }
                     break;
                 case EBindResource: {
-                        int procID = m_stream->readInt();
-                        std::string resName = m_stream->readString();
-                        int resID = m_stream->readInt();
+                        int procID = input->readInt();
+                        std::string resName = input->readString();
+                        int resID = input->readInt();
                         RemoteProcess *rp = m_processes[procID];
                         rp->bindResource(resName, m_resources[resID]);
                     }
                     break;
                 case EWorkUnit : {
-                        int id = m_stream->readInt();
+                        int id = input->readInt();
                         RemoteProcess *rp = m_processes[id];
                         WorkUnit *wu = rp->getEmptyWorkUnit();
-                        wu->load(m_stream);
+                        wu->load(input);
                         rp->putFullWorkUnit(wu);
                         m_scheduler->schedule(rp);
                     }
                     break;
                 case EProcessTerminated : {
-                        int id = m_stream->readInt();
+                        int id = input->readInt();
                         RemoteProcess *rp = m_processes[id];
                         rp->setDone();
                         rp->decRef();
@@ -447,7 +1037,7 @@ void StreamBackend::run() {
                     }
                     break;
                 case EProcessCancelled: {
-                        int id = m_stream->readInt();
+                        int id = input->readInt();
                         RemoteProcess *rp = m_processes[id];
                         m_scheduler->cancel(rp);
                         m_processes.erase(id);
@@ -455,12 +1045,24 @@ void StreamBackend::run() {
                     }
                     break;
                 case EResourceExpired: {
-                        int id = m_stream->readInt();
+                        int id = input->readInt();
                         int localID = m_resources[id];
                         m_scheduler->unregisterResource(localID);
                         m_resources.erase(id);
                     }
                     break;
+                case EPing: {
+                        /* Answer right away -- the pong is only queued
+                           behind work results that are already complete */
+                        uint64_t timestamp = input->readULong();
+                        ref<MemoryStream> message = new MemoryStream(16);
+                        message->setByteOrder(Stream::ENetworkByteOrder);
+                        message->writeShort(EPong);
+                        message->writeInt(-1);
+                        message->writeULong(timestamp);
+                        send(message);
+                    }
+                    break;
                 case EQuit: running = false; break;
                 default: Log(EError, "Received an unknown message type: %i", msg);
             }
@@ -486,6 +1088,15 @@ void StreamBackend::run() {
         m_scheduler->unregisterResource((*it).second);
     }
 
+    cacheRelease(m_cachedResources);
+
+    if (m_sender) {
+        m_sender->shutdown();
+        m_sender->join();
+        /* The sender references this thread as its parent */
+        m_sender = NULL;
+    }
+
     if (m_stream->getClass()->derivesFrom(MTS_CLASS(SocketStream))) {
         SocketStream *sstream = static_cast<SocketStream *>(m_stream.get());
         Log(EInfo, "Closing connection to %s - received %i KB / sent %i KB",
@@ -497,40 +1108,100 @@ void StreamBackend::run() {
 void StreamBackend::sendCancellation(int id, int numLost) {
     Log(EInfo, "Notifying the remote side about the cancellation of process %i", id);
 
-    LockGuard lock(m_sendMutex);
-    m_memStream->reset();
-    m_memStream->writeShort(EProcessCancelled);
-    m_memStream->writeInt(id);
+    ref<MemoryStream> message = new MemoryStream(6 * (numLost + 1));
+    message->setByteOrder(Stream::ENetworkByteOrder);
+    message->writeShort(EProcessCancelled);
+    message->writeInt(id);
     for (int i=0; i<numLost; ++i) {
-        m_memStream->writeShort(ECancelledWorkResult);
-        m_memStream->writeInt(id);
-    }
-    try {
-        m_memStream->seek(0);
-        m_memStream->copyTo(m_stream);
-        m_stream->flush();
-    } catch (std::exception &) {
-        Log(EWarn, "Connection error - could not submit cancellation notification");
-        /* A connection failure occurred - this will eventually be
-           caught and handled in run() and is therefore ignored for now */
+        message->writeShort(ECancelledWorkResult);
+        message->writeInt(id);
     }
+    send(message);
 }
 
 void StreamBackend::sendWorkResult(int id, const WorkResult *result, bool cancelled) {
-    LockGuard lock(m_sendMutex);
-    m_memStream->reset();
-    m_memStream->writeShort(cancelled ? ECancelledWorkResult : EWorkResult);
-    m_memStream->writeInt(id);
-    if (!cancelled)
-        result->save(m_memStream);
-    try {
-        m_memStream->seek(0);
-        m_memStream->copyTo(m_stream);
-        m_stream->flush();
-    } catch (std::exception &) {
-        Log(EWarn, "Connection error - could not submit work result");
-        /* A connection failure occurred - this will eventually be
-           caught and handled in run() and is therefore ignored for now */
+    /* Serialize (and compress) on the calling worker thread. The result
+       is prefixed with its size, which allows the receiving side to
+       defer the deserialization to a separate thread */
+    ref<MemoryStream> message = new MemoryStream();
+    message->setByteOrder(Stream::ENetworkByteOrder);
+    message->writeShort(cancelled ? ECancelledWorkResult : EWorkResult);
+    message->writeInt(id);
+    if (!cancelled) {
+        size_t sizePos = message->getPos();
+        message->writeSize(0);
+        result->save(message);
+        size_t endPos = message->getPos();
+        message->seek(sizePos);
+        message->writeSize(endPos - sizePos - sizeof(uint64_t));
+        message->seek(endPos);
+    }
+    send(message);
+}
+
+void StreamBackend::send(MemoryStream *message) {
+    if (m_compressionLevel > 0) {
+        ref<MemoryStream> frames = new MemoryStream();
+        frames->setByteOrder(Stream::ENetworkByteOrder);
+        std::vector<uint8_t> buffer;
+        writeFrames(frames, message->getData(), message->getPos(),
+            m_compressionLevel, buffer);
+        m_sender->push(frames);
+    } else {
+        m_sender->push(message);
+    }
+}
+
+StreamBackendSender::StreamBackendSender(const std::string &name, Stream *stream)
+    : Thread(name), m_stream(stream), m_shutdown(false) {
+    m_mutex = new Mutex();
+    m_cond = new ConditionVariable(m_mutex);
+}
+
+StreamBackendSender::~StreamBackendSender() { }
+
+void StreamBackendSender::push(MemoryStream *message) {
+    LockGuard lock(m_mutex);
+    if (m_shutdown)
+        return; /* The connection is being closed */
+    m_queue.push_back(message);
+    m_cond->signal();
+}
+
+void StreamBackendSender::shutdown() {
+    LockGuard lock(m_mutex);
+    m_shutdown = true;
+    m_cond->signal();
+}
+
+void StreamBackendSender::run() {
+    std::vector<ref<MemoryStream> > messages;
+    bool failed = false;
+
+    while (true) {
+        {
+            LockGuard lock(m_mutex);
+            while (m_queue.empty() && !m_shutdown)
+                m_cond->wait();
+            if (m_queue.empty())
+                break;
+            messages.swap(m_queue);
+        }
+
+        if (!failed) {
+            try {
+                /* Send everything that has accumulated in the meantime at once */
+                for (size_t i=0; i<messages.size(); ++i)
+                    m_stream->write(messages[i]->getData(), messages[i]->getPos());
+                m_stream->flush();
+            } catch (std::exception &) {
+                Log(EWarn, "Connection error - could not submit work results");
+                /* A connection failure occurred - this will eventually be
+                   caught and handled in StreamBackend::run() */
+                failed = true;
+            }
+        }
+        messages.clear();
     }
 }
 
@@ -589,8 +1260,11 @@ void RemoteProcess::handleCancellation() {
     m_full.clear();
 }
 
+MTS_IMPLEMENT_CLASS(FrameInputStream, false, Stream)
 MTS_IMPLEMENT_CLASS(RemoteWorker, false, Worker)
 MTS_IMPLEMENT_CLASS(RemoteWorkerReader, false, Thread)
+MTS_IMPLEMENT_CLASS(RemoteWorkerMerger, false, Thread)
 MTS_IMPLEMENT_CLASS(StreamBackend, false, Thread)
+MTS_IMPLEMENT_CLASS(StreamBackendSender, false, Thread)
 MTS_IMPLEMENT_CLASS(RemoteProcess, false, ParallelProcess)
 MTS_NAMESPACE_END
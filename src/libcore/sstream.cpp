@@ -25,6 +25,7 @@
 # include <sys/types.h>
 # include <sys/socket.h>
 # include <netinet/in.h>
+# include <netinet/tcp.h>
 # include <netdb.h>
 # include <arpa/inet.h>
 # include <sys/wait.h>
@@ -74,6 +75,15 @@ void *get_in_addr(struct sockaddr_storage *sa)
     return &(((struct sockaddr_in6*)sa)->sin6_addr);
 }
 
+/* Mitsuba batches messages before writing them, hence Nagle's algorithm
+   would only hold back the last segment of a message until the previous
+   one is acknowledged -- which can take a full round trip. */
+void disableNagle(SocketStream::socket_t socket, int family) {
+    int on = 1;
+    if (family == AF_INET || family == AF_INET6)
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char *) &on, sizeof(int));
+}
+
 } // namespace
 
 SocketStream::SocketStream(socket_t socket)
@@ -89,6 +99,8 @@ SocketStream::SocketStream(socket_t socket)
     if (inet_ntop(sockaddr.ss_family, get_in_addr(&sockaddr), s, sizeof(s)) == NULL)
         handleError("inet_ntop");
 
+    disableNagle(m_socket, sockaddr.ss_family);
+
     m_peer = s;
 }
 
@@ -134,6 +146,8 @@ SocketStream::SocketStream(const std::string &host, int port)
     if (inet_ntop(sockaddr.ss_family, get_in_addr(&sockaddr), s, sizeof(s)) == NULL)
         handleError("inet_ntop");
 
+    disableNagle(m_socket, sockaddr.ss_family);
+
 #if defined(__OSX__)
     int on = 1;
     /* Turn of SIGPIPE when writing to a disconnected socket */
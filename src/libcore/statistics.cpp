@@ -19,9 +19,26 @@
 #include <mitsuba/mitsuba.h>
 #include <mitsuba/core/statistics.h>
 #include <mitsuba/core/lock.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
 
 MTS_NAMESPACE_BEGIN
 
+namespace {
+    /* Counter shard of the current thread. Stored as 'index + 1' for
+       exclusively owned shards, as '~index' for shared ones and zero
+       when no shard has been assigned yet */
+#if defined(__WINDOWS__)
+    __declspec(thread) int __stats_shard = 0;
+#else
+    __thread int __stats_shard = 0;
+#endif
+
+    boost::mutex __stats_shard_mutex;
+    std::vector<int> __stats_free_shards;
+    int __stats_shard_ctr = 0;
+}
+
 // -----------------------------------------------------------------------
 //  Statistics collection
 // -----------------------------------------------------------------------
@@ -106,6 +123,36 @@ StatsCounter::~StatsCounter() {
     freeAligned(m_base);
 }
 
+int StatsCounter::getShard() {
+    int shard = __stats_shard;
+    if (EXPECT_TAKEN(shard != 0))
+        return shard > 0 ? shard - 1 : shard;
+
+    boost::lock_guard<boost::mutex> guard(__stats_shard_mutex);
+    if (!__stats_free_shards.empty()) {
+        shard = __stats_free_shards.back();
+        __stats_free_shards.pop_back();
+    } else if (__stats_shard_ctr < NUM_COUNTERS - 1) {
+        shard = __stats_shard_ctr++;
+    } else {
+        /* All shards are in use -- fall back to the last shard, which is
+           never owned by a thread and therefore only updated atomically */
+        __stats_shard = ~(NUM_COUNTERS - 1);
+        return __stats_shard;
+    }
+    __stats_shard = shard + 1;
+    return shard;
+}
+
+void StatsCounter::releaseShard() {
+    int shard = __stats_shard;
+    if (shard > 0) {
+        boost::lock_guard<boost::mutex> guard(__stats_shard_mutex);
+        __stats_free_shards.push_back(shard - 1);
+    }
+    __stats_shard = 0;
+}
+
 bool StatsCounter::operator<(const StatsCounter &v) const {
     if (getCategory() == v.getCategory())
         return getName() < v.getName();
@@ -113,6 +160,7 @@ bool StatsCounter::operator<(const StatsCounter &v) const {
 }
 
 ref<Statistics> Statistics::m_instance = new Statistics();
+bool Statistics::m_timingEnabled = false;
 
 void Statistics::staticInitialization() {
     SAssert(sizeof(CacheLineCounter) == 128);
@@ -126,6 +174,10 @@ Statistics::Statistics() {
     m_mutex = new Mutex();
 }
 
+void Statistics::setTimingEnabled(bool enabled) {
+    m_timingEnabled = enabled;
+}
+
 void Statistics::registerCounter(const StatsCounter *ctr) {
     m_counters.push_back(ctr);
 }
@@ -256,6 +308,18 @@ std::string Statistics::getStats() {
                         value3, suffixesNumber[suffixIndex2].c_str());
                     break;
                 }
+            case ETimeValue: {
+                    Float avg = baseValue == 0 ? (Float) 0 : value / (Float) baseValue;
+                    Float value3 = baseValue;
+                    while (value3 > 1000.0f && suffixIndex2 < lastSuffix) {
+                        value3 /= 1000.0f;
+                        suffixIndex2++;
+                    }
+                    snprintf(temp, sizeof(temp), "    -  %s : %s (%.1f ns / call, %.2f%s calls)",
+                        counter->getName().c_str(), timeString(value * 1e-9f, true).c_str(),
+                        avg, value3, suffixesNumber[suffixIndex2].c_str());
+                    break;
+                }
             default:
                 Log(EError, "Unknown counter type!");
         }
@@ -272,5 +336,70 @@ std::string Statistics::getStats() {
     return oss.str();
 }
 
+/// Quote and escape a string for use in a JSON document
+static std::string jsonString(const std::string &str) {
+    std::ostringstream oss;
+    oss << '"';
+    for (size_t i=0; i<str.length(); ++i) {
+        char c = str[i];
+        switch (c) {
+            case '"': oss << "\\\""; break;
+            case '\\': oss << "\\\\"; break;
+            case '\n': oss << "\\n"; break;
+            case '\t': oss << "\\t"; break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char temp[8];
+                    snprintf(temp, sizeof(temp), "\\u%04x", (int) c);
+                    oss << temp;
+                } else {
+                    oss << c;
+                }
+        }
+    }
+    oss << '"';
+    return oss.str();
+}
+
+std::string Statistics::getStatsJSON() {
+    const char *typeNames[] = { "number", "bytes", "percentage",
+        "minimum", "maximum", "average", "time" };
+    std::ostringstream oss;
+    LockGuard lock(m_mutex);
+
+    std::sort(m_plugins.begin(), m_plugins.end());
+    std::sort(m_counters.begin(), m_counters.end(), compareCategory());
+
+    oss << "{" << endl << "  \"plugins\": [";
+    for (size_t i=0; i<m_plugins.size(); ++i) {
+        oss << (i == 0 ? "" : ",") << endl
+            << "    { \"name\": " << jsonString(m_plugins[i].first)
+            << ", \"description\": " << jsonString(m_plugins[i].second) << " }";
+    }
+    oss << endl << "  ]," << endl << "  \"counters\": [";
+    for (size_t i=0; i<m_counters.size(); ++i) {
+        const StatsCounter *counter = m_counters[i];
+        EStatsType type = counter->getType();
+        uint64_t value;
+        if (type == EMinimumValue)
+            value = counter->getMinimum();
+        else if (type == EMaximumValue)
+            value = counter->getMaximum();
+        else
+            value = counter->getValue();
+
+        oss << (i == 0 ? "" : ",") << endl
+            << "    { \"category\": " << jsonString(counter->getCategory())
+            << ", \"name\": " << jsonString(counter->getName())
+            << ", \"type\": \"" << typeNames[type] << "\""
+            << ", \"value\": " << value;
+        if (type == EPercentage || type == EAverage || type == ETimeValue)
+            oss << ", \"base\": " << counter->getBase();
+        oss << " }";
+    }
+    oss << endl << "  ]" << endl << "}" << endl;
+    return oss.str();
+}
+
 MTS_IMPLEMENT_CLASS(Statistics, false, Object)
 MTS_NAMESPACE_END
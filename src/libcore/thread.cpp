@@ -19,6 +19,7 @@
 #include <mitsuba/core/lock.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/atomic.h>
+#include <mitsuba/core/statistics.h>
 
 #if defined(MTS_OPENMP)
 # include <omp.h>
@@ -498,6 +499,7 @@ void Thread::exit() {
     Log(EDebug, "Thread \"%s\" has finished", d->name.c_str());
     d->running = false;
     Assert(ThreadPrivate::self->get() == this);
+    StatsCounter::releaseShard();
     detail::destroyLocalTLS();
     decRef();
 }
@@ -184,6 +184,10 @@ Float Timer::lap() {
     return (Float) (delta * 1e-9);
 }
 
+uint64_t Timer::getTimestamp() {
+    return static_cast<uint64_t>(timeInNanoseconds());
+}
+
 std::string Timer::toString() const {
     std::ostringstream oss;
     oss << "Timer[ms=" << getMilliseconds() << "]";
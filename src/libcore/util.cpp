@@ -26,6 +26,7 @@
 #include <stdarg.h>
 #include <iomanip>
 #include <errno.h>
+#include <fstream>
 
 #if defined(__OSX__)
 #include <sys/sysctl.h>
@@ -36,6 +37,8 @@
 #include <psapi.h>
 #else
 #include <malloc.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 #endif
 
 #if defined(__WINDOWS__)
@@ -216,6 +219,143 @@ done:
 #endif
 }
 
+#if defined(__LINUX__)
+/* Constants from <numaif.h> -- avoids a build dependency on libnuma */
+#if !defined(MPOL_INTERLEAVE)
+#define MPOL_INTERLEAVE 3
+#endif
+#if !defined(MPOL_MF_MOVE)
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+static int __cached_numa_node_count = 0;
+
+/// Parse a sysfs CPU list such as "0-7,16-23"
+static std::vector<int> parseCPUList(const std::string &str) {
+    std::vector<int> result;
+    std::vector<std::string> ranges = tokenize(str, ",\n");
+    for (size_t i=0; i<ranges.size(); ++i) {
+        int first = 0, last = 0;
+        int count = sscanf(ranges[i].c_str(), "%i-%i", &first, &last);
+        if (count == 1)
+            last = first;
+        else if (count != 2)
+            continue;
+        for (int j=first; j<=last; ++j)
+            result.push_back(j);
+    }
+    return result;
+}
+
+/// Return the logical IDs of the CPUs that this process may run on
+static std::vector<int> getAvailableCPUs() {
+    std::vector<int> result;
+    int nLogicalCores = sysconf(_SC_NPROCESSORS_CONF);
+
+    for (int i = 0; i<6; ++i) {
+        size_t size = CPU_ALLOC_SIZE(nLogicalCores);
+        cpu_set_t *cpuset = CPU_ALLOC(nLogicalCores);
+        if (!cpuset)
+            break;
+        CPU_ZERO_S(size, cpuset);
+
+        int retval = pthread_getaffinity_np(pthread_self(), size, cpuset);
+        if (retval == 0) {
+            for (int j=0; j<nLogicalCores; ++j) {
+                if (CPU_ISSET_S(j, size, cpuset))
+                    result.push_back(j);
+            }
+            CPU_FREE(cpuset);
+            return result;
+        }
+        CPU_FREE(cpuset);
+        if (retval != EINVAL)
+            break;
+        nLogicalCores *= 2;
+    }
+
+    /* Could not read the affinity map -- assume that all cores are usable */
+    for (int i=0; i<getCoreCount(); ++i)
+        result.push_back(i);
+    return result;
+}
+#endif
+
+int getNUMANodeCount() {
+#if defined(__LINUX__)
+    // assumes atomic word size memory access
+    if (__cached_numa_node_count)
+        return __cached_numa_node_count;
+
+    /* Nodes are assumed to be numbered consecutively */
+    int nodeCount = 0;
+    while (access(formatString("/sys/devices/system/node/node%i/cpulist",
+            nodeCount).c_str(), R_OK) == 0)
+        ++nodeCount;
+
+    __cached_numa_node_count = std::max(nodeCount, 1);
+    return __cached_numa_node_count;
+#else
+    return 1;
+#endif
+}
+
+std::vector<int> getNUMANodeCores(int node) {
+    std::vector<int> result;
+#if defined(__LINUX__)
+    if (getNUMANodeCount() > 1) {
+        std::ifstream is(formatString("/sys/devices/system/node/node%i/cpulist", node).c_str());
+        std::string line;
+        if (!is.good() || !std::getline(is, line))
+            return result;
+
+        std::vector<int> nodeCPUs = parseCPUList(line),
+                         available = getAvailableCPUs();
+
+        for (size_t i=0; i<available.size(); ++i) {
+            if (std::find(nodeCPUs.begin(), nodeCPUs.end(), available[i]) != nodeCPUs.end())
+                result.push_back((int) i);
+        }
+        return result;
+    }
+#endif
+    if (node == 0) {
+        for (int i=0; i<getCoreCount(); ++i)
+            result.push_back(i);
+    }
+    return result;
+}
+
+bool interleaveMemory(const void *ptr, size_t size) {
+#if defined(__LINUX__) && defined(SYS_mbind)
+    int nodeCount = getNUMANodeCount();
+    if (nodeCount <= 1 || ptr == NULL || size == 0)
+        return false;
+
+    const size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start = reinterpret_cast<uintptr_t>(ptr) & ~(uintptr_t) (pageSize-1),
+              end = (reinterpret_cast<uintptr_t>(ptr) + size + pageSize - 1) & ~(uintptr_t) (pageSize-1);
+
+    const size_t bitsPerWord = sizeof(unsigned long) * 8;
+    std::vector<unsigned long> nodeMask((nodeCount + bitsPerWord - 1) / bitsPerWord, 0);
+    for (int i=0; i<nodeCount; ++i)
+        nodeMask[i / bitsPerWord] |= 1UL << (i % bitsPerWord);
+
+    /* The kernel expects the mask size in bits plus one */
+    long retval = syscall(SYS_mbind, reinterpret_cast<void *>(start), (unsigned long) (end - start),
+        MPOL_INTERLEAVE, &nodeMask[0], (unsigned long) (nodeMask.size() * bitsPerWord + 1),
+        MPOL_MF_MOVE);
+
+    if (retval != 0) {
+        SLog(EDebug, "interleaveMemory(): mbind() failed: %s", strerror(errno));
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 size_t getTotalSystemMemory() {
 #if defined(__WINDOWS__)
     MEMORYSTATUSEX status;
@@ -900,4 +1040,78 @@ std::string memString(size_t size, bool precise) {
     return os.str();
 }
 
+static const uint32_t sha256RoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr32(uint32_t x, int r) {
+    return (x >> r) | (x << (32 - r));
+}
+
+/// Process one 64-byte block of the SHA-256 message schedule
+static void sha256Block(uint32_t *state, const uint8_t *block) {
+    uint32_t w[64];
+    for (int i=0; i<16; ++i)
+        w[i] = ((uint32_t) block[4*i] << 24) | ((uint32_t) block[4*i+1] << 16)
+             | ((uint32_t) block[4*i+2] << 8) | (uint32_t) block[4*i+3];
+    for (int i=16; i<64; ++i) {
+        uint32_t s0 = rotr32(w[i-15], 7) ^ rotr32(w[i-15], 18) ^ (w[i-15] >> 3),
+                 s1 = rotr32(w[i-2], 17) ^ rotr32(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+             e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i=0; i<64; ++i) {
+        uint32_t S1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25),
+                 ch = (e & f) ^ (~e & g),
+                 t1 = h + S1 + ch + sha256RoundConstants[i] + w[i],
+                 S0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22),
+                 maj = (a & b) ^ (a & c) ^ (b & c),
+                 t2 = S0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+std::string sha256(const void *data_, size_t size) {
+    const uint8_t *data = static_cast<const uint8_t *>(data_);
+    uint32_t state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    size_t nBlocks = size / 64;
+    for (size_t i=0; i<nBlocks; ++i)
+        sha256Block(state, data + 64*i);
+
+    /* Pad the remainder with a single one bit, zeros and the message length */
+    uint8_t tail[128];
+    size_t remainder = size % 64;
+    memset(tail, 0, sizeof(tail));
+    if (remainder > 0)
+        memcpy(tail, data + 64*nBlocks, remainder);
+    tail[remainder] = 0x80;
+    size_t tailSize = remainder < 56 ? 64 : 128;
+    uint64_t bitCount = (uint64_t) size * 8;
+    for (int i=0; i<8; ++i)
+        tail[tailSize-1-i] = (uint8_t) (bitCount >> (8*i));
+    for (size_t i=0; i<tailSize; i += 64)
+        sha256Block(state, tail + i);
+
+    std::string result;
+    for (int i=0; i<8; ++i)
+        result += formatString("%08x", state[i]);
+    return result;
+}
+
 MTS_NAMESPACE_END
@@ -1728,10 +1728,15 @@ void export_core() {
 
     BP_CLASS(Statistics, Object, bp::no_init)
         .def("getStats", &Statistics::getStats, BP_RETURN_VALUE)
+        .def("getStatsJSON", &Statistics::getStatsJSON, BP_RETURN_VALUE)
         .def("resetAll", &Statistics::resetAll)
         .def("printStats", &Statistics::printStats)
         .def("getInstance", &Statistics::getInstance, BP_RETURN_VALUE)
-        .staticmethod("getInstance");
+        .def("setTimingEnabled", &Statistics::setTimingEnabled)
+        .def("isTimingEnabled", &Statistics::isTimingEnabled)
+        .staticmethod("getInstance")
+        .staticmethod("setTimingEnabled")
+        .staticmethod("isTimingEnabled");
 
     BP_CLASS(WorkUnit, Object, bp::no_init)
         .def("set", &WorkUnit::set)
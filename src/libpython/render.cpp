@@ -420,7 +420,11 @@ void export_render() {
     bp::class_<SceneHandler, boost::noncopyable>("SceneHandler", bp::no_init)
         .def("loadScene", &loadScene1, BP_RETURN_VALUE)
         .def("loadScene", &loadScene2, BP_RETURN_VALUE)
-        .staticmethod("loadScene");
+        .staticmethod("loadScene")
+        .def("setParallelLoading", &SceneHandler::setParallelLoading)
+        .staticmethod("setParallelLoading")
+        .def("getParallelLoading", &SceneHandler::getParallelLoading)
+        .staticmethod("getParallelLoading");
 
     Scene *(RenderJob::*renderJob_getScene)(void) = &RenderJob::getScene;
     RenderQueue *(RenderJob::*renderJob_getRenderQueue)(void) = &RenderJob::getRenderQueue;
@@ -148,6 +148,22 @@ ref<Bitmap> Emitter::getBitmap(const Vector2i &sizeHint) const {
     NotImplementedError("getBitmap");
 }
 
+bool Emitter::getEmissionBounds(EmissionBounds &bounds) const {
+    return false;
+}
+
+std::string EmissionBounds::toString() const {
+    std::ostringstream oss;
+    oss << "EmissionBounds[" << endl
+        << "  aabb = " << aabb.toString() << "," << endl
+        << "  axis = " << axis.toString() << "," << endl
+        << "  thetaO = " << radToDeg(math::safe_acos(cosThetaO)) << "," << endl
+        << "  thetaE = " << radToDeg(math::safe_acos(cosThetaE)) << "," << endl
+        << "  power = " << power << endl
+        << "]";
+    return oss.str();
+}
+
 MTS_IMPLEMENT_CLASS(Emitter, false, AbstractEmitter)
 MTS_IMPLEMENT_CLASS(AbstractEmitter, true, ConfigurableObject)
 MTS_NAMESPACE_END
@@ -0,0 +1,163 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/geompager.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/lrucache.h>
+#include <mitsuba/core/atomic.h>
+#include <boost/bind.hpp>
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter statsHitRate("Out-of-core geometry", "Page cache hit rate", EPercentage);
+static StatsCounter statsFaults("Out-of-core geometry", "Page faults");
+
+typedef LRUCache<uint32_t, std::less<uint32_t>, TriAccel *> PageLRUCache;
+
+struct GeometryPager::PageCache : public PageLRUCache {
+    /// Most recently accessed page and its contents
+    uint32_t page;
+    const TriAccel *data;
+
+    PageCache(size_t capacity,
+        const boost::function<TriAccel *(const uint32_t &)> &load,
+        const boost::function<void (TriAccel * const &)> &release)
+        : PageLRUCache(capacity, load, release),
+          page(0xFFFFFFFFu), data(NULL) { }
+};
+
+namespace {
+    /* Page cache that the current thread used most recently, and the ID
+       of the pager that owns it. Every triangle test looks up its page,
+       and this avoids going through the ThreadLocal in the common case */
+#if defined(__WINDOWS__)
+    __declspec(thread) int32_t __pager_hint_id = 0;
+    __declspec(thread) void *__pager_hint_cache = NULL;
+#else
+    __thread int32_t __pager_hint_id = 0;
+    __thread void *__pager_hint_cache = NULL;
+#endif
+
+    volatile int32_t __pager_id_ctr = 0;
+}
+
+GeometryPager::GeometryPager(size_t recordCount, size_t cacheSize)
+    : m_recordCount(recordCount), m_appended(0), m_cacheSize(cacheSize),
+      m_residentPages(0) {
+    m_id = atomicAdd(&__pager_id_ctr, 1);
+    if (recordCount > ((size_t) 0xFFFFFFFFu))
+        Log(EError, "The page file cannot hold more than 2^32 records!");
+
+    const size_t pageBytes = EPageSize * sizeof(TriAccel);
+    m_pageCount = (recordCount + EPageSize - 1) / EPageSize;
+    m_file = MemoryMappedFile::createTemporary(
+        std::max(recordCount, (size_t) 1) * sizeof(TriAccel));
+    m_location = new uint32_t[std::max(recordCount, (size_t) 1)];
+
+    /* The limit is enforced across all threads when pages are loaded,
+       hence every single cache may use all of it */
+    m_maxPages = std::max((size_t) 1, std::min(cacheSize / pageBytes,
+        (size_t) std::numeric_limits<int32_t>::max()));
+
+    Log(EDebug, "Out-of-core geometry: " SIZE_T_FMT " pages (%s) in \"%s\", "
+        "up to " SIZE_T_FMT " resident pages", m_pageCount,
+        memString(m_file->getSize()).c_str(),
+        m_file->getFilename().string().c_str(), m_maxPages);
+}
+
+GeometryPager::~GeometryPager() {
+    delete[] m_location;
+}
+
+TriAccel &GeometryPager::append(uint32_t primIndex) {
+    Assert(m_appended < m_recordCount && primIndex < m_recordCount);
+    m_location[primIndex] = (uint32_t) m_appended;
+    TriAccel *records = static_cast<TriAccel *>(m_file->getData());
+    TriAccel &result = records[m_appended++];
+    memset(&result, 0, sizeof(TriAccel));
+    return result;
+}
+
+const TriAccel *GeometryPager::getPage(uint32_t page) const {
+    PageCache *cache;
+    if (EXPECT_TAKEN(__pager_hint_id == m_id)) {
+        cache = static_cast<PageCache *>(__pager_hint_cache);
+        if (EXPECT_TAKEN(cache->page == page)) {
+            statsHitRate.incrementBase();
+            ++statsHitRate;
+            return cache->data;
+        }
+    } else {
+        cache = m_cache.get();
+        if (EXPECT_NOT_TAKEN(cache == NULL)) {
+            cache = new PageCache(m_maxPages,
+                boost::bind(&GeometryPager::loadPage, this, _1),
+                boost::bind(&GeometryPager::releasePage, this, _1));
+            m_cache.set(cache);
+        }
+        __pager_hint_id = m_id;
+        __pager_hint_cache = cache;
+        if (cache->page == page) {
+            statsHitRate.incrementBase();
+            ++statsHitRate;
+            return cache->data;
+        }
+    }
+
+    bool hit = false;
+    cache->data = cache->get(page, hit);
+    cache->page = page;
+
+    statsHitRate.incrementBase();
+    if (hit)
+        ++statsHitRate;
+
+    return cache->data;
+}
+
+TriAccel *GeometryPager::loadPage(uint32_t page) const {
+    /* Make room by evicting the least recently used pages of the current
+       thread if the caches of all threads have reached the limit */
+    if ((size_t) atomicAdd(&m_residentPages, 1) > m_maxPages) {
+        PageCache *cache = m_cache.get();
+        while ((size_t) m_residentPages > m_maxPages && cache->evict())
+            ;
+    }
+
+    size_t start = (size_t) page * EPageSize,
+           count = std::min((size_t) EPageSize, m_recordCount - start);
+
+    TriAccel *data = static_cast<TriAccel *>(
+        allocAligned(EPageSize * sizeof(TriAccel)));
+    memcpy(data, static_cast<const TriAccel *>(m_file->getData()) + start,
+        count * sizeof(TriAccel));
+    ++statsFaults;
+    return data;
+}
+
+void GeometryPager::releasePage(TriAccel * const &data) const {
+    atomicAdd(&m_residentPages, -1);
+    freeAligned(data);
+}
+
+size_t GeometryPager::getMemoryUsage() const {
+    return m_recordCount * sizeof(uint32_t);
+}
+
+MTS_IMPLEMENT_CLASS(GeometryPager, false, Object)
+MTS_NAMESPACE_END
@@ -17,6 +17,8 @@
 */
 
 #include <mitsuba/render/imageblock.h>
+#include <mitsuba/core/atomic.h>
+#include <boost/thread/thread.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -35,11 +37,43 @@ ImageBlock::ImageBlock(Bitmap::EPixelFormat fmt, const Vector2i &size,
         m_weightsX = new Float[2*tempBufferSize];
         m_weightsY = m_weightsX + tempBufferSize;
     }
+
+    /* Locks used by putConcurrent() */
+    int bandCount = (m_bitmap->getHeight() + MTS_IMAGEBLOCK_BAND_HEIGHT - 1)
+        / MTS_IMAGEBLOCK_BAND_HEIGHT;
+    m_bandLocks = new int32_t[std::max(bandCount, 1)];
+    for (int i=0; i<bandCount; ++i)
+        m_bandLocks[i] = 0;
 }
 
 ImageBlock::~ImageBlock() {
     if (m_weightsX)
         delete[] m_weightsX;
+    delete[] m_bandLocks;
+}
+
+void ImageBlock::putConcurrent(const ImageBlock *block) {
+    const Bitmap *source = block->getBitmap();
+    Point2i targetOffset(block->getOffset() - m_offset
+        - Vector2i(block->getBorderSize() - m_borderSize));
+
+    int yStart = std::max(targetOffset.y, 0),
+        yEnd = std::min(targetOffset.y + source->getHeight(), m_bitmap->getHeight());
+
+    for (int y = yStart; y < yEnd; ) {
+        int band = y / MTS_IMAGEBLOCK_BAND_HEIGHT,
+            bandEnd = std::min((band + 1) * MTS_IMAGEBLOCK_BAND_HEIGHT, yEnd);
+
+        while (!atomicCompareAndExchange(&m_bandLocks[band], 1, 0))
+            boost::this_thread::yield();
+
+        m_bitmap->accumulate(source, Point2i(0, y - targetOffset.y),
+            Point2i(targetOffset.x, y), Vector2i(source->getWidth(), bandEnd - y));
+
+        /* Release the band (the CAS acts as a full memory barrier) */
+        atomicCompareAndExchange(&m_bandLocks[band], 0, 1);
+        y = bandEnd;
+    }
 }
 
 void ImageBlock::load(Stream *stream) {
@@ -25,23 +25,24 @@ MTS_NAMESPACE_BEGIN
 /*                          BlockedImageProcess                         */
 /* ==================================================================== */
 
-void BlockedImageProcess::init(const Point2i &offset, const Vector2i &size, uint32_t blockSize) {
+void BlockedImageProcess::init(const Point2i &offset, const Vector2i &size,
+        uint32_t blockSize, EBlockOrder blockOrder) {
     m_offset = offset;
     m_size = size;
     m_blockSize = (int) blockSize;
+    m_blockOrder = blockOrder;
     m_direction = ERight;
     m_numBlocks = Vector2i(
         (int) std::ceil((Float) size.x / (Float) blockSize),
         (int) std::ceil((Float) size.y / (Float) blockSize));
     m_numBlocksTotal = m_numBlocks.x * m_numBlocks.y;
     m_numBlocksGenerated = 0;
-    m_curBlock = Point2i(m_numBlocks / 2);
+    m_curBlock = blockOrder == ESpiralOrder ? Point2i(m_numBlocks / 2) : Point2i(0, 0);
     m_stepsLeft = 1;
     m_numSteps = 1;
 }
 
 ParallelProcess::EStatus BlockedImageProcess::generateWork(WorkUnit *unit, int worker) {
-    /* Reimplementation of the spiraling block generator by Adam Arbree */
     RectangularWorkUnit &rect = *static_cast<RectangularWorkUnit *>(unit);
 
     if (m_numBlocksTotal == m_numBlocksGenerated)
@@ -56,6 +57,15 @@ ParallelProcess::EStatus BlockedImageProcess::generateWork(WorkUnit *unit, int w
     if (++m_numBlocksGenerated == m_numBlocksTotal)
         return ESuccess;
 
+    if (m_blockOrder == EScanlineOrder) {
+        if (++m_curBlock.x == m_numBlocks.x) {
+            m_curBlock.x = 0;
+            ++m_curBlock.y;
+        }
+        return ESuccess;
+    }
+
+    /* Reimplementation of the spiraling block generator by Adam Arbree */
     do {
         switch (m_direction) {
             case ERight: ++m_curBlock.x; break;
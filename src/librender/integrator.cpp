@@ -20,6 +20,9 @@
 #include <mitsuba/render/integrator.h>
 #include <mitsuba/render/renderproc.h>
 
+/// Maximum number of pixels that are processed in lockstep by the wavefront mode
+#define MTS_WAVEFRONT_SIZE 256
+
 MTS_NAMESPACE_BEGIN
 
 Integrator::Integrator(const Properties &props)
@@ -43,13 +46,20 @@ void Integrator::configureSampler(const Scene *scene, Sampler *sampler) {
 const Integrator *Integrator::getSubIntegrator(int idx) const { return NULL; }
 
 SamplingIntegrator::SamplingIntegrator(const Properties &props)
- : Integrator(props) { }
+ : Integrator(props) {
+    /* Process the pixels of each block in lockstep, which allows
+       tracing their rays and shading their hits in batches */
+    m_wavefront = props.getBoolean("wavefront", false);
+}
 
 SamplingIntegrator::SamplingIntegrator(Stream *stream, InstanceManager *manager)
- : Integrator(stream, manager) { }
+ : Integrator(stream, manager) {
+    m_wavefront = stream->readBool();
+}
 
 void SamplingIntegrator::serialize(Stream *stream, InstanceManager *manager) const {
     Integrator::serialize(stream, manager);
+    stream->writeBool(m_wavefront);
 }
 
 Spectrum SamplingIntegrator::E(const Scene *scene, const Intersection &its,
@@ -141,6 +151,11 @@ void SamplingIntegrator::renderBlock(const Scene *scene,
         const Sensor *sensor, Sampler *sampler, ImageBlock *block,
         const bool &stop, const std::vector< TPoint2<uint8_t> > &points) const {
 
+    if (m_wavefront) {
+        renderBlockWavefront(scene, sensor, sampler, block, stop, points);
+        return;
+    }
+
     Float diffScaleFactor = 1.0f /
         std::sqrt((Float) sampler->getSampleCount());
 
@@ -187,6 +202,142 @@ void SamplingIntegrator::renderBlock(const Scene *scene,
     }
 }
 
+void SamplingIntegrator::renderBlockWavefront(const Scene *scene,
+        const Sensor *sensor, Sampler *sampler, ImageBlock *block,
+        const bool &stop, const std::vector< TPoint2<uint8_t> > &points) const {
+
+    Float diffScaleFactor = 1.0f /
+        std::sqrt((Float) sampler->getSampleCount());
+
+    bool needsApertureSample = sensor->needsApertureSample();
+    bool needsTimeSample = sensor->needsTimeSample();
+
+    Point2 apertureSample(0.5f);
+    Float timeSample = 0.5f;
+
+    block->clear();
+
+    uint32_t queryType = RadianceQueryRecord::ESensorRay;
+
+    if (!sensor->getFilm()->hasAlpha()) /* Don't compute an alpha channel if we don't have to */
+        queryType &= ~RadianceQueryRecord::EOpacity;
+
+    /* Samplers keep track of the current sample dimension, hence every
+       pixel of the wavefront needs its own one. They are cloned once per
+       thread and reused for all blocks rendered with the same sampler */
+    size_t width = std::min(points.size(), (size_t) MTS_WAVEFRONT_SIZE);
+    WavefrontSamplers &wavefrontSamplers = m_wavefrontSamplers.get();
+    if (wavefrontSamplers.parent.get() != sampler) {
+        wavefrontSamplers.parent = sampler;
+        wavefrontSamplers.samplers.clear();
+    }
+    ref_vector<Sampler> &samplers = wavefrontSamplers.samplers;
+    while (samplers.size() < width)
+        samplers.push_back(sampler->clone());
+
+    std::vector<RadianceQueryRecord> rRecs(width);
+    std::vector<RayDifferential> rays(width);
+    std::vector<Point2i> offsets(width);
+    std::vector<Point2> samplePos(width);
+    std::vector<Spectrum> weights(width), result(width);
+
+    for (size_t i=0; i<width; ++i) {
+        rRecs[i].scene = scene;
+        rRecs[i].sampler = samplers[i];
+    }
+
+    for (size_t start=0; start<points.size() && !stop; start += width) {
+        size_t count = std::min(width, points.size() - start);
+
+        for (size_t i=0; i<count; ++i) {
+            offsets[i] = Point2i(points[start+i]) + Vector2i(block->getOffset());
+            samplers[i]->generate(offsets[i]);
+        }
+
+        for (size_t j = 0; j<sampler->getSampleCount() && !stop; j++) {
+            for (size_t i=0; i<count; ++i) {
+                RadianceQueryRecord &rRec = rRecs[i];
+                rRec.newQuery(queryType, sensor->getMedium());
+                samplePos[i] = Point2(offsets[i]) + Vector2(rRec.nextSample2D());
+
+                if (needsApertureSample)
+                    apertureSample = rRec.nextSample2D();
+                if (needsTimeSample)
+                    timeSample = rRec.nextSample1D();
+
+                weights[i] = sensor->sampleRayDifferential(
+                    rays[i], samplePos[i], apertureSample, timeSample);
+
+                rays[i].scaleDifferential(diffScaleFactor);
+            }
+
+            LiWavefront(count, &rays[0], &rRecs[0], &result[0]);
+
+            for (size_t i=0; i<count; ++i) {
+                block->put(samplePos[i], weights[i] * result[i], rRecs[i].alpha);
+                samplers[i]->advance();
+            }
+        }
+    }
+}
+
+void SamplingIntegrator::LiWavefront(size_t count, const RayDifferential *rays,
+        RadianceQueryRecord *rRecs, Spectrum *result) const {
+    std::vector<uint32_t> indices;
+    indices.reserve(count);
+
+    /* Intersect all rays at once (unless the intersections were provided) */
+    for (size_t i=0; i<count; ++i) {
+        if (rRecs[i].type & RadianceQueryRecord::EIntersection)
+            indices.push_back((uint32_t) i);
+    }
+    rayIntersectBatch(rays, rRecs, indices);
+
+    /* Shade the hits grouped by material */
+    indices.resize(count);
+    for (size_t i=0; i<count; ++i)
+        indices[i] = (uint32_t) i;
+    sortByMaterial(rRecs, indices);
+
+    for (size_t i=0; i<count; ++i) {
+        uint32_t idx = indices[i];
+        result[idx] = Li(rays[idx], rRecs[idx]);
+    }
+}
+
+void SamplingIntegrator::rayIntersectBatch(const RayDifferential *rays,
+        RadianceQueryRecord *rRecs, const std::vector<uint32_t> &indices) {
+    if (indices.empty())
+        return;
+
+    std::vector<Ray> batch(indices.size());
+    std::vector<Intersection> its(indices.size());
+    for (size_t i=0; i<indices.size(); ++i)
+        batch[i] = rays[indices[i]];
+
+    rRecs[indices[0]].scene->rayIntersectBatch(&batch[0], batch.size(), &its[0]);
+
+    for (size_t i=0; i<indices.size(); ++i) {
+        RadianceQueryRecord &rRec = rRecs[indices[i]];
+        rRec.its = its[i];
+        if (rRec.type & RadianceQueryRecord::EIntersection)
+            rRec.setIntersection(rays[indices[i]]);
+    }
+}
+
+void SamplingIntegrator::sortByMaterial(const RadianceQueryRecord *rRecs,
+        std::vector<uint32_t> &indices) {
+    /* Ties are broken by the index, which keeps neighboring pixels together */
+    std::vector<std::pair<const BSDF *, uint32_t> > keys(indices.size());
+    for (size_t i=0; i<indices.size(); ++i) {
+        const Intersection &its = rRecs[indices[i]].its;
+        keys[i] = std::make_pair(its.isValid() ? its.getBSDF() : NULL, indices[i]);
+    }
+    std::sort(keys.begin(), keys.end());
+    for (size_t i=0; i<indices.size(); ++i)
+        indices[i] = keys[i].second;
+}
+
 MonteCarloIntegrator::MonteCarloIntegrator(const Properties &props) : SamplingIntegrator(props) {
     /* Depth to begin using russian roulette */
     m_rrDepth = props.getInteger("rrDepth", 5);
@@ -222,6 +222,7 @@ IrradianceCache::IrradianceCache(const AABB &aabb)
     /* Use the longest AABB axis as an estimate of the scene dimensions */
     m_sceneSize = (aabb.max-aabb.min)[aabb.getLargestAxis()];
     m_mutex = new Mutex();
+    m_buffered = false;
 
     /* Reasonable default settings */
     setQuality(1.0f);
@@ -233,6 +234,7 @@ IrradianceCache::IrradianceCache(const AABB &aabb)
 IrradianceCache::IrradianceCache(Stream *stream, InstanceManager *manager) :
     m_octree(AABB(stream)) {
     m_mutex = new Mutex();
+    m_buffered = false;
     m_kappa = stream->readFloat();
     m_sceneSize = stream->readFloat();
     m_clampScreen = stream->readBool();
@@ -322,8 +324,15 @@ IrradianceCache::Record *IrradianceCache::put(const RayDifferential &ray, const
            geometric feature information amongst neighboring hss */
         clamp_self_functor clampSelf(its.p, R0);
         m_octree.searchSphere(BSphere(its.p, R0), clampSelf);
+        if (m_buffered)
+            searchPending(BSphere(its.p, R0), clampSelf);
+
+        /* When buffering, shared records are only clamped in commit() */
         clamp_neighbors_functor clampNeighbors(its.p, R0);
-        m_octree.searchSphere(BSphere(its.p, R0), clampNeighbors);
+        if (m_buffered)
+            searchPending(BSphere(its.p, R0), clampNeighbors);
+        else
+            m_octree.searchSphere(BSphere(its.p, R0), clampNeighbors);
     }
 
     Record *record = new Record();
@@ -338,7 +347,19 @@ IrradianceCache::Record *IrradianceCache::put(const RayDifferential &ray, const
         record->rGrad[i] = hs.getRotationalGradient()[i];
         record->tGrad[i] = tGrad[i];
     }
-    insert(record);
+    if (m_buffered) {
+        PendingRecords &pending = m_pending.get();
+        if (!pending.octree)
+            pending.octree = new DynamicOctree<Record *>(m_octree.getAABB());
+        Float validRadius = record->R0 / (2*m_kappa);
+        pending.octree->insert(record, AABB(
+            record->p-Vector(1,1,1)*validRadius,
+            record->p+Vector(1,1,1)*validRadius
+        ));
+        pending.records.push_back(record);
+    } else {
+        insert(record);
+    }
     return record;
 }
 
@@ -352,12 +373,44 @@ void IrradianceCache::insert(Record *record) {
     m_records.push_back(record);
 }
 
+void IrradianceCache::commit() {
+    PendingRecords &pendingRecords = m_pending.get();
+    const std::vector<Record *> &pending = pendingRecords.records;
+    if (pending.empty())
+        return;
+
+    /* Serialize concurrent commits; lookups proceed without locking */
+    LockGuard lock(m_mutex);
+    for (size_t i=0; i<pending.size(); ++i) {
+        Record *record = pending[i];
+        if (m_clampNeighbor) {
+            clamp_neighbors_functor clampNeighbors(record->p, record->originalR0);
+            m_octree.searchSphere(BSphere(record->p, record->originalR0), clampNeighbors);
+        }
+        Float validRadius = record->R0 / (2*m_kappa);
+        m_octree.insert(record, AABB(
+            record->p-Vector(1,1,1)*validRadius,
+            record->p+Vector(1,1,1)*validRadius
+        ));
+        m_records.push_back(record);
+    }
+    pendingRecords.clear();
+}
+
+void IrradianceCache::detach(std::vector<Record *> &records) {
+    PendingRecords &pending = m_pending.get();
+    records.insert(records.end(), pending.records.begin(), pending.records.end());
+    pending.clear();
+}
+
 static StatsCounter irradHits("Irradiance cache", "Hits");
 static StatsCounter irradMisses("Irradiance cache", "Misses");
 
 bool IrradianceCache::get(const Intersection &its, Spectrum &E) const {
     irr_interp_functor functor(its, m_kappa, m_useGradients);
     m_octree.lookup(its.p, functor);
+    if (m_buffered)
+        lookupPending(its.p, functor);
 
     if (functor.weightSum > 0) {
         E = functor.E / functor.weightSum;
@@ -378,7 +431,8 @@ std::string IrradianceCache::toString() const {
         << "  sceneSize = " << m_sceneSize << "," << endl
         << "  clampScreen = " << m_clampScreen << "," << endl
         << "  clampNeighbor = " << m_clampNeighbor << "," << endl
-        << "  useGradients = " << m_useGradients << endl
+        << "  useGradients = " << m_useGradients << "," << endl
+        << "  buffered = " << m_buffered << endl
         << "]";
     return oss.str();
 }
@@ -0,0 +1,423 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/lighttree.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter failedSelections("Light tree",
+    "Selections without a contributing emitter", EPercentage);
+
+/// Compute cos(max(0, a-b)) given the sines and cosines of two angles
+static inline Float cosSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+    if (cosA > cosB)
+        return 1.0f;
+    return cosA * cosB + sinA * sinB;
+}
+
+/// Compute sin(max(0, a-b)) given the sines and cosines of two angles
+static inline Float sinSubClamped(Float sinA, Float cosA, Float sinB, Float cosB) {
+    if (cosA > cosB)
+        return 0.0f;
+    return sinA * cosB - cosA * sinB;
+}
+
+struct LightTree::BucketPredicate {
+    BucketPredicate(int axis, int bucket, Float min, Float scale)
+        : axis(axis), bucket(bucket), min(min), scale(scale) { }
+
+    inline bool operator()(const EmitterRef &ref) const {
+        return std::min(MTS_LIGHTTREE_BUCKETS - 1, (int) ((ref.bounds.aabb.getCenter()[axis]
+            - min) * scale)) < bucket;
+    }
+
+    int axis, bucket;
+    Float min, scale;
+};
+
+struct LightTree::CentroidOrdering {
+    CentroidOrdering(int axis) : axis(axis) { }
+
+    inline bool operator()(const EmitterRef &a, const EmitterRef &b) const {
+        return a.bounds.aabb.getCenter()[axis] < b.bounds.aabb.getCenter()[axis];
+    }
+
+    int axis;
+};
+
+LightTree::LightTree(const ref_vector<Emitter> &emitters) {
+    ref<Timer> timer = new Timer();
+    std::vector<EmitterRef> refs;
+    Float boundedWeight = 0, unboundedWeight = 0;
+
+    for (size_t i=0; i<emitters.size(); ++i) {
+        const Emitter *emitter = emitters[i].get();
+        EmitterRef eref;
+
+        if (emitter->getEmissionBounds(eref.bounds) && eref.bounds.aabb.isValid()) {
+            /* Emitters that are never chosen don't need to be in the tree */
+            eref.bounds.power *= emitter->getSamplingWeight();
+            if (!(eref.bounds.power > 0))
+                continue;
+            eref.index = (IndexType) m_emitters.size();
+            m_emitters.push_back(emitter);
+            refs.push_back(eref);
+            boundedWeight += emitter->getSamplingWeight();
+        } else {
+            m_unbounded.push_back(emitter);
+            m_unboundedPDF.append(emitter->getSamplingWeight());
+            unboundedWeight += emitter->getSamplingWeight();
+        }
+    }
+
+    m_unboundedProb = 0.0f;
+    if (unboundedWeight > 0) {
+        m_unboundedPDF.normalize();
+        m_unboundedProb = unboundedWeight / (unboundedWeight + boundedWeight);
+    }
+
+    /* Bounded emitters are mapped to their index, unbounded
+       ones to their index plus the number of bounded emitters */
+    for (size_t i=0; i<m_emitters.size(); ++i)
+        m_emitterIndices[m_emitters[i]] = (IndexType) i;
+    for (size_t i=0; i<m_unbounded.size(); ++i)
+        m_emitterIndices[m_unbounded[i]] = (IndexType) (m_emitters.size() + i);
+
+    if (!refs.empty()) {
+        m_nodes.reserve(2 * refs.size() - 1);
+        m_nodes.resize(1);
+        m_nodes[0].parent = 0;
+        m_leaves.resize(m_emitters.size());
+        build(refs, 0, refs.size(), 0, 0);
+    }
+
+    m_buildTime = timer->getMilliseconds();
+    Log(EDebug, "Built a light tree over " SIZE_T_FMT " emitters in %i ms ("
+        SIZE_T_FMT " nodes, %s, " SIZE_T_FMT " emitters without bounds)",
+        m_emitters.size(), m_buildTime, m_nodes.size(),
+        memString(getMemoryUsage()).c_str(), m_unbounded.size());
+}
+
+LightTree::~LightTree() { }
+
+void LightTree::build(std::vector<EmitterRef> &refs, size_t start,
+        size_t end, IndexType nodeIndex, int depth) {
+    if (end - start == 1) {
+        LightNode &node = m_nodes[nodeIndex];
+        node.bounds = refs[start].bounds;
+        node.index = refs[start].index;
+        node.leaf = true;
+        m_leaves[node.index] = nodeIndex;
+        return;
+    }
+
+    EmissionBounds bounds = refs[start].bounds;
+    AABB centroidAABB(refs[start].bounds.aabb.getCenter());
+    for (size_t i=start+1; i<end; ++i) {
+        bounds = merge(bounds, refs[i].bounds);
+        centroidAABB.expandBy(refs[i].bounds.aabb.getCenter());
+    }
+
+    /* Search for the split with the lowest orientation-aware SAH cost */
+    int bestAxis = -1, bestBucket = -1;
+    Float bestCost = std::numeric_limits<Float>::infinity();
+    Vector extents = bounds.aabb.getExtents();
+    Float maxExtent = std::max(extents.x, std::max(extents.y, extents.z));
+
+    for (int axis=0; axis<3 && depth < MTS_LIGHTTREE_MAXDEPTH; ++axis) {
+        Float min = centroidAABB.min[axis], max = centroidAABB.max[axis];
+        if (!(max > min))
+            continue;
+
+        EmissionBounds buckets[MTS_LIGHTTREE_BUCKETS];
+        size_t counts[MTS_LIGHTTREE_BUCKETS];
+        memset(counts, 0, sizeof(counts));
+        Float scale = MTS_LIGHTTREE_BUCKETS / (max - min);
+
+        for (size_t i=start; i<end; ++i) {
+            int bucket = std::min(MTS_LIGHTTREE_BUCKETS - 1,
+                (int) ((refs[i].bounds.aabb.getCenter()[axis] - min) * scale));
+            buckets[bucket] = counts[bucket] == 0 ? refs[i].bounds
+                : merge(buckets[bucket], refs[i].bounds);
+            counts[bucket]++;
+        }
+
+        /* Sweep from the right to accumulate the cost of all suffixes */
+        Float rightCost[MTS_LIGHTTREE_BUCKETS];
+        EmissionBounds right;
+        size_t rightCount = 0;
+        for (int i=MTS_LIGHTTREE_BUCKETS-1; i>0; --i) {
+            if (counts[i] > 0) {
+                right = rightCount == 0 ? buckets[i] : merge(right, buckets[i]);
+                rightCount += counts[i];
+            }
+            rightCost[i] = rightCount > 0 ? cost(right) : 0.0f;
+        }
+
+        /* Regularize splits along the short axes of the node */
+        Float kr = maxExtent / extents[axis];
+        EmissionBounds left;
+        size_t leftCount = 0;
+        for (int i=1; i<MTS_LIGHTTREE_BUCKETS; ++i) {
+            if (counts[i-1] > 0) {
+                left = leftCount == 0 ? buckets[i-1] : merge(left, buckets[i-1]);
+                leftCount += counts[i-1];
+            }
+            if (leftCount == 0 || leftCount == end - start)
+                continue;
+            Float splitCost = kr * (cost(left) + rightCost[i]);
+            if (splitCost < bestCost) {
+                bestCost = splitCost;
+                bestAxis = axis;
+                bestBucket = i;
+            }
+        }
+    }
+
+    size_t mid;
+    if (bestAxis != -1) {
+        Float min = centroidAABB.min[bestAxis],
+              scale = MTS_LIGHTTREE_BUCKETS / (centroidAABB.max[bestAxis] - min);
+        EmitterRef *middle = std::partition(&refs[start], &refs[end-1] + 1,
+            BucketPredicate(bestAxis, bestBucket, min, scale));
+        mid = (size_t) (middle - &refs[0]);
+    } else {
+        /* Coincident centroids or a very deep tree: median split */
+        int axis = centroidAABB.getLargestAxis();
+        mid = (start + end) / 2;
+        std::nth_element(refs.begin() + start, refs.begin() + mid,
+            refs.begin() + end, CentroidOrdering(axis));
+    }
+    Assert(mid > start && mid < end);
+
+    IndexType child = (IndexType) m_nodes.size();
+    m_nodes.resize(m_nodes.size() + 2);
+    LightNode &node = m_nodes[nodeIndex];
+    node.bounds = bounds;
+    node.index = child;
+    node.leaf = false;
+    m_nodes[child].parent = m_nodes[child+1].parent = nodeIndex;
+
+    build(refs, start, mid, child, depth + 1);
+    build(refs, mid, end, child + 1, depth + 1);
+}
+
+EmissionBounds LightTree::merge(const EmissionBounds &a, const EmissionBounds &b) {
+    EmissionBounds result;
+    result.aabb = a.aabb;
+    result.aabb.expandBy(b.aabb);
+    result.power = a.power + b.power;
+    result.cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+
+    /* Compute a cone bounding both normal cones */
+    Float thetaA = math::safe_acos(a.cosThetaO),
+          thetaB = math::safe_acos(b.cosThetaO),
+          thetaD = unitAngle(a.axis, b.axis);
+
+    if (std::min(thetaD + thetaB, (Float) M_PI) <= thetaA) {
+        result.axis = a.axis;
+        result.cosThetaO = a.cosThetaO;
+    } else if (std::min(thetaD + thetaA, (Float) M_PI) <= thetaB) {
+        result.axis = b.axis;
+        result.cosThetaO = b.cosThetaO;
+    } else {
+        Float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+        Vector rotAxis = cross(a.axis, b.axis);
+        if (thetaO >= M_PI || rotAxis.isZero()) {
+            result.axis = a.axis;
+            result.cosThetaO = -1.0f;
+        } else {
+            /* Rotate a.axis towards b.axis (Rodrigues' formula; the
+               rotation axis is perpendicular to a.axis) */
+            Float thetaR = thetaO - thetaA;
+            result.axis = normalize(a.axis * std::cos(thetaR)
+                + cross(normalize(rotAxis), a.axis) * std::sin(thetaR));
+            result.cosThetaO = std::cos(thetaO);
+        }
+    }
+
+    return result;
+}
+
+Float LightTree::cost(const EmissionBounds &bounds) {
+    Float thetaO = math::safe_acos(bounds.cosThetaO),
+          thetaE = math::safe_acos(bounds.cosThetaE),
+          thetaW = std::min(thetaO + thetaE, (Float) M_PI),
+          sinThetaO = math::safe_sqrt(1 - bounds.cosThetaO * bounds.cosThetaO);
+
+    /* Solid angle measure of the emission cone (Conty Estevez and Kulla) */
+    Float mOmega = 2 * M_PI * (1 - bounds.cosThetaO) + 0.5f * M_PI *
+        (2 * thetaW * sinThetaO - std::cos(thetaO - 2 * thetaW)
+         - 2 * thetaO * sinThetaO + bounds.cosThetaO);
+
+    return bounds.power * mOmega * bounds.aabb.getSurfaceArea();
+}
+
+Float LightTree::importance(const EmissionBounds &bounds,
+        const Point &p, const Normal &n) {
+    Point center = bounds.aabb.getCenter();
+    Vector wi = p - center;
+    Float dist2 = wi.lengthSquared(),
+          radius2 = 0.25f * bounds.aabb.getExtents().lengthSquared();
+
+    /* Don't let the estimate diverge for points close to the emitters */
+    Float d2 = std::max(dist2, std::max(radius2, Epsilon * Epsilon));
+
+    if (dist2 <= radius2) {
+        /* The reference point is inside the bounding sphere: any
+           orientation is possible */
+        return bounds.power / d2;
+    }
+    wi /= std::sqrt(dist2);
+
+    /* Angle subtended by the bounding sphere */
+    Float sin2ThetaB = radius2 / dist2,
+          sinThetaB = std::sqrt(sin2ThetaB),
+          cosThetaB = math::safe_sqrt(1 - sin2ThetaB);
+
+    /* Minimal angle between the emission cone and the reference point */
+    Float cosThetaW = dot(bounds.axis, wi),
+          sinThetaW = math::safe_sqrt(1 - cosThetaW * cosThetaW),
+          sinThetaO = math::safe_sqrt(1 - bounds.cosThetaO * bounds.cosThetaO),
+          cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, bounds.cosThetaO),
+          sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, bounds.cosThetaO),
+          cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+
+    if (cosThetaP <= bounds.cosThetaE)
+        return 0.0f;
+
+    Float result = bounds.power * cosThetaP / d2;
+
+    if (!n.isZero()) {
+        /* Minimal angle between the normal and the emitters */
+        Float cosThetaI = -dot(wi, n),
+              sinThetaI = math::safe_sqrt(1 - cosThetaI * cosThetaI),
+              cosThetaIP = cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+        if (cosThetaIP <= 0)
+            return 0.0f;
+        result *= cosThetaIP;
+    }
+
+    return result;
+}
+
+const Emitter *LightTree::sample(const Point &p, const Normal &n,
+        Float &sample, Float &pdf) const {
+    pdf = 1.0f;
+
+    if (m_unboundedProb > 0) {
+        if (sample < m_unboundedProb) {
+            sample /= m_unboundedProb;
+            Float emPdf;
+            size_t index = m_unboundedPDF.sampleReuse(sample, emPdf);
+            pdf = m_unboundedProb * emPdf;
+            return m_unbounded[index];
+        }
+        sample = std::min((sample - m_unboundedProb)
+            / (1 - m_unboundedProb), (Float) ONE_MINUS_EPS);
+        pdf = 1 - m_unboundedProb;
+    }
+
+    failedSelections.incrementBase();
+    if (m_nodes.empty() || importance(m_nodes[0].bounds, p, n) == 0) {
+        ++failedSelections;
+        return NULL;
+    }
+
+    IndexType nodeIndex = 0;
+    while (!m_nodes[nodeIndex].leaf) {
+        IndexType child = m_nodes[nodeIndex].index;
+        Float imp0 = importance(m_nodes[child].bounds, p, n),
+              imp1 = importance(m_nodes[child+1].bounds, p, n);
+
+        if (imp0 == 0 && imp1 == 0) {
+            ++failedSelections;
+            return NULL;
+        }
+
+        Float prob0 = imp0 / (imp0 + imp1);
+        if (sample < prob0) {
+            sample = std::min(sample / prob0, (Float) ONE_MINUS_EPS);
+            pdf *= prob0;
+            nodeIndex = child;
+        } else {
+            sample = std::min((sample - prob0) / (1 - prob0), (Float) ONE_MINUS_EPS);
+            pdf *= 1 - prob0;
+            nodeIndex = child + 1;
+        }
+    }
+
+    return m_emitters[m_nodes[nodeIndex].index];
+}
+
+Float LightTree::pdf(const Point &p, const Normal &n, const Emitter *emitter) const {
+    boost::unordered_map<const Emitter *, IndexType>::const_iterator it
+        = m_emitterIndices.find(emitter);
+    if (it == m_emitterIndices.end())
+        return 0.0f;
+
+    IndexType index = it->second;
+    if (index >= m_emitters.size())
+        return m_unboundedProb * m_unboundedPDF[index - m_emitters.size()];
+
+    if (importance(m_nodes[0].bounds, p, n) == 0)
+        return 0.0f;
+
+    /* Walk from the leaf to the root, while accounting for the
+       decisions that were made at each inner node */
+    Float pdf = 1 - m_unboundedProb;
+    IndexType nodeIndex = m_leaves[index];
+    while (nodeIndex != 0) {
+        const LightNode &node = m_nodes[nodeIndex];
+        const LightNode &parent = m_nodes[node.parent];
+        IndexType sibling = nodeIndex == parent.index ? nodeIndex + 1 : nodeIndex - 1;
+
+        Float imp = importance(node.bounds, p, n);
+        if (imp == 0)
+            return 0.0f;
+        pdf *= imp / (imp + importance(m_nodes[sibling].bounds, p, n));
+        nodeIndex = node.parent;
+    }
+
+    return pdf;
+}
+
+size_t LightTree::getMemoryUsage() const {
+    return m_nodes.capacity() * sizeof(LightNode)
+        + m_leaves.capacity() * sizeof(IndexType)
+        + (m_emitters.capacity() + m_unbounded.capacity()) * sizeof(const Emitter *)
+        + m_emitterIndices.size() * (sizeof(const Emitter *) + sizeof(IndexType) + sizeof(void *));
+}
+
+std::string LightTree::toString() const {
+    std::ostringstream oss;
+    oss << "LightTree[" << endl
+        << "  boundedEmitters = " << m_emitters.size() << "," << endl
+        << "  unboundedEmitters = " << m_unbounded.size() << "," << endl
+        << "  unboundedProb = " << m_unboundedProb << "," << endl
+        << "  nodeCount = " << m_nodes.size() << "," << endl
+        << "  memoryUsage = " << memString(getMemoryUsage()) << "," << endl
+        << "  buildTime = " << m_buildTime << " ms" << endl
+        << "]";
+    return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(LightTree, false, Object)
+MTS_NAMESPACE_END
@@ -141,10 +141,16 @@ ref<WorkProcessor> BlockedRenderProcess::createWorkProcessor() const {
 
 void BlockedRenderProcess::processResult(const WorkResult *result, bool cancelled) {
     const ImageBlock *block = static_cast<const ImageBlock *>(result);
-    UniqueLock lock(m_resultMutex);
-    m_film->put(block);
-    m_progress->update(++m_resultCount);
-    lock.unlock();
+    if (m_film->hasConcurrentPut()) {
+        /* The film synchronizes the merge internally */
+        m_film->put(block);
+        UniqueLock lock(m_resultMutex);
+        m_progress->update(++m_resultCount);
+    } else {
+        UniqueLock lock(m_resultMutex);
+        m_film->put(block);
+        m_progress->update(++m_resultCount);
+    }
     m_queue->signalWorkEnd(m_parent, block, cancelled);
 }
 
@@ -173,7 +179,8 @@ void BlockedRenderProcess::bindResource(const std::string &name, int id) {
         if (m_blockSize < m_borderSize)
             Log(EError, "The block size must be larger than the image reconstruction filter radius!");
 
-        BlockedImageProcess::init(offset, size, m_blockSize);
+        BlockedImageProcess::init(offset, size, m_blockSize,
+            m_film->hasScanlineOrder() ? EScanlineOrder : ESpiralOrder);
         if (m_progress)
             delete m_progress;
         m_progress = new ProgressReporter("Rendering", m_numBlocksTotal, m_parent);
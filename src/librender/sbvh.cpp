@@ -0,0 +1,876 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/sbvh.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/sched.h>
+#include <mitsuba/core/timer.h>
+
+#if defined(MTS_SSE)
+#include <mitsuba/core/sse.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter bvhRaysTraced("BVH", "Normal rays traced");
+static StatsCounter bvhShadowRaysTraced("BVH", "Shadow rays traced");
+static StatsCounter timeRayIntersect("Timing", "Ray intersection (BVH)", ETimeValue);
+static StatsCounter timeShadowRay("Timing", "Shadow ray tests (BVH)", ETimeValue);
+
+/// Compute the SAH bin of a primitive reference along an axis
+static inline int computeBin(const AABB &aabb, int axis, Float min,
+        Float scale, int binCount) {
+    Float center = (aabb.min[axis] + aabb.max[axis]) * (Float) 0.5f;
+    int bin = (int) ((center - min) * scale);
+    return std::max(0, std::min(bin, binCount - 1));
+}
+
+/// Is a primitive reference located left of a SAH bin boundary?
+struct ShapeBVH::BinPredicate {
+    int axis, binCount, splitBin;
+    Float min, scale;
+
+    inline bool operator()(const PrimRef &ref) const {
+        return computeBin(ref.aabb, axis, min, scale, binCount) < splitBin;
+    }
+};
+
+/// Orders primitive references by their centroid along an axis
+struct ShapeBVH::CentroidOrdering {
+    int axis;
+
+    inline bool operator()(const PrimRef &a, const PrimRef &b) const {
+        return a.aabb.min[axis] + a.aabb.max[axis]
+             < b.aabb.min[axis] + b.aabb.max[axis];
+    }
+};
+
+ShapeBVH::ShapeBVH() {
+    m_nodes = NULL;
+    m_nodeCount = 0;
+#if defined(MTS_KD_CONSERVE_MEMORY)
+    m_primIndices = NULL;
+#else
+    m_triAccel = NULL;
+#endif
+    m_binCount = 16;
+    m_maxLeafSize = 4;
+    m_traversalCost = 1;
+    m_queryCost = 1;
+    m_sahCost = 0;
+    m_buildTime = 0;
+    m_refitTime = 0;
+    m_shapeMap.push_back(0);
+}
+
+ShapeBVH::~ShapeBVH() {
+    if (m_nodes)
+        freeAligned(m_nodes);
+#if defined(MTS_KD_CONSERVE_MEMORY)
+    if (m_primIndices)
+        delete[] m_primIndices;
+#else
+    if (m_triAccel)
+        freeAligned(m_triAccel);
+#endif
+    for (size_t i=0; i<m_shapes.size(); ++i)
+        m_shapes[i]->decRef();
+}
+
+void ShapeBVH::addShape(const Shape *shape) {
+    Assert(!isBuilt());
+    if (shape->isCompound())
+        Log(EError, "Cannot add compound shapes to a BVH - expand them first!");
+    if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+        m_shapeMap.push_back((SizeType)
+            static_cast<const TriMesh *>(shape)->getTriangleCount());
+        m_triangleFlag.push_back(true);
+    } else {
+        m_shapeMap.push_back(1);
+        m_triangleFlag.push_back(false);
+    }
+    shape->incRef();
+    m_shapes.push_back(shape);
+}
+
+void ShapeBVH::build() {
+    for (size_t i=1; i<m_shapeMap.size(); ++i)
+        m_shapeMap[i] += m_shapeMap[i-1];
+
+    ref<Timer> timer = new Timer();
+    SizeType primCount = getPrimitiveCount();
+    if (primCount >= (1u << 27))
+        Log(EError, "The BVH supports at most 2^27 primitives!");
+    m_binCount = std::max((SizeType) 2, std::min(m_binCount, (SizeType) MTS_BVH_MAX_BINS));
+    m_maxLeafSize = std::max((SizeType) 1, std::min(m_maxLeafSize, (SizeType) MTS_BVH_MAX_LEAF_SIZE));
+
+    Log(EInfo, "Constructing a 4-wide SAH BVH (%i primitives) ..", primCount);
+
+    /* Collect the bounds of all primitives */
+    std::vector<PrimRef> refs(primCount);
+    IndexType idx = 0;
+    for (IndexType i=0; i<m_shapes.size(); ++i) {
+        const Shape *shape = m_shapes[i];
+        if (m_triangleFlag[i]) {
+            const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+            const Triangle *triangles = mesh->getTriangles();
+            const Point *positions = mesh->getVertexPositions();
+            for (IndexType j=0; j<mesh->getTriangleCount(); ++j) {
+                refs[idx].aabb = triangles[j].getAABB(positions);
+                refs[idx].index = idx;
+                ++idx;
+            }
+        } else {
+            refs[idx].aabb = shape->getAABB();
+            refs[idx].index = idx;
+            ++idx;
+        }
+    }
+    Assert(idx == primCount);
+
+    BuildRange root;
+    root.start = 0;
+    root.end = primCount;
+    computeBounds(refs, root);
+    setAABB(root.aabb);
+
+    std::vector<BVHNode> nodes;
+    m_primOrder.reserve(primCount);
+    m_sahCost = 0;
+    buildNode(refs, nodes, &root, primCount > 0 ? 1 : 0, 1);
+
+    if (m_tightAABB.isValid() && m_tightAABB.getSurfaceArea() > 0)
+        m_sahCost /= m_tightAABB.getSurfaceArea();
+
+    m_nodeCount = (SizeType) nodes.size();
+    m_nodes = static_cast<BVHNode *>(allocAligned(sizeof(BVHNode) * m_nodeCount));
+    memcpy(m_nodes, &nodes[0], sizeof(BVHNode) * m_nodeCount);
+
+    /* Store the primitive data in leaf order */
+#if defined(MTS_KD_CONSERVE_MEMORY)
+    m_primIndices = new IndexType[primCount];
+    if (primCount > 0)
+        memcpy(m_primIndices, &m_primOrder[0], sizeof(IndexType) * primCount);
+#else
+    m_triAccel = static_cast<TriAccel *>(allocAligned(primCount * sizeof(TriAccel)));
+    for (SizeType i=0; i<primCount; ++i) {
+        IndexType primIdx = m_primOrder[i];
+        IndexType shapeIdx = findShape(primIdx);
+        if (m_triangleFlag[shapeIdx]) {
+            const TriMesh *mesh = static_cast<const TriMesh *>(m_shapes[shapeIdx]);
+            const Triangle &tri = mesh->getTriangles()[primIdx];
+            const Point *positions = mesh->getVertexPositions();
+            m_triAccel[i].load(positions[tri.idx[0]],
+                positions[tri.idx[1]], positions[tri.idx[2]]);
+            m_triAccel[i].shapeIndex = shapeIdx;
+            m_triAccel[i].primIndex = primIdx;
+        } else {
+            /* Create a 'fake' triangle, which redirects to a Shape */
+            memset(&m_triAccel[i], 0, sizeof(TriAccel));
+            m_triAccel[i].shapeIndex = shapeIdx;
+            m_triAccel[i].k = KNoTriangleFlag;
+        }
+    }
+#endif
+    std::vector<IndexType>().swap(m_primOrder);
+    computeRefitLevels();
+
+    m_buildTime = timer->getMilliseconds();
+    Log(EDebug, "Finished -- took %i ms.", m_buildTime);
+    Log(EDebug, "BVH statistics:");
+    Log(EDebug, "   Nodes                    : %i", m_nodeCount);
+    Log(EDebug, "   Memory usage             : %s", memString(getMemoryUsage()).c_str());
+    Log(EDebug, "   SAH cost                 : %.2f", m_sahCost);
+    Log(EDebug, "");
+
+    /* Spread the read-only traversal data over all NUMA nodes */
+    if (Scheduler::getInstance()->getNUMAMode() && getNUMANodeCount() > 1) {
+        bool success = interleaveMemory(m_nodes, sizeof(BVHNode) * m_nodeCount);
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+        success &= interleaveMemory(m_triAccel, sizeof(TriAccel) * primCount);
+#endif
+        if (!success)
+            Log(EWarn, "Could not interleave the BVH across NUMA nodes!");
+    }
+}
+
+void ShapeBVH::computeBounds(const std::vector<PrimRef> &refs, BuildRange &range) {
+    range.aabb.reset();
+    range.centroidAABB.reset();
+    for (size_t i=range.start; i<range.end; ++i) {
+        range.aabb.expandBy(refs[i].aabb);
+        range.centroidAABB.expandBy(refs[i].aabb.getCenter());
+    }
+}
+
+bool ShapeBVH::split(std::vector<PrimRef> &refs, const BuildRange &range,
+        int depth, BuildRange &left, BuildRange &right) const {
+    const size_t count = range.size();
+    if (count <= 1)
+        return false;
+
+    const int binCount = (int) m_binCount;
+    const Vector extents = range.centroidAABB.getExtents();
+    int bestAxis = -1, bestBin = 0;
+    Float bestCost = std::numeric_limits<Float>::infinity(), scale[3];
+
+    if (depth < MTS_BVH_MAXDEPTH) {
+        /* Bin the primitive centroids along all axes */
+        SizeType binCounts[3][MTS_BVH_MAX_BINS];
+        AABB binAABBs[3][MTS_BVH_MAX_BINS];
+
+        for (int axis=0; axis<3; ++axis) {
+            scale[axis] = extents[axis] > 0 ? binCount / extents[axis] : 0;
+            for (int bin=0; bin<binCount; ++bin) {
+                binCounts[axis][bin] = 0;
+                binAABBs[axis][bin].reset();
+            }
+        }
+
+        for (size_t i=range.start; i<range.end; ++i) {
+            const AABB &aabb = refs[i].aabb;
+            for (int axis=0; axis<3; ++axis) {
+                int bin = computeBin(aabb, axis, range.centroidAABB.min[axis],
+                    scale[axis], binCount);
+                binCounts[axis][bin]++;
+                binAABBs[axis][bin].expandBy(aabb);
+            }
+        }
+
+        /* Sweep over the bin boundaries and evaluate the SAH */
+        for (int axis=0; axis<3; ++axis) {
+            if (extents[axis] <= 0)
+                continue;
+
+            Float rightArea[MTS_BVH_MAX_BINS];
+            SizeType rightCount[MTS_BVH_MAX_BINS];
+            AABB aabb;
+            SizeType primsRight = 0;
+            for (int bin=binCount-1; bin>0; --bin) {
+                aabb.expandBy(binAABBs[axis][bin]);
+                primsRight += binCounts[axis][bin];
+                rightArea[bin] = primsRight > 0 ? aabb.getSurfaceArea() : 0;
+                rightCount[bin] = primsRight;
+            }
+
+            aabb.reset();
+            SizeType primsLeft = 0;
+            for (int bin=1; bin<binCount; ++bin) {
+                aabb.expandBy(binAABBs[axis][bin-1]);
+                primsLeft += binCounts[axis][bin-1];
+                if (primsLeft == 0 || rightCount[bin] == 0)
+                    continue;
+                Float cost = primsLeft * aabb.getSurfaceArea()
+                    + rightCount[bin] * rightArea[bin];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = bin;
+                }
+            }
+        }
+    }
+
+    if (bestAxis >= 0) {
+        Float area = range.aabb.getSurfaceArea();
+        Float splitCost = m_traversalCost + m_queryCost * bestCost
+            * (area > 0 ? 1 / area : 0);
+        if (count <= m_maxLeafSize && m_queryCost * count <= splitCost)
+            return false;
+    } else if (count <= m_maxLeafSize) {
+        return false;
+    }
+
+    std::vector<PrimRef>::iterator
+        start = refs.begin() + range.start,
+        end = refs.begin() + range.end,
+        middle;
+
+    if (bestAxis >= 0) {
+        BinPredicate pred;
+        pred.axis = bestAxis;
+        pred.binCount = binCount;
+        pred.splitBin = bestBin;
+        pred.min = range.centroidAABB.min[bestAxis];
+        pred.scale = scale[bestAxis];
+        middle = std::partition(start, end, pred);
+    } else {
+        /* No usable SAH split (coincident centroids or too deep):
+           fall back to a median split along the largest axis */
+        CentroidOrdering ordering;
+        ordering.axis = extents[range.centroidAABB.getLargestAxis()] > 0
+            ? range.centroidAABB.getLargestAxis() : range.aabb.getLargestAxis();
+        middle = start + count / 2;
+        std::nth_element(start, middle, end, ordering);
+    }
+
+    size_t split = range.start + (middle - start);
+    Assert(split > range.start && split < range.end);
+    left.start = range.start;
+    left.end = split;
+    right.start = split;
+    right.end = range.end;
+    computeBounds(refs, left);
+    computeBounds(refs, right);
+    return true;
+}
+
+int32_t ShapeBVH::buildNode(std::vector<PrimRef> &refs,
+        std::vector<BVHNode> &nodes, BuildRange *initialChildren,
+        int childCount, int depth) {
+    BuildRange children[4];
+    bool isLeaf[4] = { false, false, false, false };
+    for (int i=0; i<childCount; ++i)
+        children[i] = initialChildren[i];
+
+    /* Repeatedly split the child with the largest surface area
+       until the node has four children */
+    while (childCount < 4) {
+        int best = -1;
+        Float bestArea = -1;
+        for (int i=0; i<childCount; ++i) {
+            Float area = children[i].aabb.getSurfaceArea();
+            if (!isLeaf[i] && area > bestArea) {
+                best = i;
+                bestArea = area;
+            }
+        }
+        if (best < 0)
+            break;
+
+        BuildRange range = children[best];
+        if (split(refs, range, depth, children[best], children[childCount]))
+            ++childCount;
+        else
+            isLeaf[best] = true;
+    }
+
+    int32_t nodeIndex = (int32_t) nodes.size();
+    nodes.push_back(BVHNode());
+
+    int32_t childRefs[4] = { ~0, ~0, ~0, ~0 };
+    AABB nodeAABB;
+    for (int i=0; i<childCount; ++i) {
+        nodeAABB.expandBy(children[i].aabb);
+        if (isLeaf[i]) {
+            childRefs[i] = createLeaf(refs, children[i]);
+            continue;
+        }
+
+        /* Split right away, so that no node ends up with a single child */
+        BuildRange grandChildren[4];
+        if (split(refs, children[i], depth + 1, grandChildren[0], grandChildren[1]))
+            childRefs[i] = buildNode(refs, nodes, grandChildren, 2, depth + 1);
+        else
+            childRefs[i] = createLeaf(refs, children[i]);
+    }
+
+    BVHNode &node = nodes[nodeIndex];
+    for (int i=0; i<4; ++i) {
+        for (int axis=0; axis<3; ++axis) {
+            if (i < childCount) {
+                node.bounds[0][axis][i] = math::castflt_down(children[i].aabb.min[axis]);
+                node.bounds[1][axis][i] = math::castflt_up(children[i].aabb.max[axis]);
+            } else {
+                node.bounds[0][axis][i] =  std::numeric_limits<float>::infinity();
+                node.bounds[1][axis][i] = -std::numeric_limits<float>::infinity();
+            }
+        }
+        node.child[i] = childRefs[i];
+    }
+
+    if (childCount > 0)
+        m_sahCost += m_traversalCost * nodeAABB.getSurfaceArea();
+
+    return nodeIndex;
+}
+
+int32_t ShapeBVH::createLeaf(std::vector<PrimRef> &refs, const BuildRange &range) {
+    size_t offset = m_primOrder.size(), count = range.size();
+    Assert(count <= MTS_BVH_MAX_LEAF_SIZE);
+
+    for (size_t i=range.start; i<range.end; ++i)
+        m_primOrder.push_back(refs[i].index);
+    m_sahCost += m_queryCost * count * range.aabb.getSurfaceArea();
+
+    return ~(int32_t) ((offset << 4) | count);
+}
+
+void ShapeBVH::computeRefitLevels() {
+    /* Breadth-first traversal: every level only
+       references nodes of the following ones */
+    m_refitOrder.clear();
+    m_refitLevels.clear();
+    if (m_nodeCount == 0)
+        return;
+
+    m_refitOrder.reserve(m_nodeCount);
+    m_refitOrder.push_back(0);
+    m_refitLevels.push_back(0);
+    size_t levelStart = 0;
+    while (levelStart < m_refitOrder.size()) {
+        size_t levelEnd = m_refitOrder.size();
+        for (size_t i=levelStart; i<levelEnd; ++i) {
+            const BVHNode &node = m_nodes[m_refitOrder[i]];
+            for (int j=0; j<4; ++j) {
+                if (node.child[j] >= 0)
+                    m_refitOrder.push_back(node.child[j]);
+            }
+        }
+        m_refitLevels.push_back((SizeType) levelEnd);
+        levelStart = levelEnd;
+    }
+    Assert(m_refitOrder.size() == m_nodeCount);
+}
+
+void ShapeBVH::refitNode(int32_t nodeIndex) {
+    BVHNode &node = m_nodes[nodeIndex];
+
+    for (int i=0; i<4; ++i) {
+        int32_t child = node.child[i];
+        AABB aabb;
+
+        if (child >= 0) {
+            /* Inner node: merge the (already refit) bounds of its children */
+            const BVHNode &childNode = m_nodes[child];
+            for (int j=0; j<4; ++j) {
+                for (int axis=0; axis<3; ++axis) {
+                    aabb.min[axis] = std::min(aabb.min[axis], (Float) childNode.bounds[0][axis][j]);
+                    aabb.max[axis] = std::max(aabb.max[axis], (Float) childNode.bounds[1][axis][j]);
+                }
+            }
+        } else {
+            /* Leaf: recompute the bounds (and TriAccel records) of its primitives */
+            const uint32_t leaf = (uint32_t) ~child;
+            const IndexType primStart = leaf >> 4,
+                            primEnd = primStart + (leaf & 0xF);
+            if (primStart == primEnd)
+                continue; /* Unused slot */
+
+            for (IndexType j=primStart; j<primEnd; ++j) {
+#if defined(MTS_KD_CONSERVE_MEMORY)
+                IndexType primIdx = m_primIndices[j];
+                IndexType shapeIdx = findShape(primIdx);
+                if (m_triangleFlag[shapeIdx]) {
+                    const TriMesh *mesh = static_cast<const TriMesh *>(m_shapes[shapeIdx]);
+                    aabb.expandBy(mesh->getTriangles()[primIdx].getAABB(
+                        mesh->getVertexPositions()));
+                } else {
+                    aabb.expandBy(m_shapes[shapeIdx]->getAABB());
+                }
+#else
+                TriAccel &ta = m_triAccel[j];
+                if (ta.k != KNoTriangleFlag) {
+                    const TriMesh *mesh = static_cast<const TriMesh *>(m_shapes[ta.shapeIndex]);
+                    const Triangle &tri = mesh->getTriangles()[ta.primIndex];
+                    const Point *positions = mesh->getVertexPositions();
+                    uint32_t shapeIndex = ta.shapeIndex, primIndex = ta.primIndex;
+                    ta.load(positions[tri.idx[0]], positions[tri.idx[1]], positions[tri.idx[2]]);
+                    ta.shapeIndex = shapeIndex;
+                    ta.primIndex = primIndex;
+                    aabb.expandBy(tri.getAABB(positions));
+                } else {
+                    aabb.expandBy(m_shapes[ta.shapeIndex]->getAABB());
+                }
+#endif
+            }
+        }
+
+        for (int axis=0; axis<3; ++axis) {
+            node.bounds[0][axis][i] = math::castflt_down(aabb.min[axis]);
+            node.bounds[1][axis][i] = math::castflt_up(aabb.max[axis]);
+        }
+    }
+}
+
+void ShapeBVH::setAABB(const AABB &aabb) {
+    /* Slightly enlarge the bounding box, as done by the kd-tree
+       (necessary e.g. when the scene is planar) */
+    m_tightAABB = m_aabb = aabb;
+    if (aabb.isValid()) {
+        const Float eps = MTS_KD_AABB_EPSILON;
+        m_aabb.min -= (aabb.max-aabb.min) * eps + Vector(eps);
+        m_aabb.max += (aabb.max-aabb.min) * eps + Vector(eps);
+    }
+}
+
+void ShapeBVH::refit() {
+    Assert(isBuilt());
+    ref<Timer> timer = new Timer();
+
+    /* Process one level at a time, starting with the deepest one */
+    for (int level=(int) m_refitLevels.size()-2; level >= 0; --level) {
+        int start = (int) m_refitLevels[level], end = (int) m_refitLevels[level+1];
+
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (int i=start; i<end; ++i)
+            refitNode(m_refitOrder[i]);
+    }
+
+    AABB aabb;
+    if (m_nodeCount > 0) {
+        const BVHNode &root = m_nodes[0];
+        for (int i=0; i<4; ++i) {
+            if (root.bounds[0][0][i] > root.bounds[1][0][i])
+                continue;
+            for (int axis=0; axis<3; ++axis) {
+                aabb.min[axis] = std::min(aabb.min[axis], (Float) root.bounds[0][axis][i]);
+                aabb.max[axis] = std::max(aabb.max[axis], (Float) root.bounds[1][axis][i]);
+            }
+        }
+    }
+    setAABB(aabb);
+
+    m_refitTime = timer->getMilliseconds();
+    Log(EDebug, "Refit the BVH (%i nodes) in %i ms", m_nodeCount, m_refitTime);
+}
+
+size_t ShapeBVH::getMemoryUsage() const {
+    size_t size = sizeof(BVHNode) * m_nodeCount
+        + sizeof(int32_t) * m_refitOrder.size();
+#if defined(MTS_KD_CONSERVE_MEMORY)
+    size += sizeof(IndexType) * getPrimitiveCount();
+#else
+    size += sizeof(TriAccel) * getPrimitiveCount();
+#endif
+    return size;
+}
+
+bool ShapeBVH::intersect(const Ray &ray, IndexType idx, Float mint,
+        Float maxt, Float &t, void *temp) const {
+    ShapeKDTree::IntersectionCache *cache =
+        static_cast<ShapeKDTree::IntersectionCache *>(temp);
+
+#if defined(MTS_KD_CONSERVE_MEMORY)
+    IndexType primIdx = m_primIndices[idx];
+    IndexType shapeIdx = findShape(primIdx);
+    if (EXPECT_TAKEN(m_triangleFlag[shapeIdx])) {
+        const TriMesh *mesh =
+            static_cast<const TriMesh *>(m_shapes[shapeIdx]);
+        const Triangle &tri = mesh->getTriangles()[primIdx];
+        Float tempU, tempV, tempT;
+        if (tri.rayIntersect(mesh->getVertexPositions(), ray,
+                    tempU, tempV, tempT)) {
+            if (tempT < mint || tempT > maxt)
+                return false;
+            t = tempT;
+            cache->shapeIndex = shapeIdx;
+            cache->primIndex = primIdx;
+            cache->u = tempU;
+            cache->v = tempV;
+            return true;
+        }
+    } else {
+        const Shape *shape = m_shapes[shapeIdx];
+        if (shape->rayIntersect(ray, mint, maxt, t,
+                reinterpret_cast<uint8_t*>(temp) + 2*sizeof(IndexType))) {
+            cache->shapeIndex = shapeIdx;
+            cache->primIndex = KNoTriangleFlag;
+            return true;
+        }
+    }
+#else
+    const TriAccel &ta = m_triAccel[idx];
+    if (EXPECT_TAKEN(ta.k != KNoTriangleFlag)) {
+        Float tempU, tempV, tempT;
+        if (ta.rayIntersect(ray, mint, maxt, tempU, tempV, tempT)) {
+            t = tempT;
+            cache->shapeIndex = ta.shapeIndex;
+            cache->primIndex = ta.primIndex;
+            cache->u = tempU;
+            cache->v = tempV;
+            return true;
+        }
+    } else {
+        uint32_t shapeIndex = ta.shapeIndex;
+        const Shape *shape = m_shapes[shapeIndex];
+        if (shape->rayIntersect(ray, mint, maxt, t,
+                reinterpret_cast<uint8_t*>(temp) + 2*sizeof(IndexType))) {
+            cache->shapeIndex = shapeIndex;
+            cache->primIndex = KNoTriangleFlag;
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+bool ShapeBVH::intersect(const Ray &ray, IndexType idx,
+        Float mint, Float maxt) const {
+#if defined(MTS_KD_CONSERVE_MEMORY)
+    IndexType primIdx = m_primIndices[idx];
+    IndexType shapeIdx = findShape(primIdx);
+    if (EXPECT_TAKEN(m_triangleFlag[shapeIdx])) {
+        const TriMesh *mesh =
+            static_cast<const TriMesh *>(m_shapes[shapeIdx]);
+        const Triangle &tri = mesh->getTriangles()[primIdx];
+        Float tempU, tempV, tempT;
+        if (tri.rayIntersect(mesh->getVertexPositions(), ray, tempU, tempV, tempT))
+            return tempT >= mint && tempT <= maxt;
+        return false;
+    } else {
+        return m_shapes[shapeIdx]->rayIntersect(ray, mint, maxt);
+    }
+#else
+    const TriAccel &ta = m_triAccel[idx];
+    if (EXPECT_TAKEN(ta.k != KNoTriangleFlag)) {
+        Float tempU, tempV, tempT;
+        return ta.rayIntersect(ray, mint, maxt, tempU, tempV, tempT);
+    } else {
+        return m_shapes[ta.shapeIndex]->rayIntersect(ray, mint, maxt);
+    }
+#endif
+}
+
+template <bool shadowRay> bool ShapeBVH::traverse(const Ray &ray,
+        Float mint, Float maxt, Float &t, void *temp) const {
+    /// Traversal stack entry: node reference and entry distance
+    struct StackEntry {
+        int32_t node;
+        float mint;
+    };
+
+    StackEntry stack[MTS_BVH_STACKSIZE];
+    int stackIndex = 0;
+    bool foundIntersection = false;
+
+    /* Select the near and far bounds of each axis */
+    const int nearX = ray.d.x >= 0 ? 0 : 1,
+              nearY = ray.d.y >= 0 ? 0 : 1,
+              nearZ = ray.d.z >= 0 ? 0 : 1;
+
+#if defined(MTS_SSE)
+    const __m128
+        ox = _mm_set1_ps((float) ray.o.x),
+        oy = _mm_set1_ps((float) ray.o.y),
+        oz = _mm_set1_ps((float) ray.o.z),
+        rx = _mm_set1_ps((float) ray.dRcp.x),
+        ry = _mm_set1_ps((float) ray.dRcp.y),
+        rz = _mm_set1_ps((float) ray.dRcp.z),
+        rayMinT = _mm_set1_ps((float) mint);
+#endif
+
+    stack[stackIndex].node = 0;
+    stack[stackIndex].mint = (float) mint;
+    stackIndex++;
+
+    while (stackIndex > 0) {
+        const StackEntry entry = stack[--stackIndex];
+        if (entry.mint > maxt)
+            continue;
+
+        if (entry.node < 0) {
+            /* Leaf reference - intersect against the primitives */
+            const uint32_t leaf = (uint32_t) ~entry.node;
+            const IndexType primStart = leaf >> 4,
+                            primEnd = primStart + (leaf & 0xF);
+            for (IndexType i=primStart; i<primEnd; ++i) {
+                if (shadowRay) {
+                    if (intersect(ray, i, mint, maxt))
+                        return true;
+                } else if (intersect(ray, i, mint, maxt, t, temp)) {
+                    maxt = t;
+                    foundIntersection = true;
+                }
+            }
+            continue;
+        }
+
+        /* Intersect the ray with the bounds of all four children */
+        const BVHNode &node = m_nodes[entry.node];
+        int mask = 0;
+#if defined(MTS_SSE)
+        float MM_ALIGN16 tNear[4];
+        const __m128
+            tx0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[nearX][0]), ox), rx),
+            ty0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[nearY][1]), oy), ry),
+            tz0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[nearZ][2]), oz), rz),
+            tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[1-nearX][0]), ox), rx),
+            ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[1-nearY][1]), oy), ry),
+            tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[1-nearZ][2]), oz), rz),
+            /* The operand order makes sure that NaNs are discarded */
+            tmin = _mm_max_ps(_mm_max_ps(tx0, ty0), _mm_max_ps(tz0, rayMinT)),
+            tmax = _mm_min_ps(_mm_min_ps(tx1, ty1), _mm_min_ps(tz1, _mm_set1_ps((float) maxt)));
+        _mm_store_ps(tNear, tmin);
+        mask = _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+#else
+        float tNear[4];
+        const int near[3] = { nearX, nearY, nearZ };
+        for (int i=0; i<4; ++i) {
+            float tmin = (float) mint, tmax = (float) maxt;
+            for (int axis=0; axis<3; ++axis) {
+                float o = (float) ray.o[axis], r = (float) ray.dRcp[axis],
+                      t0 = (node.bounds[near[axis]][axis][i] - o) * r,
+                      t1 = (node.bounds[1-near[axis]][axis][i] - o) * r;
+                if (t0 > tmin) tmin = t0;
+                if (t1 < tmax) tmax = t1;
+            }
+            tNear[i] = tmin;
+            if (tmin <= tmax)
+                mask |= 1 << i;
+        }
+#endif
+
+        /* Push the intersected children so that the closest one is visited first */
+        const int base = stackIndex;
+        for (int i=0; i<4; ++i) {
+            if (!(mask & (1 << i)))
+                continue;
+            StackEntry child;
+            child.node = node.child[i];
+            child.mint = tNear[i];
+            int j = stackIndex++;
+            if (!shadowRay) {
+                while (j > base && stack[j-1].mint < child.mint) {
+                    stack[j] = stack[j-1];
+                    --j;
+                }
+            }
+            stack[j] = child;
+        }
+    }
+
+    return foundIntersection;
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray, Intersection &its) const {
+    ScopedStatsTimer timer(timeRayIntersect);
+    uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+    its.t = std::numeric_limits<Float>::infinity();
+    Float mint, maxt;
+
+    ++bvhRaysTraced;
+    if (m_aabb.rayIntersect(ray, mint, maxt)) {
+        /* Use an adaptive ray epsilon */
+        Float rayMinT = ray.mint;
+        if (rayMinT == Epsilon)
+            rayMinT *= std::max(std::max(std::max(std::abs(ray.o.x),
+                std::abs(ray.o.y)), std::abs(ray.o.z)), Epsilon);
+
+        if (rayMinT > mint) mint = rayMinT;
+        if (ray.maxt < maxt) maxt = ray.maxt;
+
+        if (EXPECT_TAKEN(maxt > mint)) {
+            if (traverse<false>(ray, mint, maxt, its.t, temp)) {
+                const ShapeKDTree::IntersectionCache *cache =
+                    reinterpret_cast<const ShapeKDTree::IntersectionCache *>(temp);
+                ShapeKDTree::fillIntersectionRecord<true>(m_shapes[cache->shapeIndex],
+                    m_triangleFlag[cache->shapeIndex], ray, temp, its);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
+        Normal &n, Point2 &uv) const {
+    uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+    Float mint, maxt;
+
+    t = std::numeric_limits<Float>::infinity();
+
+    ++bvhShadowRaysTraced;
+    if (m_aabb.rayIntersect(ray, mint, maxt)) {
+        /* Use an adaptive ray epsilon */
+        Float rayMinT = ray.mint;
+        if (rayMinT == Epsilon)
+            rayMinT *= std::max(std::max(std::abs(ray.o.x),
+                std::abs(ray.o.y)), std::abs(ray.o.z));
+
+        if (rayMinT > mint) mint = rayMinT;
+        if (ray.maxt < maxt) maxt = ray.maxt;
+
+        if (EXPECT_TAKEN(maxt > mint)) {
+            if (traverse<false>(ray, mint, maxt, t, temp)) {
+                const ShapeKDTree::IntersectionCache *cache =
+                    reinterpret_cast<const ShapeKDTree::IntersectionCache *>(temp);
+                ShapeKDTree::fillCompactIntersectionRecord(m_shapes[cache->shapeIndex],
+                    m_triangleFlag[cache->shapeIndex], ray, t, temp, shape, n, uv);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray) const {
+    ScopedStatsTimer timer(timeShadowRay);
+    Float mint, maxt, t = std::numeric_limits<Float>::infinity();
+
+    ++bvhShadowRaysTraced;
+    if (m_aabb.rayIntersect(ray, mint, maxt)) {
+        /* Use an adaptive ray epsilon */
+        Float rayMinT = ray.mint;
+        if (rayMinT == Epsilon)
+            rayMinT *= std::max(std::max(std::abs(ray.o.x),
+                std::abs(ray.o.y)), std::abs(ray.o.z));
+
+        if (rayMinT > mint) mint = rayMinT;
+        if (ray.maxt < maxt) maxt = ray.maxt;
+
+        if (EXPECT_TAKEN(maxt > mint))
+            return traverse<true>(ray, mint, maxt, t, NULL);
+    }
+    return false;
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray, Float _mint, Float _maxt) const {
+    Float mint, maxt, tempT = std::numeric_limits<Float>::infinity();
+    if (m_aabb.rayIntersect(ray, mint, maxt)) {
+        if (_mint > mint) mint = _mint;
+        if (_maxt < maxt) maxt = _maxt;
+
+        if (EXPECT_TAKEN(maxt > mint))
+            return traverse<true>(ray, mint, maxt, tempT, NULL);
+    }
+    return false;
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray, Float _mint, Float _maxt,
+        Float &t, void *temp) const {
+    Float mint, maxt, tempT = std::numeric_limits<Float>::infinity();
+    if (m_aabb.rayIntersect(ray, mint, maxt)) {
+        if (_mint > mint) mint = _mint;
+        if (_maxt < maxt) maxt = _maxt;
+
+        if (EXPECT_TAKEN(maxt > mint)) {
+            if (traverse<false>(ray, mint, maxt, tempT, temp)) {
+                t = tempT;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+std::string ShapeBVH::toString() const {
+    std::ostringstream oss;
+    oss << "ShapeBVH[" << endl
+        << "  shapes = " << m_shapes.size() << "," << endl
+        << "  primitiveCount = " << getPrimitiveCount() << "," << endl
+        << "  nodeCount = " << m_nodeCount << "," << endl
+        << "  binCount = " << m_binCount << "," << endl
+        << "  maxLeafSize = " << m_maxLeafSize << "," << endl
+        << "  aabb = " << m_aabb.toString() << endl
+        << "]";
+    return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(ShapeBVH, false, Object)
+MTS_NAMESPACE_END
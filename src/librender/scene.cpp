@@ -20,6 +20,7 @@
 #include <mitsuba/render/renderjob.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/statistics.h>
+#include <boost/algorithm/string.hpp>
 
 #define DEFAULT_BLOCKSIZE 32
 
@@ -30,7 +31,8 @@ MTS_NAMESPACE_BEGIN
 // ===========================================================================
 
 Scene::Scene()
- : NetworkedObject(Properties()), m_blockSize(DEFAULT_BLOCKSIZE) {
+ : NetworkedObject(Properties()), m_blockSize(DEFAULT_BLOCKSIZE),
+   m_useLightTree(false), m_twoLevelInstancing(true) {
     m_kdtree = new ShapeKDTree();
     m_sourceFile = new fs::path();
     m_destinationFile = new fs::path();
@@ -76,12 +78,65 @@ Scene::Scene(const Properties &props)
        in succession before a leaf node will be created.*/
     if (props.hasProperty("kdMaxBadRefines"))
         m_kdtree->setMaxBadRefines(props.getInteger("kdMaxBadRefines"));
+    /* kd-tree construction: drop the precomputed triangle data and pack the
+       leaf index lists to roughly halve the memory usage of the tree, at the
+       cost of slower intersection queries. Useful for very large scenes. */
+    if (props.hasProperty("kdCompact"))
+        m_kdtree->setCompact(props.getBoolean("kdCompact"));
+    /* kd-tree construction: move the precomputed triangle data into a page
+       file on disk and read it back through a bounded cache. For scenes
+       whose geometry doesn't fit into memory. */
+    if (props.hasProperty("kdOutOfCore"))
+        m_kdtree->setOutOfCore(props.getBoolean("kdOutOfCore"));
+    /* Out-of-core kd-tree: memory limit of the page caches in MiB */
+    if (props.hasProperty("kdPageCacheSize"))
+        m_kdtree->setPageCacheSize((size_t) props.getLong("kdPageCacheSize") * 1024 * 1024);
+    /* Acceleration data structure: either a SAH kd-tree ("kdtree", the
+       default) or a four-wide SAH BVH ("bvh"), which builds much faster */
+    std::string accel = boost::to_lower_copy(props.getString("accel", "kdtree"));
+    if (accel == "bvh") {
+        m_bvh = new ShapeBVH();
+        /* BVH construction: Number of bins used by the SAH split search */
+        if (props.hasProperty("bvhBinCount"))
+            m_bvh->setBinCount(props.getInteger("bvhBinCount"));
+        /* BVH construction: Maximum number of primitives per leaf */
+        if (props.hasProperty("bvhMaxLeafSize"))
+            m_bvh->setMaxLeafSize(props.getInteger("bvhMaxLeafSize"));
+        if (props.hasProperty("kdIntersectionCost"))
+            m_bvh->setQueryCost(props.getFloat("kdIntersectionCost"));
+        if (props.hasProperty("kdTraversalCost"))
+            m_bvh->setTraversalCost(props.getFloat("kdTraversalCost"));
+    } else if (accel != "kdtree") {
+        Log(EError, "Unknown acceleration data structure \"%s\" (must be "
+            "either \"kdtree\" or \"bvh\")", accel.c_str());
+    }
+    /* Emitter selection for direct illumination: proportional to the
+       sampling weights ("weight", the default), or using a light tree that
+       accounts for the position of the reference point ("tree") */
+    std::string emitterSampling = boost::to_lower_copy(
+        props.getString("emitterSampling", "weight"));
+    if (emitterSampling == "tree") {
+        m_useLightTree = true;
+    } else if (emitterSampling == "weight") {
+        m_useLightTree = false;
+    } else {
+        Log(EError, "Unknown emitter sampling strategy \"%s\" (must be "
+            "either \"weight\" or \"tree\")", emitterSampling.c_str());
+    }
+    /* Store geometry instances in a separate top-level BVH, which can be
+       rebuilt quickly when they move (see updateInstances()) */
+    m_twoLevelInstancing = props.getBoolean("twoLevelInstancing", true);
     m_sourceFile = new fs::path();
     m_destinationFile = new fs::path();
 }
 
 Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
     m_kdtree = scene->m_kdtree;
+    m_bvh = scene->m_bvh;
+    m_instanceBVH = scene->m_instanceBVH;
+    m_lightTree = scene->m_lightTree;
+    m_useLightTree = scene->m_useLightTree;
+    m_twoLevelInstancing = scene->m_twoLevelInstancing;
     m_blockSize = scene->m_blockSize;
     m_aabb = scene->m_aabb;
     m_environmentEmitter = scene->m_environmentEmitter;
@@ -116,6 +171,18 @@ Scene::Scene(Stream *stream, InstanceManager *manager)
     m_kdtree->setParallelBuild(stream->readBool());
     m_kdtree->setRetract(stream->readBool());
     m_kdtree->setMaxBadRefines(stream->readUInt());
+    m_kdtree->setCompact(stream->readBool());
+    m_kdtree->setOutOfCore(stream->readBool());
+    m_kdtree->setPageCacheSize(stream->readSize());
+    if (stream->readBool()) {
+        m_bvh = new ShapeBVH();
+        m_bvh->setBinCount(stream->readUInt());
+        m_bvh->setMaxLeafSize(stream->readUInt());
+        m_bvh->setQueryCost(stream->readFloat());
+        m_bvh->setTraversalCost(stream->readFloat());
+    }
+    m_useLightTree = stream->readBool();
+    m_twoLevelInstancing = stream->readBool();
     m_blockSize = stream->readUInt();
     m_degenerateSensor = stream->readBool();
     m_degenerateEmitters = stream->readBool();
@@ -182,6 +249,18 @@ void Scene::serialize(Stream *stream, InstanceManager *manager) const {
     stream->writeBool(m_kdtree->getParallelBuild());
     stream->writeBool(m_kdtree->getRetract());
     stream->writeUInt(m_kdtree->getMaxBadRefines());
+    stream->writeBool(m_kdtree->getCompact());
+    stream->writeBool(m_kdtree->getOutOfCore());
+    stream->writeSize(m_kdtree->getPageCacheSize());
+    stream->writeBool(m_bvh != NULL);
+    if (m_bvh.get()) {
+        stream->writeUInt(m_bvh->getBinCount());
+        stream->writeUInt(m_bvh->getMaxLeafSize());
+        stream->writeFloat(m_bvh->getQueryCost());
+        stream->writeFloat(m_bvh->getTraversalCost());
+    }
+    stream->writeBool(m_useLightTree);
+    stream->writeBool(m_twoLevelInstancing);
     stream->writeUInt(m_blockSize);
     stream->writeBool(m_degenerateSensor);
     stream->writeBool(m_degenerateEmitters);
@@ -317,10 +396,162 @@ void Scene::configure() {
 
 void Scene::invalidate() {
     m_kdtree = new ShapeKDTree();
+    if (m_bvh.get()) {
+        ref<ShapeBVH> bvh = new ShapeBVH();
+        bvh->setBinCount(m_bvh->getBinCount());
+        bvh->setMaxLeafSize(m_bvh->getMaxLeafSize());
+        bvh->setQueryCost(m_bvh->getQueryCost());
+        bvh->setTraversalCost(m_bvh->getTraversalCost());
+        m_bvh = bvh;
+    }
+    m_instanceBVH = NULL;
+}
+
+void Scene::updateGeometry() {
+    if (m_bvh.get() ? !m_bvh->isBuilt() : !m_kdtree->isBuilt()) {
+        /* Nothing to update yet */
+        initialize();
+        return;
+    }
+
+    for (size_t i=0; i<m_shapes.size(); ++i)
+        m_shapes[i]->updateGeometry();
+
+    if (m_instanceBVH.get())
+        m_instanceBVH->refit();
+
+    if (m_bvh.get()) {
+        m_bvh->refit();
+    } else {
+        ref<ShapeKDTree> kdtree = new ShapeKDTree();
+        kdtree->setQueryCost(m_kdtree->getQueryCost());
+        kdtree->setTraversalCost(m_kdtree->getTraversalCost());
+        kdtree->setEmptySpaceBonus(m_kdtree->getEmptySpaceBonus());
+        kdtree->setStopPrims(m_kdtree->getStopPrims());
+        kdtree->setClip(m_kdtree->getClip());
+        kdtree->setMaxDepth(m_kdtree->getMaxDepth());
+        kdtree->setExactPrimitiveThreshold(m_kdtree->getExactPrimitiveThreshold());
+        kdtree->setParallelBuild(m_kdtree->getParallelBuild());
+        kdtree->setRetract(m_kdtree->getRetract());
+        kdtree->setMaxBadRefines(m_kdtree->getMaxBadRefines());
+        kdtree->setCompact(m_kdtree->getCompact());
+        kdtree->setOutOfCore(m_kdtree->getOutOfCore());
+        kdtree->setPageCacheSize(m_kdtree->getPageCacheSize());
+        for (size_t i=0; i<m_shapes.size(); ++i) {
+            if (!m_twoLevelInstancing || !m_shapes[i]->isInstance())
+                kdtree->addShape(m_shapes[i]);
+        }
+        /* With two-level instancing, the tree is empty when all
+           geometry is instanced -- don't warn about that */
+        kdtree->setWarnIfEmpty(m_instanceBVH.get() == NULL);
+        kdtree->build();
+        m_kdtree = kdtree;
+    }
+
+    /* The geometry moved: recompute the scene bounds (and thus the bounding
+       sphere) and let emitters that surround the scene adapt to them */
+    initializeBidirectional();
+
+    /* Area emitters may have moved as well */
+    if (m_lightTree.get())
+        m_lightTree = new LightTree(m_emitters);
+}
+
+void Scene::updateInstances() {
+    if (!m_twoLevelInstancing || (m_bvh.get() ? !m_bvh->isBuilt() : !m_kdtree->isBuilt())) {
+        updateGeometry();
+        return;
+    }
+
+    ref<ShapeBVH> bvh = createInstanceBVH();
+    for (size_t i=0; i<m_shapes.size(); ++i) {
+        if (m_shapes[i]->isInstance())
+            bvh->addShape(m_shapes[i]);
+    }
+
+    if (bvh->getShapes().empty()) {
+        m_instanceBVH = NULL;
+    } else {
+        bvh->build();
+        m_instanceBVH = bvh;
+    }
+
+    initializeBidirectional();
+}
+
+ShapeBVH *Scene::createInstanceBVH() const {
+    ShapeBVH *bvh = new ShapeBVH();
+    /* Intersecting an instance is much more expensive than a triangle */
+    bvh->setMaxLeafSize(2);
+    bvh->setQueryCost(4);
+    return bvh;
+}
+
+bool Scene::rayIntersectInstances(const Ray &ray, bool found, Intersection &its) const {
+    if (!found)
+        return m_instanceBVH->rayIntersect(ray, its);
+
+    /* Only look for instance hits in front of the current intersection */
+    Ray instanceRay(ray);
+    instanceRay.maxt = its.t;
+    Intersection instanceIts;
+    if (m_instanceBVH->rayIntersect(instanceRay, instanceIts))
+        its = instanceIts;
+    return true;
+}
+
+bool Scene::rayIntersectInstances(const Ray &ray, bool found, Float &t,
+        ConstShapePtr &shape, Normal &n, Point2 &uv) const {
+    if (!found)
+        return m_instanceBVH->rayIntersect(ray, t, shape, n, uv);
+
+    Ray instanceRay(ray);
+    instanceRay.maxt = t;
+    Float instanceT;
+    ConstShapePtr instanceShape;
+    Normal instanceN;
+    Point2 instanceUV;
+    if (m_instanceBVH->rayIntersect(instanceRay, instanceT, instanceShape, instanceN, instanceUV)) {
+        t = instanceT;
+        shape = instanceShape;
+        n = instanceN;
+        uv = instanceUV;
+    }
+    return true;
+}
+
+void Scene::rayIntersectBatch(const Ray *rays, size_t count,
+        Intersection *its) const {
+    if (m_bvh.get()) {
+        for (size_t i=0; i<count; ++i)
+            m_bvh->rayIntersect(rays[i], its[i]);
+    } else {
+        m_kdtree->rayIntersectBatch(rays, count, its);
+    }
+
+    if (EXPECT_NOT_TAKEN(m_instanceBVH.get() != NULL)) {
+        for (size_t i=0; i<count; ++i)
+            rayIntersectInstances(rays[i], its[i].isValid(), its[i]);
+    }
+}
+
+void Scene::rayIntersectBatch(const Ray *rays, size_t count,
+        bool *occluded) const {
+    if (m_bvh.get()) {
+        for (size_t i=0; i<count; ++i)
+            occluded[i] = m_bvh->rayIntersect(rays[i]);
+    } else {
+        m_kdtree->rayIntersectBatch(rays, count, occluded);
+    }
+
+    if (EXPECT_NOT_TAKEN(m_instanceBVH.get() != NULL)) {
+        for (size_t i=0; i<count; ++i)
+            occluded[i] = occluded[i] || m_instanceBVH->rayIntersect(rays[i]);
+    }
 }
 
 void Scene::initialize() {
-    if (!m_kdtree->isBuilt()) {
+    if (m_bvh.get() ? !m_bvh->isBuilt() : !m_kdtree->isBuilt()) {
         /* Expand all geometry */
         ref_vector<Shape> temp;
         temp.reserve(m_shapes.size());
@@ -341,10 +572,20 @@ void Scene::initialize() {
                 SIZE_T_FMT ".", primitiveCount, effPrimitiveCount);
         }
 
-        /* Build the kd-tree */
-        m_kdtree->build();
+        /* Build the acceleration data structure */
+        if (m_bvh.get())
+            m_bvh->build();
+        else {
+            /* With two-level instancing, the tree is empty when all
+               geometry is instanced -- don't warn about that */
+            m_kdtree->setWarnIfEmpty(m_instanceBVH.get() == NULL);
+            m_kdtree->build();
+        }
+
+        if (m_instanceBVH.get())
+            m_instanceBVH->build();
 
-        m_aabb = m_kdtree->getAABB();
+        m_aabb = getGeometryAABB();
     }
 
     /* Make sure that there are no duplicates */
@@ -378,13 +619,16 @@ void Scene::initialize() {
             m_emitterPDF.append(it->get()->getSamplingWeight());
 
         m_emitterPDF.normalize();
+
+        if (m_useLightTree)
+            m_lightTree = new LightTree(m_emitters);
     }
 
     initializeBidirectional();
 }
 
 void Scene::initializeBidirectional() {
-    m_aabb = m_kdtree->getAABB();
+    m_aabb = getGeometryAABB();
     m_degenerateEmitters = true;
     m_specialShapes.clear();
 
@@ -586,7 +830,15 @@ void Scene::addShape(Shape *shape) {
         if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
             m_meshes.push_back(static_cast<TriMesh *>(shape));
 
-        m_kdtree->addShape(shape);
+        if (m_twoLevelInstancing && shape->isInstance()) {
+            if (!m_instanceBVH.get())
+                m_instanceBVH = createInstanceBVH();
+            m_instanceBVH->addShape(shape);
+        } else if (m_bvh.get()) {
+            m_bvh->addShape(shape);
+        } else {
+            m_kdtree->addShape(shape);
+        }
         m_shapes.push_back(shape);
     }
 }
@@ -598,7 +850,7 @@ std::string Scene::toString() const {
         << "  sensor = " << indent(m_sensor.toString()) << "," << endl
         << "  sampler = " << indent(m_sampler.toString()) << "," << endl
         << "  integrator = " << indent(m_integrator.toString()) << "," << endl
-        << "  kdtree = " << indent(m_kdtree.toString()) << "," << endl
+        << "  accel = " << indent(m_bvh.get() ? m_bvh.toString() : m_kdtree.toString()) << "," << endl
         << "  environmentEmitter = " << indent(m_environmentEmitter.toString()) << "," << endl
         << "  shapes = " << indent(containerToString(m_shapes.begin(), m_shapes.end())) << "," << endl
         << "  emitters = " << indent(containerToString(m_emitters.begin(), m_emitters.end())) << "," << endl
@@ -615,6 +867,7 @@ std::string Scene::toString() const {
 // ===========================================================================
 
 static StatsCounter mediumInconsistencies("General", "Detected medium inconsistencies");
+static StatsCounter timeEmitterSample("Timing", "Emitter sampling (incl. shadow rays)", ETimeValue);
 
 Spectrum Scene::evalTransmittance(const Point &p1, bool p1OnSurface, const Point &p2, bool p2OnSurface,
         Float time, const Medium *medium, int &interactions, Sampler *sampler) const {
@@ -827,19 +1080,23 @@ Spectrum Scene::evalTransmittanceAll(const Point &p1, bool p1OnSurface, const Po
 
 Spectrum Scene::sampleEmitterDirect(DirectSamplingRecord &dRec,
         const Point2 &_sample, bool testVisibility) const {
+    ScopedStatsTimer timer(timeEmitterSample);
     Point2 sample(_sample);
 
     /* Randomly pick an emitter */
     Float emPdf;
-    size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
-    const Emitter *emitter = m_emitters[index].get();
+    const Emitter *emitter = sampleEmitterDirectDiscrete(dRec, sample.x, emPdf);
+    if (!emitter) {
+        dRec.pdf = 0.0f;
+        return Spectrum(0.0f);
+    }
     Spectrum value = emitter->sampleDirect(dRec, sample);
 
     if (dRec.pdf != 0) {
         if (testVisibility) {
             Ray ray(dRec.ref, dRec.d, Epsilon,
                     dRec.dist*(1-ShadowEpsilon), dRec.time);
-            if (m_kdtree->rayIntersect(ray))
+            if (rayIntersect(ray))
                 return Spectrum(0.0f);
         }
         dRec.object = emitter;
@@ -857,8 +1114,11 @@ Spectrum Scene::sampleAttenuatedEmitterDirect(DirectSamplingRecord &dRec,
 
     /* Randomly pick an emitter */
     Float emPdf;
-    size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
-    const Emitter *emitter = m_emitters[index].get();
+    const Emitter *emitter = sampleEmitterDirectDiscrete(dRec, sample.x, emPdf);
+    if (!emitter) {
+        dRec.pdf = 0.0f;
+        return Spectrum(0.0f);
+    }
     Spectrum value = emitter->sampleDirect(dRec, sample);
 
     if (dRec.pdf != 0) {
@@ -880,8 +1140,11 @@ Spectrum Scene::sampleAttenuatedEmitterDirect(DirectSamplingRecord &dRec,
 
     /* Randomly pick an emitter */
     Float emPdf;
-    size_t index = m_emitterPDF.sampleReuse(sample.x, emPdf);
-    const Emitter *emitter = m_emitters[index].get();
+    const Emitter *emitter = sampleEmitterDirectDiscrete(dRec, sample.x, emPdf);
+    if (!emitter) {
+        dRec.pdf = 0.0f;
+        return Spectrum(0.0f);
+    }
     Spectrum value = emitter->sampleDirect(dRec, sample);
 
     if (dRec.pdf != 0) {
@@ -905,7 +1168,7 @@ Spectrum Scene::sampleSensorDirect(DirectSamplingRecord &dRec,
         if (testVisibility) {
             Ray ray(dRec.ref, dRec.d, Epsilon,
                     dRec.dist*(1-ShadowEpsilon), dRec.time);
-            if (m_kdtree->rayIntersect(ray))
+            if (rayIntersect(ray))
                 return Spectrum(0.0f);
         }
         dRec.object = m_sensor.get();
@@ -948,6 +1211,10 @@ Spectrum Scene::sampleAttenuatedSensorDirect(DirectSamplingRecord &dRec,
 
 Float Scene::pdfEmitterDirect(const DirectSamplingRecord &dRec) const {
     const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
+    if (m_lightTree.get()) {
+        Float pdf = emitter->pdfDirect(dRec);
+        return pdf != 0 ? (pdf * m_lightTree->pdf(dRec.ref, dRec.refN, emitter)) : 0.0f;
+    }
     return emitter->pdfDirect(dRec) * pdfEmitterDiscrete(emitter);
 }
 
@@ -30,6 +30,9 @@
 #include <xercesc/sax/Locator.hpp>
 #include <mitsuba/render/scenehandler.h>
 #include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/sched.h>
+#include <mitsuba/core/atomic.h>
+#include <mitsuba/core/timer.h>
 #include <mitsuba/render/scene.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/unordered_set.hpp>
@@ -49,19 +52,171 @@ typedef void (*CleanupFun) ();
 typedef boost::unordered_set<CleanupFun> CleanupSet;
 static PrimitiveThreadLocal<CleanupSet> __cleanup_tls;
 
-SceneHandler::SceneHandler(const ParameterMap &params,
-    NamedObjectMap *namedObjects, bool isIncludedFile) : m_params(params),
-        m_namedObjects(namedObjects), m_isIncludedFile(isIncludedFile) {
-    m_pluginManager = PluginManager::getInstance();
-    m_locator = NULL;
+bool SceneHandler::m_parallelLoading = false;
+
+/// Call the cleanup handlers that were registered by the current thread
+static void runCleanupHandlers() {
+    CleanupSet &cleanup = __cleanup_tls.get();
+    for (CleanupSet::iterator it = cleanup.begin();
+            it != cleanup.end(); ++it)
+        (*it)();
+    cleanup.clear();
+}
+
+/**
+ * \brief Node of the object graph, which is assembled while parsing
+ * a scene file.
+ *
+ * Nodes are created for every plugin object and the scene itself.
+ * References and aliases simply point to an existing node, and the
+ * result of \ref Texture::expand() is stored in a separate node.
+ */
+struct SceneHandler::ObjectNode {
+    /// Class of the object (as determined by the tag)
+    const Class *theClass;
+    /// Properties that are passed to the constructor
+    Properties props;
+    /// Location within the scene file (used for error messages)
+    std::string location;
+    /// Must the object be constructed from \c props?
+    bool create;
+    /// Is the node referenced by an ID?
+    bool named;
+    /// The instantiated object
+    ref<ConfigurableObject> object;
+    /// Error message of a failed construction
+    std::string error;
+    /// Time spent in the constructor (in nanoseconds)
+    uint64_t time;
+
+    inline ObjectNode(const Class *theClass, const Properties &props,
+        const std::string &location, bool create)
+        : theClass(theClass), props(props), location(location),
+          create(create), named(false), time(0) { }
+
+    /// Construct the object. Errors are stored instead of being thrown
+    void construct(PluginManager *pluginManager) {
+        uint64_t start = Timer::getTimestamp();
+        try {
+            if (theClass == MTS_CLASS(Scene))
+                object = new Scene(props);
+            else
+                object = pluginManager->createObject(theClass, props);
+        } catch (const std::exception &ex) {
+            error = ex.what();
+        }
+        time = Timer::getTimestamp() - start;
+    }
+};
+
+/// Work result of \ref InstantiationProcess (carries no data)
+class InstantiationResult : public WorkResult {
+public:
+    void load(Stream *stream) { }
+    void save(Stream *stream) const { }
+    std::string toString() const { return "InstantiationResult[]"; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~InstantiationResult() { }
+};
+
+/**
+ * \brief Constructs the nodes of an object graph using the local
+ * worker threads.
+ *
+ * There is one work unit per worker, which keeps fetching nodes from
+ * a shared counter until all of them have been processed. This balances
+ * the load when a few huge meshes are mixed with many small objects and
+ * lets plugins reuse thread-local state (e.g. open file streams) between
+ * consecutive objects.
+ */
+class InstantiationProcess : public ParallelProcess {
+public:
+    InstantiationProcess(const std::vector<SceneHandler::ObjectNode *> &nodes,
+        size_t unitCount) : m_nodes(nodes), m_unitCount(unitCount),
+            m_generated(0), m_next(0) {
+        m_resolver = Thread::getThread()->getFileResolver();
+        m_pluginManager = PluginManager::getInstance();
+    }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        if (m_generated == m_unitCount)
+            return EFailure;
+        ++m_generated;
+        return ESuccess;
+    }
+
+    void processResult(const WorkResult *result, bool cancelled) { }
+
+    ref<WorkProcessor> createWorkProcessor() const;
+
+    bool isLocal() const { return true; }
+
+    /// Construct nodes until none are left (called by the work processors)
+    void run() {
+        /* Resolve relative paths like the thread that parsed the scene */
+        Thread *thread = Thread::getThread();
+        ref<FileResolver> resolver = thread->getFileResolver();
+        thread->setFileResolver(m_resolver);
+
+        int64_t index;
+        while ((index = atomicAdd(&m_next, 1) - 1) < (int64_t) m_nodes.size())
+            m_nodes[index]->construct(m_pluginManager);
+
+        runCleanupHandlers();
+        thread->setFileResolver(resolver);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~InstantiationProcess() { }
+private:
+    const std::vector<SceneHandler::ObjectNode *> &m_nodes;
+    ref<FileResolver> m_resolver;
+    PluginManager *m_pluginManager;
+    size_t m_unitCount, m_generated;
+    volatile int64_t m_next;
+};
+
+class InstantiationProcessor : public WorkProcessor {
+public:
+    InstantiationProcessor(InstantiationProcess *process)
+        : m_process(process) { }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        Log(EError, "serialize(): not supported (local process)!");
+    }
 
-    if (m_isIncludedFile) {
-        SAssert(namedObjects != NULL);
-    } else {
-        SAssert(namedObjects == NULL);
-        m_namedObjects = new NamedObjectMap();
+    ref<WorkUnit> createWorkUnit() const { return new DummyWorkUnit(); }
+    ref<WorkResult> createWorkResult() const { return new InstantiationResult(); }
+    ref<WorkProcessor> clone() const { return new InstantiationProcessor(m_process); }
+    void prepare() { }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult, const bool &stop) {
+        m_process->run();
     }
 
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~InstantiationProcessor() { }
+private:
+    InstantiationProcess *m_process;
+};
+
+ref<WorkProcessor> InstantiationProcess::createWorkProcessor() const {
+    return new InstantiationProcessor(const_cast<InstantiationProcess *>(this));
+}
+
+SceneHandler::SceneHandler(const ParameterMap &params)
+    : SceneHandler(params, NULL) { }
+
+SceneHandler::SceneHandler(const ParameterMap &params, SceneHandler *parent)
+        : m_sceneNode(NULL), m_params(params), m_isIncludedFile(parent != NULL),
+          m_root(parent ? parent->m_root : this), m_deferred(false) {
+    m_pluginManager = PluginManager::getInstance();
+    m_locator = NULL;
+
 #if !defined(WIN32)
     setlocale(LC_NUMERIC, "C");
 #endif
@@ -113,8 +268,6 @@ SceneHandler::SceneHandler(const ParameterMap &params,
 SceneHandler::~SceneHandler() {
     delete m_transcoder;
     clear();
-    if (!m_isIncludedFile)
-        delete m_namedObjects;
 }
 
 void SceneHandler::setDocumentLocator(const xercesc::Locator* const locator) {
@@ -123,12 +276,129 @@ void SceneHandler::setDocumentLocator(const xercesc::Locator* const locator) {
 
 void SceneHandler::clear() {
     if (!m_isIncludedFile) {
-        for (NamedObjectMap::iterator it = m_namedObjects->begin();
-                it != m_namedObjects->end(); ++it)
-            if (it->second)
-                it->second->decRef();
-        m_namedObjects->clear();
+        for (size_t i=0; i<m_nodes.size(); ++i)
+            delete m_nodes[i];
+        m_nodes.clear();
+        m_actions.clear();
+        m_namedObjects.clear();
     }
+    m_sceneNode = NULL;
+}
+
+void SceneHandler::setParallelLoading(bool parallel) {
+    m_parallelLoading = parallel;
+}
+
+bool SceneHandler::getParallelLoading() {
+    return m_parallelLoading;
+}
+
+std::string SceneHandler::getLocation() const {
+    return formatString("In file \"%s\" (near line %i): ",
+        m_locator ? transcode(m_locator->getSystemId()).c_str() : "<unknown>",
+        m_locator ? (int) m_locator->getLineNumber() : -1);
+}
+
+SceneHandler::ObjectNode *SceneHandler::createNode(const Class *theClass,
+        const Properties &props, bool create) {
+    ObjectNode *node = new ObjectNode(theClass, props, getLocation(), create);
+    m_root->m_nodes.push_back(node);
+
+    if (create && !m_root->m_deferred) {
+        node->construct(m_pluginManager);
+        if (!node->error.empty())
+            XMLLog(EError, "Error while creating object: %s", node->error.c_str());
+    }
+
+    return node;
+}
+
+void SceneHandler::record(const Action &action) {
+    if (m_root->m_deferred)
+        m_root->m_actions.push_back(action);
+    else
+        execute(action);
+}
+
+void SceneHandler::execute(const Action &action) {
+    ConfigurableObject *object = action.node->object;
+
+    switch (action.type) {
+        case EAddChild: {
+                ConfigurableObject *child = action.other->object;
+                object->addChild(action.name, child);
+                child->setParent(object);
+            }
+            break;
+
+        case EConfigure:
+            object->configure();
+            break;
+
+        case EExpand:
+            action.node->object = static_cast<Texture *>(
+                action.other->object.get())->expand();
+            break;
+
+        case ECheckProperties: {
+                /* Warn about unqueried properties */
+                std::vector<std::string> unq = action.node->props.getUnqueried();
+                for (unsigned int i=0; i<unq.size(); ++i)
+                    SLog(EWarn, "%sUnqueried attribute \"%s\" in element \"%s\"",
+                        action.node->location.c_str(), unq[i].c_str(),
+                        action.name.c_str());
+            }
+            break;
+    }
+}
+
+void SceneHandler::instantiate() {
+    std::vector<ObjectNode *> nodes;
+    for (size_t i=0; i<m_nodes.size(); ++i) {
+        if (m_nodes[i]->create)
+            nodes.push_back(m_nodes[i]);
+    }
+
+    Scheduler *scheduler = Scheduler::getInstance();
+    size_t unitCount = 1;
+    if (scheduler->isRunning() &&
+        !Thread::getThread()->getClass()->derivesFrom(MTS_CLASS(Worker)))
+        unitCount = std::min(scheduler->getLocalWorkerCount(), nodes.size());
+
+    ref<Timer> timer = new Timer();
+    if (unitCount > 1) {
+        ref<InstantiationProcess> proc = new InstantiationProcess(nodes, unitCount);
+        scheduler->schedule(proc);
+        scheduler->wait(proc);
+    }
+
+    /* Construct any remaining objects on the current thread (serial mode,
+       or if the process was cancelled) */
+    for (size_t i=0; i<nodes.size(); ++i) {
+        if (!nodes[i]->object && nodes[i]->error.empty())
+            nodes[i]->construct(m_pluginManager);
+    }
+    uint64_t wallTime = timer->getNanoseconds(), serialTime = 0;
+
+    for (size_t i=0; i<nodes.size(); ++i) {
+        const ObjectNode *node = nodes[i];
+        if (!node->error.empty())
+            SLog(EError, "%sError while creating object: %s",
+                node->location.c_str(), node->error.c_str());
+        serialTime += node->time;
+    }
+
+    SLog(EInfo, "Instantiated " SIZE_T_FMT " objects using " SIZE_T_FMT
+        " thread%s in %s (serial construction: %s, saved %s)", nodes.size(),
+        unitCount, unitCount > 1 ? "s" : "",
+        timeString(wallTime * 1e-9f, true).c_str(),
+        timeString(serialTime * 1e-9f, true).c_str(),
+        timeString(std::max((Float) 0, ((Float) serialTime - (Float) wallTime) * 1e-9f), true).c_str());
+
+    /* Attach children and configure everything in document order */
+    for (size_t i=0; i<m_actions.size(); ++i)
+        execute(m_actions[i]);
+    m_actions.clear();
 }
 
 std::string SceneHandler::transcode(const XMLCh * input) const {
@@ -159,17 +429,27 @@ std::string SceneHandler::transcode(const XMLCh * input) const {
 
 void SceneHandler::startDocument() {
     clear();
+    if (!m_isIncludedFile)
+        m_deferred = m_parallelLoading;
 }
 
 void SceneHandler::endDocument() {
-    SAssert(m_scene != NULL);
+    SAssert(m_sceneNode != NULL);
+
+    if (!m_isIncludedFile) {
+        if (m_deferred)
+            instantiate();
+        m_scene = static_cast<Scene *>(m_sceneNode->object.get());
+
+        /* Only keep references to named objects */
+        for (size_t i=0; i<m_nodes.size(); ++i) {
+            if (!m_nodes[i]->named)
+                m_nodes[i]->object = NULL;
+        }
+    }
 
     /* Call cleanup handlers */
-    CleanupSet &cleanup = __cleanup_tls.get();
-    for (CleanupSet::iterator it = cleanup.begin();
-            it != cleanup.end(); ++it)
-        (*it)();
-    cleanup.clear();
+    runCleanupHandlers();
 }
 
 void SceneHandler::characters(const XMLCh* const name,
@@ -278,7 +558,8 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
     if (context.attributes.find("id") != context.attributes.end())
         context.properties.setID(context.attributes["id"]);
 
-    ref<ConfigurableObject> object;
+    NamedObjectMap &namedObjects = m_root->m_namedObjects;
+    ObjectNode *node = NULL, *created = NULL;
 
     TagMap::const_iterator it = m_tags.find(name);
     if (it == m_tags.end())
@@ -288,18 +569,19 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
 
     switch (tag.first) {
         case EScene:
-            object = m_scene = new Scene(context.properties);
+            node = created = m_sceneNode = createNode(
+                MTS_CLASS(Scene), context.properties);
             break;
 
         case ENull:
-            object = NULL;
+            node = NULL;
             break;
 
         case EReference: {
                 std::string id = context.attributes["id"];
-                if (m_namedObjects->find(id) == m_namedObjects->end())
+                if (namedObjects.find(id) == namedObjects.end())
                     XMLLog(EError, "Referenced object '%s' not found!", id.c_str());
-                object = (*m_namedObjects)[id];
+                node = namedObjects[id];
             }
             break;
 
@@ -645,13 +927,12 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
 
         case EAlias: {
                 std::string id = context.attributes["id"], as = context.attributes["as"];
-                if (m_namedObjects->find(id) == m_namedObjects->end())
+                if (namedObjects.find(id) == namedObjects.end())
                     XMLLog(EError, "Referenced object '%s' not found!", id.c_str());
-                ConfigurableObject *obj = (*m_namedObjects)[id];
-                if (m_namedObjects->find(as) != m_namedObjects->end())
+                ObjectNode *obj = namedObjects[id];
+                if (namedObjects.find(as) != namedObjects.end())
                     XMLLog(EError, "Duplicate ID '%s' used in scene description!", id.c_str());
-                obj->incRef();
-                (*m_namedObjects)[as] = obj;
+                namedObjects[as] = obj;
             }
             break;
 
@@ -667,7 +948,7 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
                 parser->setExternalNoNamespaceSchemaLocation(reinterpret_cast<std::conditional_t<std::is_same_v<boost::filesystem::path::value_type, wchar_t>, const XMLCh *, const char *>>(schemaPath.c_str()));
 
                 /* Set the handler and start parsing */
-                SceneHandler *handler = new SceneHandler(m_params, m_namedObjects, true);
+                SceneHandler *handler = new SceneHandler(m_params, this);
                 parser->setDoNamespaces(true);
                 parser->setDocumentHandler(handler);
                 parser->setErrorHandler(handler);
@@ -675,7 +956,7 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
                 XMLLog(EInfo, "Parsing included file \"%s\" ..", path.filename().string().c_str());
                 parser->parse(reinterpret_cast<std::conditional_t<std::is_same_v<boost::filesystem::path::value_type, wchar_t>, const XMLCh *, const char *>>(path.c_str()));
 
-                object = handler->getScene();
+                node = handler->m_sceneNode;
                 delete parser;
                 delete handler;
             }
@@ -709,90 +990,78 @@ void SceneHandler::endElement(const XMLCh* const xmlName) {
                     if (trafo->isStatic())
                         props.setTransform("toWorld", trafo->eval(0));
 
-                    object = m_pluginManager->createObject(tag.second, props);
+                    node = created = createNode(tag.second, props);
 
                     if (!trafo->isStatic()) {
-                        object = m_pluginManager->createObject(tag.second, props);
                         /* If the object has children, append them */
-                        for (std::vector<std::pair<std::string, ConfigurableObject *> >
+                        for (std::vector<std::pair<std::string, ObjectNode *> >
                                 ::iterator it = context.children.begin();
                                 it != context.children.end(); ++it) {
-                            if (it->second != NULL) {
-                                object->addChild(it->first, it->second);
-                                it->second->setParent(object);
-                                it->second->decRef();
-                            }
+                            if (it->second != NULL)
+                                record(Action(EAddChild, node, it->second, it->first));
                         }
                         context.children.clear();
 
-                        object->configure();
+                        record(Action(EConfigure, node));
 
-                        ref<Shape> shapeGroup = static_cast<Shape *> (
-                            m_pluginManager->createObject(MTS_CLASS(Shape), Properties("shapegroup")));
-                        shapeGroup->addChild(object);
-                        shapeGroup->configure();
+                        ObjectNode *shapeGroup = createNode(
+                            MTS_CLASS(Shape), Properties("shapegroup"));
+                        record(Action(EAddChild, shapeGroup, node));
+                        record(Action(EConfigure, shapeGroup));
 
                         Properties instanceProps("instance");
                         instanceProps.setAnimatedTransform("toWorld", trafo);
-                        object = m_pluginManager->createObject(instanceProps);
-                        object->addChild(shapeGroup);
-
+                        node = createNode(MTS_CLASS(Shape), instanceProps);
+                        record(Action(EAddChild, node, shapeGroup));
                     }
                 } else {
-                    try {
-                        object = m_pluginManager->createObject(tag.second, props);
-                    } catch (const std::exception &ex) {
-                        XMLLog(EError, "Error while creating object: %s", ex.what());
-                    }
+                    node = created = createNode(tag.second, props);
                 }
             }
             break;
     }
 
-    if (object != NULL || name == "null") {
+    if (node != NULL || name == "null") {
         std::string id = context.attributes["id"];
         std::string nodeName = context.attributes["name"];
 
-        if (object) {
+        if (node) {
             /* If the object has a parent, add it to the parent's children list */
-            if (context.parent != NULL) {
-                object->incRef();
+            if (context.parent != NULL)
                 context.parent->children.push_back(
-                    std::pair<std::string, ConfigurableObject *>(nodeName, object));
-            }
+                    std::pair<std::string, ObjectNode *>(nodeName, node));
 
             /* If the object has children, append them */
-            for (std::vector<std::pair<std::string, ConfigurableObject *> >
+            for (std::vector<std::pair<std::string, ObjectNode *> >
                     ::iterator it = context.children.begin();
                     it != context.children.end(); ++it) {
-                if (it->second != NULL) {
-                    object->addChild(it->first, it->second);
-                    it->second->setParent(object);
-                    it->second->decRef();
-                }
+                if (it->second != NULL)
+                    record(Action(EAddChild, node, it->second, it->first));
             }
 
             /* Don't configure a scene object if it is from an included file */
-            if (name != "include" && (!m_isIncludedFile || !object->getClass()->derivesFrom(MTS_CLASS(Scene))))
-                object->configure();
+            if (name != "include" && (!m_isIncludedFile || node->theClass != MTS_CLASS(Scene)))
+                record(Action(EConfigure, node));
 
-            if (object->getClass()->derivesFrom(MTS_CLASS(Texture)))
-                object = static_cast<Texture *>(object.get())->expand();
+            if (node->theClass->derivesFrom(MTS_CLASS(Texture))) {
+                ObjectNode *expanded = createNode(node->theClass, Properties(), false);
+                record(Action(EExpand, expanded, node));
+                node = expanded;
+            }
         }
 
         if (id != "" && name != "ref") {
-            if (m_namedObjects->find(id) != m_namedObjects->end())
+            if (namedObjects.find(id) != namedObjects.end())
                 XMLLog(EError, "Duplicate ID '%s' used in scene description!", id.c_str());
-            (*m_namedObjects)[id] = object;
-            if (object)
-                object->incRef();
+            namedObjects[id] = node;
+            if (node)
+                node->named = true;
         }
     }
 
-    /* Warn about unqueried properties */
-    std::vector<std::string> unq = context.properties.getUnqueried();
-    for (unsigned int i=0; i<unq.size(); ++i)
-        XMLLog(EWarn, "Unqueried attribute \"%s\" in element \"%s\"", unq[i].c_str(), name.c_str());
+    /* Warn about unqueried properties (once the object has been created) */
+    if (created)
+        record(Action(ECheckProperties, created, NULL, name));
 
     m_context.pop();
 }
@@ -896,4 +1165,8 @@ void SceneHandler::staticShutdown() {
 
 VersionException::~VersionException() throw () {}
 
+MTS_IMPLEMENT_CLASS(InstantiationResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS(InstantiationProcessor, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(InstantiationProcess, false, ParallelProcess)
+
 MTS_NAMESPACE_END
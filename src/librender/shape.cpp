@@ -85,6 +85,10 @@ bool Shape::isCompound() const {
     return false;
 }
 
+bool Shape::isInstance() const {
+    return false;
+}
+
 std::string Shape::getName() const {
     return m_name;
 }
@@ -99,6 +103,8 @@ AABB Shape::getClippedAABB(const AABB &box) const {
     return result;
 }
 
+void Shape::updateGeometry() { }
+
 void Shape::sampleDirect(DirectSamplingRecord &dRec,
             const Point2 &sample) const {
     /* Piggyback on sampleArea() */
@@ -18,6 +18,7 @@
 
 #include <mitsuba/render/skdtree.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/sched.h>
 
 #if defined(MTS_SSE)
 #include <mitsuba/core/sse.h>
@@ -25,26 +26,36 @@
 #include <mitsuba/render/triaccel_sse.h>
 #endif
 
+#if defined(MTS_AVX)
+#include <mitsuba/render/triaccel_avx.h>
+#endif
+
 MTS_NAMESPACE_BEGIN
 
 ShapeKDTree::ShapeKDTree() {
-#if !defined(MTS_KD_CONSERVE_MEMORY)
     m_triAccel = NULL;
+#if defined(MTS_KD_CONSERVE_MEMORY)
+    m_compact = true;
+#else
+    m_compact = false;
 #endif
+    m_outOfCore = false;
+    m_pageCacheSize = (size_t) 256 * 1024 * 1024;
     m_shapeMap.push_back(0);
+    m_trianglesOnly = true;
 }
 
 ShapeKDTree::~ShapeKDTree() {
-#if !defined(MTS_KD_CONSERVE_MEMORY)
     if (m_triAccel)
         freeAligned(m_triAccel);
-#endif
     for (size_t i=0; i<m_shapes.size(); ++i)
         m_shapes[i]->decRef();
 }
 
 static StatsCounter raysTraced("General", "Normal rays traced");
 static StatsCounter shadowRaysTraced("General", "Shadow rays traced");
+static StatsCounter timeRayIntersect("Timing", "Ray intersection (kd-tree)", ETimeValue);
+static StatsCounter timeShadowRay("Timing", "Shadow ray tests (kd-tree)", ETimeValue);
 
 void ShapeKDTree::addShape(const Shape *shape) {
     Assert(!isBuilt());
@@ -60,6 +71,7 @@ void ShapeKDTree::addShape(const Shape *shape) {
     } else {
         m_shapeMap.push_back(1);
         m_triangleFlag.push_back(false);
+        m_trianglesOnly = false;
     }
     shape->incRef();
     m_shapes.push_back(shape);
@@ -71,45 +83,136 @@ void ShapeKDTree::build() {
 
     SAHKDTree3D<ShapeKDTree>::buildInternal();
 
-#if !defined(MTS_KD_CONSERVE_MEMORY)
-    ref<Timer> timer = new Timer();
-    SizeType primCount = getPrimitiveCount();
-    Log(EDebug, "Precomputing triangle intersection information (%s)",
-            memString(sizeof(TriAccel)*primCount).c_str());
-    m_triAccel = static_cast<TriAccel *>(allocAligned(primCount * sizeof(TriAccel)));
-
-    IndexType idx = 0;
-    for (IndexType i=0; i<m_shapes.size(); ++i) {
-        const Shape *shape = m_shapes[i];
-        if (m_triangleFlag[i]) {
-            const TriMesh *mesh = static_cast<const TriMesh *>(shape);
-            const Triangle *triangles = mesh->getTriangles();
-            const Point *positions = mesh->getVertexPositions();
-            for (IndexType j=0; j<mesh->getTriangleCount(); ++j) {
-                const Triangle &tri = triangles[j];
-                const Point &v0 = positions[tri.idx[0]];
-                const Point &v1 = positions[tri.idx[1]];
-                const Point &v2 = positions[tri.idx[2]];
-                m_triAccel[idx].load(v0, v1, v2);
+    if (m_outOfCore) {
+        buildPages();
+        packIndices();
+        Log(m_logLevel, "");
+    } else if (m_compact) {
+        packIndices();
+        Log(m_logLevel, "");
+    } else {
+        ref<Timer> timer = new Timer();
+        SizeType primCount = getPrimitiveCount();
+        Log(EDebug, "Precomputing triangle intersection information (%s)",
+                memString(sizeof(TriAccel)*primCount).c_str());
+        m_triAccel = static_cast<TriAccel *>(allocAligned(primCount * sizeof(TriAccel)));
+
+        IndexType idx = 0;
+        for (IndexType i=0; i<m_shapes.size(); ++i) {
+            const Shape *shape = m_shapes[i];
+            if (m_triangleFlag[i]) {
+                const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+                const Triangle *triangles = mesh->getTriangles();
+                const Point *positions = mesh->getVertexPositions();
+                for (IndexType j=0; j<mesh->getTriangleCount(); ++j) {
+                    const Triangle &tri = triangles[j];
+                    const Point &v0 = positions[tri.idx[0]];
+                    const Point &v1 = positions[tri.idx[1]];
+                    const Point &v2 = positions[tri.idx[2]];
+                    m_triAccel[idx].load(v0, v1, v2);
+                    m_triAccel[idx].shapeIndex = i;
+                    m_triAccel[idx].primIndex = j;
+                    ++idx;
+                }
+            } else {
+                /* Create a 'fake' triangle, which redirects to a Shape */
+                memset(&m_triAccel[idx], 0, sizeof(TriAccel));
                 m_triAccel[idx].shapeIndex = i;
-                m_triAccel[idx].primIndex = j;
+                m_triAccel[idx].k = KNoTriangleFlag;
                 ++idx;
             }
-        } else {
-            /* Create a 'fake' triangle, which redirects to a Shape */
-            memset(&m_triAccel[idx], 0, sizeof(TriAccel));
-            m_triAccel[idx].shapeIndex = i;
-            m_triAccel[idx].k = KNoTriangleFlag;
-            ++idx;
         }
+        Log(EDebug, "Finished -- took %i ms.", timer->getMilliseconds());
+        Log(m_logLevel, "");
+        KDAssert(idx == primCount);
     }
-    Log(EDebug, "Finished -- took %i ms.", timer->getMilliseconds());
-    Log(m_logLevel, "");
-    KDAssert(idx == primCount);
-#endif
+
+    /* Spread the read-only traversal data over all NUMA nodes so that
+       workers on every socket see the same average access latency */
+    if (Scheduler::getInstance()->getNUMAMode() && getNUMANodeCount() > 1) {
+        bool success = interleaveMemory(m_nodes-1, sizeof(KDNode) * (m_nodeCount+1));
+        if (m_packedIndices)
+            success &= interleaveMemory(m_packedIndices, m_packedSize);
+        else
+            success &= interleaveMemory(m_indices, sizeof(IndexType) * m_indexCount);
+        if (m_triAccel)
+            success &= interleaveMemory(m_triAccel, sizeof(TriAccel) * getPrimitiveCount());
+        if (success)
+            Log(EDebug, "Interleaved the kd-tree across %i NUMA nodes", getNUMANodeCount());
+        else
+            Log(EWarn, "Could not interleave the kd-tree across NUMA nodes!");
+    }
+}
+
+size_t ShapeKDTree::getMemoryUsage() const {
+    size_t size = SAHKDTree3D<ShapeKDTree>::getMemoryUsage();
+    if (m_triAccel)
+        size += sizeof(TriAccel) * getPrimitiveCount();
+    if (m_pager.get())
+        size += m_pager->getMemoryUsage();
+    return size;
+}
+
+void ShapeKDTree::appendPagedRecord(IndexType idx) {
+    TriAccel &ta = m_pager->append(idx);
+    IndexType shapeIdx = findShape(idx);
+    ta.shapeIndex = shapeIdx;
+    if (m_triangleFlag[shapeIdx]) {
+        const TriMesh *mesh = static_cast<const TriMesh *>(m_shapes[shapeIdx]);
+        const Triangle &tri = mesh->getTriangles()[idx];
+        const Point *positions = mesh->getVertexPositions();
+        ta.load(positions[tri.idx[0]], positions[tri.idx[1]], positions[tri.idx[2]]);
+        ta.primIndex = idx;
+    } else {
+        /* Create a 'fake' triangle, which redirects to a Shape */
+        ta.k = KNoTriangleFlag;
+    }
+}
+
+void ShapeKDTree::buildPages() {
+    ref<Timer> timer = new Timer();
+    SizeType primCount = getPrimitiveCount();
+    m_pager = new GeometryPager(primCount, m_pageCacheSize);
+
+    /* Append the records in the depth-first order of the leaves, so that
+       the geometry of each subtree is clustered on a few pages. Primitives
+       that are referenced by several leaves are stored only once. */
+    std::vector<bool> stored(primCount, false);
+    std::vector<const KDNode *> stack;
+    stack.push_back(getRoot());
+
+    while (!stack.empty()) {
+        const KDNode *node = stack.back();
+        stack.pop_back();
+        if (!node->isLeaf()) {
+            const KDNode *left = node->getLeft(), *right = node->getRight();
+            stack.push_back(right);
+            stack.push_back(left);
+            continue;
+        }
+        LeafIterator it(this, node);
+        IndexType primIdx;
+        while (it.next(primIdx)) {
+            if (!stored[primIdx]) {
+                stored[primIdx] = true;
+                appendPagedRecord(primIdx);
+            }
+        }
+    }
+
+    /* Primitives that aren't referenced by any leaf still get a record */
+    for (IndexType i=0; i<primCount; ++i) {
+        if (!stored[i])
+            appendPagedRecord(i);
+    }
+
+    Log(EDebug, "Wrote the triangle data to " SIZE_T_FMT " pages (%s) -- took %i ms.",
+        m_pager->getPageCount(), memString(m_pager->getFileSize()).c_str(),
+        timer->getMilliseconds());
 }
 
 bool ShapeKDTree::rayIntersect(const Ray &ray, Intersection &its) const {
+    ScopedStatsTimer timer(timeRayIntersect);
     uint8_t temp[MTS_KD_INTERSECTION_TEMP];
     its.t = std::numeric_limits<Float>::infinity();
     Float mint, maxt;
@@ -162,40 +265,8 @@ bool ShapeKDTree::rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
         if (EXPECT_TAKEN(maxt > mint)) {
             if (rayIntersectHavran<false>(ray, mint, maxt, t, temp)) {
                 const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
-                shape = m_shapes[cache->shapeIndex];
-
-                if (m_triangleFlag[cache->shapeIndex]) {
-                    const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
-                    const Triangle &tri = trimesh->getTriangles()[cache->primIndex];
-                    const Point *vertexPositions = trimesh->getVertexPositions();
-                    const Point2 *vertexTexcoords = trimesh->getVertexTexcoords();
-                    const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
-                    const Point &p0 = vertexPositions[idx0];
-                    const Point &p1 = vertexPositions[idx1];
-                    const Point &p2 = vertexPositions[idx2];
-                    n = normalize(cross(p1-p0, p2-p0));
-
-                    if (EXPECT_TAKEN(vertexTexcoords)) {
-                        const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
-                        const Point2 &t0 = vertexTexcoords[idx0];
-                        const Point2 &t1 = vertexTexcoords[idx1];
-                        const Point2 &t2 = vertexTexcoords[idx2];
-                        uv = t0 * b.x + t1 * b.y + t2 * b.z;
-                    } else {
-                        uv = Point2(0.0f);
-                    }
-                } else {
-                    /// Uh oh... -- much unnecessary work is done here
-                    Intersection its;
-                    its.t = t;
-                    shape->fillIntersectionRecord(ray,
-                        reinterpret_cast<const uint8_t*>(temp) + 2*sizeof(IndexType), its);
-                    n = its.geoFrame.n;
-                    uv = its.uv;
-                    if (its.shape)
-                        shape = its.shape;
-                }
-
+                fillCompactIntersectionRecord(m_shapes[cache->shapeIndex],
+                    m_triangleFlag[cache->shapeIndex], ray, t, temp, shape, n, uv);
                 return true;
             }
         }
@@ -204,7 +275,47 @@ bool ShapeKDTree::rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
 }
 
 
+void ShapeKDTree::fillCompactIntersectionRecord(const Shape *hitShape,
+        bool isTriangle, const Ray &ray, Float t, const void *temp,
+        ConstShapePtr &shape, Normal &n, Point2 &uv) {
+    const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
+    shape = hitShape;
+
+    if (isTriangle) {
+        const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
+        const Triangle &tri = trimesh->getTriangles()[cache->primIndex];
+        const Point *vertexPositions = trimesh->getVertexPositions();
+        const Point2 *vertexTexcoords = trimesh->getVertexTexcoords();
+        const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
+        const Point &p0 = vertexPositions[idx0];
+        const Point &p1 = vertexPositions[idx1];
+        const Point &p2 = vertexPositions[idx2];
+        n = normalize(cross(p1-p0, p2-p0));
+
+        if (EXPECT_TAKEN(vertexTexcoords)) {
+            const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
+            const Point2 &t0 = vertexTexcoords[idx0];
+            const Point2 &t1 = vertexTexcoords[idx1];
+            const Point2 &t2 = vertexTexcoords[idx2];
+            uv = t0 * b.x + t1 * b.y + t2 * b.z;
+        } else {
+            uv = Point2(0.0f);
+        }
+    } else {
+        /// Uh oh... -- much unnecessary work is done here
+        Intersection its;
+        its.t = t;
+        shape->fillIntersectionRecord(ray,
+            reinterpret_cast<const uint8_t*>(temp) + 2*sizeof(IndexType), its);
+        n = its.geoFrame.n;
+        uv = its.uv;
+        if (its.shape)
+            shape = its.shape;
+    }
+}
+
 bool ShapeKDTree::rayIntersect(const Ray &ray) const {
+    ScopedStatsTimer timer(timeShadowRay);
     Float mint, maxt, t = std::numeric_limits<Float>::infinity();
 
     ++shadowRaysTraced;
@@ -243,6 +354,13 @@ void ShapeKDTree::rayIntersectPacket(const RayPacket4 &packet,
     CoherentKDStackEntry MM_ALIGN16 stack[MTS_KD_MAXDEPTH];
     RayInterval4 MM_ALIGN16 interval;
 
+    /* Compact and out-of-core trees don't keep the TriAccel records
+       in memory -- trace the rays one at a time */
+    if (EXPECT_NOT_TAKEN(m_triAccel == NULL)) {
+        rayIntersectPacketIncoherent(packet, rayInterval, its, temp);
+        return;
+    }
+
     const KDNode * __restrict currNode = m_nodes;
     int stackIndex = 0;
 
@@ -381,7 +499,369 @@ void ShapeKDTree::rayIntersectPacketIncoherent(const RayPacket4 &packet,
     }
 }
 
+#if defined(MTS_AVX)
+
+/// Ray traversal stack entry for 8- and 16-wide packets
+template <typename SIMD> struct WideKDStackEntry {
+    /* Current ray interval */
+    TRayInterval<SIMD> interval;
+    /* Pointer to the far child */
+    const ShapeKDTree::KDNode * __restrict node;
+};
+
+static StatsCounter widePackets("General", "Coherent ray packets (8/16-wide)");
+
+template <typename SIMD> void ShapeKDTree::rayIntersectPacketWide(
+        const TRayPacket<SIMD> &packet, const TRayInterval<SIMD> &rayInterval,
+        TIntersection<SIMD> &its, void *temp) const {
+    typedef typename SIMD::Vec Vec;
+    typedef typename SIMD::Mask Mask;
+
+    WideKDStackEntry<SIMD> stack[MTS_KD_MAXDEPTH];
+    TRayInterval<SIMD> interval;
+
+    /* Compact and out-of-core trees don't keep the TriAccel records
+       in memory -- trace the rays one at a time */
+    if (EXPECT_NOT_TAKEN(m_triAccel == NULL)) {
+        for (int i=0; i<SIMD::Width; ++i) {
+            Ray ray;
+            Float t;
+            for (int axis=0; axis<3; axis++) {
+                ray.o[axis] = packet.o[axis].f[i];
+                ray.d[axis] = packet.d[axis].f[i];
+                ray.dRcp[axis] = packet.dRcp[axis].f[i];
+            }
+            ray.mint = rayInterval.mint.f[i];
+            ray.maxt = rayInterval.maxt.f[i];
+            uint8_t *rayTemp = reinterpret_cast<uint8_t *>(temp) + i * MTS_KD_INTERSECTION_TEMP;
+            if (ray.mint < ray.maxt && rayIntersectHavran<false>(ray, ray.mint, ray.maxt, t, rayTemp)) {
+                const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(rayTemp);
+                its.t.f[i] = t;
+                its.shapeIndex.i[i] = cache->shapeIndex;
+                its.primIndex.i[i] = cache->primIndex;
+                its.u.f[i] = cache->u;
+                its.v.f[i] = cache->v;
+            }
+        }
+        return;
+    }
+
+    const KDNode * __restrict currNode = m_nodes;
+    int stackIndex = 0;
+
+    ++widePackets;
+
+    /* First, intersect with the kd-tree AABB to determine
+       the intersection search intervals */
+    if (!mitsuba::rayIntersectPacket(m_aabb, packet, interval))
+        return;
+
+    interval.mint.ps = SIMD::max(interval.mint.ps, rayInterval.mint.ps);
+    interval.maxt.ps = SIMD::min(interval.maxt.ps, rayInterval.maxt.ps);
+
+    Mask itsFound = SIMD::cmpgt(interval.mint.ps, interval.maxt.ps);
+    Mask masked = itsFound;
+    if (SIMD::movemask(itsFound) == SIMD::FullMask)
+        return;
+
+    const Vec omEps = SIMD::set1(1-Epsilon), opEps = SIMD::set1(1+Epsilon);
+
+    while (currNode != NULL) {
+        while (EXPECT_TAKEN(!currNode->isLeaf())) {
+            const uint8_t axis = currNode->getAxis();
+
+            /* Calculate the plane intersection */
+            const Vec t = SIMD::mul(SIMD::sub(SIMD::set1(currNode->getSplit()),
+                packet.o[axis].ps), packet.dRcp[axis].ps);
+
+            const Mask
+                startsAfterSplit = SIMD::maskOr(masked,
+                    SIMD::cmplt(t, interval.mint.ps)),
+                endsBeforeSplit = SIMD::maskOr(masked,
+                    SIMD::cmpgt(t, interval.maxt.ps));
+
+            currNode = currNode->getLeft() + packet.signs[axis];
+
+            /* The interval completely lies on one side of the split plane */
+            if (EXPECT_TAKEN(SIMD::movemask(startsAfterSplit) == SIMD::FullMask)) {
+                currNode = currNode->getSibling();
+                continue;
+            }
+
+            if (EXPECT_TAKEN(SIMD::movemask(endsBeforeSplit) == SIMD::FullMask))
+                continue;
+
+            stack[stackIndex].node = currNode->getSibling();
+            stack[stackIndex].interval.maxt = interval.maxt;
+            stack[stackIndex].interval.mint.ps = SIMD::max(t, interval.mint.ps);
+            interval.maxt.ps = SIMD::min(t, interval.maxt.ps);
+            masked = SIMD::maskOr(masked,
+                SIMD::cmpgt(interval.mint.ps, interval.maxt.ps));
+            stackIndex++;
+        }
+
+        /* Arrived at a leaf node - intersect against primitives */
+        const IndexType primStart = currNode->getPrimStart();
+        const IndexType primEnd = currNode->getPrimEnd();
+
+        if (EXPECT_NOT_TAKEN(primStart != primEnd)) {
+            TSIMDVector<SIMD>
+                searchStart(SIMD::max(rayInterval.mint.ps,
+                    SIMD::mul(interval.mint.ps, omEps))),
+                searchEnd(SIMD::min(rayInterval.maxt.ps,
+                    SIMD::mul(interval.maxt.ps, opEps)));
+
+            for (IndexType entry=primStart; entry != primEnd; entry++) {
+                const TriAccel &kdTri = m_triAccel[m_indices[entry]];
+                if (EXPECT_TAKEN(kdTri.k != KNoTriangleFlag)) {
+                    itsFound = SIMD::maskOr(itsFound, mitsuba::rayIntersectPacket<SIMD>(
+                        kdTri, packet, searchStart.ps, searchEnd.ps, masked, its));
+                } else {
+                    const Shape *shape = m_shapes[kdTri.shapeIndex];
+                    int maskedLanes = SIMD::movemask(masked);
+                    TSIMDVector<SIMD> hit(SIMD::set1i(0));
+
+                    for (int i=0; i<SIMD::Width; ++i) {
+                        if (maskedLanes & (1 << i))
+                            continue;
+                        Ray ray;
+                        for (int axis=0; axis<3; axis++) {
+                            ray.o[axis] = packet.o[axis].f[i];
+                            ray.d[axis] = packet.d[axis].f[i];
+                            ray.dRcp[axis] = packet.dRcp[axis].f[i];
+                        }
+                        Float t;
+
+                        if (shape->rayIntersect(ray, searchStart.f[i], searchEnd.f[i], t,
+                                reinterpret_cast<uint8_t *>(temp)
+                                + i * MTS_KD_INTERSECTION_TEMP + 2*sizeof(IndexType))) {
+                            its.t.f[i] = t;
+                            its.shapeIndex.i[i] = kdTri.shapeIndex;
+                            its.primIndex.i[i] = KNoTriangleFlag;
+                            hit.f[i] = 1.0f;
+                        }
+                    }
+                    itsFound = SIMD::maskOr(itsFound,
+                        SIMD::cmpgt(hit.ps, SIMD::set1(0.0f)));
+                }
+                searchEnd.ps = SIMD::min(searchEnd.ps, its.t.ps);
+            }
+        }
+
+        /* Abort if the tree has been traversed or if
+           intersections have been found for all rays */
+        if (SIMD::movemask(itsFound) == SIMD::FullMask || --stackIndex < 0)
+            break;
+
+        /* Pop from the stack */
+        currNode = stack[stackIndex].node;
+        interval = stack[stackIndex].interval;
+        masked = SIMD::maskOr(itsFound,
+            SIMD::cmpgt(interval.mint.ps, interval.maxt.ps));
+    }
+}
+
+void ShapeKDTree::rayIntersectPacket(const RayPacket8 &packet,
+        const RayInterval8 &interval, Intersection8 &its, void *temp) const {
+    rayIntersectPacketWide<SIMD8>(packet, interval, its, temp);
+}
+
+#if defined(MTS_AVX512)
+void ShapeKDTree::rayIntersectPacket(const RayPacket16 &packet,
+        const RayInterval16 &interval, Intersection16 &its, void *temp) const {
+    rayIntersectPacketWide<SIMD16>(packet, interval, its, temp);
+}
+#endif
+#endif /* MTS_AVX */
+
+/// Hits of a ray packet of any width, converted to scalars
+struct PacketHits {
+    Float t[16], u[16], v[16];
+    uint32_t shapeIndex[16], primIndex[16];
+};
+
+/// Trace a packet of rays with matching direction signs
+template <typename Packet, typename Interval, typename Its, int Width>
+    static void tracePacket(const ShapeKDTree *kdtree, const Ray *rays,
+        PacketHits &hits, void *temp) {
+    Packet MM_ALIGN64 packet;
+    Interval MM_ALIGN64 interval(rays);
+    Its MM_ALIGN64 its;
+
+    /* Can't fail, since the caller groups the rays by octant */
+    packet.load(rays);
+    kdtree->rayIntersectPacket(packet, interval, its, temp);
+
+    for (int i=0; i<Width; ++i) {
+        hits.t[i] = its.t.f[i];
+        hits.u[i] = its.u.f[i];
+        hits.v[i] = its.v.f[i];
+        hits.shapeIndex[i] = (uint32_t) its.shapeIndex.i[i];
+        hits.primIndex[i] = (uint32_t) its.primIndex.i[i];
+    }
+}
+
+/// Spread the lower 10 bits of \c x such that two zero bits separate each
+static inline uint32_t mortonSpread(uint32_t x) {
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x <<  8)) & 0x0300F00F;
+    x = (x | (x <<  4)) & 0x030C30C3;
+    x = (x | (x <<  2)) & 0x09249249;
+    return x;
+}
+
+#endif /* MTS_HAS_COHERENT_RT */
+
+int ShapeKDTree::getMaxPacketWidth() {
+#if defined(MTS_HAS_COHERENT_RT) && defined(MTS_AVX512)
+    return 16;
+#elif defined(MTS_HAS_COHERENT_RT) && defined(MTS_AVX)
+    return 8;
+#elif defined(MTS_HAS_COHERENT_RT)
+    return 4;
+#else
+    return 1;
+#endif
+}
+
+void ShapeKDTree::rayIntersectBatch(const Ray *rays, size_t count,
+        Intersection *its, int packetWidth) const {
+    rayIntersectStream(rays, count, its, NULL, packetWidth);
+}
+
+void ShapeKDTree::rayIntersectBatch(const Ray *rays, size_t count,
+        bool *occluded, int packetWidth) const {
+    rayIntersectStream(rays, count, NULL, occluded, packetWidth);
+}
+
+void ShapeKDTree::rayIntersectStream(const Ray *rays, size_t count,
+        Intersection *its, bool *occluded, int packetWidth) const {
+    int maxWidth = getMaxPacketWidth();
+    if (packetWidth == 0)
+        packetWidth = maxWidth;
+    else if (packetWidth > maxWidth || (packetWidth != 1 && packetWidth != 4
+            && packetWidth != 8 && packetWidth != 16))
+        Log(EError, "Unsupported ray packet width %i (this build supports "
+            "1, 4, .., %i)", packetWidth, maxWidth);
+
+#if defined(MTS_HAS_COHERENT_RT)
+    if (m_triAccel && m_trianglesOnly && packetWidth >= 4 && count >= 4) {
+        /* Regroup the rays by their direction octant, and within each
+           octant by the Morton code of their origin. Ties are resolved
+           by the index, hence coherent input streams (e.g. camera rays
+           sharing one origin) keep their order */
+        std::vector<std::pair<uint64_t, uint32_t> > order(count);
+        Vector extents = m_aabb.getExtents(), scale;
+        for (int axis=0; axis<3; ++axis)
+            scale[axis] = extents[axis] > 0 ? 1023 / extents[axis] : 0;
+
+        for (size_t i=0; i<count; ++i) {
+            const Ray &ray = rays[i];
+            uint32_t octant = (ray.d.x < 0 ? 1 : 0) | (ray.d.y < 0 ? 2 : 0)
+                | (ray.d.z < 0 ? 4 : 0), code = 0;
+            for (int axis=0; axis<3; ++axis) {
+                Float rel = (ray.o[axis] - m_aabb.min[axis]) * scale[axis];
+                code |= mortonSpread((uint32_t) std::min(std::max(rel,
+                    (Float) 0), (Float) 1023)) << axis;
+            }
+            order[i] = std::make_pair(((uint64_t) octant << 32) | code, (uint32_t) i);
+        }
+        std::sort(order.begin(), order.end());
+
+        uint8_t MM_ALIGN64 temp[16 * MTS_KD_INTERSECTION_TEMP];
+        Ray packetRays[16];
+        PacketHits hits;
+
+        size_t i = 0;
+        while (i < count) {
+            /* Find the end of the current octant */
+            uint64_t octant = order[i].first >> 32;
+            size_t end = i + 1;
+            while (end < count && (order[end].first >> 32) == octant)
+                ++end;
+
+            while (i < end) {
+                /* Use narrower packets for the remaining rays of the octant */
+                int width = packetWidth;
+                while (width > 1 && (size_t) width > end - i)
+                    width = width > 4 ? width / 2 : 1;
+
+                if (width == 1) {
+                    uint32_t idx = order[i++].second;
+                    if (its)
+                        rayIntersect(rays[idx], its[idx]);
+                    else
+                        occluded[idx] = rayIntersect(rays[idx]);
+                    continue;
+                }
+
+                /* Use the same adaptive ray epsilon as rayIntersect() */
+                for (int j=0; j<width; ++j) {
+                    Ray &ray = packetRays[j];
+                    ray = rays[order[i+j].second];
+                    if (ray.mint == Epsilon) {
+                        Float scale = std::max(std::max(std::abs(ray.o.x),
+                            std::abs(ray.o.y)), std::abs(ray.o.z));
+                        ray.mint *= its ? std::max(scale, Epsilon) : scale;
+                    }
+                }
+
+                switch (width) {
+#if defined(MTS_AVX512)
+                    case 16:
+                        tracePacket<RayPacket16, RayInterval16, Intersection16, 16>(
+                            this, packetRays, hits, temp);
+                        break;
+#endif
+#if defined(MTS_AVX)
+                    case 8:
+                        tracePacket<RayPacket8, RayInterval8, Intersection8, 8>(
+                            this, packetRays, hits, temp);
+                        break;
 #endif
+                    default:
+                        tracePacket<RayPacket4, RayInterval4, Intersection4, 4>(
+                            this, packetRays, hits, temp);
+                        break;
+                }
+
+                for (int j=0; j<width; ++j) {
+                    uint32_t idx = order[i+j].second;
+                    bool hit = hits.t[j] != std::numeric_limits<Float>::infinity();
+                    if (!its) {
+                        occluded[idx] = hit;
+                        continue;
+                    }
+                    Intersection &result = its[idx];
+                    result.t = hits.t[j];
+                    if (!hit)
+                        continue;
+                    IntersectionCache cache;
+                    cache.shapeIndex = (SizeType) hits.shapeIndex[j];
+                    cache.primIndex = (SizeType) hits.primIndex[j];
+                    cache.u = hits.u[j];
+                    cache.v = hits.v[j];
+                    fillIntersectionRecord<true>(rays[idx], &cache, result);
+                }
+
+                if (its)
+                    raysTraced += width;
+                else
+                    shadowRaysTraced += width;
+                i += width;
+            }
+        }
+        return;
+    }
+#endif
+
+    for (size_t i=0; i<count; ++i) {
+        if (its)
+            rayIntersect(rays[i], its[i]);
+        else
+            occluded[i] = rayIntersect(rays[i]);
+    }
+}
 
 MTS_IMPLEMENT_CLASS(ShapeKDTree, false, KDTreeBase)
 MTS_NAMESPACE_END
@@ -21,6 +21,7 @@
 #include <mitsuba/core/random.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/zstream.h>
+#include <mitsuba/core/mstream.h>
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/lock.h>
 #include <mitsuba/core/properties.h>
@@ -31,10 +32,6 @@
 #include <boost/filesystem/fstream.hpp>
 #include <boost/unordered_map.hpp>
 
-#define MTS_FILEFORMAT_HEADER     0x041C
-#define MTS_FILEFORMAT_VERSION_V3 0x0003
-#define MTS_FILEFORMAT_VERSION_V4 0x0004
-
 MTS_NAMESPACE_BEGIN
 
 TriMesh::TriMesh(const std::string &name, size_t triangleCount,
@@ -187,6 +184,11 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
         stream->skip(sizeof(short) * 2); // Skip the header
     }
 
+    if (version == MTS_FILEFORMAT_VERSION_V5) {
+        loadUncompressed(stream, NULL);
+        return;
+    }
+
     stream = new ZStream(stream);
     stream->setByteOrder(Stream::ELittleEndian);
 
@@ -199,16 +201,14 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
     bool fileDoublePrecision = flags & EDoublePrecision;
     m_faceNormals = flags & EFaceNormals;
 
-    if (m_positions)
-        delete[] m_positions;
+    releaseArray(m_positions);
 
     m_positions = new Point[m_vertexCount];
     readHelper(stream, fileDoublePrecision,
             reinterpret_cast<Float *>(m_positions),
             m_vertexCount, sizeof(Point)/sizeof(Float));
 
-    if (m_normals)
-        delete[] m_normals;
+    releaseArray(m_normals);
 
     if (flags & EHasNormals) {
         m_normals = new Normal[m_vertexCount];
@@ -219,8 +219,7 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
         m_normals = NULL;
     }
 
-    if (m_texcoords)
-        delete[] m_texcoords;
+    releaseArray(m_texcoords);
 
     if (flags & EHasTexcoords) {
         m_texcoords = new Point2[m_vertexCount];
@@ -231,8 +230,7 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
         m_texcoords = NULL;
     }
 
-    if (m_colors)
-        delete[] m_colors;
+    releaseArray(m_colors);
 
     if (flags & EHasColors) {
         m_colors = new Color3[m_vertexCount];
@@ -243,14 +241,126 @@ void TriMesh::loadCompressed(Stream *_stream, int index) {
         m_colors = NULL;
     }
 
+    releaseArray(m_triangles);
     m_triangles = new Triangle[m_triangleCount];
     stream->readUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
         m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
 
+    m_mmap = NULL;
+    m_surfaceArea = m_invSurfaceArea = -1;
+    m_flipNormals = false;
+}
+
+/// Return the position of the next aligned array in an uncompressed mesh
+static inline size_t alignedPosition(size_t pos) {
+    return (pos + MTS_FILEFORMAT_ALIGNMENT - 1)
+        / MTS_FILEFORMAT_ALIGNMENT * MTS_FILEFORMAT_ALIGNMENT;
+}
+
+/**
+ * Ensure that an aligned array of \c count elements starting at the
+ * current position fits into the memory-mapped file of an uncompressed mesh
+ */
+template <typename T> static void checkMapped(Stream *stream, size_t count) {
+    size_t pos = alignedPosition(stream->getPos()), size = stream->getSize();
+    if (pos > size || count > (size - pos) / sizeof(T))
+        SLog(EError, "Unable to map an array of " SIZE_T_FMT " elements at "
+            "offset " SIZE_T_FMT ": it exceeds the end of the file (" SIZE_T_FMT
+            " bytes). The file is truncated or corrupted!", count, pos, size);
+}
+
+/**
+ * Read an aligned vertex attribute array of an uncompressed mesh. When
+ * \c mapped is specified, the returned pointer references the mapping.
+ */
+template <typename T> static T *readAligned(Stream *stream,
+        const uint8_t *mapped, bool fileDoublePrecision, size_t count) {
+    if (mapped)
+        checkMapped<T>(stream, count);
+    stream->seek(alignedPosition(stream->getPos()));
+    if (mapped) {
+        T *result = reinterpret_cast<T *>(const_cast<uint8_t *>(mapped) + stream->getPos());
+        stream->skip(count * sizeof(T));
+        return result;
+    } else {
+        T *result = new T[count];
+        readHelper(stream, fileDoublePrecision, reinterpret_cast<Float *>(result),
+            count, sizeof(T)/sizeof(Float));
+        return result;
+    }
+}
+
+void TriMesh::loadUncompressed(Stream *stream, MemoryMappedFile *mmap) {
+    uint32_t flags = stream->readUInt();
+    m_name = stream->readString();
+    m_vertexCount = stream->readSize();
+    m_triangleCount = stream->readSize();
+
+    bool fileDoublePrecision = flags & EDoublePrecision;
+#if defined(SINGLE_PRECISION)
+    bool hostDoublePrecision = false;
+#else
+    bool hostDoublePrecision = true;
+#endif
+    m_faceNormals = flags & EFaceNormals;
+
+    releaseArray(m_positions);
+    releaseArray(m_normals);
+    releaseArray(m_texcoords);
+    releaseArray(m_colors);
+    releaseArray(m_triangles);
+
+    /* Reference the data in place if its representation matches the host */
+    const uint8_t *mapped = NULL;
+    if (mmap && fileDoublePrecision == hostDoublePrecision &&
+            Stream::getHostByteOrder() == Stream::ELittleEndian)
+        mapped = static_cast<const uint8_t *>(mmap->getData());
+    m_mmap = mapped ? mmap : NULL;
+
+    m_positions = readAligned<Point>(stream, mapped,
+        fileDoublePrecision, m_vertexCount);
+
+    if (flags & EHasNormals)
+        m_normals = readAligned<Normal>(stream, mapped,
+            fileDoublePrecision, m_vertexCount);
+
+    if (flags & EHasTexcoords)
+        m_texcoords = readAligned<Point2>(stream, mapped,
+            fileDoublePrecision, m_vertexCount);
+
+    if (flags & EHasColors)
+        m_colors = readAligned<Color3>(stream, mapped,
+            fileDoublePrecision, m_vertexCount);
+
+    if (mapped)
+        checkMapped<Triangle>(stream, m_triangleCount);
+    stream->seek(alignedPosition(stream->getPos()));
+    if (mapped) {
+        m_triangles = reinterpret_cast<Triangle *>(
+            const_cast<uint8_t *>(mapped) + stream->getPos());
+    } else {
+        m_triangles = new Triangle[m_triangleCount];
+        stream->readUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
+            m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+    }
+
     m_surfaceArea = m_invSurfaceArea = -1;
     m_flipNormals = false;
 }
 
+void TriMesh::loadMapped(MemoryMappedFile *mmap, size_t offset) {
+    ref<MemoryStream> stream = new MemoryStream(mmap->getData(), mmap->getSize());
+    stream->setByteOrder(Stream::ELittleEndian);
+    stream->seek(offset);
+
+    if (readHeader(stream) != MTS_FILEFORMAT_VERSION_V5)
+        Log(EError, "Unable to map the mesh at offset " SIZE_T_FMT " of \"%s\" "
+            "into memory: it was not stored in the uncompressed format!", offset,
+            mmap->getFilename().filename().string().c_str());
+
+    loadUncompressed(stream, mmap);
+}
+
 short TriMesh::readHeader(Stream *stream) {
     short format = stream->readShort();
     if (format == 0x1C04) {
@@ -263,7 +373,8 @@ short TriMesh::readHeader(Stream *stream) {
     }
     short version = stream->readShort();
     if (version != MTS_FILEFORMAT_VERSION_V3 &&
-        version != MTS_FILEFORMAT_VERSION_V4) {
+        version != MTS_FILEFORMAT_VERSION_V4 &&
+        version != MTS_FILEFORMAT_VERSION_V5) {
         Log(EError, "Encountered an incompatible file version!");
     }
     return version;
@@ -283,7 +394,7 @@ size_t TriMesh::readOffset(Stream *stream, short version, int idx) {
     }
 
     // Seek to the correct position
-    if (version == MTS_FILEFORMAT_VERSION_V4) {
+    if (version >= MTS_FILEFORMAT_VERSION_V4) {
         stream->seek(stream->getSize() - sizeof(uint64_t) * (count-idx) - sizeof(uint32_t));
         return stream->readSize();
     } else {
@@ -310,7 +421,7 @@ int TriMesh::readOffsetDictionary(Stream *stream, short version,
 
     if (streamSize >= minSize) {
         outOffsets.resize(count);
-        if (version == MTS_FILEFORMAT_VERSION_V4) {
+        if (version >= MTS_FILEFORMAT_VERSION_V4) {
             stream->seek(stream->getSize() - sizeof(uint64_t) * count - sizeof(uint32_t));
             if (typeid(size_t) == typeid(uint64_t)) {
                 stream->readArray(&outOffsets[0], count);
@@ -337,18 +448,13 @@ int TriMesh::readOffsetDictionary(Stream *stream, short version,
 }
 
 TriMesh::~TriMesh() {
-    if (m_positions)
-        delete[] m_positions;
-    if (m_normals)
-        delete[] m_normals;
-    if (m_texcoords)
-        delete[] m_texcoords;
+    releaseArray(m_positions);
+    releaseArray(m_normals);
+    releaseArray(m_texcoords);
     if (m_tangents)
         delete[] m_tangents;
-    if (m_colors)
-        delete[] m_colors;
-    if (m_triangles)
-        delete[] m_triangles;
+    releaseArray(m_colors);
+    releaseArray(m_triangles);
 }
 
 AABB TriMesh::getAABB() const {
@@ -385,6 +491,40 @@ void TriMesh::configure() {
     computeUVTangents();
 }
 
+void TriMesh::updateGeometry() {
+    m_aabb.reset();
+    for (size_t i=0; i<m_vertexCount; i++)
+        m_aabb.expandBy(m_positions[i]);
+
+    if (m_normals && !m_faceNormals) {
+        /* Recompute the vertex normals. Their orientation relative to the
+           winding order is kept, since it may have been flipped by the
+           'flipNormals' parameter when the mesh was configured */
+        for (size_t i=0; i<m_triangleCount; i++) {
+            const Triangle &tri = m_triangles[i];
+            Float d = dot(m_normals[tri.idx[0]], cross(
+                m_positions[tri.idx[1]] - m_positions[tri.idx[0]],
+                m_positions[tri.idx[2]] - m_positions[tri.idx[0]]));
+            if (d != 0) {
+                m_flipNormals = d < 0;
+                break;
+            }
+        }
+        computeNormals(true);
+    }
+
+    if (m_tangents) {
+        delete[] m_tangents;
+        m_tangents = NULL;
+        computeUVTangents();
+    }
+
+    /* The sampling table is rebuilt on demand */
+    LockGuard guard(m_mutex);
+    m_areaDistr.clear();
+    m_surfaceArea = m_invSurfaceArea = -1;
+}
+
 void TriMesh::prepareSamplingTable() {
     if (m_triangleCount == 0) {
         Log(EError, "Encountered an empty triangle mesh!");
@@ -470,10 +610,7 @@ void TriMesh::rebuildTopology(Float maxAngle) {
     const Float dpThresh = std::cos(degToRad(maxAngle));
     size_t degenerateTriangles = 0;
 
-    if (m_normals) {
-        delete[] m_normals;
-        m_normals = NULL;
-    }
+    releaseArray(m_normals);
 
     if (m_tangents) {
         delete[] m_tangents;
@@ -574,21 +711,21 @@ void TriMesh::rebuildTopology(Float maxAngle) {
         for (int j=0; j<3; ++j)
             Assert(newTriangles[i].idx[j] != 0xFFFFFFFFU);
 
-    delete[] m_triangles;
+    releaseArray(m_triangles);
     m_triangles = newTriangles;
 
-    delete[] m_positions;
+    releaseArray(m_positions);
     m_positions = new Point[newPositions.size()];
     memcpy(m_positions, &newPositions[0], sizeof(Point) * newPositions.size());
 
     if (m_texcoords) {
-        delete[] m_texcoords;
+        releaseArray(m_texcoords);
         m_texcoords = new Point2[newTexcoords.size()];
         memcpy(m_texcoords, &newTexcoords[0], sizeof(Point2) * newTexcoords.size());
     }
 
     if (m_colors) {
-        delete[] m_colors;
+        releaseArray(m_colors);
         m_colors = new Color3[newColors.size()];
         memcpy(m_colors, &newColors[0], sizeof(Color3) * newColors.size());
     }
@@ -607,13 +744,11 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 void TriMesh::computeNormals(bool force) {
     int invalidNormals = 0;
     if (m_faceNormals) {
-        if (m_normals) {
-            delete[] m_normals;
-            m_normals = NULL;
-        }
+        releaseArray(m_normals);
 
         if (m_flipNormals) {
             /* Change the winding order */
+            detachArray(m_triangles, m_triangleCount);
             for (size_t i=0; i<m_triangleCount; ++i) {
                 Triangle &t = m_triangles[i];
                 std::swap(t.idx[0], t.idx[1]);
@@ -622,12 +757,15 @@ void TriMesh::computeNormals(bool force) {
     } else {
         if (m_normals && !force) {
             if (m_flipNormals) {
+                detachArray(m_normals, m_vertexCount);
                 for (size_t i=0; i<m_vertexCount; i++)
                     m_normals[i] *= -1;
             } else {
                 /* Do nothing */
             }
         } else {
+            if (isMapped(m_normals))
+                releaseArray(m_normals);
             if (!m_normals)
                 m_normals = new Normal[m_vertexCount];
             memset(m_normals, 0, sizeof(Normal)*m_vertexCount);
@@ -1173,6 +1311,64 @@ void TriMesh::serialize(Stream *_stream) const {
         m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
 }
 
+/// Write zeros until the stream position is aligned
+static void writePadding(Stream *stream) {
+    static const uint8_t zeros[MTS_FILEFORMAT_ALIGNMENT] = { 0 };
+    size_t pos = stream->getPos();
+    stream->write(zeros, alignedPosition(pos) - pos);
+}
+
+void TriMesh::serializeUncompressed(Stream *stream) const {
+    if (stream->getByteOrder() != Stream::ELittleEndian)
+        Log(EError, "Tried to serialize a shape to a stream, "
+            "which was not previously set to little endian byte order!");
+
+    stream->writeShort(MTS_FILEFORMAT_HEADER);
+    stream->writeShort(MTS_FILEFORMAT_VERSION_V5);
+
+#if defined(SINGLE_PRECISION)
+    uint32_t flags = ESinglePrecision;
+#else
+    uint32_t flags = EDoublePrecision;
+#endif
+
+    if (m_normals)
+        flags |= EHasNormals;
+    if (m_texcoords)
+        flags |= EHasTexcoords;
+    if (m_colors)
+        flags |= EHasColors;
+    if (m_faceNormals)
+        flags |= EFaceNormals;
+
+    stream->writeUInt(flags);
+    stream->writeString(m_name);
+    stream->writeSize(m_vertexCount);
+    stream->writeSize(m_triangleCount);
+
+    writePadding(stream);
+    stream->writeFloatArray(reinterpret_cast<Float *>(m_positions),
+        m_vertexCount * sizeof(Point)/sizeof(Float));
+    if (m_normals) {
+        writePadding(stream);
+        stream->writeFloatArray(reinterpret_cast<Float *>(m_normals),
+            m_vertexCount * sizeof(Normal)/sizeof(Float));
+    }
+    if (m_texcoords) {
+        writePadding(stream);
+        stream->writeFloatArray(reinterpret_cast<Float *>(m_texcoords),
+            m_vertexCount * sizeof(Point2)/sizeof(Float));
+    }
+    if (m_colors) {
+        writePadding(stream);
+        stream->writeFloatArray(reinterpret_cast<Float *>(m_colors),
+            m_vertexCount * sizeof(Color3)/sizeof(Float));
+    }
+    writePadding(stream);
+    stream->writeUIntArray(reinterpret_cast<uint32_t *>(m_triangles),
+        m_triangleCount * sizeof(Triangle)/sizeof(uint32_t));
+}
+
 size_t TriMesh::getPrimitiveCount() const {
     return m_triangleCount;
 }
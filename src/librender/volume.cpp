@@ -44,6 +44,11 @@ Float VolumeDataSource::lookupFloat(const Point &p) const {
     return 0;
 }
 
+void VolumeDataSource::lookupFloat(const Point *p, Float *result, size_t count) const {
+    for (size_t i=0; i<count; ++i)
+        result[i] = lookupFloat(p[i]);
+}
+
 Spectrum VolumeDataSource::lookupSpectrum(const Point &p) const {
     Log(EError, "'%s': does not implement lookupSpectrum()!", getClass()->getName().c_str());
     return Spectrum(0.0f);
@@ -9,11 +9,32 @@
 #include <mitsuba/render/scene.h>
 #include <mitsuba/render/volume.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/properties.h>
 
 MTS_NAMESPACE_BEGIN
 
+/// Generate statistics about the number of null collisions?
+// #define NANOVDB_STATISTICS 1
+
+#if defined(NANOVDB_STATISTICS)
+static StatsCounter nullCollisions("NanoVDB medium", "Null collisions");
+#endif
+
+/**
+ * NanoVDB based heterogeneous medium. Free-flight distances are sampled
+ * with delta tracking and transmittance is estimated with ratio tracking.
+ *
+ * By default (\c majorantGrid = true), both are driven by a coarse grid of
+ * conservative density bounds: every cell covers \c majorantCellSize^3
+ * voxels (dilated by the trilinear reconstruction footprint) and stores the
+ * minimum and maximum density found there. Rays are marched through this grid
+ * with a 3D-DDA, so empty space is skipped entirely and sparse regions use a
+ * tight local majorant. The cell minimum additionally serves as control
+ * density for residual ratio tracking. Setting \c majorantGrid = false
+ * reverts to the single global majorant.
+ */
 class NanovdbMedium : public Medium {
  public:
   NanovdbMedium(const Properties &props) : Medium(props) {
@@ -22,6 +43,10 @@ class NanovdbMedium : public Medium {
     m_filename = props.getString("filename");
     m_gridname = props.getString("gridname", "");
     m_volumeToWorld = props.getTransform("toWorld", Transform());
+    m_useMajorantGrid = props.getBoolean("majorantGrid", true);
+    m_majorantCellSize = props.getInteger("majorantCellSize", 8);
+    if (m_majorantCellSize < 1)
+      Log(EError, "The 'majorantCellSize' parameter must be positive!");
     loadFromFile(m_filename);
   }
 
@@ -44,6 +69,8 @@ class NanovdbMedium : public Medium {
           "Cannot use anisotropic phase function: "
           "did not specify a particle orientation field!");
     if (m_anisotropicMedium) m_maxDensity *= m_phaseFunction->sigmaDirMax();
+    m_majorantScale = m_scale;
+    if (m_anisotropicMedium) m_majorantScale *= m_phaseFunction->sigmaDirMax();
   }
 
   bool sampleDistance(const Ray &ray, MediumSamplingRecord &mRec,
@@ -59,15 +86,42 @@ class NanovdbMedium : public Medium {
         {index_ray.o.x, index_ray.o.y, index_ray.o.z},
         {index_ray.d.x, index_ray.d.y, index_ray.d.z}, index_ray.mint,
         index_ray.maxt);
+
+    auto accessor = m_density->getAccessor();
+    auto g_sampler = nanovdb::createSampler<1>(accessor);
+
+    if (m_useMajorantGrid) {
+      /* Delta tracking against the piecewise constant majorant: the
+         exponential free-flight sampling is simply restarted at every
+         cell boundary (memorylessness) */
+      bool success = false;
+      traverseMajorants(
+          index_ray, [&](Float t0, Float t1, Float /* mu_min */, Float mu_bar) {
+            if (mu_bar <= 0) return true;
+            Float inv_mu_bar = 1 / mu_bar, t = t0;
+            while (true) {
+              t -= math::fastlog(1 - sampler->next1D()) * inv_mu_bar;
+              if (t >= t1) return true;
+#if defined(NANOVDB_STATISTICS)
+              ++nullCollisions;
+#endif
+              Float mu = g_sampler(nano_index_ray(t)) * m_scale;
+              if (mu * inv_mu_bar > sampler->next1D()) {
+                fillSamplingRecord(ray, index_ray(t), mu, mRec);
+                success = true;
+                return false;
+              }
+            }
+          });
+      return success;
+    }
+
     Float tMin, tMax;
     if (!nano_index_ray.intersects(m_density->indexBBox(), tMin, tMax))
       return false;
     nano_index_ray.setMaxTime(nanovdb::Min(tMax, nano_index_ray.t1()));
     nano_index_ray.setMinTime(nanovdb::Max(tMin, nano_index_ray.t0()));
 
-    auto accessor = m_density->getAccessor();
-    auto g_sampler = nanovdb::createSampler<1>(accessor);
-
     nanovdb::TreeMarcher<nanovdb::FloatTree::LeafNodeType, nanovdb::Ray<Float>,
                          nanovdb::FloatTree::AccessorType>
         marcher(accessor);
@@ -86,94 +140,17 @@ class NanovdbMedium : public Medium {
         if (++cnt > 100000) {
           Log(EDebug, "sample too many: %d", cnt);
         }
+#if defined(NANOVDB_STATISTICS)
+        ++nullCollisions;
+#endif
         mu = g_sampler(nano_index_ray(t)) * m_scale;
 
         if (mu * inv_mu_bar > sampler->next1D()) {
-          Point p = m_volumeToWorld(index_ray(t));
-          mRec.p = p;
-          mRec.t = (mRec.p - ray.o).length() / ray.d.length();
-          Spectrum albedo = m_albedo->lookupSpectrum(p);
-          mRec.sigmaS = albedo * mu;
-          mRec.sigmaA = Spectrum(mu) - mRec.sigmaS;
-          mRec.transmittance = Spectrum(mu != 0.0f ? 1.0f / mu : 0);
-          if (!std::isfinite(
-                  mRec.transmittance[0]))  // prevent rare overflow warnings
-            mRec.transmittance = Spectrum(0.0f);
-          mRec.orientation = m_orientation != NULL
-                                 ? m_orientation->lookupVector(p)
-                                 : Vector(0.0f);
-          mRec.medium = this;
+          fillSamplingRecord(ray, index_ray(t), mu, mRec);
           return true;
         }
       }
     }
-    // Float mu_bar = 0;
-    // for (Float t0 = tMin, t1 = tMax; marcher.step(&node, t0, t1);) {
-    //   mu_bar = std::max(mu_bar, node->maximum());
-    // }
-
-    // mu_bar *= m_scale;
-    // if (m_anisotropicMedium) mu_bar *= m_phaseFunction->sigmaDirMax();
-    // Float inv_mu_bar = 1 / mu_bar;
-
-    // Float t = tMin, mu = 0;
-    // while (true) {
-    //   t -= math::fastlog(1 - sampler->next1D()) * inv_mu_bar;
-    //   if (t >= tMax) break;
-
-    //   Point p = ray(t);
-    //   mu = g_sampler(nano_index_ray(t)) * m_scale;
-
-    //   if (mu * inv_mu_bar > sampler->next1D()) {
-    //     mRec.p = m_volumeToWorld(index_ray(t));
-    //     mRec.t = (mRec.p - ray.o).length() / ray.d.length();
-    //     Spectrum albedo = m_albedo->lookupSpectrum(p);
-    //     mRec.sigmaS = albedo * mu;
-    //     mRec.sigmaA = Spectrum(mu) - mRec.sigmaS;
-    //     mRec.transmittance = Spectrum(mu != 0.0f ? 1.0f / mu : 0);
-    //     if (!std::isfinite(
-    //             mRec.transmittance[0]))  // prevent rare overflow warnings
-    //       mRec.transmittance = Spectrum(0.0f);
-    //     mRec.orientation = m_orientation != NULL
-    //                            ? m_orientation->lookupVector(p)
-    //                            : Vector(0.0f);
-    //     mRec.medium = this;
-    //     return true;
-    //   }
-    // }
-
-    // Float tr = 1;
-    // while (marcher.step(&node, tMin, tMax)) {
-    //   Float mu_bar = node->maximum() * m_scale;
-    //   if (m_anisotropicMedium) mu_bar *= m_phaseFunction->sigmaDirMax();
-    //   Float t = tMin;
-    //   Float inv_mu_bar = 1 / mu_bar;
-    //   Float weight = 1;
-    //   for (;;) {
-    //     t += -math::fastlog(1 - sampler->next1D()) * inv_mu_bar;
-    //     if (t >= tMax) break;
-    //     Float mu = g_sampler(index_ray(t)) * m_scale;
-    //     tr *= 1 - mu * inv_mu_bar;
-    //     if (mu * inv_mu_bar > sampler->next1D()) {
-    //       // mRec.t =
-    //       mRec.p = m_volumeToWorld(index_ray(t));
-    //       mRec.t = (mRec.p - ray.o).length() / ray.d.length();
-    //       Spectrum albedo = m_albedo->lookupSpectrum(mRec.p);
-    //       mRec.sigmaS = albedo * mu;
-    //       mRec.sigmaA = Spectrum(mu) - mRec.sigmaS;
-    //       mRec.transmittance =
-    //           Spectrum(mu != 0.0f ? 1.0f / mu : 0);
-    //       if (!std::isfinite(
-    //               mRec.transmittance[0]))  // prevent rare overflow warnings
-    //         mRec.transmittance = Spectrum(0.0f);
-    //       mRec.orientation = m_orientation != NULL
-    //                              ? m_orientation->lookupVector(mRec.p)
-    //                              : Vector(0.0f);
-    //       mRec.medium = this;
-    //       return true;
-    //     }
-    //   }
-    // }
     return false;
   }
 
@@ -188,14 +165,41 @@ class NanovdbMedium : public Medium {
         {index_ray.o.x, index_ray.o.y, index_ray.o.z},
         {index_ray.d.x, index_ray.d.y, index_ray.d.z}, index_ray.mint,
         index_ray.maxt);
+
+    auto accessor = m_density->getAccessor();
+    auto g_sampler = nanovdb::createSampler<1>(accessor);
+
+    if (m_useMajorantGrid) {
+      /* Residual ratio tracking: the per-cell minimum acts as control
+         density whose contribution is integrated analytically, and only
+         the residual between it and the cell majorant is tracked */
+      Float tr = 1.0;
+      traverseMajorants(
+          index_ray, [&](Float t0, Float t1, Float mu_c, Float mu_bar) {
+            if (mu_c > 0) tr *= math::fastexp(-mu_c * (t1 - t0));
+            Float mu_r = mu_bar - mu_c;
+            if (mu_r <= 0) return tr > 0;
+            Float inv_mu_r = 1 / mu_r, t = t0;
+            while (true) {
+              t -= math::fastlog(1 - sampler->next1D()) * inv_mu_r;
+              if (t >= t1) break;
+#if defined(NANOVDB_STATISTICS)
+              ++nullCollisions;
+#endif
+              Float mu = g_sampler(nano_index_ray(t)) * m_scale;
+              tr *= 1 - (mu - mu_c) * inv_mu_r;
+            }
+            return tr > 0;
+          });
+      return Spectrum(std::max(tr, (Float)0));
+    }
+
     Float tMin, tMax;
     if (!nano_index_ray.intersects(m_density->indexBBox(), tMin, tMax))
       return Spectrum(1.0);
     nano_index_ray.setMaxTime(nanovdb::Min(tMax, nano_index_ray.t1()));
     nano_index_ray.setMinTime(nanovdb::Max(tMin, nano_index_ray.t0()));
 
-    auto accessor = m_density->getAccessor();
-    auto g_sampler = nanovdb::createSampler<1>(accessor);
     nanovdb::TreeMarcher<nanovdb::FloatTree::LeafNodeType, nanovdb::Ray<Float>,
                          nanovdb::FloatTree::AccessorType>
         marcher(accessor);
@@ -211,6 +215,9 @@ class NanovdbMedium : public Medium {
       for (;;) {
         t += -math::fastlog(1 - sampler->next1D()) * inv_mu_bar;
         if (t >= tMax) break;
+#if defined(NANOVDB_STATISTICS)
+        ++nullCollisions;
+#endif
         Float density = g_sampler(nano_index_ray(t)) * m_scale;
         Float val = density * inv_mu_bar;
         if (val > 1) {
@@ -283,6 +290,7 @@ class NanovdbMedium : public Medium {
     m_maxDensity = max_val * m_scale;
     updateTransform(openvdb_grid);
     calculateBoundingBox(openvdb_grid);
+    if (m_useMajorantGrid) buildMajorantGrid(openvdb_grid);
     m_densityHandle =
         std::make_shared<nanovdb::GridHandle<nanovdb::HostBuffer>>(
             nanovdb::openToNanoVDB(openvdb_grid));
@@ -290,6 +298,204 @@ class NanovdbMedium : public Medium {
 
   MTS_DECLARE_CLASS()
  protected:
+  /// Populate a sampling record for a real collision at index-space point \c p
+  void fillSamplingRecord(const Ray &ray, const Point &p, Float mu,
+                          MediumSamplingRecord &mRec) const {
+    mRec.p = m_volumeToWorld(p);
+    mRec.t = (mRec.p - ray.o).length() / ray.d.length();
+    Spectrum albedo = m_albedo->lookupSpectrum(mRec.p);
+    mRec.sigmaS = albedo * mu;
+    mRec.sigmaA = Spectrum(mu) - mRec.sigmaS;
+    mRec.transmittance = Spectrum(mu != 0.0f ? 1.0f / mu : 0);
+    if (!std::isfinite(mRec.transmittance[0]))  // prevent rare overflow warnings
+      mRec.transmittance = Spectrum(0.0f);
+    mRec.orientation = m_orientation != NULL
+                           ? m_orientation->lookupVector(mRec.p)
+                           : Vector(0.0f);
+    mRec.medium = this;
+  }
+
+  /**
+   * \brief Walk the majorant grid cells pierced by an index-space ray
+   *
+   * Invokes <tt>functor(t0, t1, mu_min, mu_max)</tt> for every non-empty
+   * intersection with a cell, in front-to-back order. The bounds include
+   * the density scale (and the directional factor for anisotropic media).
+   * Traversal stops early when the functor returns \c false.
+   */
+  template <typename Functor>
+  void traverseMajorants(const Ray &ray, Functor functor) const {
+    const Float invCellSize = 1.0f / (Float)m_majorantCellSize;
+    Float o[3], d[3], mint = ray.mint, maxt = ray.maxt;
+
+    /* Transform into the grid's cell coordinates and clip */
+    for (int i = 0; i < 3; ++i) {
+      o[i] = (ray.o[i] - m_majorantOrigin[i]) * invCellSize;
+      d[i] = ray.d[i] * invCellSize;
+      if (d[i] == 0) {
+        if (o[i] < 0 || o[i] > m_majorantRes[i]) return;
+        continue;
+      }
+      Float invD = 1 / d[i];
+      Float t0 = -o[i] * invD, t1 = (m_majorantRes[i] - o[i]) * invD;
+      if (t0 > t1) std::swap(t0, t1);
+      mint = std::max(mint, t0);
+      maxt = std::min(maxt, t1);
+    }
+    if (!(mint < maxt)) return;
+
+    int cell[3], step[3];
+    Float tNext[3], tDelta[3];
+    for (int i = 0; i < 3; ++i) {
+      Float p = o[i] + d[i] * mint;
+      cell[i] = math::clamp(math::floorToInt(p), 0, m_majorantRes[i] - 1);
+      if (d[i] > 0) {
+        step[i] = 1;
+        tDelta[i] = 1 / d[i];
+        tNext[i] = mint + (cell[i] + 1 - p) * tDelta[i];
+      } else if (d[i] < 0) {
+        step[i] = -1;
+        tDelta[i] = -1 / d[i];
+        tNext[i] = mint + (p - cell[i]) * tDelta[i];
+      } else {
+        step[i] = 0;
+        tDelta[i] = tNext[i] = std::numeric_limits<Float>::infinity();
+      }
+    }
+
+    Float t = mint;
+    while (true) {
+      int axis = (tNext[0] < tNext[1]) ? (tNext[0] < tNext[2] ? 0 : 2)
+                                       : (tNext[1] < tNext[2] ? 1 : 2);
+      Float tEnd = std::min(tNext[axis], maxt);
+      if (tEnd > t) {
+        size_t idx = ((size_t)cell[2] * m_majorantRes[1] + cell[1]) *
+                         m_majorantRes[0] + cell[0];
+        if (!functor(t, tEnd, m_majorantMin[idx] * m_scale,
+                     m_majorantMax[idx] * m_majorantScale))
+          return;
+      }
+      if (tNext[axis] >= maxt) return;
+      t = tNext[axis];
+      cell[axis] += step[axis];
+      if (cell[axis] < 0 || cell[axis] >= m_majorantRes[axis]) return;
+      tNext[axis] += tDelta[axis];
+    }
+  }
+
+  /**
+   * \brief Precompute the coarse majorant grid from the OpenVDB tree
+   *
+   * Every leaf node and active tile is splatted with its value range into
+   * all cells whose trilinear footprint it overlaps. Cells that are not
+   * entirely covered by leaves/tiles also see the background value. The
+   * stored bounds are unscaled, see \ref configure().
+   */
+  void buildMajorantGrid(openvdb::FloatGrid::Ptr grid) {
+    ref<Timer> timer = new Timer();
+    openvdb::CoordBBox bbox = grid->evalActiveVoxelBoundingBox();
+    const Float background = grid->background();
+
+    /* Positions that can reconstruct a non-background density */
+    int extent[3];
+    for (int i = 0; i < 3; ++i) {
+      m_majorantOrigin[i] = bbox.min()[i] - 1;
+      extent[i] = std::max(bbox.max()[i] - bbox.min()[i] + 2, 1);
+    }
+
+    /* Coarsen the grid until it stays within a reasonable memory budget */
+    const size_t maxCells = 1u << 24;
+    while (true) {
+      for (int i = 0; i < 3; ++i)
+        m_majorantRes[i] = std::max(
+            (extent[i] + m_majorantCellSize - 1) / m_majorantCellSize, 1);
+      if ((size_t)m_majorantRes[0] * m_majorantRes[1] * m_majorantRes[2] <=
+          maxCells)
+        break;
+      m_majorantCellSize *= 2;
+    }
+
+    const size_t cellCount =
+        (size_t)m_majorantRes[0] * m_majorantRes[1] * m_majorantRes[2];
+    const int footprint = m_majorantCellSize + 3;
+    const uint64_t fullCoverage = (uint64_t)footprint * footprint * footprint;
+    std::vector<uint64_t> coverage(cellCount, 0);
+    m_majorantMin.assign(cellCount, std::numeric_limits<Float>::infinity());
+    m_majorantMax.assign(cellCount, -std::numeric_limits<Float>::infinity());
+
+    auto splat = [&](const openvdb::CoordBBox &box, Float minValue,
+                     Float maxValue) {
+      int lo[3], hi[3];
+      for (int i = 0; i < 3; ++i) {
+        /* Cell c reads voxels [origin + c*S - 1, origin + (c+1)*S + 1] */
+        int b0 = box.min()[i] - m_majorantOrigin[i],
+            b1 = box.max()[i] - m_majorantOrigin[i];
+        lo[i] = std::max(
+            math::floorToInt((Float)(b0 - 1) / m_majorantCellSize) - 1, 0);
+        hi[i] = std::min(
+            math::floorToInt((Float)(b1 + 1) / m_majorantCellSize),
+            m_majorantRes[i] - 1);
+        if (lo[i] > hi[i]) return;
+      }
+      for (int z = lo[2]; z <= hi[2]; ++z) {
+        for (int y = lo[1]; y <= hi[1]; ++y) {
+          for (int x = lo[0]; x <= hi[0]; ++x) {
+            const int c[3] = {x, y, z};
+            uint64_t overlap = 1;
+            for (int i = 0; i < 3; ++i) {
+              int f0 = m_majorantOrigin[i] + c[i] * m_majorantCellSize - 1,
+                  f1 = f0 + footprint - 1;
+              int o0 = std::max(f0, box.min()[i]),
+                  o1 = std::min(f1, box.max()[i]);
+              overlap *= (uint64_t)std::max(o1 - o0 + 1, 0);
+            }
+            if (overlap == 0) continue;
+            size_t idx = ((size_t)z * m_majorantRes[1] + y) * m_majorantRes[0] + x;
+            coverage[idx] += overlap;
+            m_majorantMin[idx] = std::min(m_majorantMin[idx], minValue);
+            m_majorantMax[idx] = std::max(m_majorantMax[idx], maxValue);
+          }
+        }
+      }
+    };
+
+    for (auto leaf = grid->tree().cbeginLeaf(); leaf; ++leaf) {
+      Float minValue = std::numeric_limits<Float>::infinity(),
+            maxValue = -std::numeric_limits<Float>::infinity();
+      for (auto it = leaf->cbeginValueAll(); it; ++it) {
+        minValue = std::min(minValue, (Float)*it);
+        maxValue = std::max(maxValue, (Float)*it);
+      }
+      splat(leaf->getNodeBoundingBox(), minValue, maxValue);
+    }
+
+    for (auto it = grid->cbeginValueOn(); it; ++it) {
+      if (it.isVoxelValue()) continue;
+      openvdb::CoordBBox box;
+      it.getBoundingBox(box);
+      splat(box, *it, *it);
+    }
+
+    size_t emptyCells = 0;
+    for (size_t i = 0; i < cellCount; ++i) {
+      if (coverage[i] < fullCoverage) {
+        /* Part of the footprint reconstructs from the background */
+        m_majorantMin[i] = std::min(m_majorantMin[i], background);
+        m_majorantMax[i] = std::max(m_majorantMax[i], background);
+      }
+      m_majorantMin[i] = std::max(m_majorantMin[i], (Float)0);
+      m_majorantMax[i] = std::max(m_majorantMax[i], (Float)0);
+      if (m_majorantMax[i] == 0) ++emptyCells;
+    }
+
+    Log(EDebug,
+        "Majorant grid: %i x %i x %i cells of %i^3 voxels (%s), %.1f%% empty, "
+        "built in %i ms", m_majorantRes[0], m_majorantRes[1], m_majorantRes[2],
+        m_majorantCellSize,
+        memString(cellCount * 2 * sizeof(Float)).c_str(),
+        100.0f * emptyCells / (Float)cellCount, timer->getMilliseconds());
+  }
+
   void updateTransform(openvdb::FloatGrid::Ptr grid) {
     Matrix4x4 mat;
     openvdb::math::Mat4d g_mat =
@@ -336,6 +542,13 @@ class NanovdbMedium : public Medium {
   Transform m_volumeToWorld;
   Transform m_worldToVolume;
   Float m_maxDensity;
+  bool m_useMajorantGrid;
+  int m_majorantCellSize;
+  Float m_majorantScale;
+  int m_majorantOrigin[3];
+  int m_majorantRes[3];
+  std::vector<Float> m_majorantMin;
+  std::vector<Float> m_majorantMax;
 };
 
 MTS_IMPLEMENT_CLASS_S(NanovdbMedium, false, Medium)
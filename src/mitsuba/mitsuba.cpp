@@ -71,6 +71,8 @@ void help() {
     cout <<  "                       out -- by default, \"~/mitsuba\" is used)" << endl << endl;
     cout <<  "   -s file     Connect to additional Mitsuba servers specified in a file" << endl;
     cout <<  "               with one name per line (same format as in -c)" << endl<< endl;
+    cout <<  "   -Z level    Compress the messages sent to the servers specified using -c" << endl;
+    cout <<  "               and -s (zlib level 1-9, Default: 0, i.e. no compression)" << endl << endl;
     cout <<  "   -j count    Simultaneously schedule several scenes. Can sometimes accelerate" << endl;
     cout <<  "               rendering when large amounts of processing power are available" << endl;
     cout <<  "               (e.g. when running Mitsuba on a cluster. Default: 1)" << endl << endl;
@@ -79,6 +81,16 @@ void help() {
     cout <<  "   -r sec      Write (partial) output images every 'sec' seconds" << endl << endl;
     cout <<  "   -b res      Specify the block resolution used to split images into parallel" << endl;
     cout <<  "               workloads (default: 32). Only applies to some integrators." << endl << endl;
+    cout <<  "   -W          Let local worker threads steal work units from each other" << endl;
+    cout <<  "               instead of acquiring every unit from the central queue." << endl;
+    cout <<  "               Reduces scheduling overheads on machines with many cores" << endl << endl;
+    cout <<  "   -N          NUMA mode: pin the local worker threads to the cores of each" << endl;
+    cout <<  "               NUMA node, interleave acceleration data structures across" << endl;
+    cout <<  "               nodes, and report the per-node work unit timings" << endl << endl;
+    cout <<  "   -P          Load scenes in parallel: construct all shapes, textures, volumes," << endl;
+    cout <<  "               etc. on the local worker threads once the file has been parsed" << endl << endl;
+    cout <<  "   -S file     Profiling: measure the time spent in ray intersection, BSDF and" << endl;
+    cout <<  "               emitter sampling, and write all statistics to a JSON file" << endl << endl;
     cout <<  "   -v          Be more verbose (can be specified twice)" << endl << endl;
     cout <<  "   -L level    Explicitly specify the log level (trace/debug/info/warn/error)" << endl << endl;
     cout <<  "   -w          Treat warnings as errors" << endl << endl;
@@ -135,14 +147,16 @@ int mitsuba_app(int argc, char **argv) {
         int nprocs_avail = getCoreCount(), nprocs = nprocs_avail;
         int numParallelScenes = 1;
         std::string nodeName = getHostName(),
-                    networkHosts = "", destFile="";
+                    networkHosts = "", destFile="", statsFile="";
         bool quietMode = false, progressBars = true, skipExisting = false;
+        bool workStealing = false, numaMode = false;
         ELogLevel logLevel = EInfo;
         ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver();
         bool treatWarningsAsErrors = false;
         std::map<std::string, std::string, SimpleStringOrdering> parameters;
         int blockSize = 32;
         int flushTimer = -1;
+        int compressionLevel = 0;
 
         if (argc < 2) {
             help();
@@ -151,7 +165,7 @@ int mitsuba_app(int argc, char **argv) {
 
         optind = 1;
         /* Parse command-line arguments */
-        while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:p:L:qhzvtwx")) != -1) {
+        while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:p:L:S:Z:qhzvtwxWNP")) != -1) {
             switch (optchar) {
                 case 'a': {
                         std::vector<std::string> paths = tokenize(optarg, ";");
@@ -215,6 +229,11 @@ int mitsuba_app(int argc, char **argv) {
                 case 'x':
                     skipExisting = true;
                     break;
+                case 'Z':
+                    compressionLevel = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || compressionLevel < 0 || compressionLevel > 9)
+                        SLog(EError, "Could not parse the compression level!");
+                    break;
                 case 'p':
                     nprocs = strtol(optarg, &end_ptr, 10);
                     if (*end_ptr != '\0')
@@ -240,6 +259,18 @@ int mitsuba_app(int argc, char **argv) {
                 case 'z':
                     progressBars = false;
                     break;
+                case 'W':
+                    workStealing = true;
+                    break;
+                case 'N':
+                    numaMode = true;
+                    break;
+                case 'S':
+                    statsFile = optarg;
+                    break;
+                case 'P':
+                    SceneHandler::setParallelLoading(true);
+                    break;
                 case 'q':
                     quietMode = true;
                     break;
@@ -251,6 +282,7 @@ int mitsuba_app(int argc, char **argv) {
         }
 
         ProgressReporter::setEnabled(progressBars);
+        Statistics::setTimingEnabled(!statsFile.empty());
 
         /* Initialize OpenMP */
         Thread::initializeOpenMP(nprocs);
@@ -276,10 +308,12 @@ int mitsuba_app(int argc, char **argv) {
 
         /* Configure the scheduling subsystem */
         Scheduler *scheduler = Scheduler::getInstance();
-        bool useCoreAffinity = nprocs == nprocs_avail;
+        bool useCoreAffinity = nprocs == nprocs_avail && !numaMode;
         for (int i=0; i<nprocs; ++i)
             scheduler->registerWorker(new LocalWorker(useCoreAffinity ? i : -1,
                 formatString("wrk%i", i)));
+        scheduler->setWorkStealing(workStealing);
+        scheduler->setNUMAMode(numaMode);
         std::vector<std::string> hosts = tokenize(networkHosts, ";");
 
         /* Establish network connections to nested servers */
@@ -311,7 +345,7 @@ int mitsuba_app(int argc, char **argv) {
                 stream = new SSHStream(tokens[0], tokens[1], cmdLine);
             }
             try {
-                scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream));
+                scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream, compressionLevel));
             } catch (std::runtime_error &e) {
                 if (hostName.find("@") != std::string::npos) {
 #if defined(__WINDOWS__)
@@ -406,6 +440,13 @@ int mitsuba_app(int argc, char **argv) {
         delete parser;
 
         Statistics::getInstance()->printStats();
+
+        if (!statsFile.empty()) {
+            std::ofstream os(statsFile.c_str());
+            if (!os.good())
+                SLog(EError, "Could not write the statistics to \"%s\"!", statsFile.c_str());
+            os << Statistics::getInstance()->getStatsJSON();
+        }
     } catch (const std::exception &e) {
         std::cerr << "Caught a critical exception: " << e.what() << endl;
         return -1;
@@ -106,10 +106,13 @@ int mtssrv(int argc, char **argv) {
         std::string hostName = getFQDN();
         FileResolver *fileResolver = Thread::getThread()->getFileResolver();
         bool hostNameSet = false;
+        int compressionLevel = 0;
+        size_t cacheMemory = (size_t) MTS_RESOURCE_CACHE_SIZE;
+        fs::path cacheDirectory;
 
         optind = 1;
         /* Parse command-line arguments */
-        while ((optchar = getopt(argc, argv, "a:c:s:n:p:i:l:L:qhv")) != -1) {
+        while ((optchar = getopt(argc, argv, "a:c:s:n:p:i:l:L:C:M:Z:qhv")) != -1) {
             switch (optchar) {
                 case 'a': {
                         std::vector<std::string> paths = tokenize(optarg, ";");
@@ -173,6 +176,19 @@ int mtssrv(int argc, char **argv) {
                             SLog(EError, "Could not parse the port number");
                     }
                     break;
+                case 'C':
+                    cacheDirectory = optarg;
+                    break;
+                case 'M':
+                    cacheMemory = strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0')
+                        SLog(EError, "Could not parse the resource cache size!");
+                    break;
+                case 'Z':
+                    compressionLevel = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || compressionLevel < 0 || compressionLevel > 9)
+                        SLog(EError, "Could not parse the compression level!");
+                    break;
                 case 'q':
                     quietMode = true;
                     break;
@@ -197,6 +213,12 @@ int mtssrv(int argc, char **argv) {
                     cout <<  "                       out -- by default, \"~/mitsuba\" is used)" << endl << endl;
                     cout <<  "   -s file     Connect to additional Mitsuba servers specified in a file" << endl;
                     cout <<  "               with one name per line (same format as in -c)" << endl<< endl;
+                    cout <<  "   -Z level    Compress the messages sent to the servers specified using -c" << endl;
+                    cout <<  "               and -s (zlib level 1-9, Default: 0, i.e. no compression)" << endl << endl;
+                    cout <<  "   -M size     Memory used to cache scene resources between jobs, in MiB" << endl;
+                    cout <<  "               (Default: " << MTS_RESOURCE_CACHE_SIZE << ")" << endl << endl;
+                    cout <<  "   -C path     Also keep the cached scene resources in this directory, so" << endl;
+                    cout <<  "               that they survive restarts of the server" << endl << endl;
                     cout <<  "   -i name     IP address / host name on which to listen for connections" << endl << endl;
                     cout <<  "   -l port     Listen for connections on a certain port (Default: " << MTS_DEFAULT_PORT << ")." << endl;
                     cout <<  "               To listen on stdin, specify \"-ls\" (implies -q)" << endl << endl;
@@ -234,6 +256,9 @@ int mtssrv(int argc, char **argv) {
         SetConsoleCtrlHandler((PHANDLER_ROUTINE) CtrlHandler, TRUE);
 #endif
 
+        /* Configure the cache for resources received from clients */
+        StreamBackend::configureResourceCache(cacheMemory * 1024 * 1024, cacheDirectory);
+
         /* Configure the scheduling subsystem */
         Scheduler *scheduler = Scheduler::getInstance();
         for (int i=0; i<nprocs; ++i)
@@ -269,7 +294,7 @@ int mtssrv(int argc, char **argv) {
                 stream = new SSHStream(tokens[0], tokens[1], cmdLine);
             }
             try {
-                scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream));
+                scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream, compressionLevel));
             } catch (std::runtime_error &e) {
                 if (hostName.find("@") != std::string::npos) {
 #if defined(__WINDOWS__)
@@ -570,7 +570,7 @@ void GLWidget::keyPressEvent(QKeyEvent *event) {
                 m_aabb.reset();
             } else if (m_context->scene) {
                 m_context->selectionMode = EScene;
-                m_aabb = m_context->scene->getKDTree()->getAABB();
+                m_aabb = m_context->scene->getGeometryAABB();
             }
             m_context->selectedShape = NULL;
             emit selectionChanged();
@@ -1300,7 +1300,8 @@ void GLWidget::paintGL() {
             m_renderer->setBlendMode(Renderer::EBlendAdditive);
 
             if (m_context->showKDTree) {
-                oglRenderKDTree(m_context->scene->getKDTree());
+                if (m_context->scene->getKDTree()->isBuilt())
+                    oglRenderKDTree(m_context->scene->getKDTree());
                 const ref_vector<Shape> &shapes = m_context->scene->getShapes();
                 for (size_t j=0; j<shapes.size(); ++j)
                     if (shapes[j]->getKDTree())
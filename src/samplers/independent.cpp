@@ -92,6 +92,10 @@ public:
         m_dimension1DArray = m_dimension2DArray = 0;
     }
 
+    void seed(uint64_t value) {
+        m_random->seed(value);
+    }
+
     Float next1D() {
         return m_random->nextFloat();
     }
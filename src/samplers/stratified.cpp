@@ -166,6 +166,10 @@ public:
         m_dimension1DArray = m_dimension2DArray = 0;
     }
 
+    void seed(uint64_t value) {
+        m_random->seed(value);
+    }
+
     void setSampleIndex(size_t sampleIndex) {
         m_sampleIndex = sampleIndex;
         m_dimension1D = m_dimension2D = 0;
@@ -23,6 +23,8 @@
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/mstream.h>
 #include <mitsuba/core/mmap.h>
+#include <mitsuba/core/timer.h>
+#include <boost/algorithm/string.hpp>
 
 #define SHAPE_PER_SEGMENT 1
 #define NO_CLIPPING_SUPPORT 1
@@ -43,6 +45,14 @@ public:
 
     SpaceTimeKDTree(const std::vector<Float> &times) : m_times(times) { }
 
+    /// Create an (unbuilt) tree, which references the same geometry as \c other
+    SpaceTimeKDTree(const SpaceTimeKDTree *other)
+        : m_times(other->m_times), m_meshes(other->m_meshes) {
+        for (size_t i=0; i<m_meshes.size(); ++i)
+            for (size_t j=0; j<m_meshes[i].size(); ++j)
+                m_meshes[i][j]->incRef();
+    }
+
     SpaceTimeKDTree(Stream *stream, InstanceManager *manager) {
         size_t times = (size_t) stream->readUInt();
         m_times.resize(times);
@@ -100,7 +110,8 @@ public:
     }
 
 
-    void build() {
+    /// Validate the geometry and compute the primitive index mapping
+    void prepare() {
         if (m_meshes.size() < 2)
             Log(EError, "The deformable shape requires at least two sub-shapes!");
 
@@ -137,6 +148,18 @@ public:
         for (size_t i=0; i<m_meshes[0].size(); ++i)
             m_shapeMap[i+1] = m_shapeMap[i] + (SizeType) m_meshes[0][i]->getTriangleCount();
 
+        /* Intersection records only reference the sub-shape and a primitive
+           index relative to it -- sort the sub-shapes by their address so
+           that getShapeIndex() can use a binary search */
+        m_shapeIndices.resize(m_meshes[0].size());
+        for (size_t i=0; i<m_meshes[0].size(); ++i)
+            m_shapeIndices[i] = ShapeIndexEntry(m_meshes[0][i], (IndexType) i);
+        std::sort(m_shapeIndices.begin(), m_shapeIndices.end());
+    }
+
+    void build() {
+        prepare();
+
         this->setClip(false);
         buildInternal();
 
@@ -368,6 +391,16 @@ public:
         return m_meshes[frameIndex][shapeIndex];
     }
 
+    /// Return the index of a sub-shape of the first frame
+    inline IndexType getShapeIndex(const Shape *shape) const {
+        std::vector<ShapeIndexEntry>::const_iterator it = std::lower_bound(
+            m_shapeIndices.begin(), m_shapeIndices.end(),
+            ShapeIndexEntry(shape, (IndexType) 0));
+        if (EXPECT_NOT_TAKEN(it == m_shapeIndices.end() || it->first != shape))
+            Log(EError, "Internal error: unknown sub-shape!");
+        return it->second;
+    }
+
     inline Triangle getTriangle(IndexType shapeIndex, IndexType primIndex) const {
         return m_meshes[0][shapeIndex]->getTriangles()[primIndex];
     }
@@ -378,13 +411,353 @@ public:
 
     MTS_DECLARE_CLASS()
 protected:
+    typedef std::pair<const Shape *, IndexType> ShapeIndexEntry;
+
     std::vector<Float> m_times;
     std::vector<std::vector<const TriMesh *> > m_meshes;
     std::vector<IndexType> m_shapeMap;
+    std::vector<ShapeIndexEntry> m_shapeIndices;
     AABB m_spatialAABB;
     Float m_traceTime;
 };
 
+/**
+ * \brief Refittable bounding volume hierarchy over the animated triangles
+ * of a \ref SpaceTimeKDTree
+ *
+ * The tree topology is built only once using a binned SAH. Every segment
+ * between two consecutive keyframes stores its own set of node bounds, and
+ * \ref refit() recomputes all of them bottom-up and in parallel when the
+ * vertex positions change. Memory usage therefore grows linearly with the
+ * number of keyframes.
+ */
+class SpaceTimeBVH : public Object {
+public:
+    typedef SpaceTimeKDTree::IndexType IndexType;
+
+    /// Create a BVH over the geometry referenced by a (possibly unbuilt) kd-tree
+    SpaceTimeBVH(const SpaceTimeKDTree *geometry)
+        : m_geometry(geometry), m_maxLeafSize(4) { }
+
+    void build() {
+        ref<Timer> timer = new Timer();
+        IndexType primCount = m_geometry->getPrimitiveCount();
+        m_segmentCount = m_geometry->getTimeCount() - 1;
+
+        /* Use the bounds over the whole animation to create the topology */
+        std::vector<AABB> primBounds(primCount);
+        m_primIndices.resize(primCount);
+        for (IndexType i=0; i<primCount; ++i) {
+            AABB4 aabb = m_geometry->getAABB(i);
+            primBounds[i] = AABB(Point(aabb.min.x, aabb.min.y, aabb.min.z),
+                Point(aabb.max.x, aabb.max.y, aabb.max.z));
+            m_primIndices[i] = i;
+        }
+
+        m_nodes.clear();
+        m_nodes.reserve(2 * primCount / m_maxLeafSize + 1);
+        buildRecursive(primBounds, 0, primCount, 0);
+        std::vector<Node>(m_nodes).swap(m_nodes);
+
+        /* Sort the nodes by their depth for the refit */
+        m_refitOrder.clear();
+        m_refitLevels.clear();
+        m_refitOrder.reserve(m_nodes.size());
+        m_refitOrder.push_back(0);
+        m_refitLevels.push_back(0);
+        size_t levelStart = 0;
+        while (levelStart < m_refitOrder.size()) {
+            size_t levelEnd = m_refitOrder.size();
+            for (size_t i=levelStart; i<levelEnd; ++i) {
+                uint32_t index = m_refitOrder[i];
+                if (m_nodes[index].count == 0) {
+                    m_refitOrder.push_back(index + 1);
+                    m_refitOrder.push_back(m_nodes[index].index);
+                }
+            }
+            m_refitLevels.push_back(levelEnd);
+            levelStart = levelEnd;
+        }
+
+        m_bounds.resize(m_nodes.size() * m_segmentCount);
+        refit();
+
+        Log(EDebug, "Built a space-time BVH with " SIZE_T_FMT " nodes and "
+            SIZE_T_FMT " segments in %i ms (%s)", m_nodes.size(), m_segmentCount,
+            timer->getMilliseconds(), memString(getMemoryUsage()).c_str());
+    }
+
+    /**
+     * \brief Recompute the bounds of all nodes after the vertex
+     * positions of the referenced meshes have changed
+     */
+    void refit() {
+        size_t nodeCount = m_nodes.size();
+
+        for (int level=(int) m_refitLevels.size()-2; level >= 0; --level) {
+            size_t start = m_refitLevels[level], end = m_refitLevels[level+1];
+            int workCount = (int) ((end - start) * m_segmentCount);
+
+            #pragma omp parallel for schedule(dynamic, 16)
+            for (int i=0; i<workCount; ++i) {
+                size_t segment = (size_t) i / (end - start);
+                uint32_t index = m_refitOrder[start + (size_t) i % (end - start)];
+                const Node &node = m_nodes[index];
+                AABB *bounds = &m_bounds[segment * nodeCount];
+
+                if (node.count > 0) {
+                    AABB aabb;
+                    for (uint32_t j=node.index; j<node.index+node.count; ++j)
+                        aabb.expandBy(getPrimitiveAABB(m_primIndices[j], segment));
+                    bounds[index] = aabb;
+                } else {
+                    bounds[index] = bounds[index + 1];
+                    bounds[index].expandBy(bounds[node.index]);
+                }
+            }
+        }
+
+        m_aabb.reset();
+        for (size_t i=0; i<m_segmentCount; ++i)
+            m_aabb.expandBy(m_bounds[i * nodeCount]);
+    }
+
+    /// Intersect a ray with all primitives stored in the BVH
+    inline bool rayIntersect(const Ray &ray, Float mint, Float maxt,
+            Float &t, void *temp) const {
+        return traverse<false>(ray, mint, maxt, t, temp);
+    }
+
+    /// Intersect a ray with all primitives stored in the BVH (visibility query)
+    inline bool rayIntersect(const Ray &ray, Float mint, Float maxt) const {
+        Float t;
+        return traverse<true>(ray, mint, maxt, t, NULL);
+    }
+
+    /// Return the spatial extents over all segments
+    inline const AABB &getAABB() const { return m_aabb; }
+
+    /// Return the number of nodes
+    inline size_t getNodeCount() const { return m_nodes.size(); }
+
+    /// Return the memory usage in bytes
+    size_t getMemoryUsage() const {
+        return m_nodes.size() * sizeof(Node)
+            + m_primIndices.size() * sizeof(IndexType)
+            + m_bounds.size() * sizeof(AABB)
+            + m_refitOrder.size() * sizeof(uint32_t);
+    }
+
+    MTS_DECLARE_CLASS()
+protected:
+    struct Node {
+        /**
+         * For leaves, the index of the first primitive in \c m_primIndices.
+         * For inner nodes, the index of the right child (the left one
+         * directly follows its parent)
+         */
+        uint32_t index;
+        /// Number of primitives (zero for inner nodes)
+        uint32_t count;
+    };
+
+    /// Return the bounds of a triangle during one animation segment
+    inline AABB getPrimitiveAABB(IndexType index, size_t segment) const {
+        IndexType shapeIndex = m_geometry->findShape(index);
+        const Triangle tri = m_geometry->getTriangle(shapeIndex, index);
+        const Point *pos0 = m_geometry->getMesh((IndexType) segment, shapeIndex)->getVertexPositions();
+        const Point *pos1 = m_geometry->getMesh((IndexType) segment+1, shapeIndex)->getVertexPositions();
+
+        AABB aabb;
+        for (int i=0; i<3; ++i) {
+            aabb.expandBy(pos0[tri.idx[i]]);
+            aabb.expandBy(pos1[tri.idx[i]]);
+        }
+        return aabb;
+    }
+
+    /// Recursively build the subtree for the primitive range [start, end)
+    void buildRecursive(const std::vector<AABB> &primBounds,
+            IndexType start, IndexType end, int depth) {
+        const int binCount = 16;
+        uint32_t nodeIndex = (uint32_t) m_nodes.size();
+        m_nodes.push_back(Node());
+        IndexType count = end - start;
+
+        AABB centroidBounds;
+        for (IndexType i=start; i<end; ++i)
+            centroidBounds.expandBy(primBounds[m_primIndices[i]].getCenter());
+        int axis = centroidBounds.getLargestAxis();
+        Float min = centroidBounds.min[axis],
+              extent = centroidBounds.max[axis] - min;
+
+        if (count <= m_maxLeafSize || (extent == 0 && count <= 4 * m_maxLeafSize)) {
+            m_nodes[nodeIndex].index = start;
+            m_nodes[nodeIndex].count = count;
+            return;
+        }
+
+        IndexType mid = start + count / 2;
+        if (extent > 0 && depth < 40) {
+            /* Binned SAH split along the axis of largest centroid extent */
+            AABB binBounds[binCount];
+            IndexType binCounts[binCount];
+            memset(binCounts, 0, sizeof(binCounts));
+            Float scale = binCount / extent;
+
+            for (IndexType i=start; i<end; ++i) {
+                const AABB &aabb = primBounds[m_primIndices[i]];
+                int bin = std::min((int) ((aabb.getCenter()[axis] - min) * scale), binCount-1);
+                binBounds[bin].expandBy(aabb);
+                binCounts[bin]++;
+            }
+
+            Float rightArea[binCount];
+            AABB aabb;
+            for (int i=binCount-1; i>0; --i) {
+                aabb.expandBy(binBounds[i]);
+                rightArea[i] = aabb.isValid() ? aabb.getSurfaceArea() : 0;
+            }
+
+            aabb.reset();
+            IndexType leftCount = 0;
+            Float bestCost = std::numeric_limits<Float>::infinity();
+            int bestSplit = -1;
+            for (int i=1; i<binCount; ++i) {
+                aabb.expandBy(binBounds[i-1]);
+                leftCount += binCounts[i-1];
+                if (leftCount == 0 || leftCount == count)
+                    continue;
+                Float cost = aabb.getSurfaceArea() * leftCount
+                    + rightArea[i] * (count - leftCount);
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestSplit = i;
+                }
+            }
+
+            if (bestSplit > 0) {
+                mid = (IndexType) (std::partition(m_primIndices.begin() + start,
+                    m_primIndices.begin() + end, BinPredicate(primBounds, axis,
+                    min, scale, bestSplit, binCount)) - m_primIndices.begin());
+            }
+        }
+
+        if (mid == start || mid == end || extent == 0 || depth >= 40) {
+            /* Fall back to an object median split */
+            mid = start + count / 2;
+            std::nth_element(m_primIndices.begin() + start, m_primIndices.begin() + mid,
+                m_primIndices.begin() + end, CentroidOrder(primBounds, axis));
+        }
+
+        m_nodes[nodeIndex].count = 0;
+        buildRecursive(primBounds, start, mid, depth+1);
+        m_nodes[nodeIndex].index = (uint32_t) m_nodes.size();
+        buildRecursive(primBounds, mid, end, depth+1);
+    }
+
+    struct BinPredicate {
+        const std::vector<AABB> &primBounds;
+        int axis, split, binCount;
+        Float min, scale;
+
+        BinPredicate(const std::vector<AABB> &primBounds, int axis, Float min,
+            Float scale, int split, int binCount) : primBounds(primBounds),
+            axis(axis), split(split), binCount(binCount), min(min), scale(scale) { }
+
+        inline bool operator()(IndexType index) const {
+            int bin = std::min((int) ((primBounds[index].getCenter()[axis] - min) * scale), binCount-1);
+            return bin < split;
+        }
+    };
+
+    struct CentroidOrder {
+        const std::vector<AABB> &primBounds;
+        int axis;
+
+        CentroidOrder(const std::vector<AABB> &primBounds, int axis)
+            : primBounds(primBounds), axis(axis) { }
+
+        inline bool operator()(IndexType a, IndexType b) const {
+            return primBounds[a].getCenter()[axis] < primBounds[b].getCenter()[axis];
+        }
+    };
+
+    template <bool shadowRay> bool traverse(const Ray &ray, Float mint,
+            Float maxt, Float &t, void *temp) const {
+        size_t segment = std::min((size_t) m_geometry->findFrame(ray.time), m_segmentCount-1);
+        const AABB *bounds = &m_bounds[segment * m_nodes.size()];
+        Float nearT, farT;
+
+        if (!bounds[0].rayIntersect(ray, nearT, farT) || nearT > maxt || farT < mint)
+            return false;
+
+        uint32_t stack[128], nodeIndex = 0;
+        int stackPos = 0;
+        bool foundIntersection = false;
+
+        while (true) {
+            const Node &node = m_nodes[nodeIndex];
+
+            if (node.count > 0) {
+                for (uint32_t i=node.index; i<node.index+node.count; ++i) {
+                    if (shadowRay) {
+                        if (m_geometry->intersect(ray, m_primIndices[i], mint, maxt))
+                            return true;
+                    } else {
+                        Float tempT;
+                        if (m_geometry->intersect(ray, m_primIndices[i], mint, maxt, tempT, temp)) {
+                            maxt = tempT;
+                            foundIntersection = true;
+                        }
+                    }
+                }
+            } else {
+                uint32_t left = nodeIndex + 1, right = node.index;
+                Float nearL, farL, nearR, farR;
+                bool hitLeft = bounds[left].rayIntersect(ray, nearL, farL)
+                    && nearL <= maxt && farL >= mint;
+                bool hitRight = bounds[right].rayIntersect(ray, nearR, farR)
+                    && nearR <= maxt && farR >= mint;
+
+                if (hitLeft && hitRight) {
+                    /* Visit the closer child first */
+                    if (nearR < nearL)
+                        std::swap(left, right);
+                    stack[stackPos++] = right;
+                    nodeIndex = left;
+                    continue;
+                } else if (hitLeft) {
+                    nodeIndex = left;
+                    continue;
+                } else if (hitRight) {
+                    nodeIndex = right;
+                    continue;
+                }
+            }
+
+            if (stackPos == 0)
+                break;
+            nodeIndex = stack[--stackPos];
+        }
+
+        if (foundIntersection)
+            t = maxt;
+        return foundIntersection;
+    }
+
+protected:
+    const SpaceTimeKDTree *m_geometry;
+    std::vector<Node> m_nodes;
+    std::vector<IndexType> m_primIndices;
+    std::vector<AABB> m_bounds;
+    std::vector<uint32_t> m_refitOrder;
+    std::vector<size_t> m_refitLevels;
+    size_t m_segmentCount;
+    IndexType m_maxLeafSize;
+    AABB m_aabb;
+};
+
 class Deformable : public Shape {
 public:
     Deformable(const Properties &props) : Shape(props) {
@@ -400,28 +773,65 @@ public:
             times[i] = value;
         }
         m_kdtree = new SpaceTimeKDTree(times);
+
+        /* Acceleration data structure: a space-time kd-tree ("kdtree"), or
+           a BVH ("bvh") that can be refit when the keyframes change */
+        std::string accel = boost::to_lower_copy(props.getString("accel", "kdtree"));
+        if (accel == "kdtree")
+            m_useBVH = false;
+        else if (accel == "bvh")
+            m_useBVH = true;
+        else
+            Log(EError, "Unknown acceleration data structure \"%s\"! Must be "
+                "either \"kdtree\" or \"bvh\".", accel.c_str());
     }
 
     Deformable(Stream *stream, InstanceManager *manager)
         : Shape(stream, manager) {
         m_kdtree = new SpaceTimeKDTree(stream, manager);
+        m_useBVH = stream->readBool();
     }
 
     void serialize(Stream *stream, InstanceManager *manager) const {
         Shape::serialize(stream, manager);
         m_kdtree->serialize(stream, manager);
+        stream->writeBool(m_useBVH);
     }
 
     void configure() {
-        m_kdtree->build();
+        if (m_useBVH) {
+            m_kdtree->prepare();
+            m_bvh = new SpaceTimeBVH(m_kdtree);
+            m_bvh->build();
+        } else {
+            m_kdtree->build();
+        }
+    }
+
+    /**
+     * Refit the BVH after the vertex positions of the keyframe meshes
+     * have been modified. The kd-tree variant must be rebuilt instead.
+     */
+    void updateGeometry() {
+        if (m_bvh.get()) {
+            m_bvh->refit();
+        } else {
+            ref<SpaceTimeKDTree> kdtree = new SpaceTimeKDTree(m_kdtree.get());
+            kdtree->build();
+            m_kdtree = kdtree;
+        }
     }
 
     bool rayIntersect(const Ray &ray, Float mint,
             Float maxt, Float &t, void *temp) const {
+        if (m_bvh.get())
+            return m_bvh->rayIntersect(ray, mint, maxt, t, temp);
         return m_kdtree->rayIntersect(ray, mint, maxt, t, temp);
     }
 
     bool rayIntersect(const Ray &ray, Float mint, Float maxt) const {
+        if (m_bvh.get())
+            return m_bvh->rayIntersect(ray, mint, maxt);
         return m_kdtree->rayIntersect(ray, mint, maxt);
     }
 
@@ -508,7 +918,6 @@ public:
         its.shape = m_kdtree->getMesh(0, cache->shapeIndex);
         its.hasUVPartials = false;
         its.primIndex = cache->primIndex;
-        its.other = cache->shapeIndex;
         its.instance = this;
         its.time = ray.time;
     }
@@ -522,7 +931,8 @@ public:
             (its.time - times[frameIndex])
             / (times[frameIndex + 1] - times[frameIndex])));
 
-        uint32_t primIndex = its.primIndex, shapeIndex = its.other;
+        uint32_t primIndex = its.primIndex,
+                 shapeIndex = m_kdtree->getShapeIndex(its.shape);
         const TriMesh *trimesh0 = m_kdtree->getMesh(frameIndex,   shapeIndex);
         const TriMesh *trimesh1 = m_kdtree->getMesh(frameIndex+1, shapeIndex);
         const Point *vertexPositions0 = trimesh0->getVertexPositions();
@@ -614,7 +1024,7 @@ public:
         const std::vector<Float> &times = m_kdtree->getTimes();
 
         cache.primIndex = its.primIndex;
-        cache.shapeIndex = its.other;
+        cache.shapeIndex = m_kdtree->getShapeIndex(its.shape);
         cache.frameIndex = m_kdtree->findFrame(its.time);
         cache.alpha = std::max((Float) 0.0f, std::min((Float) 1.0f,
             (its.time - times[cache.frameIndex])
@@ -651,6 +1061,8 @@ public:
 
 
     AABB getAABB() const {
+        if (m_bvh.get())
+            return m_bvh->getAABB();
         return m_kdtree->getSpatialAABB();
     }
 
@@ -678,7 +1090,8 @@ public:
         oss << "Deformable[" << endl
             << "   primitiveCount = " << m_kdtree->getPrimitiveCount() << "," << endl
             << "   timeCount = " << m_kdtree->getTimeCount() << "," << endl
-            << "   aabb = " << indent(m_kdtree->getSpatialAABB().toString()) << endl
+            << "   accel = " << (m_useBVH ? "bvh" : "kdtree") << "," << endl
+            << "   aabb = " << indent(getAABB().toString()) << endl
             << "]";
         return oss.str();
     }
@@ -686,9 +1099,12 @@ public:
     MTS_DECLARE_CLASS()
 private:
     ref<SpaceTimeKDTree> m_kdtree;
+    ref<SpaceTimeBVH> m_bvh;
+    bool m_useBVH;
 };
 
 MTS_IMPLEMENT_CLASS_S(SpaceTimeKDTree, false, KDTreeBase)
+MTS_IMPLEMENT_CLASS(SpaceTimeBVH, false, Object)
 MTS_IMPLEMENT_CLASS_S(Deformable, false, Shape)
 MTS_EXPORT_PLUGIN(Deformable, "Deformable shape");
 MTS_NAMESPACE_END
@@ -51,17 +51,22 @@ MTS_NAMESPACE_BEGIN
  *    the shape group is the one that matters.
  *   \item Shape groups cannot be used to replicate shapes with
  *   attached emitters, sensors, or subsurface scattering models.
+ *   \item Instances are not stored in the scene's kd-tree, but in a
+ *   separate BVH over their bounding boxes. Moving or adding instances
+ *   therefore only requires rebuilding this hierarchy. This can be
+ *   disabled by setting the scene parameter \code{twoLevelInstancing}
+ *   to \code{false}.
  * }
  */
 
 Instance::Instance(const Properties &props) : Shape(props) {
-    m_transform = props.getAnimatedTransform("toWorld", Transform());
+    setWorldTransform(props.getAnimatedTransform("toWorld", Transform()));
 }
 
 Instance::Instance(Stream *stream, InstanceManager *manager)
     : Shape(stream, manager) {
     m_shapeGroup = static_cast<ShapeGroup *>(manager->getInstance(stream));
-    m_transform = new AnimatedTransform(stream);
+    setWorldTransform(new AnimatedTransform(stream));
 }
 
 void Instance::serialize(Stream *stream, InstanceManager *manager) const {
@@ -81,10 +86,16 @@ AABB Instance::getAABB() const {
     if (!aabb.isValid()) // the geometry group is empty
         return aabb;
 
+    AABB result;
+    if (m_static) {
+        for (int i=0; i<8; ++i)
+            result.expandBy(m_objectToWorld(aabb.getCorner(i)));
+        return result;
+    }
+
     std::set<Float> times;
     m_transform->collectKeyframes(times);
 
-    AABB result;
     for (std::set<Float>::iterator it = times.begin(); it != times.end(); ++it) {
         const Transform &trafo = m_transform->eval(*it);
 
@@ -115,17 +126,21 @@ size_t Instance::getEffectivePrimitiveCount() const {
 bool Instance::rayIntersect(const Ray &_ray, Float mint,
         Float maxt, Float &t, void *temp) const {
     const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
-    const Transform &trafo = m_transform->eval(_ray.time);
     Ray ray;
-    trafo.inverse()(_ray, ray);
+    if (EXPECT_TAKEN(m_static))
+        m_worldToObject(_ray, ray);
+    else
+        m_transform->eval(_ray.time).inverse()(_ray, ray);
     return kdtree->rayIntersect(ray, mint, maxt, t, temp);
 }
 
 bool Instance::rayIntersect(const Ray &_ray, Float mint, Float maxt) const {
     const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
     Ray ray;
-    const Transform &trafo = m_transform->eval(_ray.time);
-    trafo.inverse()(_ray, ray);
+    if (EXPECT_TAKEN(m_static))
+        m_worldToObject(_ray, ray);
+    else
+        m_transform->eval(_ray.time).inverse()(_ray, ray);
     return kdtree->rayIntersect(ray, mint, maxt);
 }
 
@@ -146,9 +161,12 @@ void Instance::adjustTime(Intersection &its, Float time) const {
 void Instance::fillIntersectionRecord(const Ray &_ray,
     const void *temp, Intersection &its) const {
     const ShapeKDTree *kdtree = m_shapeGroup->getKDTree();
-    const Transform &trafo = m_transform->eval(_ray.time);
+    const Transform &trafo = m_static ? m_objectToWorld : m_transform->eval(_ray.time);
     Ray ray;
-    trafo.inverse()(_ray, ray);
+    if (EXPECT_TAKEN(m_static))
+        m_worldToObject(_ray, ray);
+    else
+        trafo.inverse()(_ray, ray);
     kdtree->fillIntersectionRecord<false>(ray, temp, its);
 
     its.shFrame.n = normalize(trafo(its.shFrame.n));
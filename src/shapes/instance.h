@@ -42,6 +42,23 @@ public:
     /// Return the object-to-world transformation used by this instance
     inline const AnimatedTransform *getWorldTransform() const { return m_transform.get(); }
 
+    /**
+     * \brief Set the object-to-world transformation used by this instance
+     *
+     * When the instance is part of an initialized scene, the scene's
+     * instance hierarchy must be updated afterwards using
+     * \ref Scene::updateInstances().
+     */
+    inline void setWorldTransform(const AnimatedTransform *trafo) {
+        m_transform = trafo;
+        m_static = trafo->isStatic();
+        if (m_static) {
+            /* Avoid evaluating and inverting the transformation for every ray */
+            m_objectToWorld = trafo->eval(0);
+            m_worldToObject = m_objectToWorld.inverse();
+        }
+    }
+
     /// Add a child ConfigurableObject
     void addChild(const std::string &name, ConfigurableObject *child);
 
@@ -60,6 +77,8 @@ public:
 
     AABB getAABB() const;
 
+    inline bool isInstance() const { return true; }
+
     bool rayIntersect(const Ray &_ray, Float mint,
             Float maxt, Float &t, void *temp) const;
 
@@ -84,6 +103,8 @@ public:
 private:
     ref<ShapeGroup> m_shapeGroup;
     ref<const AnimatedTransform> m_transform;
+    Transform m_objectToWorld, m_worldToObject;
+    bool m_static;
 };
 
 MTS_NAMESPACE_END
@@ -21,11 +21,72 @@
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/mmap.h>
 #include <ply/ply_parser.hpp>
 #include <functional>
 
 MTS_NAMESPACE_BEGIN
 
+/// Number of vertices or faces that are decoded by one task of the fast path
+#define PLY_FAST_CHUNK_SIZE 65536
+
+namespace {
+    /// Scalar types that can occur in a binary PLY file
+    enum EPLYType {
+        EPLYInvalid = 0, EPLYInt8, EPLYUInt8, EPLYInt16, EPLYUInt16,
+        EPLYInt32, EPLYUInt32, EPLYFloat32, EPLYFloat64
+    };
+
+    EPLYType parsePLYType(const std::string &name) {
+        if (name == "char" || name == "int8") return EPLYInt8;
+        else if (name == "uchar" || name == "uint8") return EPLYUInt8;
+        else if (name == "short" || name == "int16") return EPLYInt16;
+        else if (name == "ushort" || name == "uint16") return EPLYUInt16;
+        else if (name == "int" || name == "int32") return EPLYInt32;
+        else if (name == "uint" || name == "uint32") return EPLYUInt32;
+        else if (name == "float" || name == "float32") return EPLYFloat32;
+        else if (name == "double" || name == "float64") return EPLYFloat64;
+        return EPLYInvalid;
+    }
+
+    size_t getPLYTypeSize(EPLYType type) {
+        const size_t sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+        return sizes[type];
+    }
+
+    template <typename T> inline T readPLYValue(const uint8_t *ptr, bool swap) {
+        T value;
+        memcpy(&value, ptr, sizeof(T));
+        return swap ? endianness_swap(value) : value;
+    }
+
+    /// Read a floating point property (positions, normals, ..)
+    inline Float readPLYFloat(const uint8_t *ptr, EPLYType type, bool swap) {
+        if (type == EPLYFloat32)
+            return (Float) readPLYValue<float>(ptr, swap);
+        else
+            return (Float) readPLYValue<double>(ptr, swap);
+    }
+
+    /// Read an integer property (list sizes and vertex indices)
+    inline uint32_t readPLYIndex(const uint8_t *ptr, EPLYType type, bool swap) {
+        switch (type) {
+            case EPLYUInt8: return *ptr;
+            case EPLYInt32: return (uint32_t) readPLYValue<int32_t>(ptr, swap);
+            default: return readPLYValue<uint32_t>(ptr, swap);
+        }
+    }
+
+    /// Location of a vertex property within a vertex record
+    struct PLYProperty {
+        EPLYType type;
+        size_t offset;
+
+        PLYProperty() : type(EPLYInvalid), offset(0) { }
+        inline bool isValid() const { return type != EPLYInvalid; }
+    };
+};
+
 /*!\plugin{ply}{PLY (Stanford Triangle Format) mesh loader}
  * \order{6}
  * \parameters{
@@ -53,6 +114,10 @@ MTS_NAMESPACE_BEGIN
  *       When set to \code{true}, any vertex colors will be interpreted as sRGB,
  *       instead of linear RGB \default{\code{true}}.
  *     }
+ *     \parameter{fastLoad}{\Boolean}{
+ *       When set to \code{false}, binary files are always read using the
+ *       generic parser (see below) \default{\code{true}}.
+ *     }
  * }
  * \renderings{
  *     \rendering{The PLY plugin is useful for loading large geometry. (Dragon
@@ -66,6 +131,11 @@ MTS_NAMESPACE_BEGIN
  * The current plugin implementation supports triangle meshes with optional
  * UV coordinates, vertex normals, and vertex colors.
  *
+ * Binary files that contain only vertices and triangle or quad faces (the
+ * layout written by most tools) are memory-mapped and decoded in parallel,
+ * which is much faster for large meshes. Other files are read using
+ * \code{libply}.
+ *
  * When loading meshes that contain vertex colors, note that they need to be
  * explicitly referenced in a BSDF using a special texture named
  * \pluginref{vertexcolors}.
@@ -91,12 +161,17 @@ public:
 
         m_triangleCount = m_vertexCount = 0;
         m_vertexCtr = m_faceCount = m_faceCtr = m_indexCtr = 0;
+        m_triangleCapacity = 0;
         m_normal = Normal(0.0f);
         m_uv = Point2(0.0f);
         m_hasNormals = false;
         m_hasTexCoords = false;
         memset(&m_face, 0, sizeof(uint32_t)*4);
-        loadPLY(filePath);
+
+        /* Decode common binary files directly from a memory mapping
+           (can be disabled to compare with the generic parser) */
+        if (!props.getBoolean("fastLoad", true) || !loadBinaryPLY(filePath))
+            loadPLY(filePath);
 
         if (m_triangleCount == 0 || m_vertexCount == 0)
             Log(EError, "Unable to load \"%s\" (no triangles or vertices found)!");
@@ -111,7 +186,7 @@ public:
             rebuildTopology(props.getFloat("maxSmoothAngle"));
         }
 
-        if (m_triangleCount < m_faceCount * 2) {
+        if (m_triangleCount < m_triangleCapacity) {
             /* Needed less memory than the earlier conservative estimate -- free it! */
             Triangle *temp = new Triangle[m_triangleCount];
             memcpy(temp, m_triangles, sizeof(Triangle) * m_triangleCount);
@@ -125,6 +200,19 @@ public:
 
     void loadPLY(const fs::path &path);
 
+    /**
+     * \brief Fast path for binary PLY files, which decodes the vertex and
+     * face data in parallel and without any per-property callbacks.
+     *
+     * Supports files consisting of a vertex element followed by a face
+     * element with triangles or quads. Returns \c false without changing
+     * the mesh when the file uses any other layout.
+     */
+    bool loadBinaryPLY(const fs::path &path);
+
+    /// Write a summary of the loaded mesh to the log
+    void logStatistics(const Timer *timer) const;
+
     void info_callback(const std::string& filename, std::size_t line_number,
             const std::string& message) {
         Log(EInfo, "\"%s\" [line %i] info: %s", filename.c_str(), line_number,
@@ -147,6 +235,11 @@ public:
         scalar_property_definition_callback(const std::string& element_name,
         const std::string& property_name);
 
+    /// Callbacks of floating point properties (single or double precision)
+    template<typename ValueType> std::function <void (ValueType)>
+        float_property_definition_callback(const std::string& element_name,
+        const std::string& property_name);
+
     template<typename SizeType, typename IndexType> std::tuple<std::function<void (SizeType)>,
         std::function<void (IndexType)>, std::function<void ()> >
         list_property_definition_callback(const std::string& element_name,
@@ -164,7 +257,8 @@ public:
             );
         } else if (element_name == "face") {
             m_faceCount = count;
-            m_triangles = new Triangle[m_faceCount*2];
+            m_triangleCapacity = m_faceCount*2;
+            m_triangles = new Triangle[m_triangleCapacity];
             return std::tuple<std::function<void()>,
                 std::function<void()> >(
                 std::bind(&PLYLoader::face_begin_callback, this),
@@ -177,22 +271,22 @@ public:
         }
     }
 
-    void vertex_x_callback(ply::float32 x) { m_position.x = x; }
-    void vertex_y_callback(ply::float32 y) { m_position.y = y; }
-    void vertex_z_callback(ply::float32 z) { m_position.z = z; }
-    void normal_x_callback(ply::float32 x) {
+    void vertex_x_callback(Float x) { m_position.x = x; }
+    void vertex_y_callback(Float y) { m_position.y = y; }
+    void vertex_z_callback(Float z) { m_position.z = z; }
+    void normal_x_callback(Float x) {
         if (!m_normals)
             m_normals = new Normal[m_vertexCount];
         m_normal.x = x;
     }
-    void normal_y_callback(ply::float32 y) { m_normal.y = y; }
-    void normal_z_callback(ply::float32 z) { m_normal.z = z; }
-    void texcoord_u_callback(ply::float32 x) {
+    void normal_y_callback(Float y) { m_normal.y = y; }
+    void normal_z_callback(Float z) { m_normal.z = z; }
+    void texcoord_u_callback(Float x) {
         if (!m_texcoords)
             m_texcoords = new Point2[m_vertexCount];
         m_uv.x = x;
     }
-    void texcoord_v_callback(ply::float32 y) { m_uv.y = y; }
+    void texcoord_v_callback(Float y) { m_uv.y = y; }
 
     inline Float fromSRGBComponent(Float value) {
         if (value <= (Float) 0.04045)
@@ -229,21 +323,21 @@ public:
     }
     void green_callback_uint8(ply::uint8 g) { m_green = g / 255.0f; }
     void blue_callback_uint8(ply::uint8 b) { m_blue = b / 255.0f; }
-    void red_callback(ply::float32 r) {
+    void red_callback(Float r) {
         if (!m_colors)
             m_colors = new Color3[m_vertexCount];
         m_red = r;
     }
-    void green_callback(ply::float32 g) { m_green = g; }
-    void blue_callback(ply::float32 b) { m_blue = b; }
+    void green_callback(Float g) { m_green = g; }
+    void blue_callback(Float b) { m_blue = b; }
 
     /* Face colors are unsupported */
     void face_red_callback_uint8(ply::uint8 r) { }
     void face_green_callback_uint8(ply::uint8 g) { }
     void face_blue_callback_uint8(ply::uint8 b) { }
-    void face_red_callback(ply::float32 r) { }
-    void face_green_callback(ply::float32 g) { }
-    void face_blue_callback(ply::float32 b) { }
+    void face_red_callback(Float r) { }
+    void face_green_callback(Float g) { }
+    void face_blue_callback(Float b) { }
 
     void face_begin_callback() { }
     void face_end_callback() { }
@@ -294,7 +388,7 @@ private:
     Normal m_normal;
     Float m_red, m_green, m_blue;
     Transform m_objectToWorld;
-    size_t m_faceCount, m_vertexCtr;
+    size_t m_faceCount, m_vertexCtr, m_triangleCapacity;
     size_t m_faceCtr, m_indexCtr;
     uint32_t m_face[4];
     bool m_hasNormals, m_hasTexCoords;
@@ -302,8 +396,8 @@ private:
     bool m_sRGB;
 };
 
-template<> std::function <void (ply::float32)>
-    PLYLoader::scalar_property_definition_callback(const std::string& element_name,
+template<typename ValueType> std::function <void (ValueType)>
+    PLYLoader::float_property_definition_callback(const std::string& element_name,
     const std::string& property_name) {
     if (element_name == "vertex") {
         if (property_name == "x") {
@@ -343,6 +437,18 @@ template<> std::function <void (ply::float32)>
     return nullptr;
 }
 
+template<> std::function <void (ply::float32)>
+    PLYLoader::scalar_property_definition_callback(const std::string& element_name,
+    const std::string& property_name) {
+    return float_property_definition_callback<ply::float32>(element_name, property_name);
+}
+
+template<> std::function <void (ply::float64)>
+    PLYLoader::scalar_property_definition_callback(const std::string& element_name,
+    const std::string& property_name) {
+    return float_property_definition_callback<ply::float64>(element_name, property_name);
+}
+
 template<> std::function <void (ply::uint8)>
     PLYLoader::scalar_property_definition_callback(const std::string& element_name,
     const std::string& property_name) {
@@ -457,6 +563,9 @@ void PLYLoader::loadPLY(const fs::path &path) {
     ply::at<ply::float32>(scalar_property_definition_callbacks) = std::bind(
         &PLYLoader::scalar_property_definition_callback<ply::float32>, this, _1, _2);
 
+    ply::at<ply::float64>(scalar_property_definition_callbacks) = std::bind(
+        &PLYLoader::scalar_property_definition_callback<ply::float64>, this, _1, _2);
+
     ply::at<ply::uint8>(scalar_property_definition_callbacks) = std::bind(
         &PLYLoader::scalar_property_definition_callback<ply::uint8>, this, _1, _2);
 
@@ -477,7 +586,10 @@ void PLYLoader::loadPLY(const fs::path &path) {
 
     ref<Timer> timer = new Timer();
     ply_parser.parse(path.string());
+    logStatistics(timer);
+}
 
+void PLYLoader::logStatistics(const Timer *timer) const {
     size_t vertexSize = sizeof(Point);
     if (m_normals)
         vertexSize += sizeof(Normal);
@@ -493,6 +605,293 @@ void PLYLoader::loadPLY(const fs::path &path) {
 }
 
 
+bool PLYLoader::loadBinaryPLY(const fs::path &path) {
+    ref<Timer> timer = new Timer();
+    ref<MemoryMappedFile> mmap = new MemoryMappedFile(path);
+    const uint8_t *data = static_cast<const uint8_t *>(mmap->getData());
+    size_t fileSize = mmap->getSize();
+
+    /* Locate the end of the header */
+    const char *endTag = "end_header";
+    const uint8_t *headerEnd = std::search(data, data + fileSize,
+        endTag, endTag + strlen(endTag));
+    if (headerEnd == data + fileSize)
+        return false;
+    const uint8_t *body = std::find(headerEnd, data + fileSize, '\n');
+    if (body == data + fileSize)
+        return false;
+    ++body;
+
+    /* Parse the header. Bail out on anything that is not understood */
+    std::istringstream header(std::string((const char *) data,
+        (const char *) headerEnd));
+    std::string line, keyword;
+    bool bigEndian = false, haveFormat = false;
+    size_t vertexCount = 0, faceCount = 0, vertexStride = 0;
+    size_t facePrefix = 0, faceSuffix = 0;
+    EPLYType listSizeType = EPLYInvalid, listIndexType = EPLYInvalid;
+    PLYProperty pos[3], normal[3], uv[2], color[3];
+    int element = -1; /* 0: vertex, 1: face */
+
+    while (std::getline(header, line)) {
+        std::istringstream tokens(line);
+        if (!(tokens >> keyword) || keyword == "ply" || keyword == "comment"
+                || keyword == "obj_info")
+            continue;
+
+        if (keyword == "format") {
+            std::string format;
+            tokens >> format;
+            if (format == "binary_little_endian")
+                bigEndian = false;
+            else if (format == "binary_big_endian")
+                bigEndian = true;
+            else
+                return false;
+            haveFormat = true;
+        } else if (keyword == "element") {
+            std::string name;
+            size_t count = 0;
+            if (!(tokens >> name >> count))
+                return false;
+            if (name == "vertex" && element == -1) {
+                element = 0;
+                vertexCount = count;
+            } else if (name == "face" && element == 0) {
+                element = 1;
+                faceCount = count;
+            } else {
+                return false;
+            }
+        } else if (keyword == "property") {
+            std::string typeName, name;
+            if (!(tokens >> typeName))
+                return false;
+
+            if (typeName == "list") {
+                std::string sizeTypeName, indexTypeName;
+                if (!(tokens >> sizeTypeName >> indexTypeName >> name))
+                    return false;
+                /* Only a single list of vertex indices is supported */
+                if (element != 1 || listSizeType != EPLYInvalid ||
+                    (name != "vertex_indices" && name != "vertex_index"))
+                    return false;
+                listSizeType = parsePLYType(sizeTypeName);
+                listIndexType = parsePLYType(indexTypeName);
+                if ((listSizeType != EPLYUInt8 && listSizeType != EPLYUInt32) ||
+                    (listIndexType != EPLYInt32 && listIndexType != EPLYUInt32))
+                    return false;
+                continue;
+            }
+
+            EPLYType type = parsePLYType(typeName);
+            if (type == EPLYInvalid || !(tokens >> name))
+                return false;
+
+            if (element == 1) {
+                /* Other face properties (e.g. colors) are skipped */
+                if (listSizeType == EPLYInvalid)
+                    facePrefix += getPLYTypeSize(type);
+                else
+                    faceSuffix += getPLYTypeSize(type);
+                continue;
+            } else if (element != 0) {
+                return false;
+            }
+
+            PLYProperty *target = NULL;
+            bool isColor = false;
+            if (name == "x") target = &pos[0];
+            else if (name == "y") target = &pos[1];
+            else if (name == "z") target = &pos[2];
+            else if (name == "nx") target = &normal[0];
+            else if (name == "ny") target = &normal[1];
+            else if (name == "nz") target = &normal[2];
+            else if (name == "u" || name == "texture_u" || name == "s") target = &uv[0];
+            else if (name == "v" || name == "texture_v" || name == "t") target = &uv[1];
+            else if (name == "diffuse_red" || name == "red") { target = &color[0]; isColor = true; }
+            else if (name == "diffuse_green" || name == "green") { target = &color[1]; isColor = true; }
+            else if (name == "diffuse_blue" || name == "blue") { target = &color[2]; isColor = true; }
+
+            if (target) {
+                /* Leave unusual types to the generic parser */
+                if (type != EPLYFloat32 && type != EPLYFloat64 &&
+                    !(isColor && type == EPLYUInt8))
+                    return false;
+                target->type = type;
+                target->offset = vertexStride;
+            }
+            vertexStride += getPLYTypeSize(type);
+        } else {
+            return false;
+        }
+    }
+
+    bool hasNormals = normal[0].isValid() && normal[1].isValid() && normal[2].isValid(),
+         hasTexcoords = uv[0].isValid() && uv[1].isValid(),
+         hasColors = color[0].isValid() && color[1].isValid() && color[2].isValid();
+
+    if (!haveFormat || element != 1 || listSizeType == EPLYInvalid ||
+        !pos[0].isValid() || !pos[1].isValid() || !pos[2].isValid() ||
+        (normal[0].isValid() && !hasNormals) || (uv[0].isValid() && !hasTexcoords) ||
+        (color[0].isValid() && !hasColors) || vertexCount == 0 || faceCount == 0)
+        return false;
+
+    const uint8_t *vertexData = body, *faceData = body + vertexCount * vertexStride,
+                  *end = data + fileSize;
+    if (faceData > end)
+        Log(EError, "\"%s\": the file is truncated!", m_name.c_str());
+
+    /* Determine whether all faces have the same number of vertices */
+    size_t sizeSize = getPLYTypeSize(listSizeType),
+           indexSize = getPLYTypeSize(listIndexType),
+           faceBytes = (size_t) (end - faceData), uniformSize = 0;
+    for (size_t n=3; n<=4; ++n) {
+        if (faceBytes == faceCount * (facePrefix + sizeSize + n * indexSize + faceSuffix))
+            uniformSize = n;
+    }
+
+    bool swap = bigEndian != (Stream::getHostByteOrder() == Stream::EBigEndian);
+
+    m_vertexCount = vertexCount;
+    m_faceCount = faceCount;
+    m_positions = new Point[m_vertexCount];
+    m_normals = hasNormals ? new Normal[m_vertexCount] : NULL;
+    m_texcoords = hasTexcoords ? new Point2[m_vertexCount] : NULL;
+    m_colors = hasColors ? new Color3[m_vertexCount] : NULL;
+    m_hasNormals = hasNormals;
+    m_hasTexCoords = hasTexcoords;
+
+    /* Decode the vertices */
+    int vertexChunks = (int) ((vertexCount + PLY_FAST_CHUNK_SIZE - 1) / PLY_FAST_CHUNK_SIZE);
+    std::vector<AABB> chunkAABB(vertexChunks);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int chunk=0; chunk<vertexChunks; ++chunk) {
+        size_t start = (size_t) chunk * PLY_FAST_CHUNK_SIZE,
+               last = std::min(start + PLY_FAST_CHUNK_SIZE, vertexCount);
+        AABB aabb;
+        for (size_t i=start; i<last; ++i) {
+            const uint8_t *ptr = vertexData + i * vertexStride;
+            Point p(
+                readPLYFloat(ptr + pos[0].offset, pos[0].type, swap),
+                readPLYFloat(ptr + pos[1].offset, pos[1].type, swap),
+                readPLYFloat(ptr + pos[2].offset, pos[2].type, swap));
+            p = m_objectToWorld(p);
+            aabb.expandBy(p);
+            m_positions[i] = p;
+
+            if (hasNormals) {
+                Normal n(
+                    readPLYFloat(ptr + normal[0].offset, normal[0].type, swap),
+                    readPLYFloat(ptr + normal[1].offset, normal[1].type, swap),
+                    readPLYFloat(ptr + normal[2].offset, normal[2].type, swap));
+                m_normals[i] = normalize(m_objectToWorld(n));
+            }
+
+            if (hasTexcoords)
+                m_texcoords[i] = Point2(
+                    readPLYFloat(ptr + uv[0].offset, uv[0].type, swap),
+                    readPLYFloat(ptr + uv[1].offset, uv[1].type, swap));
+
+            if (hasColors) {
+                Float rgb[3];
+                for (int j=0; j<3; ++j) {
+                    if (color[j].type == EPLYUInt8)
+                        rgb[j] = ptr[color[j].offset] / 255.0f;
+                    else
+                        rgb[j] = readPLYFloat(ptr + color[j].offset, color[j].type, swap);
+                    if (m_sRGB)
+                        rgb[j] = fromSRGBComponent(rgb[j]);
+                }
+                m_colors[i] = Color3(rgb[0], rgb[1], rgb[2]);
+            }
+        }
+        chunkAABB[chunk] = aabb;
+    }
+
+    for (int chunk=0; chunk<vertexChunks; ++chunk)
+        m_aabb.expandBy(chunkAABB[chunk]);
+
+    /* Decode the faces */
+    bool invalid = false;
+    if (uniformSize != 0) {
+        size_t faceStride = facePrefix + sizeSize + uniformSize * indexSize + faceSuffix,
+               trisPerFace = uniformSize - 2;
+        m_triangleCount = m_triangleCapacity = faceCount * trisPerFace;
+        m_triangles = new Triangle[m_triangleCount];
+
+        int faceChunks = (int) ((faceCount + PLY_FAST_CHUNK_SIZE - 1) / PLY_FAST_CHUNK_SIZE);
+        std::vector<uint8_t> chunkInvalid(faceChunks, 0);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int chunk=0; chunk<faceChunks; ++chunk) {
+            size_t start = (size_t) chunk * PLY_FAST_CHUNK_SIZE,
+                   last = std::min(start + PLY_FAST_CHUNK_SIZE, faceCount);
+            bool bad = false;
+            for (size_t i=start; i<last; ++i) {
+                const uint8_t *ptr = faceData + i * faceStride + facePrefix;
+                uint32_t face[4];
+                bad |= readPLYIndex(ptr, listSizeType, swap) != uniformSize;
+                ptr += sizeSize;
+                for (size_t j=0; j<uniformSize; ++j) {
+                    face[j] = readPLYIndex(ptr + j * indexSize, listIndexType, swap);
+                    bad |= face[j] >= vertexCount;
+                }
+                Triangle *tri = m_triangles + i * trisPerFace;
+                tri[0].idx[0] = face[0]; tri[0].idx[1] = face[1]; tri[0].idx[2] = face[2];
+                if (uniformSize == 4) {
+                    tri[1].idx[0] = face[3]; tri[1].idx[1] = face[0]; tri[1].idx[2] = face[2];
+                }
+            }
+            chunkInvalid[chunk] = bad;
+        }
+
+        for (int chunk=0; chunk<faceChunks; ++chunk)
+            invalid |= chunkInvalid[chunk] != 0;
+    } else {
+        /* Mixed triangles and quads: decode sequentially */
+        m_triangleCapacity = faceCount * 2;
+        m_triangles = new Triangle[m_triangleCapacity];
+        m_triangleCount = 0;
+        const uint8_t *ptr = faceData;
+        for (size_t i=0; i<faceCount && !invalid; ++i) {
+            ptr += facePrefix;
+            if (ptr + sizeSize > end) {
+                invalid = true;
+                break;
+            }
+            uint32_t size = readPLYIndex(ptr, listSizeType, swap), face[4];
+            ptr += sizeSize;
+            if ((size != 3 && size != 4) || ptr + size * indexSize + faceSuffix > end) {
+                invalid = true;
+                break;
+            }
+            for (uint32_t j=0; j<size; ++j) {
+                face[j] = readPLYIndex(ptr + j * indexSize, listIndexType, swap);
+                invalid |= face[j] >= vertexCount;
+            }
+            ptr += size * indexSize + faceSuffix;
+
+            Triangle &t0 = m_triangles[m_triangleCount++];
+            t0.idx[0] = face[0]; t0.idx[1] = face[1]; t0.idx[2] = face[2];
+            if (size == 4) {
+                Triangle &t1 = m_triangles[m_triangleCount++];
+                t1.idx[0] = face[3]; t1.idx[1] = face[0]; t1.idx[2] = face[2];
+            }
+        }
+    }
+
+    if (invalid)
+        Log(EError, "\"%s\": encountered an invalid face (only triangles and "
+            "quads with valid vertex indices are supported)!", m_name.c_str());
+
+    m_vertexCtr = m_vertexCount;
+    m_faceCtr = m_faceCount;
+    logStatistics(timer);
+    return true;
+}
+
 MTS_IMPLEMENT_CLASS_S(PLYLoader, false, TriMesh)
 MTS_EXPORT_PLUGIN(PLYLoader, "PLY mesh loader");
 MTS_NAMESPACE_END
@@ -142,6 +142,15 @@ extern MTS_EXPORT_RENDER void pushSceneCleanupHandler(void (*cleanup)());
  * \bottomrule
  * \end{longtable}
  * \end{center}
+ *
+ * \paragraph{Uncompressed variant:}
+ * Files with the version identifier \code{0x0005} (written by
+ * \code{mtsimport -u}) store the same fields without compression. Here,
+ * the vertex attribute arrays and the triangle data each start at a file
+ * offset that is a multiple of 64 bytes (the gaps are zero-padded). Such files
+ * are larger, but Mitsuba maps them into memory and uses the data in place,
+ * which avoids the decompression step and lets several rendering processes
+ * share the same physical memory.
  */
 class SerializedMesh : public TriMesh {
 public:
@@ -163,8 +172,9 @@ public:
         Log(EInfo, "Loading shape %i from \"%s\" ..", shapeIndex, filePath.filename().string().c_str());
         ref<Timer> timer = new Timer();
         loadCompressed(filePath, shapeIndex);
-        Log(EDebug, "Done (" SIZE_T_FMT " triangles, " SIZE_T_FMT " vertices, %i ms)",
-            m_triangleCount, m_vertexCount, timer->getMilliseconds());
+        Log(EDebug, "Done (" SIZE_T_FMT " triangles, " SIZE_T_FMT " vertices, %i ms%s)",
+            m_triangleCount, m_vertexCount, timer->getMilliseconds(),
+            isMapped() ? ", memory-mapped" : "");
 
         if (m_name.empty())
             m_name = name;
@@ -182,6 +192,8 @@ public:
         m_flipNormals = props.getBoolean("flipNormals", false);
 
         if (!objectToWorld.isIdentity()) {
+            detachArray(m_positions, m_vertexCount);
+            detachArray(m_normals, m_vertexCount);
             m_aabb.reset();
             for (size_t i=0; i<m_vertexCount; ++i) {
                 Point p = objectToWorld(m_positions[i]);
@@ -195,6 +207,7 @@ public:
         }
 
         if (objectToWorld.det3x3() < 0) {
+            detachArray(m_triangles, m_triangleCount);
             for (size_t i=0; i<m_triangleCount; ++i) {
                 Triangle &t = m_triangles[i];
                 std::swap(t.idx[0], t.idx[1]);
@@ -235,6 +248,24 @@ private:
                 // Assume there is a single mesh in the file at offset 0
                 m_offsets.resize(1, 0);
             }
+
+            /* Uncompressed files are mapped into memory, so that the
+               meshes can directly reference their contents */
+            if (version == MTS_FILEFORMAT_VERSION_V5) {
+                m_fstream->close();
+                m_fstream = NULL;
+                m_mmap = new MemoryMappedFile(filePath, true, true);
+            }
+        }
+
+        /// Return the offset of the given shape index within the file
+        inline size_t getOffset(size_t shapeIndex) const {
+            if (shapeIndex >= m_offsets.size()) {
+                SLog(EError, "Unable to unserialize mesh, "
+                    "shape index is out of range! (requested %i out of 0..%i)",
+                    (int) shapeIndex, (int) (m_offsets.size()-1));
+            }
+            return m_offsets[shapeIndex];
         }
 
         /**
@@ -242,19 +273,17 @@ private:
          * Returns the modified stream.
          */
         inline FileStream* seekStream(size_t shapeIndex) {
-            if (shapeIndex > m_offsets.size()) {
-                SLog(EError, "Unable to unserialize mesh, "
-                    "shape index is out of range! (requested %i out of 0..%i)",
-                    shapeIndex, (int) (m_offsets.size()-1));
-            }
-            const size_t pos = m_offsets[shapeIndex];
-            m_fstream->seek(pos);
+            m_fstream->seek(getOffset(shapeIndex));
             return m_fstream;
         }
 
+        /// Return the memory mapping of an uncompressed file (or \c NULL)
+        inline MemoryMappedFile *getMapping() { return m_mmap; }
+
     private:
         std::vector<size_t> m_offsets;
         ref<FileStream> m_fstream;
+        ref<MemoryMappedFile> m_mmap;
     };
 
     typedef LRUCache<fs::path, std::less<fs::path>,
@@ -298,7 +327,11 @@ private:
 
         boost::shared_ptr<MeshLoader> meshLoader = cache->get(filePath);
         Assert(meshLoader != NULL);
-        TriMesh::loadCompressed(meshLoader->seekStream((size_t) idx));
+        if (meshLoader->getMapping())
+            TriMesh::loadMapped(meshLoader->getMapping(),
+                meshLoader->getOffset((size_t) idx));
+        else
+            TriMesh::loadCompressed(meshLoader->seekStream((size_t) idx));
     }
 
     static ThreadLocal<FileStreamCache> m_cache;
@@ -1513,10 +1513,9 @@ public:
                     // b1) is it a leaf?
                     if (currNode->isLeaf()) {
                         /// Index number format (max 2^32 prims)
-                        const uint32_t primEnd = currNode->getPrimEnd();
-                        for (uint32_t entry = currNode->getPrimStart();
-                             entry < primEnd; entry++) {
-                            uint32_t primIdx = scene->getKDTree()->getIndices()[entry];
+                        ShapeKDTree::LeafIterator leafIt(scene->getKDTree(), currNode);
+                        uint32_t primIdx;
+                        while (leafIt.next(primIdx)) {
                             uint32_t shapeIdx = scene->getKDTree()->findShape(primIdx);
                             if (its.shape ==
                                 scene->getKDTree()->getShapes()[shapeIdx]) {
@@ -1666,6 +1665,14 @@ public:
                 MTS_CLASS(SamplingIntegrator)))
             Log(EError, "The single scattering pluging requires "
                         "a sampling-based surface integrator!");
+        if (!m_fastSingleScatter && scene->getBVH())
+            Log(EError, "The single scattering plugin requires the kd-tree "
+                        "accelerator when 'fastSingleScatter' is disabled!");
+        /* Instanced geometry is stored in a separate BVH, which the
+           kd-tree leaf traversal of the exact path would miss */
+        if (!m_fastSingleScatter && scene->getInstanceBVH())
+            Log(EError, "The single scattering plugin does not support "
+                        "instanced geometry when 'fastSingleScatter' is disabled!");
         return true;
     }
 
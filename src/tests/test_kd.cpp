@@ -20,6 +20,15 @@
 #include <mitsuba/core/kdtree.h>
 #include <mitsuba/render/testcase.h>
 #include <mitsuba/render/skdtree.h>
+#include <mitsuba/render/sbvh.h>
+#include <mitsuba/render/photonmap.h>
+#include <mitsuba/render/scene.h>
+#if defined(MTS_HAS_COHERENT_RT)
+#include <mitsuba/core/ray_sse.h>
+#if defined(MTS_AVX)
+#include <mitsuba/core/ray_avx.h>
+#endif
+#endif
 
 MTS_NAMESPACE_BEGIN
 
@@ -29,6 +38,14 @@ public:
     MTS_DECLARE_TEST(test01_sutherlandHodgman)
     MTS_DECLARE_TEST(test02_bunnyBenchmark)
     MTS_DECLARE_TEST(test03_pointKDTree)
+    MTS_DECLARE_TEST(test04_bunnyBVH)
+    MTS_DECLARE_TEST(test05_bunnyBVHRefit)
+    MTS_DECLARE_TEST(test06_photonMapBuildBenchmark)
+    MTS_DECLARE_TEST(test07_deformable)
+    MTS_DECLARE_TEST(test08_sceneUpdateGeometry)
+    MTS_DECLARE_TEST(test09_rayStreams)
+    MTS_DECLARE_TEST(test10_compactPackets)
+    MTS_DECLARE_TEST(test11_outOfCore)
     MTS_END_TESTCASE()
 
     void test01_sutherlandHodgman() {
@@ -214,6 +231,557 @@ public:
         Log(EInfo, "Normal node size = " SIZE_T_FMT " bytes", sizeof(KDTree2::NodeType));
         Log(EInfo, "Left-balanced node size = " SIZE_T_FMT " bytes", sizeof(KDTree2Left::NodeType));
     }
+
+    void test04_bunnyBVH() {
+        Properties bunnyProps("ply");
+        bunnyProps.setString("filename", "data/tests/bunny.ply");
+
+        PluginManager *pmgr = PluginManager::getInstance();
+        ref<TriMesh> mesh = static_cast<TriMesh *> (
+                pmgr->createObject(MTS_CLASS(TriMesh), bunnyProps));
+        mesh->addChild(pmgr->createObject(Properties("diffuse")));
+        mesh->configure();
+        ref<ShapeKDTree> tree = new ShapeKDTree();
+        tree->addShape(mesh);
+        tree->build();
+        ref<ShapeBVH> bvh = new ShapeBVH();
+        bvh->addShape(mesh);
+        bvh->build();
+
+        Log(EInfo, "kd-tree: %u ms, %s; BVH: %u ms, %s",
+            tree->getBuildTime(), memString(tree->getMemoryUsage()).c_str(),
+            bvh->getBuildTime(), memString(bvh->getMemoryUsage()).c_str());
+
+        /* Both accelerators must report the same closest intersections */
+        BSphere bsphere(Point(-0.016840, 0.110154, -0.001537), .2f);
+        ref<Random> random = new Random();
+        size_t nRays = 100000, nIntersections = 0;
+        for (size_t i=0; i<nRays; ++i) {
+            Point2 sample1(random->nextFloat(), random->nextFloat()),
+                sample2(random->nextFloat(), random->nextFloat());
+            Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+            Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+            Ray r(p1, normalize(p2-p1), 0.0f);
+            Intersection its1, its2;
+
+            bool hit = tree->rayIntersect(r, its1);
+            assertTrue(hit == bvh->rayIntersect(r, its2));
+            assertTrue(hit == bvh->rayIntersect(r));
+            if (hit) {
+                assertEqualsEpsilon(its1.t, its2.t, 1e-4f);
+                nIntersections++;
+            }
+        }
+        Log(EInfo, "Compared " SIZE_T_FMT " rays (" SIZE_T_FMT " intersections)",
+            nRays, nIntersections);
+    }
+
+    void test05_bunnyBVHRefit() {
+        Properties bunnyProps("ply");
+        bunnyProps.setString("filename", "data/tests/bunny.ply");
+
+        PluginManager *pmgr = PluginManager::getInstance();
+        ref<TriMesh> mesh = static_cast<TriMesh *> (
+                pmgr->createObject(MTS_CLASS(TriMesh), bunnyProps));
+        mesh->addChild(pmgr->createObject(Properties("diffuse")));
+        mesh->configure();
+        ref<ShapeBVH> bvh = new ShapeBVH();
+        bvh->addShape(mesh);
+        bvh->build();
+
+        /* Twist the bunny around the vertical axis and refit the BVH */
+        Point *positions = mesh->getVertexPositions();
+        Point center = mesh->getAABB().getCenter();
+        for (size_t i=0; i<mesh->getVertexCount(); ++i) {
+            Transform rotation = Transform::rotate(Vector(0, 1, 0),
+                2000 * (positions[i].y - center.y));
+            positions[i] = center + rotation(positions[i] - center);
+        }
+        mesh->updateGeometry();
+        bvh->refit();
+
+        ref<ShapeKDTree> tree = new ShapeKDTree();
+        tree->addShape(mesh);
+        tree->build();
+
+        Log(EInfo, "BVH build: %u ms, refit: %u ms", bvh->getBuildTime(),
+            bvh->getRefitTime());
+
+        /* The refit BVH must agree with a kd-tree built from scratch */
+        BSphere bsphere(Point(-0.016840, 0.110154, -0.001537), .2f);
+        ref<Random> random = new Random();
+        for (size_t i=0; i<100000; ++i) {
+            Point2 sample1(random->nextFloat(), random->nextFloat()),
+                sample2(random->nextFloat(), random->nextFloat());
+            Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+            Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+            Ray r(p1, normalize(p2-p1), 0.0f);
+            Intersection its1, its2;
+
+            bool hit = tree->rayIntersect(r, its1);
+            assertTrue(hit == bvh->rayIntersect(r, its2));
+            assertTrue(hit == bvh->rayIntersect(r));
+            if (hit)
+                assertEqualsEpsilon(its1.t, its2.t, 1e-4f);
+        }
+    }
+
+    void test06_photonMapBuildBenchmark() {
+        typedef PhotonMap::PhotonTree PhotonTree;
+        int coreCount = getCoreCount();
+        ref<Random> random = new Random();
+
+        for (size_t photonCount = 250000; photonCount <= 16000000; photonCount *= 4) {
+            /* Clustered photon distribution, which leads to unbalanced subtrees */
+            std::vector<Point> positions(photonCount);
+            for (size_t i=0; i<photonCount; ++i) {
+                Float scale = (i % 4 == 0) ? 1.0f : 0.05f;
+                positions[i] = Point(random->nextFloat(), random->nextFloat(),
+                    random->nextFloat()) * scale;
+            }
+
+            PhotonTree reference;
+            for (int threadCount = 1; threadCount <= coreCount; threadCount *= 2) {
+                Thread::initializeOpenMP(threadCount);
+
+                PhotonTree tree(photonCount, PhotonTree::ESlidingMidpoint);
+                tree.setParallelBuild(threadCount > 1);
+                for (size_t i=0; i<photonCount; ++i)
+                    tree[i].setPosition(positions[i]);
+
+                ref<Timer> timer = new Timer();
+                tree.build(true);
+                Log(EInfo, "Built a photon map with " SIZE_T_FMT " photons using %i "
+                    "thread(s) in %i ms (depth = " SIZE_T_FMT ")", photonCount,
+                    threadCount, timer->getMilliseconds(), tree.getDepth());
+
+                /* The parallel build must produce exactly the same tree */
+                if (threadCount == 1) {
+                    reference = tree;
+                    continue;
+                }
+                assertTrue(reference.getDepth() == tree.getDepth());
+                size_t mismatches = 0;
+                for (size_t i=0; i<photonCount; ++i) {
+                    const Photon &p1 = reference[i], &p2 = tree[i];
+                    if (p1.getPosition() != p2.getPosition() || p1.isLeaf() != p2.isLeaf()
+                        || p1.getAxis() != p2.getAxis()
+                        || p1.getRightIndex((uint32_t) i) != p2.getRightIndex((uint32_t) i))
+                        ++mismatches;
+                }
+                assertTrue(mismatches == 0);
+            }
+        }
+
+        Thread::initializeOpenMP(coreCount);
+    }
+
+    /// Create a unit square in the XY plane at the given height
+    ref<TriMesh> createSquare(Float z) {
+        ref<TriMesh> mesh = new TriMesh("square", 2, 4);
+        Point *positions = mesh->getVertexPositions();
+        Triangle *triangles = mesh->getTriangles();
+        positions[0] = Point(0, 0, z); positions[1] = Point(1, 0, z);
+        positions[2] = Point(1, 1, z); positions[3] = Point(0, 1, z);
+        triangles[0].idx[0] = 0; triangles[0].idx[1] = 1; triangles[0].idx[2] = 2;
+        triangles[1].idx[0] = 0; triangles[1].idx[1] = 2; triangles[1].idx[2] = 3;
+        ref<ConfigurableObject> bsdf =
+            PluginManager::getInstance()->createObject(Properties("diffuse"));
+        bsdf->configure();
+        mesh->addChild(bsdf);
+        mesh->configure();
+        return mesh;
+    }
+
+    void test07_deformable() {
+        PluginManager *pmgr = PluginManager::getInstance();
+        const char *accels[] = { "kdtree", "bvh" };
+
+        for (int i=0; i<2; ++i) {
+            /* A square that moves from z=0 to z=1 */
+            ref<TriMesh> frame0 = createSquare(0), frame1 = createSquare(1);
+            Properties props("deformable");
+            props.setString("times", "0, 1");
+            props.setString("accel", accels[i]);
+            ref<Shape> shape = static_cast<Shape *> (
+                pmgr->createObject(MTS_CLASS(Shape), props));
+            shape->addChild(frame0);
+            shape->addChild(frame1);
+            shape->configure();
+
+            for (int pass=0; pass<2; ++pass) {
+                /* The second pass moves the last keyframe up to z=2 */
+                Float height = (Float) (pass + 1);
+                for (int j=0; j<=10; ++j) {
+                    Float time = j / (Float) 10;
+                    Ray ray(Point(0.25f, 0.5f, -1), Vector(0, 0, 1), time);
+                    uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+                    Float t;
+
+                    assertTrue(shape->rayIntersect(ray, ray.mint, ray.maxt, t, temp));
+                    assertTrue(shape->rayIntersect(ray, ray.mint, ray.maxt));
+                    assertEqualsEpsilon(t, 1 + time * height, 1e-4f);
+
+                    Intersection its;
+                    its.t = t;
+                    shape->fillIntersectionRecord(ray, temp, its);
+                    assertEqualsEpsilon(its.p.z, time * height, 1e-4f);
+                    assertEqualsEpsilon(absDot(its.geoFrame.n, Vector(0, 0, 1)), (Float) 1, 1e-4f);
+
+                    Vector dndu, dndv;
+                    shape->getNormalDerivative(its, dndu, dndv, true);
+                }
+
+                Point *positions = frame1->getVertexPositions();
+                for (size_t j=0; j<frame1->getVertexCount(); ++j)
+                    positions[j].z = 2;
+                shape->updateGeometry();
+            }
+            Log(EInfo, "Deformable shape with accel=\"%s\" works", accels[i]);
+        }
+    }
+
+    void test08_sceneUpdateGeometry() {
+        PluginManager *pmgr = PluginManager::getInstance();
+        Properties sceneProps("scene");
+        sceneProps.setString("accel", "bvh");
+        ref<Scene> scene = new Scene(sceneProps);
+        ref<TriMesh> mesh = createSquare(0);
+        scene->addChild(mesh);
+        Properties emitterProps("point");
+        emitterProps.setPoint("position", Point(0.5f, 0.5f, 1));
+        scene->addChild(pmgr->createObject(MTS_CLASS(Emitter), emitterProps));
+        scene->configure();
+        scene->initialize();
+
+        /* Move the square far away; the scene bounds must follow */
+        Point *positions = mesh->getVertexPositions();
+        for (size_t i=0; i<mesh->getVertexCount(); ++i)
+            positions[i].z = 100;
+        scene->updateGeometry();
+
+        assertTrue(scene->getGeometryAABB().contains(Point(0.5f, 0.5f, 100)));
+        assertTrue(scene->getAABB().contains(Point(0.5f, 0.5f, 100)));
+        assertTrue(scene->getBSphere().contains(Point(0.5f, 0.5f, 100)));
+
+        Ray ray(Point(0.25f, 0.5f, 50), Vector(0, 0, 1), 0.0f);
+        Intersection its;
+        assertTrue(scene->rayIntersect(ray, its));
+        assertEqualsEpsilon(its.t, (Float) 50, 1e-4f);
+
+        /* Vertex normals must follow a tilted square, including ones
+           that were flipped when the mesh was configured */
+        for (int flip=0; flip<2; ++flip) {
+            ref<TriMesh> square = new TriMesh("square", 2, 4, true, false,
+                false, flip == 1);
+            Point *p = square->getVertexPositions();
+            Triangle *triangles = square->getTriangles();
+            p[0] = Point(0, 0, 0); p[1] = Point(1, 0, 0);
+            p[2] = Point(1, 1, 0); p[3] = Point(0, 1, 0);
+            triangles[0].idx[0] = 0; triangles[0].idx[1] = 1; triangles[0].idx[2] = 2;
+            triangles[1].idx[0] = 0; triangles[1].idx[1] = 2; triangles[1].idx[2] = 3;
+            square->computeNormals(true);
+
+            for (int i=0; i<4; ++i)
+                p[i].z = p[i].x;
+            square->updateGeometry();
+
+            Normal expected = Normal(-1, 0, 1) / std::sqrt((Float) 2) * (flip ? -1 : 1);
+            for (int i=0; i<4; ++i)
+                assertEqualsEpsilon(Vector(square->getVertexNormals()[i]),
+                    Vector(expected), 1e-5f);
+        }
+    }
+
+    /// Build a kd-tree over the bunny and a square behind it
+    ref<ShapeKDTree> createBunnyTree() {
+        Properties bunnyProps("ply");
+        bunnyProps.setString("filename", "data/tests/bunny.ply");
+
+        PluginManager *pmgr = PluginManager::getInstance();
+        ref<TriMesh> mesh = static_cast<TriMesh *> (
+                pmgr->createObject(MTS_CLASS(TriMesh), bunnyProps));
+        ref<ConfigurableObject> bsdf = pmgr->createObject(Properties("diffuse"));
+        bsdf->configure();
+        mesh->addChild(bsdf);
+        mesh->configure();
+
+        ref<ShapeKDTree> tree = new ShapeKDTree();
+        tree->addShape(mesh);
+        tree->addShape(createSquare(-0.1f));
+        return tree;
+    }
+
+    /**
+     * Create a stream of rays through the bunny. Coherent streams are
+     * camera rays of a pinhole camera in front of it, otherwise the rays
+     * connect random points on its bounding sphere
+     */
+    std::vector<Ray> createRays(bool coherent) {
+        const BSphere bsphere(Point(-0.016840f, 0.110154f, -0.001537f), .2f);
+        const int xres = 101, yres = 99;
+        std::vector<Ray> rays(xres * yres);
+        ref<Random> random = new Random();
+
+        for (int y=0; y<yres; ++y) {
+            for (int x=0; x<xres; ++x) {
+                Ray &ray = rays[y*xres + x];
+                if (coherent) {
+                    Vector d(x / (Float) (xres-1) - 0.5f,
+                        y / (Float) (yres-1) - 0.5f, -1.0f);
+                    ray = Ray(bsphere.center + Vector(0, 0, 0.5f), normalize(d), 0.0f);
+                } else {
+                    Point2 sample1(random->nextFloat(), random->nextFloat()),
+                        sample2(random->nextFloat(), random->nextFloat());
+                    Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+                    Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+                    ray = Ray(p1, normalize(p2-p1), 0.0f);
+                }
+            }
+        }
+        return rays;
+    }
+
+    /// Do two intersection records refer to the same hit?
+    bool sameHit(const Intersection &its1, const Intersection &its2) {
+        if (!its1.isValid() || !its2.isValid())
+            return its1.isValid() == its2.isValid();
+        return its1.shape == its2.shape && its1.primIndex == its2.primIndex
+            && std::abs(its1.t - its2.t) <= 1e-4f * std::max((Float) 1, its1.t);
+    }
+
+    void test09_rayStreams() {
+        ref<ShapeKDTree> tree = createBunnyTree();
+        tree->build();
+
+        for (int coherent=0; coherent<2; ++coherent) {
+            std::vector<Ray> rays = createRays(coherent == 1);
+            size_t count = rays.size();
+            std::vector<Intersection> reference(count);
+            std::vector<bool> referenceOccluded(count);
+            size_t hits[2] = { 0, 0 };
+            for (size_t i=0; i<count; ++i) {
+                tree->rayIntersect(rays[i], reference[i]);
+                referenceOccluded[i] = tree->rayIntersect(rays[i]);
+                if (reference[i].isValid())
+                    hits[reference[i].shape == tree->getShapes()[0] ? 0 : 1]++;
+            }
+            /* Both shapes must be hit for the shape indices to be compared */
+            assertTrue(hits[0] > 0 && hits[1] > 0);
+
+            /* Every packet width must return the same hits as the scalar
+               traversal, also for the rays that are left over after the
+               stream was regrouped into packets of the given width */
+            for (int width=1; width<=ShapeKDTree::getMaxPacketWidth(); width *= (width == 1 ? 4 : 2)) {
+                std::vector<Intersection> its(count);
+                bool *occluded = new bool[count];
+                tree->rayIntersectBatch(&rays[0], count, &its[0], width);
+                tree->rayIntersectBatch(&rays[0], count, occluded, width);
+
+                size_t mismatches = 0, occlusionMismatches = 0;
+                for (size_t i=0; i<count; ++i) {
+                    if (!sameHit(its[i], reference[i]))
+                        ++mismatches;
+                    if (occluded[i] != referenceOccluded[i])
+                        ++occlusionMismatches;
+                }
+                delete[] occluded;
+
+                Log(EInfo, "%s rays, %i-wide packets: " SIZE_T_FMT "/" SIZE_T_FMT
+                    " hits and " SIZE_T_FMT " occlusion queries differ",
+                    coherent ? "Coherent" : "Incoherent", width, mismatches,
+                    count, occlusionMismatches);
+                assertTrue(mismatches == 0);
+                assertTrue(occlusionMismatches == 0);
+            }
+        }
+    }
+
+#if defined(MTS_HAS_COHERENT_RT)
+    /// Hit of a single ray of a packet
+    struct PacketHit {
+        Float t;
+        int shapeIndex, primIndex;
+    };
+
+    /**
+     * Trace a stream of rays as packets of the given width. The rays are
+     * grouped by their direction octant, and the packets at the end of each
+     * octant are padded with copies of its last ray
+     */
+    template <typename Packet, typename Interval, typename Its, int Width>
+            std::vector<PacketHit> tracePackets(const ShapeKDTree *tree,
+            const std::vector<Ray> &rays) {
+        std::vector<std::pair<int, size_t> > order(rays.size());
+        for (size_t i=0; i<rays.size(); ++i)
+            order[i] = std::make_pair((rays[i].d.x < 0 ? 1 : 0) | (rays[i].d.y < 0 ? 2 : 0)
+                | (rays[i].d.z < 0 ? 4 : 0), i);
+        std::sort(order.begin(), order.end());
+
+        std::vector<PacketHit> hits(rays.size());
+        uint8_t MM_ALIGN64 temp[Width * MTS_KD_INTERSECTION_TEMP];
+        Ray packetRays[Width];
+        size_t packetIndices[Width];
+
+        size_t start = 0;
+        while (start < order.size()) {
+            size_t end = start + 1;
+            while (end < order.size() && order[end].first == order[start].first)
+                ++end;
+
+            for (size_t i=start; i<end; i += Width) {
+                for (int j=0; j<Width; ++j) {
+                    packetIndices[j] = order[std::min(i + j, end - 1)].second;
+                    packetRays[j] = rays[packetIndices[j]];
+                }
+
+                Packet MM_ALIGN64 packet;
+                Interval MM_ALIGN64 interval(packetRays);
+                Its MM_ALIGN64 its;
+                assertTrue(packet.load(packetRays));
+                tree->rayIntersectPacket(packet, interval, its, temp);
+
+                for (int j=0; j<Width; ++j) {
+                    PacketHit &hit = hits[packetIndices[j]];
+                    hit.t = its.t.f[j];
+                    hit.shapeIndex = its.shapeIndex.i[j];
+                    hit.primIndex = its.primIndex.i[j];
+                }
+            }
+            start = end;
+        }
+        return hits;
+    }
+#endif
+
+    void test10_compactPackets() {
+#if defined(MTS_HAS_COHERENT_RT)
+        /* Compact trees don't store the TriAccel records that the packet
+           traversal relies on. They must still return the same hits */
+        ref<ShapeKDTree> tree = createBunnyTree(), compactTree = createBunnyTree();
+        tree->build();
+        compactTree->setCompact(true);
+        compactTree->build();
+
+        for (int coherent=0; coherent<2; ++coherent) {
+            std::vector<Ray> rays = createRays(coherent == 1);
+            size_t count = rays.size();
+            std::vector<Intersection> reference(count);
+            for (size_t i=0; i<count; ++i)
+                tree->rayIntersect(rays[i], reference[i]);
+
+            for (int width=4; width<=ShapeKDTree::getMaxPacketWidth(); width *= 2) {
+                std::vector<PacketHit> hits;
+                switch (width) {
+#if defined(MTS_AVX512)
+                    case 16:
+                        hits = tracePackets<RayPacket16, RayInterval16, Intersection16, 16>(compactTree, rays);
+                        break;
+#endif
+#if defined(MTS_AVX)
+                    case 8:
+                        hits = tracePackets<RayPacket8, RayInterval8, Intersection8, 8>(compactTree, rays);
+                        break;
+#endif
+                    default:
+                        hits = tracePackets<RayPacket4, RayInterval4, Intersection4, 4>(compactTree, rays);
+                        break;
+                }
+
+                size_t mismatches = 0;
+                for (size_t i=0; i<count; ++i) {
+                    const Intersection &its = reference[i];
+                    const PacketHit &hit = hits[i];
+                    bool same;
+                    if (!its.isValid())
+                        same = hit.t == std::numeric_limits<Float>::infinity();
+                    else
+                        same = tree->getShapes()[hit.shapeIndex] == its.shape
+                            && (uint32_t) hit.primIndex == its.primIndex
+                            && std::abs(hit.t - its.t) <= 1e-4f * std::max((Float) 1, its.t);
+                    if (!same)
+                        ++mismatches;
+                }
+                Log(EInfo, "%s rays, %i-wide packets on a compact tree: " SIZE_T_FMT "/"
+                    SIZE_T_FMT " hits differ", coherent ? "Coherent" : "Incoherent",
+                    width, mismatches, count);
+                assertTrue(mismatches == 0);
+            }
+        }
+#endif
+    }
+
+    /// Traces a range of rays and records the largest number of resident pages
+    class TraceThread : public Thread {
+    public:
+        TraceThread(const ShapeKDTree *tree, const Ray *rays, Intersection *its,
+            size_t count) : Thread("trace"), m_tree(tree), m_rays(rays), m_its(its),
+            m_count(count), m_maxResident(0) { }
+
+        void run() {
+            const GeometryPager *pager = m_tree->getPager();
+            for (size_t i=0; i<m_count; ++i) {
+                m_tree->rayIntersect(m_rays[i], m_its[i]);
+                m_maxResident = std::max(m_maxResident, pager->getResidentPageCount());
+            }
+        }
+
+        inline size_t getMaxResident() const { return m_maxResident; }
+    private:
+        const ShapeKDTree *m_tree;
+        const Ray *m_rays;
+        Intersection *m_its;
+        size_t m_count, m_maxResident;
+    };
+
+    void test11_outOfCore() {
+        /* Page the bunny through caches that only hold four pages in total */
+        const size_t maxPages = 4, threadCount = 4;
+        ref<ShapeKDTree> tree = createBunnyTree(), outOfCoreTree = new ShapeKDTree();
+        for (size_t i=0; i<tree->getShapes().size(); ++i)
+            outOfCoreTree->addShape(tree->getShapes()[i]);
+        tree->build();
+        outOfCoreTree->setOutOfCore(true);
+        outOfCoreTree->setPageCacheSize(maxPages * GeometryPager::EPageSize * sizeof(TriAccel));
+        outOfCoreTree->build();
+        assertTrue(outOfCoreTree->getPager() != NULL);
+        assertTrue(outOfCoreTree->getPager()->getPageCount() > maxPages);
+
+        for (int coherent=0; coherent<2; ++coherent) {
+            std::vector<Ray> rays = createRays(coherent == 1);
+            size_t count = rays.size();
+            std::vector<Intersection> reference(count), its(count);
+            for (size_t i=0; i<count; ++i)
+                tree->rayIntersect(rays[i], reference[i]);
+
+            /* None of these threads is a worker of the scheduler. The caches
+               of all of them must nonetheless share the same limit, apart
+               from the page that each thread is currently reading */
+            ref_vector<TraceThread> threads;
+            size_t perThread = (count + threadCount - 1) / threadCount;
+            for (size_t i=0; i<count; i += perThread)
+                threads.push_back(new TraceThread(outOfCoreTree, &rays[i],
+                    &its[i], std::min(perThread, count - i)));
+            for (size_t i=0; i<threads.size(); ++i)
+                threads[i]->start();
+            size_t maxResident = 0;
+            for (size_t i=0; i<threads.size(); ++i) {
+                threads[i]->join();
+                maxResident = std::max(maxResident, threads[i]->getMaxResident());
+            }
+
+            size_t mismatches = 0;
+            for (size_t i=0; i<count; ++i) {
+                if (!sameHit(its[i], reference[i]))
+                    ++mismatches;
+            }
+            Log(EInfo, "%s rays, out-of-core: " SIZE_T_FMT "/" SIZE_T_FMT " hits differ, "
+                "up to " SIZE_T_FMT " resident pages", coherent ? "Coherent" : "Incoherent",
+                mismatches, count, maxResident);
+            assertTrue(mismatches == 0);
+            assertTrue(maxResident <= maxPages + threads.size());
+        }
+    }
 };
 
 MTS_EXPORT_TESTCASE(TestKDTree, "Testcase for kd-tree related code")
@@ -0,0 +1,71 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/core/plugin.h>
+
+MTS_NAMESPACE_BEGIN
+
+class TestPLY : public TestCase {
+public:
+    MTS_BEGIN_TESTCASE()
+    MTS_DECLARE_TEST(test01_doublePrecisionFast)
+    MTS_DECLARE_TEST(test02_doublePrecisionGeneric)
+    MTS_END_TESTCASE()
+
+    /// Load a quad with double precision attributes using either PLY parser
+    void checkDoublePrecision(bool fastLoad) {
+        Properties props("ply");
+        props.setString("filename", "data/tests/ply_double.ply");
+        props.setBoolean("fastLoad", fastLoad);
+
+        ref<TriMesh> mesh = static_cast<TriMesh *> (PluginManager::getInstance()->
+            createObject(MTS_CLASS(TriMesh), props));
+        mesh->configure();
+
+        const Point positions[] = {
+            Point(-1.25f, 0.5f, 0.375f), Point(2.5f, 0.5f, 0.375f),
+            Point(2.5f, 3.75f, 0.375f), Point(-1.25f, 3.75f, 0.375f)
+        };
+        const Point2 texcoords[] = {
+            Point2(0, 0), Point2(1, 0), Point2(1, 1), Point2(0, 1)
+        };
+
+        assertEquals((int) mesh->getVertexCount(), 4);
+        assertEquals((int) mesh->getTriangleCount(), 2);
+        assertTrue(mesh->hasVertexNormals());
+        assertTrue(mesh->hasVertexTexcoords());
+        for (int i=0; i<4; ++i) {
+            assertEqualsEpsilon(mesh->getVertexPositions()[i], positions[i], 1e-6f);
+            assertEqualsEpsilon(Vector(mesh->getVertexNormals()[i]), Vector(0, 0, 1), 1e-6f);
+            assertEqualsEpsilon(mesh->getVertexTexcoords()[i], texcoords[i], 1e-6f);
+        }
+    }
+
+    void test01_doublePrecisionFast() {
+        checkDoublePrecision(true);
+    }
+
+    void test02_doublePrecisionGeneric() {
+        checkDoublePrecision(false);
+    }
+};
+
+MTS_EXPORT_TESTCASE(TestPLY, "Testcase for the PLY loader")
+MTS_NAMESPACE_END
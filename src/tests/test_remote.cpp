@@ -0,0 +1,414 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/render/range.h>
+#include <mitsuba/core/sched_remote.h>
+#include <mitsuba/core/sstream.h>
+#include <mitsuba/core/version.h>
+#include <mitsuba/core/timer.h>
+#include <deque>
+
+#if defined(__WINDOWS__)
+# include <winsock2.h>
+# include <ws2tcpip.h>
+# define closeSocket closesocket
+#else
+# include <unistd.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+# define closeSocket close
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+/// Array of integers, which is transmitted to the remote node as a resource
+class TestArray : public SerializableObject {
+public:
+    TestArray(size_t size, uint64_t seed) : m_data(size) {
+        ref<Random> random = new Random(seed);
+        for (size_t i=0; i<size; ++i)
+            m_data[i] = (unsigned int) random->nextULong();
+    }
+
+    TestArray(Stream *stream, InstanceManager *manager)
+        : SerializableObject(stream, manager) {
+        m_data.resize(stream->readSize());
+        stream->readUIntArray(&m_data[0], m_data.size());
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        stream->writeSize(m_data.size());
+        stream->writeUIntArray(&m_data[0], m_data.size());
+    }
+
+    inline size_t getSize() const { return m_data.size(); }
+
+    inline uint64_t sum(size_t start, size_t end) const {
+        uint64_t result = 0;
+        for (size_t i=start; i<end; ++i)
+            result += m_data[i];
+        return result;
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    std::vector<unsigned int> m_data;
+};
+
+class TestSumResult : public WorkResult {
+public:
+    void load(Stream *stream) { sum = stream->readULong(); }
+    void save(Stream *stream) const { stream->writeULong(sum); }
+    std::string toString() const { return "TestSumResult[]"; }
+
+    uint64_t sum;
+
+    MTS_DECLARE_CLASS()
+};
+
+/// Sums up a range of the array, which is bound to the resource name "data"
+class TestSumWorker : public WorkProcessor {
+public:
+    TestSumWorker() { }
+
+    TestSumWorker(Stream *stream, InstanceManager *manager)
+        : WorkProcessor(stream, manager) { }
+
+    void serialize(Stream *stream, InstanceManager *manager) const { }
+
+    ref<WorkUnit> createWorkUnit() const { return new RangeWorkUnit(); }
+    ref<WorkResult> createWorkResult() const { return new TestSumResult(); }
+    ref<WorkProcessor> clone() const { return new TestSumWorker(); }
+
+    void prepare() {
+        m_array = static_cast<TestArray *>(getResource("data"));
+    }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult, const bool &stop) {
+        const RangeWorkUnit *range = static_cast<const RangeWorkUnit *>(workUnit);
+        static_cast<TestSumResult *>(workResult)->sum =
+            m_array->sum(range->getRangeStart(), range->getRangeEnd() + 1);
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    ref<TestArray> m_array;
+};
+
+class TestSumProcess : public ParallelProcess {
+public:
+    TestSumProcess(size_t size) : m_size(size), m_pos(0), m_sum(0) {
+        m_mutex = new Mutex();
+    }
+
+    ref<WorkProcessor> createWorkProcessor() const { return new TestSumWorker(); }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        if (m_pos >= m_size)
+            return EFailure;
+        size_t end = std::min(m_pos + 4096, m_size);
+        static_cast<RangeWorkUnit *>(unit)->setRange(m_pos, end - 1);
+        m_pos = end;
+        return ESuccess;
+    }
+
+    void processResult(const WorkResult *result, bool cancelled) {
+        LockGuard lock(m_mutex);
+        m_sum += static_cast<const TestSumResult *>(result)->sum;
+    }
+
+    inline uint64_t getSum() const { return m_sum; }
+
+    MTS_DECLARE_CLASS()
+private:
+    ref<Mutex> m_mutex;
+    size_t m_size, m_pos;
+    uint64_t m_sum;
+};
+
+/**
+ * Stream wrapper, which delivers all written data after a fixed delay.
+ * Used to simulate a connection with a high latency.
+ */
+class TestDelayStream : public Stream {
+public:
+    TestDelayStream(Stream *stream, int delay) : m_stream(stream),
+            m_delay(delay), m_shutdown(false) {
+        setByteOrder(stream->getByteOrder());
+        m_mutex = new Mutex();
+        m_cond = new ConditionVariable(m_mutex);
+        m_timer = new Timer();
+        m_thread = new DelayThread(this);
+        m_thread->start();
+    }
+
+    void read(void *ptr, size_t size) { m_stream->read(ptr, size); }
+
+    void write(const void *ptr, size_t size) {
+        m_buffer.insert(m_buffer.end(), (const uint8_t *) ptr,
+            (const uint8_t *) ptr + size);
+    }
+
+    void flush() {
+        if (m_buffer.empty())
+            return;
+        LockGuard lock(m_mutex);
+        m_packets.push_back(Packet());
+        m_packets.back().deadline = m_timer->getMilliseconds() + m_delay;
+        m_packets.back().data.swap(m_buffer);
+        m_cond->signal();
+    }
+
+    void seek(size_t pos) { Log(EError, "seek(): unsupported!"); }
+    size_t getPos() const { Log(EError, "getPos(): unsupported!"); return 0; }
+    size_t getSize() const { Log(EError, "getSize(): unsupported!"); return 0; }
+    void truncate(size_t size) { Log(EError, "truncate(): unsupported!"); }
+    bool canWrite() const { return true; }
+    bool canRead() const { return true; }
+    std::string toString() const { return "TestDelayStream[]"; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~TestDelayStream() {
+        {
+            LockGuard lock(m_mutex);
+            m_shutdown = true;
+            m_cond->signal();
+        }
+        m_thread->join();
+    }
+
+    /// Forward the queued data to the nested stream once it is due
+    void deliver() {
+        while (true) {
+            Packet packet;
+            {
+                LockGuard lock(m_mutex);
+                while (m_packets.empty() && !m_shutdown)
+                    m_cond->wait();
+                if (m_packets.empty())
+                    break;
+                packet.deadline = m_packets.front().deadline;
+                packet.data.swap(m_packets.front().data);
+                m_packets.pop_front();
+            }
+            int remaining = packet.deadline - (int) m_timer->getMilliseconds();
+            if (remaining > 0)
+                Thread::sleep(remaining);
+            try {
+                m_stream->write(&packet.data[0], packet.data.size());
+                m_stream->flush();
+            } catch (const std::exception &) {
+                /* The connection was closed */
+            }
+        }
+    }
+
+    class DelayThread : public Thread {
+    public:
+        DelayThread(TestDelayStream *parent) : Thread("delay"), m_parent(parent) { }
+        void run() { m_parent->deliver(); }
+    private:
+        TestDelayStream *m_parent;
+    };
+
+    struct Packet {
+        int deadline;
+        std::vector<uint8_t> data;
+    };
+private:
+    ref<Stream> m_stream;
+    ref<Thread> m_thread;
+    ref<Mutex> m_mutex;
+    ref<ConditionVariable> m_cond;
+    ref<Timer> m_timer;
+    std::vector<uint8_t> m_buffer;
+    std::deque<Packet> m_packets;
+    int m_delay;
+    bool m_shutdown;
+};
+
+/// Scheduler of the client side, which only forwards work to the loopback connection
+class TestLoopbackScheduler : public Scheduler {
+public:
+    TestLoopbackScheduler() { }
+protected:
+    virtual ~TestLoopbackScheduler() { }
+};
+
+class TestRemoteScheduling : public TestCase {
+public:
+    MTS_BEGIN_TESTCASE()
+    MTS_DECLARE_TEST(test01_refuseOldClient)
+    MTS_DECLARE_TEST(test02_resourceCache)
+    MTS_DECLARE_TEST(test03_persistentResourceCache)
+    MTS_DECLARE_TEST(test04_latency)
+    MTS_END_TESTCASE()
+
+    /**
+     * Open a loopback connection to a stream backend, which forwards
+     * work to the global scheduler, and return the client side
+     */
+    ref<SocketStream> connect() {
+        SocketStream::socket_t listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        socklen_t addrLength = sizeof(addr);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+
+        if (bind(listenSocket, (struct sockaddr *) &addr, addrLength) != 0 ||
+            listen(listenSocket, 1) != 0 ||
+            getsockname(listenSocket, (struct sockaddr *) &addr, &addrLength) != 0)
+            Log(EError, "Could not set up a loopback socket!");
+
+        ref<SocketStream> stream = new SocketStream("127.0.0.1", ntohs(addr.sin_port));
+        SocketStream::socket_t serverSocket = accept(listenSocket, NULL, NULL);
+        closeSocket(listenSocket);
+
+        ref<StreamBackend> backend = new StreamBackend("loopback",
+            Scheduler::getInstance(), "loopback", new SocketStream(serverSocket), true);
+        backend->start();
+        return stream;
+    }
+
+    /**
+     * Sum up the array \c repetitions times on a new loopback connection
+     * and return the number of bytes that were sent to the remote node
+     */
+    size_t remoteSum(TestArray *array, int compressionLevel, int repetitions = 1) {
+        ref<SocketStream> stream = connect();
+        ref<Scheduler> scheduler = new TestLoopbackScheduler();
+        scheduler->registerWorker(new RemoteWorker("loopback", stream, compressionLevel));
+        scheduler->start();
+
+        uint64_t sum = array->sum(0, array->getSize());
+        for (int i=0; i<repetitions; ++i) {
+            /* Every iteration uses a new resource ID with identical contents */
+            int resID = scheduler->registerResource(array);
+            ref<TestSumProcess> proc = new TestSumProcess(array->getSize());
+            proc->bindResource("data", resID);
+            scheduler->schedule(proc);
+            scheduler->wait(proc);
+            scheduler->unregisterResource(resID);
+            assertTrue(proc->getReturnStatus() == ParallelProcess::ESuccess);
+            assertTrue(proc->getSum() == sum);
+        }
+
+        scheduler->stop();
+        scheduler = NULL;
+        return stream->getSentBytes();
+    }
+
+    void test01_refuseOldClient() {
+        /* Clients that predate the protocol revision send a shorter
+           hello message. They must be refused instead of hanging */
+        ref<SocketStream> stream = connect();
+        std::string hello(MTS_VERSION);
+        hello += '\0';
+        hello += (char) SPECTRUM_SAMPLES;
+#if defined(DOUBLE_PRECISION)
+        hello += (char) 1;
+#else
+        hello += (char) 0;
+#endif
+        stream->writeShort(0x1bcd); /* StreamBackend::EHello */
+        stream->write(hello.c_str(), hello.length());
+        stream->flush();
+        assertTrue(stream->readShort() != 0x1bcd);
+    }
+
+    void test02_resourceCache() {
+        ref<TestArray> array = new TestArray(1024*1024, 1);
+        size_t resourceSize = array->getSize() * sizeof(unsigned int);
+
+        /* Without a cache directory, a resource is only transmitted once
+           per connection when the node announced it during the handshake */
+        assertTrue(remoteSum(array, 0, 2) > 2 * resourceSize);
+        assertTrue(remoteSum(array, 0) < resourceSize / 16);
+        assertTrue(remoteSum(array, 1, 2) > resourceSize / 16);
+    }
+
+    void test03_persistentResourceCache() {
+        fs::path directory = fs::temp_directory_path() / fs::unique_path("mtscache-%%%%%%");
+        ref<TestArray> array = new TestArray(1024*1024, 2);
+        size_t resourceSize = array->getSize() * sizeof(unsigned int);
+
+        /* Evict every resource from memory as soon as it has been deserialized */
+        StreamBackend::configureResourceCache(0, directory);
+        assertTrue(remoteSum(array, 0) > resourceSize);
+        assertTrue(remoteSum(array, 0, 2) < resourceSize / 16);
+        assertTrue(remoteSum(array, 1, 2) < resourceSize / 16);
+
+        StreamBackend::configureResourceCache(
+            (size_t) MTS_RESOURCE_CACHE_SIZE * 1024 * 1024, fs::path());
+        fs::remove_all(directory);
+    }
+
+    void test04_latency() {
+        /* Delay everything that the client sends by 50 ms */
+        const int delay = 50;
+        ref<TestArray> array = new TestArray(4*1024*1024, 3);
+        ref<SocketStream> stream = connect();
+        ref<RemoteWorker> worker = new RemoteWorker("loopback",
+            new TestDelayStream(stream, delay));
+        ref<Scheduler> scheduler = new TestLoopbackScheduler();
+        scheduler->registerWorker(worker);
+        scheduler->start();
+
+        int resID = scheduler->registerResource(array);
+        ref<TestSumProcess> proc = new TestSumProcess(array->getSize());
+        proc->bindResource("data", resID);
+        ref<Timer> timer = new Timer();
+        scheduler->schedule(proc);
+        scheduler->wait(proc);
+        unsigned int elapsed = timer->getMilliseconds();
+        scheduler->unregisterResource(resID);
+        assertTrue(proc->getReturnStatus() == ParallelProcess::ESuccess);
+        assertTrue(proc->getSum() == array->sum(0, array->getSize()));
+
+        /* The back log must grow beyond its initial size to cover the
+           round trip. Otherwise, the work units would take at least
+           units / (MTS_BACKLOG_FACTOR * cores) round trips. This only
+           makes a difference when there are a lot more units than cores */
+        size_t cores = Scheduler::getInstance()->getLocalWorkerCount(),
+               initialBacklog = MTS_BACKLOG_FACTOR * cores,
+               units = array->getSize() / 4096;
+        Log(EInfo, "Round trip: %.1f ms, back log: " SIZE_T_FMT " work units, "
+            SIZE_T_FMT " work units took %i ms", worker->getRoundTripTime() * 1000,
+            worker->getBacklog(), units, elapsed);
+        assertTrue(worker->getRoundTripTime() >= delay * 1e-3f);
+        if (units >= 8 * initialBacklog) {
+            assertTrue(worker->getBacklog() > initialBacklog);
+            assertTrue(elapsed < (units / initialBacklog) * delay);
+        }
+
+        scheduler->stop();
+    }
+};
+
+MTS_IMPLEMENT_CLASS_S(TestArray, false, SerializableObject)
+MTS_IMPLEMENT_CLASS(TestSumResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(TestSumWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(TestSumProcess, false, ParallelProcess)
+MTS_IMPLEMENT_CLASS(TestDelayStream, false, Stream)
+MTS_EXPORT_TESTCASE(TestRemoteScheduling, "Testcase for the remote scheduling protocol")
+MTS_NAMESPACE_END
@@ -19,6 +19,7 @@
 #include <mitsuba/render/testcase.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/qmc.h>
+#include <mitsuba/core/pmf.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -28,6 +29,8 @@ public:
     MTS_DECLARE_TEST(test01_Halton)
     MTS_DECLARE_TEST(test02_Hammersley)
     MTS_DECLARE_TEST(test03_radicalInverseIncr)
+    MTS_DECLARE_TEST(test04_aliasDistribution)
+    MTS_DECLARE_TEST(test05_aliasDistribution2D)
     MTS_END_TESTCASE()
 
     void test01_Halton() {
@@ -84,6 +87,69 @@ public:
             x = radicalInverseIncremental(2, x);
         }
     }
+
+    void test04_aliasDistribution() {
+        /* Includes entries without probability mass and ones
+           that exactly match the average */
+        Float weights[] = { 1, 0, 4, 2, 0.5f, 2, 0, 2.5f };
+        const size_t n = sizeof(weights) / sizeof(weights[0]);
+
+        AliasDistribution alias(n);
+        DiscreteDistribution cdf(n);
+        for (size_t i=0; i<n; ++i) {
+            alias.append(weights[i]);
+            cdf.append(weights[i]);
+        }
+        assertEqualsEpsilon(alias.normalize(), cdf.normalize(), 1e-6);
+
+        /* Sweep over a fine grid of samples, the resulting
+           frequencies must match the original distribution */
+        const size_t sampleCount = 1000000;
+        std::vector<size_t> hist(n, 0);
+        for (size_t i=0; i<sampleCount; ++i) {
+            Float sample = (i + 0.5f) / sampleCount, pdf;
+            size_t index = alias.sampleReuse(sample, pdf);
+            assertEqualsEpsilon(pdf, cdf[index], 1e-6);
+            assertTrue(sample >= 0 && sample < 1);
+            hist[index]++;
+        }
+
+        for (size_t i=0; i<n; ++i)
+            assertEqualsEpsilon((Float) hist[i] / sampleCount, cdf[i], 1e-4);
+    }
+
+    void test05_aliasDistribution2D() {
+        const uint32_t width = 5, height = 3;
+        Float values[] = {
+            1, 2, 0, 0, 1,
+            0, 0, 0, 0, 0,
+            3, 1, 1, 1, 4
+        };
+        Float rowWeights[] = { 2, 1, 0.5f };
+
+        AliasDistribution2D alias;
+        alias.init(width, height);
+        Float sum = 0;
+        for (uint32_t y=0; y<height; ++y)
+            sum += alias.setRow(y, values + y*width, rowWeights[y]) * rowWeights[y];
+        assertEqualsEpsilon(alias.normalize(), sum, 1e-6);
+
+        const size_t resolution = 1000;
+        std::vector<size_t> hist(width*height, 0);
+        for (size_t i=0; i<resolution; ++i) {
+            for (size_t j=0; j<resolution; ++j) {
+                Point2 sample((i + 0.5f) / resolution, (j + 0.5f) / resolution);
+                Point2u pos = alias.sampleReuse(sample);
+                assertTrue(sample.x >= 0 && sample.x < 1 && sample.y >= 0 && sample.y < 1);
+                hist[pos.y*width + pos.x]++;
+            }
+        }
+
+        for (uint32_t y=0; y<height; ++y)
+            for (uint32_t x=0; x<width; ++x)
+                assertEqualsEpsilon((Float) hist[y*width + x] / (resolution*resolution),
+                    values[y*width + x] * rowWeights[y] / sum, 1e-3);
+    }
 };
 
 MTS_EXPORT_TESTCASE(TestSamplers, "Testcase for sampling-related code")
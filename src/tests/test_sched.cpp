@@ -0,0 +1,159 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/render/range.h>
+#include <mitsuba/core/sched.h>
+
+MTS_NAMESPACE_BEGIN
+
+class TestIndexResult : public WorkResult {
+public:
+    void load(Stream *stream) { index = stream->readSize(); }
+    void save(Stream *stream) const { stream->writeSize(index); }
+    std::string toString() const { return "TestIndexResult[]"; }
+
+    size_t index;
+
+    MTS_DECLARE_CLASS()
+};
+
+/// Returns the index of its work unit after waiting for a millisecond
+class TestSlowWorker : public WorkProcessor {
+public:
+    TestSlowWorker() { }
+
+    TestSlowWorker(Stream *stream, InstanceManager *manager)
+        : WorkProcessor(stream, manager) { }
+
+    void serialize(Stream *stream, InstanceManager *manager) const { }
+
+    ref<WorkUnit> createWorkUnit() const { return new RangeWorkUnit(); }
+    ref<WorkResult> createWorkResult() const { return new TestIndexResult(); }
+    ref<WorkProcessor> clone() const { return new TestSlowWorker(); }
+
+    void prepare() { }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult, const bool &stop) {
+        Thread::sleep(1);
+        static_cast<TestIndexResult *>(workResult)->index =
+            static_cast<const RangeWorkUnit *>(workUnit)->getRangeStart();
+    }
+
+    MTS_DECLARE_CLASS()
+};
+
+/// Generates a given number of work units and records which ones were processed
+class TestSlowProcess : public ParallelProcess {
+public:
+    TestSlowProcess(size_t count) : m_count(count), m_pos(0),
+            m_processed(count, 0), m_done(0) {
+        m_mutex = new Mutex();
+    }
+
+    ref<WorkProcessor> createWorkProcessor() const { return new TestSlowWorker(); }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        if (m_pos >= m_count)
+            return EFailure;
+        static_cast<RangeWorkUnit *>(unit)->setRange(m_pos, m_pos);
+        m_pos++;
+        return ESuccess;
+    }
+
+    void processResult(const WorkResult *result, bool cancelled) {
+        LockGuard lock(m_mutex);
+        m_processed[static_cast<const TestIndexResult *>(result)->index]++;
+        m_done++;
+    }
+
+    inline size_t getDone() const {
+        LockGuard lock(m_mutex);
+        return m_done;
+    }
+
+    /// Was every work unit processed exactly once?
+    bool isComplete() const {
+        LockGuard lock(m_mutex);
+        for (size_t i=0; i<m_count; ++i) {
+            if (m_processed[i] != 1)
+                return false;
+        }
+        return true;
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    mutable ref<Mutex> m_mutex;
+    size_t m_count, m_pos;
+    std::vector<int> m_processed;
+    size_t m_done;
+};
+
+class TestScheduler : public TestCase {
+public:
+    MTS_BEGIN_TESTCASE()
+    MTS_DECLARE_TEST(test01_pauseWorkStealing)
+    MTS_END_TESTCASE()
+
+    void test01_pauseWorkStealing() {
+        Scheduler *scheduler = Scheduler::getInstance();
+        bool wasRunning = scheduler->isRunning(),
+             workStealing = scheduler->getWorkStealing();
+        size_t workBatchSize = scheduler->getWorkBatchSize();
+        if (wasRunning)
+            scheduler->pause();
+
+        /* Large batches, so that the deques hold plenty of
+           units when the scheduler is paused */
+        const size_t unitCount = 2000;
+        scheduler->setWorkStealing(true, 64);
+        scheduler->start();
+
+        ref<TestSlowProcess> proc = new TestSlowProcess(unitCount);
+        scheduler->schedule(proc);
+        while (proc->getDone() < 100)
+            Thread::sleep(1);
+
+        /* Pause while the process is in flight. The queued units
+           must be processed once the scheduler is restarted */
+        scheduler->pause();
+        size_t done = proc->getDone();
+        Log(EInfo, "Paused after " SIZE_T_FMT " of " SIZE_T_FMT " work units",
+            done, unitCount);
+        assertTrue(done < unitCount);
+
+        scheduler->start();
+        scheduler->wait(proc);
+        assertTrue(proc->getReturnStatus() == ParallelProcess::ESuccess);
+        assertEquals((int) proc->getDone(), (int) unitCount);
+        assertTrue(proc->isComplete());
+
+        /* Restore the original configuration */
+        scheduler->pause();
+        scheduler->setWorkStealing(workStealing, workBatchSize);
+        if (wasRunning)
+            scheduler->start();
+    }
+};
+
+MTS_IMPLEMENT_CLASS(TestIndexResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(TestSlowWorker, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(TestSlowProcess, false, ParallelProcess)
+MTS_EXPORT_TESTCASE(TestScheduler, "Testcase for the scheduler")
+MTS_NAMESPACE_END
@@ -0,0 +1,108 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/testcase.h>
+#include "../integrators/photonmapper/sppm_proc.h"
+
+MTS_NAMESPACE_BEGIN
+
+class TestSPPM : public TestCase {
+public:
+    MTS_BEGIN_TESTCASE()
+    MTS_DECLARE_TEST(test01_gatherGridSinglePoint)
+    MTS_DECLARE_TEST(test02_gatherGridCollisions)
+    MTS_END_TESTCASE()
+
+    /* Photons at a depth that exceeds the limit of every gather point
+       are counted, but never evaluate the (missing) BSDF */
+    static const int maxDepth = 1;
+
+    SPPMGatherPoint createGatherPoint(const Point &p, Float radius) {
+        SPPMGatherPoint gp;
+        gp.its.p = p;
+        gp.its.shFrame = gp.its.geoFrame = Frame(Normal(0, 0, 1));
+        gp.radius = radius;
+        gp.depth = maxDepth;
+        return gp;
+    }
+
+    /// Splat random photons and compare the photon counts against brute force
+    void checkPhotonCounts(SPPMGatherGrid::GatherBlocks &gatherBlocks,
+            const AABB &aabb, int photonCount) {
+        ref<SPPMGatherGrid> grid = new SPPMGatherGrid(maxDepth);
+        grid->build(gatherBlocks);
+
+        ref<Random> random = new Random();
+        std::vector<std::vector<int> > expected(gatherBlocks.size());
+        for (size_t i=0; i<gatherBlocks.size(); ++i)
+            expected[i].resize(gatherBlocks[i].size(), 0);
+
+        Intersection its;
+        its.shFrame = its.geoFrame = Frame(Normal(0, 0, 1));
+        its.wi = Vector(0, 0, 1);
+
+        for (int i=0; i<photonCount; ++i) {
+            for (int j=0; j<3; ++j)
+                its.p[j] = aabb.min[j] + random->nextFloat() * aabb.getExtents()[j];
+            grid->splat(its, Spectrum(1.0f), maxDepth + 1);
+
+            for (size_t j=0; j<gatherBlocks.size(); ++j) {
+                for (size_t k=0; k<gatherBlocks[j].size(); ++k) {
+                    const SPPMGatherPoint &gp = gatherBlocks[j][k];
+                    if ((gp.its.p - its.p).lengthSquared() <= gp.radius * gp.radius)
+                        expected[j][k]++;
+                }
+            }
+        }
+
+        for (size_t i=0; i<gatherBlocks.size(); ++i) {
+            for (size_t j=0; j<gatherBlocks[i].size(); ++j) {
+                const SPPMGatherPoint &gp = gatherBlocks[i][j];
+                assertEquals(gp.M, expected[i][j]);
+                assertTrue(gp.phi.isZero());
+            }
+        }
+    }
+
+    void test01_gatherGridSinglePoint() {
+        /* With a single gather point, the hash table has one
+           bucket, into which all overlapped cells collide */
+        SPPMGatherGrid::GatherBlocks gatherBlocks(1);
+        gatherBlocks[0].push_back(createGatherPoint(Point(0.3f, -0.2f, 0.1f), 1.0f));
+
+        checkPhotonCounts(gatherBlocks, AABB(Point(-1.0f), Point(1.5f)), 10000);
+    }
+
+    void test02_gatherGridCollisions() {
+        /* A few large, overlapping gather points in a small table */
+        ref<Random> random = new Random();
+        SPPMGatherGrid::GatherBlocks gatherBlocks(3);
+        for (size_t i=0; i<gatherBlocks.size(); ++i) {
+            for (int j=0; j<3; ++j) {
+                Point p(random->nextFloat(), random->nextFloat(), random->nextFloat());
+                gatherBlocks[i].push_back(createGatherPoint(p,
+                    0.2f + random->nextFloat() * 0.5f));
+            }
+        }
+
+        checkPhotonCounts(gatherBlocks, AABB(Point(-0.5f), Point(1.5f)), 10000);
+    }
+};
+
+MTS_EXPORT_TESTCASE(TestSPPM, "Testcase for the SPPM gather point grid")
+MTS_NAMESPACE_END
@@ -0,0 +1,178 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/warp.h>
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/render/scene.h>
+
+MTS_NAMESPACE_BEGIN
+
+class TestWavefront : public TestCase {
+public:
+    MTS_BEGIN_TESTCASE()
+    MTS_DECLARE_TEST(test01_pathTracer)
+    MTS_DECLARE_TEST(test02_directIllumination)
+    MTS_END_TESTCASE()
+
+    /// Create a unit square (two triangles), which is transformed by \c trafo
+    ref<TriMesh> createQuad(const Transform &trafo, Float reflectance,
+            Float radiance = 0) {
+        PluginManager *pmgr = PluginManager::getInstance();
+        ref<TriMesh> mesh = new TriMesh("quad", 2, 4);
+        Point *positions = mesh->getVertexPositions();
+        Triangle *triangles = mesh->getTriangles();
+        positions[0] = trafo(Point(-1, -1, 0)); positions[1] = trafo(Point(1, -1, 0));
+        positions[2] = trafo(Point(1, 1, 0)); positions[3] = trafo(Point(-1, 1, 0));
+        triangles[0].idx[0] = 0; triangles[0].idx[1] = 1; triangles[0].idx[2] = 2;
+        triangles[1].idx[0] = 0; triangles[1].idx[1] = 2; triangles[1].idx[2] = 3;
+
+        Properties bsdfProps("diffuse");
+        bsdfProps.setSpectrum("reflectance", Spectrum(reflectance));
+        ref<ConfigurableObject> bsdf = pmgr->createObject(MTS_CLASS(BSDF), bsdfProps);
+        bsdf->configure();
+        mesh->addChild(bsdf);
+
+        if (radiance > 0) {
+            Properties emitterProps("area");
+            emitterProps.setSpectrum("radiance", Spectrum(radiance));
+            ref<ConfigurableObject> emitter =
+                pmgr->createObject(MTS_CLASS(Emitter), emitterProps);
+            mesh->addChild(emitter);
+            emitter->setParent(mesh);
+            emitter->configure();
+        }
+        mesh->configure();
+        return mesh;
+    }
+
+    /**
+     * Create a closed box with a small area light at the top. The second
+     * variant adds a sphere, so that the scene isn't made of triangles only
+     */
+    ref<Scene> createScene(bool withSphere) {
+        PluginManager *pmgr = PluginManager::getInstance();
+        ref<Scene> scene = new Scene(Properties("scene"));
+        scene->addChild(createQuad(Transform::translate(Vector(0, 0, -1)), 0.7f));
+        scene->addChild(createQuad(Transform::translate(Vector(0, 0, 1))
+            * Transform::rotate(Vector(1, 0, 0), 180), 0.7f));
+        scene->addChild(createQuad(Transform::translate(Vector(0, -1, 0))
+            * Transform::rotate(Vector(1, 0, 0), -90), 0.5f));
+        scene->addChild(createQuad(Transform::translate(Vector(0, 1, 0))
+            * Transform::rotate(Vector(1, 0, 0), 90), 0.5f));
+        scene->addChild(createQuad(Transform::translate(Vector(-1, 0, 0))
+            * Transform::rotate(Vector(0, 1, 0), 90), 0.3f));
+        scene->addChild(createQuad(Transform::translate(Vector(1, 0, 0))
+            * Transform::rotate(Vector(0, 1, 0), -90), 0.3f));
+        scene->addChild(createQuad(Transform::translate(Vector(0, 0.99f, 0))
+            * Transform::rotate(Vector(1, 0, 0), 90)
+            * Transform::scale(Vector(0.25f)), 0, 10));
+
+        if (withSphere) {
+            Properties sphereProps("sphere");
+            sphereProps.setPoint("center", Point(0.3f, -0.5f, 0.1f));
+            sphereProps.setFloat("radius", 0.4f);
+            ref<Shape> sphere = static_cast<Shape *> (
+                pmgr->createObject(MTS_CLASS(Shape), sphereProps));
+            sphere->configure();
+            scene->addChild(sphere);
+        }
+
+        scene->configure();
+        scene->initialize();
+        return scene;
+    }
+
+    /**
+     * Estimate the radiance along a set of fixed rays using both
+     * \ref SamplingIntegrator::Li() and the wavefront version. Every
+     * query uses a sampler with its own fixed seed, which is the same
+     * for both variants, hence they should find the same paths
+     */
+    void compare(const std::string &integratorName) {
+        PluginManager *pmgr = PluginManager::getInstance();
+        const size_t count = 512;
+
+        for (int variant=0; variant<2; ++variant) {
+            ref<Scene> scene = createScene(variant == 1);
+            ref<SamplingIntegrator> integrator = static_cast<SamplingIntegrator *> (
+                pmgr->createObject(MTS_CLASS(Integrator), Properties(integratorName)));
+            integrator->configure();
+
+            Properties samplerProps("independent");
+            samplerProps.setInteger("sampleCount", 1);
+            ref<Sampler> sampler = static_cast<Sampler *> (
+                pmgr->createObject(MTS_CLASS(Sampler), samplerProps));
+            sampler->configure();
+            integrator->configureSampler(scene, sampler);
+
+            ref<Random> random = new Random();
+            std::vector<RayDifferential> rays(count);
+            std::vector<RadianceQueryRecord> rRecs(count);
+            ref_vector<Sampler> samplers(count);
+            std::vector<Spectrum> wavefront(count);
+            for (size_t i=0; i<count; ++i) {
+                Point2 sample(random->nextFloat(), random->nextFloat());
+                rays[i] = RayDifferential(Point(0, 0, 0.9f),
+                    warp::squareToUniformSphere(sample), 0.0f);
+                samplers[i] = sampler->clone();
+                samplers[i]->seed(i);
+                samplers[i]->generate(Point2i(0));
+                rRecs[i] = RadianceQueryRecord(scene, samplers[i]);
+                rRecs[i].newQuery(RadianceQueryRecord::ERadiance, NULL);
+            }
+            integrator->LiWavefront(count, &rays[0], &rRecs[0], &wavefront[0]);
+
+            Spectrum sumScalar(0.0f), sumWavefront(0.0f);
+            size_t mismatches = 0;
+            RadianceQueryRecord rRec(scene, sampler);
+            for (size_t i=0; i<count; ++i) {
+                sampler->seed(i);
+                sampler->generate(Point2i(0));
+                rRec.newQuery(RadianceQueryRecord::ERadiance, NULL);
+                Spectrum scalar = integrator->Li(rays[i], rRec);
+
+                Float error = (scalar - wavefront[i]).abs().max();
+                if (error > 1e-3f * std::max((Float) 1, scalar.max()))
+                    ++mismatches;
+                sumScalar += scalar;
+                sumWavefront += wavefront[i];
+            }
+
+            /* A few paths may diverge due to roundoff in the packet traversal */
+            Log(EInfo, "%s (%s): " SIZE_T_FMT "/" SIZE_T_FMT " estimates differ, "
+                "average %f (scalar) vs. %f (wavefront)", integratorName.c_str(),
+                variant == 0 ? "triangles" : "triangles and a sphere", mismatches,
+                count, sumScalar.average() / count, sumWavefront.average() / count);
+            assertTrue(sumScalar.average() > 0);
+            assertTrue(mismatches <= count / 100);
+            assertEqualsEpsilon(sumWavefront.average() / sumScalar.average(), (Float) 1, 1e-2f);
+        }
+    }
+
+    void test01_pathTracer() {
+        compare("path");
+    }
+
+    void test02_directIllumination() {
+        compare("direct");
+    }
+};
+
+MTS_EXPORT_TESTCASE(TestWavefront, "Testcase for the wavefront rendering mode")
+MTS_NAMESPACE_END
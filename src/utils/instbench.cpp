@@ -0,0 +1,231 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/scene.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/warp.h>
+#include "../shapes/instance.h"
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class InstBench : public Utility {
+public:
+    void help() {
+        cout << endl;
+        cout << "Synopsis: geometry instancing benchmark. Scatters many instances of a few" << endl;
+        cout << "shape groups (a \"forest\") and measures the time needed to build the scene," << endl;
+        cout << "to update it after moving or adding instances, and the ray tracing throughput." << endl;
+        cout << endl;
+        cout << "Usage: mtsutil instbench [options]" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -n count       Number of instances (default: 1000000)" << endl << endl;
+        cout << "   -g count       Number of shape groups (default: 4)" << endl << endl;
+        cout << "   -r count       Number of rays per measurement (default: 1000000)" << endl << endl;
+        cout << "   -m fraction    Fraction of the instances that is moved (default: 0.01)" << endl << endl;
+        cout << "   -c             Also run the benchmark with a single-level acceleration" << endl
+             << "                  data structure (twoLevelInstancing=false) for comparison" << endl << endl;
+    }
+
+    /// Create a shape using the plugin manager
+    ref<Shape> createShape(const Properties &props) {
+        return static_cast<Shape *> (PluginManager::getInstance()->
+            createObject(MTS_CLASS(Shape), props));
+    }
+
+    /// Random instance-to-world transformation within a cube of the given size
+    Transform randomTransform(Random *random, Float extent) {
+        Vector offset(random->nextFloat(), random->nextFloat(), random->nextFloat());
+        Vector axis = warp::squareToUniformSphere(
+            Point2(random->nextFloat(), random->nextFloat()));
+        return Transform::translate(offset * extent)
+            * Transform::rotate(axis, 360 * random->nextFloat())
+            * Transform::scale(Vector(0.5f + random->nextFloat()));
+    }
+
+    /// Create an instance of the given shape group
+    ref<Shape> createInstance(Shape *group, const Transform &trafo) {
+        Properties props("instance");
+        props.setTransform("toWorld", trafo);
+        ref<Shape> instance = createShape(props);
+        instance->addChild(group);
+        instance->configure();
+        return instance;
+    }
+
+    /// Shoot random rays through the scene; returns the throughput in MRays/s
+    Float traceRays(const Scene *scene, size_t rayCount, size_t &hitCount) {
+        ref<Random> random = new Random(5489);
+        BSphere bsphere = scene->getGeometryAABB().getBSphere();
+        ref<Timer> timer = new Timer();
+
+        hitCount = 0;
+        for (size_t i=0; i<rayCount; ++i) {
+            Point2 sample1(random->nextFloat(), random->nextFloat()),
+                sample2(random->nextFloat(), random->nextFloat());
+            Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+            Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+            Ray r(p1, normalize(p2-p1), 0.0f);
+
+            Intersection its;
+            if (scene->rayIntersect(r, its))
+                hitCount++;
+        }
+
+        return rayCount / (timer->getMicroseconds() * (Float) 1e-6f) * 1e-6f;
+    }
+
+    void runBenchmark(bool twoLevel, size_t instanceCount, size_t groupCount,
+            size_t rayCount, Float moveFraction) {
+        const char *shapeTypes[] = { "sphere", "cube", "cylinder", "disk" };
+        ref<Random> random = new Random(1234);
+        Float extent = 4 * std::pow((Float) instanceCount, (Float) 1 / 3);
+        ref<Timer> timer = new Timer();
+
+        Log(EInfo, "Benchmarking the %s scheme ..", twoLevel ? "two-level" : "single-level");
+
+        /* The shape groups only reference their shapes -- keep them alive */
+        ref_vector<Shape> shapes, groups;
+        for (size_t i=0; i<groupCount; ++i) {
+            ref<Shape> shape = createShape(Properties(shapeTypes[i % 4]));
+            if (!shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+                shape->configure();
+                shape = shape->createTriMesh();
+            }
+            shape->configure();
+            shapes.push_back(shape);
+
+            ref<Shape> group = createShape(Properties("shapegroup"));
+            group->addChild(shape);
+            group->configure();
+            groups.push_back(group);
+        }
+
+        Properties sceneProps("scene");
+        sceneProps.setBoolean("twoLevelInstancing", twoLevel);
+        ref<Scene> scene = new Scene(sceneProps);
+        std::vector<Instance *> instances(instanceCount);
+        for (size_t i=0; i<instanceCount; ++i) {
+            ref<Shape> instance = createInstance(groups[i % groupCount],
+                randomTransform(random, extent));
+            instances[i] = static_cast<Instance *>(instance.get());
+            scene->addChild(instance);
+        }
+        Log(EInfo, "  Created " SIZE_T_FMT " instances in %i ms", instanceCount,
+            timer->getMilliseconds());
+
+        timer->reset();
+        scene->initialize();
+        int buildTime = timer->getMilliseconds();
+
+        size_t hitCount;
+        Float throughput = traceRays(scene, rayCount, hitCount);
+
+        /* Move some of the instances */
+        size_t moveCount = std::min(instanceCount, (size_t) (moveFraction * instanceCount));
+        for (size_t i=0; i<moveCount; ++i) {
+            Instance *instance = instances[random->nextULong() % instanceCount];
+            instance->setWorldTransform(new AnimatedTransform(randomTransform(random, extent)));
+        }
+        timer->reset();
+        scene->updateInstances();
+        int moveTime = timer->getMilliseconds();
+
+        /* Scatter additional instances */
+        size_t addCount = std::max(moveCount, (size_t) 1);
+        for (size_t i=0; i<addCount; ++i)
+            scene->addChild(createInstance(groups[i % groupCount],
+                randomTransform(random, extent)));
+        timer->reset();
+        scene->updateInstances();
+        int addTime = timer->getMilliseconds();
+
+        Float throughputAfter = traceRays(scene, rayCount, hitCount);
+
+        Log(EInfo, "  Initial build         : %i ms", buildTime);
+        Log(EInfo, "  Move " SIZE_T_FMT " instances : %i ms", moveCount, moveTime);
+        Log(EInfo, "  Add " SIZE_T_FMT " instances  : %i ms", addCount, addTime);
+        Log(EInfo, "  Throughput            : %.3f MRays/s (%.3f MRays/s after the "
+            "update, %.1f%% hits)", throughput, throughputAfter,
+            100 * hitCount / (Float) rayCount);
+    }
+
+    int run(int argc, char **argv) {
+        int optchar;
+        char *end_ptr = NULL;
+        size_t instanceCount = 1000000, groupCount = 4, rayCount = 1000000;
+        Float moveFraction = 0.01f;
+        bool compare = false;
+        optind = 1;
+
+        /* Parse command-line arguments */
+        while ((optchar = getopt(argc, argv, "n:g:r:m:ch")) != -1) {
+            switch (optchar) {
+                case 'h': {
+                        help();
+                        return 0;
+                    }
+                    break;
+                case 'n':
+                    instanceCount = strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || instanceCount == 0)
+                        SLog(EError, "Could not parse the instance count!");
+                    break;
+                case 'g':
+                    groupCount = strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || groupCount == 0)
+                        SLog(EError, "Could not parse the shape group count!");
+                    break;
+                case 'r':
+                    rayCount = strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || rayCount == 0)
+                        SLog(EError, "Could not parse the ray count!");
+                    break;
+                case 'm':
+                    moveFraction = (Float) strtod(optarg, &end_ptr);
+                    if (*end_ptr != '\0' || moveFraction < 0 || moveFraction > 1)
+                        SLog(EError, "Could not parse the fraction of moved instances!");
+                    break;
+                case 'c':
+                    compare = true;
+                    break;
+            };
+        }
+
+        if (optind < argc) {
+            help();
+            return 0;
+        }
+
+        runBenchmark(true, instanceCount, groupCount, rayCount, moveFraction);
+        if (compare)
+            runBenchmark(false, instanceCount, groupCount, rayCount, moveFraction);
+
+        return 0;
+    }
+
+    MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(InstBench, "Two-level geometry instancing benchmark")
+MTS_NAMESPACE_END
@@ -18,6 +18,7 @@
 
 #include <mitsuba/render/util.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/statistics.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/plugin.h>
 #include <boost/algorithm/string.hpp>
@@ -46,6 +47,10 @@ public:
         cout << "   -c true/false  Enable/disable primitive clipping (aka. \"perfect splits\")" << endl << endl;
         cout << "   -p true/false  Enable/disable parallel tree construction" << endl << endl;
         cout << "   -r true/false  Enable/disable retraction of bad splits" << endl << endl;
+        cout << "   -m true/false  Enable/disable the memory-lean compact kd-tree layout" << endl << endl;
+        cout << "   -o size        Page the triangle data of the kd-tree in and out of a" << endl;
+        cout << "                  file on disk using caches of the given total size (MiB)," << endl;
+        cout << "                  and report the page fault and cache hit statistics" << endl << endl;
         cout << "   -l value       Specify the primitive count, below which a leaf node" << endl;
         cout << "                  will always be created" << endl << endl;
         cout << "   -d depth       Specify the maximum tree depth" << endl << endl;
@@ -55,6 +60,14 @@ public:
         cout << "                  optimization method." << endl << endl;
         cout << "   -f             Try to empirically find the best SAH cost values by" << endl;
         cout << "                  fitting the cost model to collected performance data" << endl << endl;
+        cout << "   -s             Rebuild the tree with 1, 2, 4, .. builder threads and" << endl;
+        cout << "                  report the build time, SAH cost and speedup of each" << endl << endl;
+        cout << "   -a accel       Benchmark the kd-tree (\"kdtree\", default), the BVH" << endl;
+        cout << "                  (\"bvh\") or compare both on the same input (\"both\")" << endl << endl;
+        cout << "   -w size        Trace streams of the given number of coherent and" << endl;
+        cout << "                  incoherent rays through the kd-tree using each ray" << endl;
+        cout << "                  packet width supported by this build (1, 4, 8, 16)" << endl;
+        cout << "                  and report the resulting rays per second" << endl << endl;
         cout << "Examples:" << endl;
         cout << "  E.g. to build a tree for the Stanford bunny having a low SAH cost, type " << endl << endl;
         cout << "  $ mtsutil kdbench -e .9 -l1 -d48 -x100000 data/tests/bunny.ply" << endl << endl;
@@ -62,6 +75,146 @@ public:
         cout << "  The high -x paramer effectively disables Min-Max binning, which " << endl;
         cout << "  leads to a slower and more memory-intensive build, so don't try" << endl;
         cout << "  this on a huge model." << endl << endl;
+        cout << "  To compare the build time, memory usage and performance of the kd-tree" << endl;
+        cout << "  and the BVH, type" << endl << endl;
+        cout << "  $ mtsutil kdbench -a both data/tests/bunny.ply" << endl << endl;
+        cout << "  To compare the SSE, AVX2 and AVX-512 ray packets on streams of 256 rays," << endl;
+        cout << "  type" << endl << endl;
+        cout << "  $ mtsutil kdbench -w 256 data/tests/bunny.ply" << endl << endl;
+    }
+
+    /// Trace incoherent rays through the bounding sphere and return the best MRays/s of three runs
+    template <typename Accel> Float traceRays(const Accel *accel, const BSphere &bsphere, size_t nRays) {
+        Float best = 0;
+        for (int j=0; j<3; ++j) {
+            ref<Random> random = new Random();
+            ref<Timer> timer = new Timer();
+            size_t nIntersections = 0;
+
+            Log(EInfo, "Shooting " SIZE_T_FMT " rays (1 thread, incoherent) ..", nRays);
+
+            for (size_t i=0; i<nRays; ++i) {
+                Point2 sample1(random->nextFloat(), random->nextFloat()),
+                    sample2(random->nextFloat(), random->nextFloat());
+                Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+                Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+                Ray r(p1, normalize(p2-p1), 0.0f);
+
+                Intersection its;
+                if (accel->rayIntersect(r, its))
+                    nIntersections++;
+            }
+
+            Log(EInfo, "Found " SIZE_T_FMT " intersections in %i ms",
+                nIntersections, timer->getMilliseconds());
+            Float mrays = nRays / (timer->getMilliseconds() * (Float) 1000);
+            Log(EInfo, "-> %.3f MRays/s", mrays);
+            Log(EInfo, "");
+            best = std::max(best, mrays);
+        }
+        Log(EInfo, "Best of three: %.3f MRays/s", best);
+        Log(EInfo, "");
+        return best;
+    }
+
+    /// Trace a set of rays as streams of the given size and return the best MRays/s of three runs
+    Float traceStreams(const ShapeKDTree *kdtree, const std::vector<Ray> &rays,
+            size_t streamSize, int packetWidth) {
+        std::vector<Intersection> its(streamSize);
+        Float best = 0;
+        for (int j=0; j<3; ++j) {
+            ref<Timer> timer = new Timer();
+            for (size_t i=0; i<rays.size(); i += streamSize)
+                kdtree->rayIntersectBatch(&rays[i], std::min(streamSize,
+                    rays.size() - i), &its[0], packetWidth);
+            best = std::max(best, rays.size() /
+                (std::max(timer->getMilliseconds(), 1u) * (Float) 1000));
+        }
+        return best;
+    }
+
+    /// Compare the throughput of the supported ray packet widths
+    void runPacketStudy(const ShapeKDTree *kdtree, const BSphere &bsphere,
+            size_t streamSize) {
+        const int res = 1024, tileSize = 16;
+        std::vector<Ray> coherent, incoherent;
+        coherent.reserve(res*res);
+        incoherent.reserve(res*res);
+
+        /* Coherent rays of a pinhole camera that sees the entire bounding
+           sphere, enumerated tile by tile like in the block renderer */
+        Point cameraPos = bsphere.center - Vector(0, 0, 2*bsphere.radius);
+        for (int ty=0; ty<res; ty += tileSize) {
+            for (int tx=0; tx<res; tx += tileSize) {
+                for (int y=ty; y<ty+tileSize; ++y) {
+                    for (int x=tx; x<tx+tileSize; ++x) {
+                        Vector d((2*(x+0.5f)/res - 1) * 0.6f,
+                                 (2*(y+0.5f)/res - 1) * 0.6f, 1.0f);
+                        coherent.push_back(Ray(cameraPos, normalize(d), 0.0f));
+                    }
+                }
+            }
+        }
+
+        /* Incoherent rays, as in traceRays() */
+        ref<Random> random = new Random();
+        for (int i=0; i<res*res; ++i) {
+            Point2 sample1(random->nextFloat(), random->nextFloat()),
+                sample2(random->nextFloat(), random->nextFloat());
+            Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+            Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+            incoherent.push_back(Ray(p1, normalize(p2-p1), 0.0f));
+        }
+
+        Log(EInfo, "Ray packet widths (streams of " SIZE_T_FMT " rays, 1 thread):", streamSize);
+        Log(EInfo, "  Width    Coherent MRays/s    Incoherent MRays/s");
+        for (int width = 1; width <= ShapeKDTree::getMaxPacketWidth();
+                width = (width == 1) ? 4 : width * 2) {
+            Float coherentPerf = traceStreams(kdtree, coherent, streamSize, width),
+                incoherentPerf = traceStreams(kdtree, incoherent, streamSize, width);
+            Log(EInfo, "  %5i    %16.3f    %18.3f", width, coherentPerf, incoherentPerf);
+        }
+        Log(EInfo, "");
+    }
+
+    /// Rebuild a kd-tree with an increasing number of builder threads
+    void runScalingStudy(const ShapeKDTree *kdtree) {
+        const std::vector<const Shape *> &shapes = kdtree->getShapes();
+        size_t maxBuilders = (size_t) getCoreCount();
+        unsigned int serialTime = 0;
+
+        Log(EInfo, "Builder thread scaling:");
+        Log(EInfo, "  Builders    Build time    SAH cost    Speedup");
+        for (size_t builders = 1; ; builders = std::min(builders * 2, maxBuilders)) {
+            ref<ShapeKDTree> tree = new ShapeKDTree();
+            for (size_t i=0; i<shapes.size(); ++i)
+                tree->addShape(shapes[i]);
+            tree->setQueryCost(kdtree->getQueryCost());
+            tree->setTraversalCost(kdtree->getTraversalCost());
+            tree->setEmptySpaceBonus(kdtree->getEmptySpaceBonus());
+            tree->setStopPrims(kdtree->getStopPrims());
+            tree->setMaxDepth(kdtree->getMaxDepth());
+            tree->setExactPrimitiveThreshold(kdtree->getExactPrimitiveThreshold());
+            tree->setMinMaxBins(kdtree->getMinMaxBins());
+            tree->setClip(kdtree->getClip());
+            tree->setRetract(kdtree->getRetract());
+            tree->setCompact(kdtree->getCompact());
+            tree->setOutOfCore(kdtree->getOutOfCore());
+            tree->setPageCacheSize(kdtree->getPageCacheSize());
+            tree->setParallelBuild(builders > 1);
+            tree->setBuilderCount((uint32_t) builders);
+            tree->setLogLevel(ETrace);
+            tree->build();
+
+            if (builders == 1)
+                serialTime = tree->getBuildTime();
+            Log(EInfo, "  %8i    %7u ms    %8.3f    %6.2fx", (int) builders,
+                tree->getBuildTime(), tree->getSAHCost(),
+                serialTime / (Float) std::max(tree->getBuildTime(), 1u));
+            if (builders == maxBuilders)
+                break;
+        }
+        Log(EInfo, "");
     }
 
     int run(int argc, char **argv) {
@@ -70,11 +223,14 @@ public:
         char *end_ptr = NULL;
         Float intersectionCost = -1, traversalCost = -1, emptySpaceBonus = -1;
         int stopPrims = -1, maxDepth = -1, exactPrims = -1, minMaxBins = -1;
-        bool clip = true, parallel = true, retract = true, fitParameters = false;
+        bool clip = true, parallel = true, retract = true, fitParameters = false,
+             scaling = false, useKDTree = true, useBVH = false,
+             compact = false, compactSet = false;
+        size_t streamSize = 0, pageCacheSize = 0;
         optind = 1;
 
         /* Parse command-line arguments */
-        while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:l:x:b:d:hf")) != -1) {
+        while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:m:o:l:x:b:d:a:w:hfs")) != -1) {
             switch (optchar) {
                 case 'h': {
                         help();
@@ -84,6 +240,24 @@ public:
                 case 'f':
                     fitParameters = true;
                     break;
+                case 's':
+                    scaling = true;
+                    break;
+                case 'a':
+                    if (strcmp(optarg, "kdtree") == 0 || strcmp(optarg, "both") == 0)
+                        useKDTree = true;
+                    else if (strcmp(optarg, "bvh") == 0)
+                        useKDTree = false;
+                    else
+                        SLog(EError, "Could not parse the accelerator (must be "
+                            "\"kdtree\", \"bvh\" or \"both\")!");
+                    useBVH = strcmp(optarg, "kdtree") != 0;
+                    break;
+                case 'w':
+                    streamSize = (size_t) strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || streamSize == 0)
+                        SLog(EError, "Could not parse the ray stream size!");
+                    break;
                 case 'i':
                     intersectionCost = (Float) strtod(optarg, &end_ptr);
                     if (*end_ptr != '\0')
@@ -143,6 +317,20 @@ public:
                     else
                         SLog(EError, "Could not parse the retraction parameter!");
                     break;
+                case 'm':
+                    if (strcmp(optarg, "true") == 0)
+                        compact = true;
+                    else if (strcmp(optarg, "false") == 0)
+                        compact = false;
+                    else
+                        SLog(EError, "Could not parse the compact layout parameter!");
+                    compactSet = true;
+                    break;
+                case 'o':
+                    pageCacheSize = (size_t) strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || pageCacheSize == 0)
+                        SLog(EError, "Could not parse the page cache size!");
+                    break;
             };
         }
 
@@ -195,6 +383,12 @@ public:
         kdtree->setClip(clip);
         kdtree->setRetract(retract);
         kdtree->setParallelBuild(parallel);
+        if (compactSet)
+            kdtree->setCompact(compact);
+        if (pageCacheSize > 0) {
+            kdtree->setOutOfCore(true);
+            kdtree->setPageCacheSize(pageCacheSize * 1024 * 1024);
+        }
 
         /* Show some statistics, and make sure it roughly fits in 80cols */
         Logger *logger = Thread::getThread()->getLogger();
@@ -202,49 +396,95 @@ public:
         logger->setLogLevel(EDebug);
         formatter->setHaveDate(false);
 
-        if (scene)
+        ref<ShapeBVH> bvh;
+        std::vector<const Shape *> shapes;
+        if (scene) {
+            /* Builds the scene's own accelerator */
             scene->initialize();
-        else
+            if (scene->getBVH()) {
+                bvh = scene->getBVH();
+                shapes = bvh->getShapes();
+            } else {
+                shapes = kdtree->getShapes();
+            }
+        } else {
+            shapes = kdtree->getShapes();
+        }
+
+        if (useKDTree && !kdtree->isBuilt()) {
+            if (kdtree->getShapes().empty()) {
+                for (size_t i=0; i<shapes.size(); ++i)
+                    kdtree->addShape(shapes[i]);
+            }
             kdtree->build();
+        }
+
+        if (useBVH && !bvh) {
+            bvh = new ShapeBVH();
+            if (intersectionCost != -1)
+                bvh->setQueryCost(intersectionCost);
+            if (traversalCost != -1)
+                bvh->setTraversalCost(traversalCost);
+            for (size_t i=0; i<shapes.size(); ++i)
+                bvh->addShape(shapes[i]);
+            bvh->build();
+        }
+
+        if (useKDTree) {
+            Log(EInfo, "kd-tree build time: %u ms, SAH cost: %.3f, memory: %s "
+                "(%.1f bytes/primitive%s)", kdtree->getBuildTime(), kdtree->getSAHCost(),
+                memString(kdtree->getMemoryUsage()).c_str(),
+                kdtree->getMemoryUsage() / (Float) std::max((size_t) kdtree->getPrimitiveCount(), (size_t) 1),
+                kdtree->getCompact() ? ", compact" : "");
+            Log(EInfo, "");
+
+            if (scaling)
+                runScalingStudy(kdtree);
+        }
+
+        if (useBVH) {
+            Log(EInfo, "BVH build time: %u ms, SAH cost: %.3f, memory: %s",
+                bvh->getBuildTime(), bvh->getSAHCost(),
+                memString(bvh->getMemoryUsage()).c_str());
+            Log(EInfo, "");
+        }
 
-        BSphere bsphere(kdtree->getAABB().getBSphere());
+        BSphere bsphere(useKDTree ? kdtree->getAABB().getBSphere()
+            : bvh->getAABB().getBSphere());
         const size_t nRays = 5000000;
 
         if (!fitParameters) {
             Log(EInfo, "Bounding sphere: %s", bsphere.toString().c_str());
-            Float best = 0;
-            for (int j=0; j<3; ++j) {
-                ref<Random> random = new Random();
-                ref<Timer> timer = new Timer();
-                size_t nIntersections = 0;
-
-                Log(EInfo, "Shooting " SIZE_T_FMT " rays (1 thread, incoherent) ..", nRays);
-
-                for (size_t i=0; i<nRays; ++i) {
-                    Point2 sample1(random->nextFloat(), random->nextFloat()),
-                        sample2(random->nextFloat(), random->nextFloat());
-                    Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
-                    Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
-                    Ray r(p1, normalize(p2-p1), 0.0f);
-
-                    Intersection its;
-                    if (kdtree->rayIntersect(r, its))
-                        nIntersections++;
-                }
+            Float kdPerf = 0, bvhPerf = 0;
+            if (useKDTree) {
+                Log(EInfo, "Benchmarking the kd-tree ..");
+                kdPerf = traceRays(kdtree.get(), bsphere, nRays);
+                if (streamSize > 0)
+                    runPacketStudy(kdtree, bsphere, streamSize);
+            }
+            if (useBVH) {
+                Log(EInfo, "Benchmarking the BVH ..");
+                bvhPerf = traceRays(bvh.get(), bsphere, nRays);
+            }
 
-                Log(EInfo, "Found " SIZE_T_FMT " intersections in %i ms",
-                    nIntersections, timer->getMilliseconds());
-                Float mrays = nRays / (timer->getMilliseconds() * (Float) 1000);
-                Log(EInfo, "-> %.3f MRays/s", mrays);
+            if (useKDTree && useBVH) {
+                Log(EInfo, "  Accel      Build time    Memory        MRays/s");
+                Log(EInfo, "  kd-tree    %7u ms    %-12s  %7.3f", kdtree->getBuildTime(),
+                    memString(kdtree->getMemoryUsage()).c_str(), kdPerf);
+                Log(EInfo, "  BVH        %7u ms    %-12s  %7.3f", bvh->getBuildTime(),
+                    memString(bvh->getMemoryUsage()).c_str(), bvhPerf);
                 Log(EInfo, "");
-                best = std::max(best, mrays);
             }
-            Log(EInfo, "Best of three: %.3f MRays/s", best);
-        } else {
+        } else if (useKDTree) {
             Float intersectionCost, traversalCost;
             kdtree->findCosts(intersectionCost, traversalCost);
+        } else {
+            Log(EError, "Fitting the SAH cost values requires the kd-tree!");
         }
 
+        if (useKDTree && kdtree->getOutOfCore())
+            Statistics::getInstance()->printStats();
+
         Thread::getThread()->getLogger()->setLogLevel(EInfo);
         return 0;
     }
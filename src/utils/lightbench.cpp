@@ -0,0 +1,282 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/scene.h>
+#include <mitsuba/render/lighttree.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/fresolver.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/warp.h>
+#include <boost/algorithm/string.hpp>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class LightBench : public Utility {
+public:
+    void help() {
+        cout << endl;
+        cout << "Synopsis: emitter selection benchmark. Estimates the direct illumination at" << endl;
+        cout << "random surface points of a scene, once choosing emitters proportionally to" << endl;
+        cout << "their sampling weights and once using the light tree (emitterSampling=\"tree\")," << endl;
+        cout << "and reports the variance, the time and the resulting efficiency of both." << endl;
+        cout << "When no scene is specified, a \"city at night\" with many small area, spot" << endl;
+        cout << "and point lights above a ground plane is generated." << endl;
+        cout << endl;
+        cout << "Usage: mtsutil lightbench [options] [Scene XML file]" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -n count       Number of emitters of the generated scene (default: 30000)" << endl << endl;
+        cout << "   -r count       Number of receiver points (default: 2000)" << endl << endl;
+        cout << "   -s count       Number of samples per receiver point (default: 64)" << endl << endl;
+    }
+
+    /// Create an object using the plugin manager and configure it
+    template <typename T> ref<T> createObject(const Properties &props) {
+        ref<T> object = static_cast<T *> (PluginManager::getInstance()->
+            createObject(MTS_CLASS(T), props));
+        object->configure();
+        return object;
+    }
+
+    /// Generate a ground plane that is lit by many small emitters
+    ref<Scene> createCityScene(size_t emitterCount, Random *random) {
+        ref<Scene> scene = new Scene(Properties("scene"));
+        Float extent = 10 * std::sqrt((Float) emitterCount);
+
+        Properties groundProps("rectangle");
+        groundProps.setTransform("toWorld", Transform::scale(Vector(extent, extent, 1)));
+        scene->addChild(createObject<Shape>(groundProps));
+
+        for (size_t i=0; i<emitterCount; ++i) {
+            Point p(extent * (2 * random->nextFloat() - 1),
+                    extent * (2 * random->nextFloat() - 1),
+                    3 + 7 * random->nextFloat());
+            /* Most emitters are dim, a few are very bright */
+            Float u = random->nextFloat(), scale = 0.1f + 5 * u * u * u;
+
+            if (i % 3 == 0) {
+                /* Small downward-facing area light */
+                Properties emitterProps("area");
+                emitterProps.setSpectrum("radiance", Spectrum(10 * scale));
+                ref<Emitter> emitter = createObject<Emitter>(emitterProps);
+
+                Properties shapeProps("rectangle");
+                shapeProps.setTransform("toWorld", Transform::translate(Vector(p))
+                    * Transform::scale(Vector(0.25f))
+                    * Transform::rotate(Vector(1, 0, 0), 180));
+                ref<Shape> shape = static_cast<Shape *> (PluginManager::getInstance()->
+                    createObject(MTS_CLASS(Shape), shapeProps));
+                shape->addChild(emitter);
+                emitter->setParent(shape);
+                shape->configure();
+                scene->addChild(shape);
+            } else if (i % 3 == 1) {
+                /* Street lamp pointing down */
+                Properties emitterProps("spot");
+                emitterProps.setSpectrum("intensity", Spectrum(20 * scale));
+                emitterProps.setFloat("cutoffAngle", 40);
+                emitterProps.setTransform("toWorld", Transform::lookAt(p,
+                    p - Vector(0, 0, 1), Vector(0, 1, 0)));
+                scene->addChild(createObject<Emitter>(emitterProps));
+            } else {
+                Properties emitterProps("point");
+                emitterProps.setSpectrum("intensity", Spectrum(5 * scale));
+                emitterProps.setPoint("position", p);
+                scene->addChild(createObject<Emitter>(emitterProps));
+            }
+        }
+
+        return scene;
+    }
+
+    /**
+     * \brief Estimate the irradiance at a receiver using a single emitter sample.
+     * The emitter is chosen using the light tree when \c tree is not \c NULL
+     */
+    Float estimate(const Scene *scene, const LightTree *tree,
+            const DiscreteDistribution &emitterPDF, const Intersection &its,
+            Point2 sample) {
+        DirectSamplingRecord dRec(its);
+        Float emPdf;
+        const Emitter *emitter;
+        if (tree)
+            emitter = tree->sample(dRec.ref, dRec.refN, sample.x, emPdf);
+        else
+            emitter = scene->getEmitters()[emitterPDF.sampleReuse(sample.x, emPdf)].get();
+        if (!emitter)
+            return 0.0f;
+
+        Spectrum value = emitter->sampleDirect(dRec, sample);
+        if (dRec.pdf == 0)
+            return 0.0f;
+
+        Ray ray(dRec.ref, dRec.d, Epsilon, dRec.dist*(1-ShadowEpsilon), dRec.time);
+        if (scene->rayIntersect(ray))
+            return 0.0f;
+
+        Float cosTheta = dot(its.shFrame.n, dRec.d);
+        cosTheta = dRec.refN.isZero() ? std::abs(cosTheta) : std::max(cosTheta, (Float) 0);
+
+        return value.getLuminance() * cosTheta / emPdf;
+    }
+
+    /// Run all receivers with one strategy; returns the average variance
+    Float runPass(const Scene *scene, const LightTree *tree,
+            const DiscreteDistribution &emitterPDF,
+            const std::vector<Intersection> &receivers, size_t sampleCount,
+            Float &mean, Float &seconds) {
+        ref<Random> random = new Random(1234);
+        ref<Timer> timer = new Timer();
+        double varianceSum = 0, meanSum = 0;
+
+        for (size_t i=0; i<receivers.size(); ++i) {
+            double sum = 0, sum2 = 0;
+            for (size_t j=0; j<sampleCount; ++j) {
+                Point2 sample(random->nextFloat(), random->nextFloat());
+                Float value = estimate(scene, tree, emitterPDF, receivers[i], sample);
+                sum += value;
+                sum2 += value * (double) value;
+            }
+            double avg = sum / sampleCount;
+            meanSum += avg;
+            varianceSum += (sum2 / sampleCount - avg * avg)
+                * sampleCount / std::max(sampleCount - 1, (size_t) 1);
+        }
+
+        seconds = timer->getMicroseconds() * 1e-6f;
+        mean = (Float) (meanSum / receivers.size());
+        return (Float) (varianceSum / receivers.size());
+    }
+
+    int run(int argc, char **argv) {
+        ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver();
+        int optchar;
+        char *end_ptr = NULL;
+        size_t emitterCount = 30000, receiverCount = 2000, sampleCount = 64;
+        optind = 1;
+
+        /* Parse command-line arguments */
+        while ((optchar = getopt(argc, argv, "n:r:s:h")) != -1) {
+            switch (optchar) {
+                case 'h': {
+                        help();
+                        return 0;
+                    }
+                    break;
+                case 'n':
+                    emitterCount = strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || emitterCount == 0)
+                        SLog(EError, "Could not parse the emitter count!");
+                    break;
+                case 'r':
+                    receiverCount = strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || receiverCount == 0)
+                        SLog(EError, "Could not parse the receiver count!");
+                    break;
+                case 's':
+                    sampleCount = strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || sampleCount == 0)
+                        SLog(EError, "Could not parse the sample count!");
+                    break;
+            };
+        }
+
+        if (optind+1 < argc) {
+            help();
+            return 0;
+        }
+
+        ref<Random> random = new Random();
+        ref<Scene> scene;
+        if (optind < argc) {
+            fs::path
+                filename = fileResolver->resolve(argv[optind]),
+                filePath = fs::absolute(filename).parent_path();
+            ref<FileResolver> frClone = fileResolver->clone();
+            frClone->prependPath(filePath);
+            Thread::getThread()->setFileResolver(frClone);
+            scene = loadScene(argv[optind]);
+        } else {
+            Log(EInfo, "Generating a scene with " SIZE_T_FMT " emitters ..", emitterCount);
+            scene = createCityScene(emitterCount, random);
+        }
+        scene->initialize();
+
+        const ref_vector<Emitter> &emitters = scene->getEmitters();
+        DiscreteDistribution emitterPDF(emitters.size());
+        for (size_t i=0; i<emitters.size(); ++i)
+            emitterPDF.append(emitters[i]->getSamplingWeight());
+        emitterPDF.normalize();
+
+        ref<Timer> timer = new Timer();
+        ref<LightTree> tree = new LightTree(emitters);
+        Log(EInfo, "Light tree: %i ms, " SIZE_T_FMT " nodes, %s",
+            timer->getMilliseconds(), tree->getNodeCount(),
+            memString(tree->getMemoryUsage()).c_str());
+
+        /* Find receivers by tracing random rays through the scene */
+        BSphere bsphere = scene->getGeometryAABB().getBSphere();
+        std::vector<Intersection> receivers;
+        receivers.reserve(receiverCount);
+        for (size_t i=0; receivers.size() < receiverCount && i < 100 * receiverCount; ++i) {
+            Point2 sample1(random->nextFloat(), random->nextFloat()),
+                sample2(random->nextFloat(), random->nextFloat());
+            Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+            Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+            Ray r(p1, normalize(p2-p1), 0.0f);
+
+            Intersection its;
+            if (scene->rayIntersect(r, its) && !its.isEmitter())
+                receivers.push_back(its);
+        }
+        if (receivers.empty())
+            Log(EError, "Could not find any receiver points!");
+
+        Log(EInfo, "Estimating the direct illumination at " SIZE_T_FMT " points using "
+            SIZE_T_FMT " samples each ..", receivers.size(), sampleCount);
+
+        Float weightMean, weightTime, treeMean, treeTime;
+        Float weightVar = runPass(scene, NULL, emitterPDF, receivers,
+            sampleCount, weightMean, weightTime);
+        Float treeVar = runPass(scene, tree, emitterPDF, receivers,
+            sampleCount, treeMean, treeTime);
+
+        /* Efficiency: inverse of the product of variance and time */
+        Float weightEff = 1 / (weightVar * weightTime),
+              treeEff = 1 / (treeVar * treeTime);
+
+        Log(EInfo, "  Strategy    Time [s]    Mean          Variance      Efficiency");
+        Log(EInfo, "  weight      %8.3f    %-12.6g  %-12.6g  %-12.6g", weightTime,
+            weightMean, weightVar, weightEff);
+        Log(EInfo, "  tree        %8.3f    %-12.6g  %-12.6g  %-12.6g", treeTime,
+            treeMean, treeVar, treeEff);
+        Log(EInfo, "Variance reduction: %.2fx, efficiency improvement: %.2fx",
+            weightVar / treeVar, treeEff / weightEff);
+
+        return 0;
+    }
+
+    MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(LightBench, "Emitter selection (light tree) benchmark")
+MTS_NAMESPACE_END
@@ -0,0 +1,241 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/fresolver.h>
+#include <boost/algorithm/string.hpp>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class PLYBench : public Utility {
+public:
+    void help() {
+        cout << endl;
+        cout << "Synopsis: PLY loading benchmark. Loads every given PLY file using the" << endl;
+        cout << "generic parser and using the parallel fast path for binary files," << endl;
+        cout << "verifies that both produce the same mesh, and reports the throughput." << endl;
+        cout << "Directories are searched for PLY files (default: data/tests)." << endl;
+        cout << endl;
+        cout << "Usage: mtsutil plybench [options] [PLY files or directories]" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -n count       Number of times each file is loaded. The fastest" << endl;
+        cout << "                  load is reported (default: 3)" << endl << endl;
+        cout << "   -g count       Also benchmark a synthetic binary mesh with about the" << endl;
+        cout << "                  given number of vertices (with normals, texture" << endl;
+        cout << "                  coordinates and vertex colors)" << endl << endl;
+    }
+
+    /// Write a binary grid mesh with all supported vertex attributes
+    void writeSyntheticPLY(const fs::path &path, size_t vertexCount) {
+        uint32_t res = std::max((uint32_t) std::sqrt((Float) vertexCount), (uint32_t) 2);
+        size_t faceCount = 2 * (size_t) (res-1) * (res-1);
+
+        ref<FileStream> fs = new FileStream(path, FileStream::ETruncReadWrite);
+        fs->setByteOrder(Stream::ELittleEndian);
+        std::string header = formatString("ply\nformat binary_little_endian 1.0\n"
+            "comment Generated by mtsutil plybench\nelement vertex %u\n"
+            "property float x\nproperty float y\nproperty float z\n"
+            "property float nx\nproperty float ny\nproperty float nz\n"
+            "property float u\nproperty float v\nproperty uchar red\n"
+            "property uchar green\nproperty uchar blue\nelement face " SIZE_T_FMT "\n"
+            "property list uchar int vertex_indices\nend_header\n",
+            res*res, faceCount);
+        fs->write(header.c_str(), header.length());
+
+        for (uint32_t y=0; y<res; ++y) {
+            for (uint32_t x=0; x<res; ++x) {
+                Float u = x / (Float) (res-1), v = y / (Float) (res-1);
+                Float height = 0.1f * std::sin(10*u) * std::cos(10*v);
+                float vertex[8] = { (float) u, (float) v, (float) height,
+                    0.0f, 0.0f, 1.0f, (float) u, (float) v };
+                fs->writeSingleArray(vertex, 8);
+                uint8_t color[3] = { (uint8_t) (x & 0xFF), (uint8_t) (y & 0xFF), 128 };
+                fs->write(color, 3);
+            }
+        }
+
+        for (uint32_t y=0; y<res-1; ++y) {
+            for (uint32_t x=0; x<res-1; ++x) {
+                int32_t i0 = y*res + x, i1 = i0 + 1, i2 = i0 + res, i3 = i2 + 1;
+                fs->writeUChar(3);
+                int32_t tri1[3] = { i0, i1, i3 };
+                fs->writeIntArray(tri1, 3);
+                fs->writeUChar(3);
+                int32_t tri2[3] = { i0, i3, i2 };
+                fs->writeIntArray(tri2, 3);
+            }
+        }
+        fs->close();
+    }
+
+    /// Load a PLY file and return the mesh along with the fastest load time
+    ref<TriMesh> load(const fs::path &path, bool fastLoad, int repetitions, Float &time) {
+        Properties props("ply");
+        props.setString("filename", path.string());
+        props.setBoolean("fastLoad", fastLoad);
+        ref<TriMesh> mesh;
+        time = std::numeric_limits<Float>::infinity();
+        ref<Timer> timer = new Timer();
+        for (int i=0; i<repetitions; ++i) {
+            mesh = NULL;
+            timer->reset();
+            mesh = static_cast<TriMesh *> (PluginManager::getInstance()->
+                    createObject(MTS_CLASS(TriMesh), props));
+            time = std::min(time, (Float) (timer->getMicroseconds() * 1e-6f));
+        }
+        return mesh;
+    }
+
+    /// Compare two meshes and return the largest attribute difference (or -1)
+    Float compare(const TriMesh *a, const TriMesh *b) {
+        if (a->getVertexCount() != b->getVertexCount() ||
+            a->getTriangleCount() != b->getTriangleCount() ||
+            a->hasVertexNormals() != b->hasVertexNormals() ||
+            a->hasVertexTexcoords() != b->hasVertexTexcoords() ||
+            a->hasVertexColors() != b->hasVertexColors())
+            return -1;
+
+        if (memcmp(a->getTriangles(), b->getTriangles(),
+                sizeof(Triangle) * a->getTriangleCount()) != 0)
+            return -1;
+
+        Float error = 0;
+        for (size_t i=0; i<a->getVertexCount(); ++i) {
+            error = std::max(error, distance(a->getVertexPositions()[i],
+                b->getVertexPositions()[i]));
+            if (a->hasVertexNormals())
+                error = std::max(error, (a->getVertexNormals()[i]
+                    - b->getVertexNormals()[i]).length());
+            if (a->hasVertexTexcoords())
+                error = std::max(error, distance(a->getVertexTexcoords()[i],
+                    b->getVertexTexcoords()[i]));
+            if (a->hasVertexColors())
+                error = std::max(error, (a->getVertexColors()[i]
+                    - b->getVertexColors()[i]).max());
+        }
+        return error;
+    }
+
+    void bench(const fs::path &path, int repetitions) {
+        Logger *logger = Thread::getThread()->getLogger();
+        ELogLevel logLevel = logger->getLogLevel();
+        logger->setLogLevel(EWarn);
+
+        Float genericTime, fastTime;
+        ref<TriMesh> generic = load(path, false, repetitions, genericTime);
+        ref<TriMesh> fast = load(path, true, repetitions, fastTime);
+        logger->setLogLevel(logLevel);
+
+        Float error = compare(generic, fast);
+        Float size = (Float) fs::file_size(path) / (1024 * 1024);
+        Log(EInfo, "  %-24s  %9.1f  %14.1f  %11.1f  %6.2fx  %s",
+            path.filename().string().c_str(), size, size / genericTime,
+            size / fastTime, genericTime / fastTime,
+            error < 0 ? "MISMATCH" : (error > 1e-5f ? "inexact" : "ok"));
+        if (error != 0)
+            Log(EDebug, "  (largest difference: %f)", error);
+    }
+
+    int run(int argc, char **argv) {
+        ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver();
+        int optchar;
+        char *end_ptr = NULL;
+        int repetitions = 3;
+        size_t syntheticVertices = 0;
+        optind = 1;
+
+        /* Parse command-line arguments */
+        while ((optchar = getopt(argc, argv, "n:g:h")) != -1) {
+            switch (optchar) {
+                case 'h': {
+                        help();
+                        return 0;
+                    }
+                    break;
+                case 'n':
+                    repetitions = strtol(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || repetitions <= 0)
+                        SLog(EError, "Could not parse the repetition count!");
+                    break;
+                case 'g':
+                    syntheticVertices = strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || syntheticVertices == 0)
+                        SLog(EError, "Could not parse the vertex count!");
+                    break;
+            };
+        }
+
+        std::vector<std::string> args;
+        for (int i=optind; i<argc; ++i)
+            args.push_back(argv[i]);
+        if (args.empty())
+            args.push_back("data/tests");
+
+        std::vector<fs::path> files;
+        for (size_t i=0; i<args.size(); ++i) {
+            fs::path path = fileResolver->resolve(args[i]);
+            if (fs::is_directory(path)) {
+                std::vector<fs::path> entries;
+                for (fs::directory_iterator it(path); it != fs::directory_iterator(); ++it) {
+                    if (boost::iequals(it->path().extension().string(), ".ply"))
+                        entries.push_back(it->path());
+                }
+                std::sort(entries.begin(), entries.end());
+                files.insert(files.end(), entries.begin(), entries.end());
+            } else if (fs::exists(path)) {
+                files.push_back(path);
+            } else {
+                Log(EError, "\"%s\" does not exist!", args[i].c_str());
+            }
+        }
+
+        fs::path synthetic;
+        if (syntheticVertices > 0) {
+            synthetic = fs::temp_directory_path() / fs::unique_path("plybench-%%%%%%.ply");
+            Log(EInfo, "Writing a synthetic mesh to \"%s\" ..", synthetic.string().c_str());
+            writeSyntheticPLY(synthetic, syntheticVertices);
+            files.push_back(synthetic);
+        }
+
+        if (files.empty())
+            Log(EError, "No PLY files were found!");
+
+        Log(EInfo, "Loading %i PLY files (best of %i) ..", (int) files.size(), repetitions);
+        Log(EInfo, "  File                      Size [MB]  Generic [MB/s]  Fast [MB/s]  Speedup  Result");
+        for (size_t i=0; i<files.size(); ++i)
+            bench(files[i], repetitions);
+
+        if (!synthetic.empty())
+            fs::remove(synthetic);
+
+        return 0;
+    }
+
+    MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(PLYBench, "PLY loading benchmark (generic parser vs. fast path)")
+MTS_NAMESPACE_END
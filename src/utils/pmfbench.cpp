@@ -0,0 +1,288 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/core/pmf.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/bitmap.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/fresolver.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+/// Number of precomputed uniform samples that are cycled through
+#define PMFBENCH_SAMPLE_BUFFER 1048576
+
+/**
+ * Marginal & conditional CDF tables with the same layout
+ * as the ones used by the \c envmap plugin
+ */
+struct CDFDistribution2D {
+    std::vector<float> cdfRows, cdfCols;
+    uint32_t width, height;
+
+    void build(const std::vector<Float> &values, uint32_t width_, uint32_t height_) {
+        width = width_; height = height_;
+        cdfCols.resize((size_t) (width + 1) * height);
+        cdfRows.resize(height + 1);
+
+        size_t colPos = 0, rowPos = 0;
+        Float rowSum = 0.0f;
+        cdfRows[rowPos++] = 0;
+        for (uint32_t y=0; y<height; ++y) {
+            Float colSum = 0;
+            cdfCols[colPos++] = 0;
+            for (uint32_t x=0; x<width; ++x) {
+                colSum += values[(size_t) y * width + x];
+                cdfCols[colPos++] = (float) colSum;
+            }
+            float normalization = 1.0f / (float) colSum;
+            for (uint32_t x=1; x<width; ++x)
+                cdfCols[colPos-x-1] *= normalization;
+            cdfCols[colPos-1] = 1.0f;
+
+            rowSum += colSum;
+            cdfRows[rowPos++] = (float) rowSum;
+        }
+        float normalization = 1.0f / (float) rowSum;
+        for (uint32_t y=1; y<height; ++y)
+            cdfRows[rowPos-y-1] *= normalization;
+        cdfRows[rowPos-1] = 1.0f;
+    }
+
+    static inline uint32_t sampleReuse(const float *cdf, uint32_t size, Float &sample) {
+        const float *entry = std::lower_bound(cdf, cdf+size+1, (float) sample);
+        uint32_t index = std::min((uint32_t) std::max((ptrdiff_t) 0, entry - cdf - 1), size-1);
+        sample = (sample - (Float) cdf[index]) / (Float) (cdf[index+1] - cdf[index]);
+        return index;
+    }
+
+    inline Point2u sampleReuse(Point2 &sample) const {
+        uint32_t row = sampleReuse(&cdfRows[0], height, sample.y),
+                 col = sampleReuse(&cdfCols[(size_t) row * (width+1)], width, sample.x);
+        return Point2u(col, row);
+    }
+};
+
+class PMFBench : public Utility {
+public:
+    void help() {
+        cout << endl;
+        cout << "Synopsis: discrete sampling benchmark. Compares the number of samples per" << endl;
+        cout << "second of distributions based on the inversion of a cumulative distribution" << endl;
+        cout << "function (DiscreteDistribution, binary search) with ones based on alias" << endl;
+        cout << "tables (AliasDistribution, constant time). The 2D test uses the marginal &" << endl;
+        cout << "conditional layout of the environment map emitter, with either the given" << endl;
+        cout << "image or a synthetic sky with a small and very bright sun." << endl;
+        cout << endl;
+        cout << "Usage: mtsutil pmfbench [options] [Image file]" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -n count       Number of entries of the 1D distributions. By default," << endl;
+        cout << "                  1K, 64K, 1M and 16M entries are tested" << endl << endl;
+        cout << "   -r width       Width of the synthetic sky (default: 8192)" << endl << endl;
+        cout << "   -s count       Number of samples per test (default: 16M)" << endl << endl;
+    }
+
+    void report(const char *name, size_t sampleCount, Float cdfTime,
+            Float aliasTime, double cdfChecksum, double aliasChecksum) {
+        Log(EInfo, "  %-16s  %10.2f      %10.2f       %.2fx", name,
+            sampleCount / (cdfTime * 1e6f), sampleCount / (aliasTime * 1e6f),
+            cdfTime / aliasTime);
+        Log(EDebug, "  (checksums: %f, %f)", cdfChecksum, aliasChecksum);
+    }
+
+    void bench1D(size_t entryCount, size_t sampleCount, Random *random,
+            const std::vector<Float> &samples) {
+        DiscreteDistribution cdf(entryCount);
+        AliasDistribution alias(entryCount);
+        for (size_t i=0; i<entryCount; ++i) {
+            /* Heavy-tailed weights, similar to the power of many emitters */
+            Float u = random->nextFloat(), weight = std::pow(u, 8.0f);
+            cdf.append(weight);
+            alias.append(weight);
+        }
+
+        ref<Timer> timer = new Timer();
+        cdf.normalize();
+        unsigned int cdfBuildTime = timer->getMilliseconds();
+        timer->reset();
+        alias.normalize();
+        unsigned int aliasBuildTime = timer->getMilliseconds();
+
+        double cdfChecksum = 0, aliasChecksum = 0;
+        timer->reset();
+        for (size_t i=0; i<sampleCount; ++i) {
+            Float sample = samples[i % PMFBENCH_SAMPLE_BUFFER], pdf;
+            cdfChecksum += cdf.sampleReuse(sample, pdf) + sample + pdf;
+        }
+        Float cdfTime = timer->getMicroseconds() * 1e-6f;
+
+        timer->reset();
+        for (size_t i=0; i<sampleCount; ++i) {
+            Float sample = samples[i % PMFBENCH_SAMPLE_BUFFER], pdf;
+            aliasChecksum += alias.sampleReuse(sample, pdf) + sample + pdf;
+        }
+        Float aliasTime = timer->getMicroseconds() * 1e-6f;
+
+        std::string name = formatString("1D, " SIZE_T_FMT, entryCount);
+        report(name.c_str(), sampleCount, cdfTime, aliasTime, cdfChecksum, aliasChecksum);
+        Log(EDebug, "  (build times: %i ms, %i ms)", cdfBuildTime, aliasBuildTime);
+    }
+
+    void bench2D(const std::vector<Float> &values, uint32_t width, uint32_t height,
+            size_t sampleCount, const std::vector<Float> &samples) {
+        ref<Timer> timer = new Timer();
+        CDFDistribution2D cdf;
+        cdf.build(values, width, height);
+        unsigned int cdfBuildTime = timer->getMilliseconds();
+
+        timer->reset();
+        AliasDistribution2D alias;
+        alias.init(width, height);
+        for (uint32_t y=0; y<height; ++y)
+            alias.setRow(y, &values[(size_t) y * width]);
+        alias.normalize();
+        unsigned int aliasBuildTime = timer->getMilliseconds();
+
+        double cdfChecksum = 0, aliasChecksum = 0;
+        timer->reset();
+        for (size_t i=0; i<sampleCount; ++i) {
+            size_t idx = (2*i) % PMFBENCH_SAMPLE_BUFFER;
+            Point2 sample(samples[idx], samples[idx+1]);
+            Point2u pos = cdf.sampleReuse(sample);
+            cdfChecksum += pos.x + pos.y + sample.x + sample.y;
+        }
+        Float cdfTime = timer->getMicroseconds() * 1e-6f;
+
+        timer->reset();
+        for (size_t i=0; i<sampleCount; ++i) {
+            size_t idx = (2*i) % PMFBENCH_SAMPLE_BUFFER;
+            Point2 sample(samples[idx], samples[idx+1]);
+            Point2u pos = alias.sampleReuse(sample);
+            aliasChecksum += pos.x + pos.y + sample.x + sample.y;
+        }
+        Float aliasTime = timer->getMicroseconds() * 1e-6f;
+
+        std::string name = formatString("2D, %ix%i", width, height);
+        report(name.c_str(), sampleCount, cdfTime, aliasTime, cdfChecksum, aliasChecksum);
+        Log(EInfo, "  (memory: %s vs. %s, build time: %i ms vs. %i ms)",
+            memString(sizeof(float) * (cdf.cdfCols.size() + cdf.cdfRows.size())).c_str(),
+            memString(alias.getMemoryUsage()).c_str(), cdfBuildTime, aliasBuildTime);
+    }
+
+    int run(int argc, char **argv) {
+        ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver();
+        int optchar;
+        char *end_ptr = NULL;
+        size_t entryCount = 0, sampleCount = 16*1024*1024;
+        uint32_t width = 8192;
+        optind = 1;
+
+        /* Parse command-line arguments */
+        while ((optchar = getopt(argc, argv, "n:r:s:h")) != -1) {
+            switch (optchar) {
+                case 'h': {
+                        help();
+                        return 0;
+                    }
+                    break;
+                case 'n':
+                    entryCount = strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || entryCount == 0)
+                        SLog(EError, "Could not parse the entry count!");
+                    break;
+                case 'r':
+                    width = (uint32_t) strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || width < 2)
+                        SLog(EError, "Could not parse the resolution!");
+                    break;
+                case 's':
+                    sampleCount = strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || sampleCount == 0)
+                        SLog(EError, "Could not parse the sample count!");
+                    break;
+            };
+        }
+
+        if (optind+1 < argc) {
+            help();
+            return 0;
+        }
+
+        ref<Random> random = new Random();
+        std::vector<Float> samples(PMFBENCH_SAMPLE_BUFFER);
+        for (size_t i=0; i<samples.size(); ++i)
+            samples[i] = random->nextFloat();
+
+        Log(EInfo, "Benchmarking with " SIZE_T_FMT " samples per test ..", sampleCount);
+        Log(EInfo, "  Distribution      CDF [MS/s]      Alias [MS/s]     Speedup");
+
+        if (entryCount == 0) {
+            const size_t counts[] = { 1024, 64*1024, 1024*1024, 16*1024*1024 };
+            for (size_t i=0; i<sizeof(counts)/sizeof(counts[0]); ++i)
+                bench1D(counts[i], sampleCount, random, samples);
+        } else {
+            bench1D(entryCount, sampleCount, random, samples);
+        }
+
+        std::vector<Float> values;
+        uint32_t height;
+        if (optind < argc) {
+            ref<FileStream> fs = new FileStream(fileResolver->resolve(argv[optind]),
+                FileStream::EReadOnly);
+            ref<Bitmap> bitmap = new Bitmap(Bitmap::EAuto, fs);
+            bitmap = bitmap->convert(Bitmap::ELuminance, Bitmap::EFloat);
+            width = bitmap->getWidth();
+            height = bitmap->getHeight();
+            values.resize((size_t) width * height);
+            for (size_t i=0; i<values.size(); ++i)
+                values[i] = (Float) bitmap->getFloatData()[i];
+        } else {
+            /* Synthetic sky: smooth gradient, some noise, and a sun
+               that covers a tiny fraction of the pixels */
+            height = width / 2;
+            values.resize((size_t) width * height);
+            Float sunX = 0.3f * width, sunY = 0.25f * height,
+                  sunRadius2 = std::max((Float) (0.00002f * width * width), (Float) 1);
+            for (uint32_t y=0; y<height; ++y) {
+                Float theta = (y + 0.5f) * M_PI / height,
+                      sky = std::max(std::cos(theta), (Float) 0) + 0.05f;
+                for (uint32_t x=0; x<width; ++x) {
+                    Float dx = x - sunX, dy = y - sunY,
+                          sun = dx*dx + dy*dy < sunRadius2 ? 1e5f : 0.0f;
+                    values[(size_t) y * width + x] = (sky
+                        * (0.5f + random->nextFloat()) + sun) * std::sin(theta);
+                }
+            }
+        }
+
+        bench2D(values, width, height, sampleCount, samples);
+
+        return 0;
+    }
+
+    MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(PMFBench, "Discrete sampling benchmark (CDF vs. alias tables)")
+MTS_NAMESPACE_END
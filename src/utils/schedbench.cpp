@@ -0,0 +1,419 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/core/sched_remote.h>
+#include <mitsuba/core/sstream.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/atomic.h>
+#if defined(WIN32)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+/// Work result of the benchmark: just a checksum to keep the spin loop alive
+class SpinWorkResult : public WorkResult {
+public:
+    void load(Stream *stream) { value = stream->readUInt(); }
+    void save(Stream *stream) const { stream->writeUInt(value); }
+    std::string toString() const { return "SpinWorkResult[]"; }
+
+    uint32_t value;
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~SpinWorkResult() { }
+};
+
+/// Burns a configurable number of iterations per work unit
+class SpinWorkProcessor : public WorkProcessor {
+public:
+    SpinWorkProcessor(uint32_t iterations) : m_iterations(iterations) { }
+
+    SpinWorkProcessor(Stream *stream, InstanceManager *manager)
+        : WorkProcessor(stream, manager) {
+        m_iterations = stream->readUInt();
+    }
+
+    void serialize(Stream *stream, InstanceManager *manager) const {
+        stream->writeUInt(m_iterations);
+    }
+
+    ref<WorkUnit> createWorkUnit() const { return new DummyWorkUnit(); }
+    ref<WorkResult> createWorkResult() const { return new SpinWorkResult(); }
+    ref<WorkProcessor> clone() const { return new SpinWorkProcessor(m_iterations); }
+    void prepare() { }
+
+    void process(const WorkUnit *workUnit, WorkResult *workResult, const bool &stop) {
+        uint32_t state = 0x12345678u;
+        for (uint32_t i=0; i<m_iterations; ++i) {
+            /* xorshift32 */
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+        }
+        static_cast<SpinWorkResult *>(workResult)->value = state;
+    }
+
+    MTS_DECLARE_CLASS()
+private:
+    uint32_t m_iterations;
+};
+
+/// Hands out a fixed number of (empty) work units
+class SpinProcess : public ParallelProcess {
+public:
+    SpinProcess(size_t unitCount, uint32_t iterations, bool local = true)
+        : m_unitCount(unitCount), m_generated(0), m_processed(0),
+          m_iterations(iterations), m_local(local) { }
+
+    EStatus generateWork(WorkUnit *unit, int worker) {
+        if (m_generated == m_unitCount)
+            return EFailure;
+        ++m_generated;
+        return ESuccess;
+    }
+
+    void processResult(const WorkResult *result, bool cancelled) {
+        atomicAdd(&m_processed, 1);
+    }
+
+    ref<WorkProcessor> createWorkProcessor() const {
+        return new SpinWorkProcessor(m_iterations);
+    }
+
+    bool isLocal() const { return m_local; }
+
+    std::vector<std::string> getRequiredPlugins() {
+        /* The work processor is implemented in this utility */
+        std::vector<std::string> plugins = ParallelProcess::getRequiredPlugins();
+        plugins.push_back("schedbench");
+        return plugins;
+    }
+
+    inline size_t getProcessedCount() const { return (size_t) m_processed; }
+
+    MTS_DECLARE_CLASS()
+private:
+    size_t m_unitCount, m_generated;
+    int64_t m_processed;
+    uint32_t m_iterations;
+    bool m_local;
+};
+
+/**
+ * Stream wrapper, which delivers all written data after a fixed delay.
+ * Used to simulate a connection with a high latency.
+ */
+class DelayStream : public Stream {
+public:
+    DelayStream(Stream *stream, int delay) : m_stream(stream),
+            m_delay(delay), m_shutdown(false) {
+        setByteOrder(stream->getByteOrder());
+        m_mutex = new Mutex();
+        m_cond = new ConditionVariable(m_mutex);
+        m_timer = new Timer();
+        m_thread = new DelayThread(this);
+        m_thread->start();
+    }
+
+    void read(void *ptr, size_t size) { m_stream->read(ptr, size); }
+
+    void write(const void *ptr, size_t size) {
+        m_buffer.insert(m_buffer.end(), (const uint8_t *) ptr,
+            (const uint8_t *) ptr + size);
+    }
+
+    void flush() {
+        if (m_buffer.empty())
+            return;
+        LockGuard lock(m_mutex);
+        m_packets.push_back(Packet());
+        m_packets.back().deadline = m_timer->getMilliseconds() + m_delay;
+        m_packets.back().data.swap(m_buffer);
+        m_cond->signal();
+    }
+
+    void seek(size_t pos) { Log(EError, "seek(): unsupported!"); }
+    size_t getPos() const { Log(EError, "getPos(): unsupported!"); return 0; }
+    size_t getSize() const { Log(EError, "getSize(): unsupported!"); return 0; }
+    void truncate(size_t size) { Log(EError, "truncate(): unsupported!"); }
+    bool canWrite() const { return true; }
+    bool canRead() const { return true; }
+    std::string toString() const { return "DelayStream[]"; }
+
+    MTS_DECLARE_CLASS()
+protected:
+    virtual ~DelayStream() {
+        {
+            LockGuard lock(m_mutex);
+            m_shutdown = true;
+            m_cond->signal();
+        }
+        m_thread->join();
+    }
+
+    /// Forward the queued data to the nested stream once it is due
+    void deliver() {
+        while (true) {
+            Packet packet;
+            {
+                LockGuard lock(m_mutex);
+                while (m_packets.empty() && !m_shutdown)
+                    m_cond->wait();
+                if (m_packets.empty())
+                    break;
+                packet.deadline = m_packets.front().deadline;
+                packet.data.swap(m_packets.front().data);
+                m_packets.pop_front();
+            }
+            int remaining = packet.deadline - (int) m_timer->getMilliseconds();
+            if (remaining > 0)
+                Thread::sleep(remaining);
+            try {
+                m_stream->write(&packet.data[0], packet.data.size());
+                m_stream->flush();
+            } catch (const std::exception &) {
+                /* The connection was closed */
+            }
+        }
+    }
+
+    class DelayThread : public Thread {
+    public:
+        DelayThread(DelayStream *parent) : Thread("delay"), m_parent(parent) { }
+        void run() { m_parent->deliver(); }
+    private:
+        DelayStream *m_parent;
+    };
+
+    struct Packet {
+        int deadline;
+        std::vector<uint8_t> data;
+    };
+private:
+    ref<Stream> m_stream;
+    ref<Thread> m_thread;
+    ref<Mutex> m_mutex;
+    ref<ConditionVariable> m_cond;
+    ref<Timer> m_timer;
+    std::vector<uint8_t> m_buffer;
+    std::deque<Packet> m_packets;
+    int m_delay;
+    bool m_shutdown;
+};
+
+class SchedBench : public Utility {
+public:
+    void help() {
+        cout << endl;
+        cout << "Synopsis: scheduler throughput benchmark. Runs a parallel process consisting" << endl;
+        cout << "of many tiny work units with an increasing number of local worker threads," << endl;
+        cout << "once using the central work queue and once with work stealing, and reports" << endl;
+        cout << "the resulting number of processed work units per second." << endl;
+        cout << endl;
+        cout << "Usage: mtsutil schedbench [options]" << endl;
+        cout << "Options/Arguments:" << endl;
+        cout << "   -h             Display this help text" << endl << endl;
+        cout << "   -n count       Number of work units per run (default: 200000)" << endl << endl;
+        cout << "   -w iterations  Amount of work per unit (default: 2000)" << endl << endl;
+        cout << "   -p count       Maximum number of worker threads (default: all cores)" << endl << endl;
+        cout << "   -b count       Work stealing batch size (default: 4)" << endl << endl;
+        cout << "   -c host[:port] Instead, measure the throughput of a remote mtssrv instance" << endl
+             << "                  (which may run on the same machine) with an increasing" << endl
+             << "                  artificial network latency" << endl << endl;
+        cout << "   -l ms;ms;..    Latencies used together with -c (default: 0;10;20;40)" << endl << endl;
+    }
+
+    /// Run a single benchmark pass and return the throughput in units/s
+    Float runPass(size_t cores, bool workStealing, size_t batchSize,
+            size_t unitCount, uint32_t iterations) {
+        Scheduler *scheduler = Scheduler::getInstance();
+        for (size_t i=0; i<cores; ++i)
+            scheduler->registerWorker(new LocalWorker(-1, formatString("bench%i", (int) i)));
+        scheduler->setWorkStealing(workStealing, batchSize);
+        scheduler->start();
+
+        ref<SpinProcess> proc = new SpinProcess(unitCount, iterations);
+        ref<Timer> timer = new Timer();
+        scheduler->schedule(proc);
+        scheduler->wait(proc);
+        Float seconds = timer->getMicroseconds() * 1e-6f;
+
+        scheduler->pause();
+        while (scheduler->getWorkerCount() > 0)
+            scheduler->unregisterWorker(scheduler->getWorker(0));
+
+        if (proc->getReturnStatus() != ParallelProcess::ESuccess ||
+            proc->getProcessedCount() != unitCount)
+            Log(EError, "Benchmark process did not complete successfully!");
+
+        return unitCount / seconds;
+    }
+
+    /// Run a benchmark pass on a remote node and return the throughput in units/s
+    Float runRemotePass(const std::string &host, int port, int latency,
+            size_t unitCount, uint32_t iterations, Float &roundTripTime,
+            size_t &backlog) {
+        ref<Stream> stream = new SocketStream(host, port);
+        if (latency > 0)
+            stream = new DelayStream(stream, latency);
+
+        Scheduler *scheduler = Scheduler::getInstance();
+        ref<RemoteWorker> worker = new RemoteWorker("net0", stream);
+        scheduler->registerWorker(worker);
+        scheduler->start();
+
+        ref<SpinProcess> proc = new SpinProcess(unitCount, iterations, false);
+        ref<Timer> timer = new Timer();
+        scheduler->schedule(proc);
+        scheduler->wait(proc);
+        Float seconds = timer->getMicroseconds() * 1e-6f;
+        roundTripTime = worker->getRoundTripTime();
+        backlog = worker->getBacklog();
+
+        scheduler->pause();
+        scheduler->unregisterWorker(worker);
+
+        if (proc->getReturnStatus() != ParallelProcess::ESuccess ||
+            proc->getProcessedCount() != unitCount)
+            Log(EError, "Benchmark process did not complete successfully!");
+
+        return unitCount / seconds;
+    }
+
+    int run(int argc, char **argv) {
+        int optchar;
+        char *end_ptr = NULL;
+        size_t unitCount = 200000, batchSize = 4;
+        uint32_t iterations = 2000;
+        size_t maxCores = (size_t) getCoreCount();
+        std::string host, latencies = "0;10;20;40";
+        optind = 1;
+
+        /* Parse command-line arguments */
+        while ((optchar = getopt(argc, argv, "n:w:p:b:c:l:h")) != -1) {
+            switch (optchar) {
+                case 'h': {
+                        help();
+                        return 0;
+                    }
+                    break;
+                case 'n':
+                    unitCount = strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || unitCount == 0)
+                        SLog(EError, "Could not parse the work unit count!");
+                    break;
+                case 'w':
+                    iterations = (uint32_t) strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0')
+                        SLog(EError, "Could not parse the amount of work per unit!");
+                    break;
+                case 'p':
+                    maxCores = strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || maxCores == 0)
+                        SLog(EError, "Could not parse the worker count!");
+                    break;
+                case 'b':
+                    batchSize = strtoul(optarg, &end_ptr, 10);
+                    if (*end_ptr != '\0' || batchSize == 0)
+                        SLog(EError, "Could not parse the batch size!");
+                    break;
+                case 'c':
+                    host = optarg;
+                    break;
+                case 'l':
+                    latencies = optarg;
+                    break;
+            };
+        }
+
+        int port = MTS_DEFAULT_PORT;
+        if (!host.empty()) {
+            std::vector<std::string> tokens = tokenize(host, ":");
+            if (tokens.size() == 0 || tokens.size() > 2)
+                SLog(EError, "Invalid host specification '%s'!", host.c_str());
+            if (tokens.size() == 2) {
+                port = strtol(tokens[1].c_str(), &end_ptr, 10);
+                if (*end_ptr != '\0')
+                    SLog(EError, "Invalid host specification '%s'!", host.c_str());
+            }
+            host = tokens[0];
+        }
+
+        /* Temporarily take over the scheduler */
+        Scheduler *scheduler = Scheduler::getInstance();
+        bool wasRunning = scheduler->isRunning(),
+             workStealing = scheduler->getWorkStealing();
+        size_t workBatchSize = scheduler->getWorkBatchSize();
+        if (wasRunning)
+            scheduler->pause();
+        std::vector<ref<Worker> > workers;
+        while (scheduler->getWorkerCount() > 0) {
+            workers.push_back(scheduler->getWorker(0));
+            scheduler->unregisterWorker(workers.back());
+        }
+
+        Log(EInfo, "Processing " SIZE_T_FMT " work units of %u iterations each",
+            unitCount, iterations);
+        if (host.empty()) {
+            Log(EInfo, "  Workers    Central [units/s]    Stealing [units/s]    Speedup");
+            for (size_t cores = 1; ; cores = std::min(cores * 2, maxCores)) {
+                Float central  = runPass(cores, false, batchSize, unitCount, iterations);
+                Float stealing = runPass(cores, true, batchSize, unitCount, iterations);
+                Log(EInfo, "  %7i    %17.0f    %18.0f    %6.2fx", (int) cores,
+                    central, stealing, stealing / central);
+                if (cores == maxCores)
+                    break;
+            }
+        } else {
+            std::vector<std::string> tokens = tokenize(latencies, ";");
+            Log(EInfo, "  Latency [ms]    Throughput [units/s]    Round trip [ms]    Back log");
+            for (size_t i=0; i<tokens.size(); ++i) {
+                int latency = strtol(tokens[i].c_str(), &end_ptr, 10);
+                if (*end_ptr != '\0' || latency < 0)
+                    SLog(EError, "Could not parse the latency \"%s\"!", tokens[i].c_str());
+                Float roundTripTime;
+                size_t backlog;
+                Float throughput = runRemotePass(host, port, latency, unitCount,
+                    iterations, roundTripTime, backlog);
+                Log(EInfo, "  %12i    %20.0f    %15.1f    %8i", latency,
+                    throughput, roundTripTime * 1000, (int) backlog);
+            }
+        }
+
+        /* Restore the original configuration */
+        for (size_t i=0; i<workers.size(); ++i)
+            scheduler->registerWorker(workers[i]);
+        scheduler->setWorkStealing(workStealing, workBatchSize);
+        if (wasRunning)
+            scheduler->start();
+
+        return 0;
+    }
+
+    MTS_DECLARE_UTILITY()
+};
+
+MTS_IMPLEMENT_CLASS(SpinWorkResult, false, WorkResult)
+MTS_IMPLEMENT_CLASS_S(SpinWorkProcessor, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(SpinProcess, false, ParallelProcess)
+MTS_IMPLEMENT_CLASS(DelayStream, false, Stream)
+MTS_EXPORT_UTILITY(SchedBench, "Scheduler throughput benchmark")
+MTS_NAMESPACE_END
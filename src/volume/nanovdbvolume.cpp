@@ -11,6 +11,7 @@
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/mmap.h>
+#include <mitsuba/core/tls.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -92,11 +93,13 @@ class NanovdbDataSource : public VolumeDataSource {
   }
 
   Float lookupFloat(const Point &p) const override {
-    auto accessor = m_grid->getAccessor();
-    auto sampler = nanovdb::createSampler<1>(accessor);
-    Point local = m_worldToVolume(p);
-    nanovdb::Vec3<Float> gp(local.x, local.y, local.z);
-    return sampler(gp);
+    return lookup(getLookupCache(), p);
+  }
+
+  void lookupFloat(const Point *p, Float *result,
+                   size_t count) const override {
+    LookupCache *cache = getLookupCache();
+    for (size_t i = 0; i < count; ++i) result[i] = lookup(cache, p[i]);
   }
 
   Float getMaximumFloatValue() const override { return m_maximumFloatValue; }
@@ -106,6 +109,37 @@ class NanovdbDataSource : public VolumeDataSource {
   MTS_DECLARE_CLASS()
 
  private:
+  /**
+   * \brief Per-thread grid accessor and trilinear sampler
+   *
+   * Kept alive across lookups so that the accessor's node cache and the
+   * sampler's stencil cache are reused between neighbouring queries.
+   */
+  struct LookupCache : public Object {
+    typedef nanovdb::FloatGrid::AccessorType AccessorType;
+    typedef nanovdb::SampleFromVoxels<AccessorType, 1> SamplerType;
+
+    LookupCache(const nanovdb::FloatGrid *grid)
+        : accessor(grid->getAccessor()), sampler(accessor) {}
+
+    AccessorType accessor;
+    SamplerType sampler;
+  };
+
+  inline LookupCache *getLookupCache() const {
+    LookupCache *cache = m_lookupCache.get();
+    if (EXPECT_NOT_TAKEN(cache == NULL)) {
+      cache = new LookupCache(m_grid);
+      m_lookupCache.set(cache);
+    }
+    return cache;
+  }
+
+  inline Float lookup(LookupCache *cache, const Point &p) const {
+    Point local = m_worldToVolume(p);
+    return cache->sampler(nanovdb::Vec3<Float>(local.x, local.y, local.z));
+  }
+
   void updateTransform(openvdb::FloatGrid::Ptr grid) {
     Matrix4x4 mat;
     openvdb::math::Mat4d g_mat =
@@ -150,6 +184,7 @@ class NanovdbDataSource : public VolumeDataSource {
   Transform m_volumeToWorld;
   Transform m_worldToVolume;
   Float m_maximumFloatValue;
+  mutable ThreadLocal<LookupCache> m_lookupCache;
 };
 
 MTS_IMPLEMENT_CLASS_S(NanovdbDataSource, false, VolumeDataSource);
@@ -6,6 +6,7 @@
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/mmap.h>
+#include <mitsuba/core/tls.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -79,14 +80,13 @@ class OpenvdbDataSource : public VolumeDataSource {
   }
 
   Float lookupFloat(const Point &p) const override {
-    Point local = m_worldToVolume(p);
-    openvdb::math::Vec3d gp(local.x, local.y, local.z);
-    // gp = m_grid->transform().worldToIndex(gp);
-    // Log(EDebug, "%f %f %f", gp.x(), gp.y(), gp.z());
-    openvdb::tools::GridSampler<openvdb::FloatGrid::ConstAccessor,
-                                openvdb::tools::BoxSampler>
-        sampler(m_grid->getConstAccessor(), m_grid->transform());
-    return sampler.isSample(gp);
+    return lookup(getLookupCache(), p);
+  }
+
+  void lookupFloat(const Point *p, Float *result,
+                   size_t count) const override {
+    LookupCache *cache = getLookupCache();
+    for (size_t i = 0; i < count; ++i) result[i] = lookup(cache, p[i]);
   }
 
   Float getMaximumFloatValue() const override { return m_maximumFloatValue; }
@@ -96,6 +96,41 @@ class OpenvdbDataSource : public VolumeDataSource {
   MTS_DECLARE_CLASS()
 
  private:
+  /**
+   * \brief Per-thread grid accessor and sampler
+   *
+   * Kept alive across lookups so that the accessor's cached node path is
+   * reused instead of descending from the root for every query.
+   */
+  struct LookupCache : public Object {
+    typedef openvdb::FloatGrid::ConstAccessor AccessorType;
+    typedef openvdb::tools::GridSampler<AccessorType,
+                                        openvdb::tools::BoxSampler>
+        SamplerType;
+
+    LookupCache(const openvdb::FloatGrid &grid)
+        : accessor(grid.getConstAccessor()),
+          sampler(accessor, grid.transform()) {}
+
+    AccessorType accessor;
+    SamplerType sampler;
+  };
+
+  inline LookupCache *getLookupCache() const {
+    LookupCache *cache = m_lookupCache.get();
+    if (EXPECT_NOT_TAKEN(cache == NULL)) {
+      cache = new LookupCache(*m_grid);
+      m_lookupCache.set(cache);
+    }
+    return cache;
+  }
+
+  inline Float lookup(LookupCache *cache, const Point &p) const {
+    Point local = m_worldToVolume(p);
+    return cache->sampler.isSample(
+        openvdb::math::Vec3d(local.x, local.y, local.z));
+  }
+
   void updateTransform() {
     Matrix4x4 mat;
     openvdb::math::Mat4d g_mat =
@@ -140,6 +175,7 @@ class OpenvdbDataSource : public VolumeDataSource {
   Transform m_volumeToWorld;
   Transform m_worldToVolume;
   Float m_maximumFloatValue;
+  mutable ThreadLocal<LookupCache> m_lookupCache;
 };
 
 MTS_IMPLEMENT_CLASS_S(OpenvdbDataSource, false, VolumeDataSource);